@@ -0,0 +1,302 @@
+/*----------------------------------------------------------------------------
+ * skeeter_ring.c
+ * 
+ * read messages from skeeter's shared memory ring (shm_ring_name)
+ *
+ * Reading a message costs the cache lines of commit_pos and the record;
+ * we only make a system call (FUTEX_WAIT) when there is nothing to read.
+ *--------------------------------------------------------------------------*/
+#include <errno.h>
+#include <fcntl.h>
+#include <linux/futex.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "skeeter_ring.h"
+
+//----------------------------------------------------------------------------
+// the current CLOCK_MONOTONIC time in milliseconds
+static int64_t
+monotonic_ms(void) {
+//----------------------------------------------------------------------------
+   struct timespec now;
+
+   clock_gettime(CLOCK_MONOTONIC, &now);
+   return (int64_t) now.tv_sec * 1000 + now.tv_nsec / 1000000;
+}
+
+//----------------------------------------------------------------------------
+// map the ring and take a reader slot
+// we start with the next message skeeter publishes
+// return 0 for success, -1 for failure (errno is set)
+int
+skeeter_ring_open(struct SkeeterRingReader * reader, const char * name) {
+//----------------------------------------------------------------------------
+   struct stat stat_buffer;
+   uint64_t pid = (uint64_t) getpid();
+   uint64_t expected;
+   int saved_errno;
+   int fd;
+   int i;
+
+   memset(reader, 0, sizeof *reader);
+   reader->slot = -1;
+
+   fd = shm_open(name, O_RDWR, 0);
+   if (fd == -1) {
+      return -1;
+   }
+   if (fstat(fd, &stat_buffer) == -1) {
+      goto error;
+   }
+   if ((size_t) stat_buffer.st_size < sizeof(struct RingHeader)) {
+      errno = EPROTO;
+      goto error;
+   }
+   reader->map_size = stat_buffer.st_size;
+   reader->header = mmap(NULL, 
+                         reader->map_size, 
+                         PROT_READ | PROT_WRITE, 
+                         MAP_SHARED, 
+                         fd, 
+                         0);
+   if (reader->header == MAP_FAILED) {
+      reader->header = NULL;
+      goto error;
+   }
+   close(fd);
+   fd = -1;
+
+   if (__atomic_load_n(&reader->header->magic, __ATOMIC_ACQUIRE) != 
+          SHM_RING_MAGIC ||
+       reader->header->version != SHM_RING_VERSION ||
+       reader->map_size < 
+          sizeof(struct RingHeader) + reader->header->capacity) {
+      errno = EPROTO;
+      goto error;
+   }
+
+   reader->buffer = malloc(reader->header->max_record);
+   if (reader->buffer == NULL) {
+      goto error;
+   }
+
+   for (i=0; i < SHM_RING_MAX_READERS; i++) {
+      expected = 0;
+      if (__atomic_compare_exchange_n(&reader->header->readers[i].pid,
+                                      &expected,
+                                      pid,
+                                      false,
+                                      __ATOMIC_ACQ_REL,
+                                      __ATOMIC_RELAXED)) {
+         reader->slot = i;
+         break;
+      }
+   }
+   if (reader->slot == -1) {
+      errno = EBUSY;
+      goto error;
+   }
+
+   reader->cursor = __atomic_load_n(&reader->header->commit_pos, 
+                                    __ATOMIC_ACQUIRE);
+   __atomic_store_n(&reader->header->readers[reader->slot].cursor,
+                    reader->cursor,
+                    __ATOMIC_RELAXED);
+
+   return 0;
+
+error:
+   saved_errno = errno;
+   if (fd != -1) close(fd);
+   skeeter_ring_close(reader);
+   errno = saved_errno;
+   return -1;
+}
+
+//----------------------------------------------------------------------------
+// release the slot and unmap the ring
+void
+skeeter_ring_close(struct SkeeterRingReader * reader) {
+//----------------------------------------------------------------------------
+   if (reader->header != NULL) {
+      if (reader->slot != -1) {
+         __atomic_store_n(&reader->header->readers[reader->slot].pid, 
+                          0, 
+                          __ATOMIC_RELEASE);
+         reader->slot = -1;
+      }
+      munmap(reader->header, reader->map_size);
+      reader->header = NULL;
+   }
+   free(reader->buffer);
+   reader->buffer = NULL;
+}
+
+//----------------------------------------------------------------------------
+// true if the writer may have overwritten the bytes at the cursor
+// call this after copying them out of the ring
+static bool
+overrun(const struct SkeeterRingReader * reader) {
+//----------------------------------------------------------------------------
+   __atomic_thread_fence(__ATOMIC_ACQUIRE);
+   return __atomic_load_n(&reader->header->reserve_pos, __ATOMIC_RELAXED) > 
+      reader->cursor + reader->header->capacity;
+}
+
+//----------------------------------------------------------------------------
+// we were lapped: skip to the newest position
+static void
+skip_overrun(struct SkeeterRingReader * reader) {
+//----------------------------------------------------------------------------
+   uint64_t commit_pos = __atomic_load_n(&reader->header->commit_pos, 
+                                         __ATOMIC_ACQUIRE);
+
+   reader->overruns++;
+   reader->lost_bytes += commit_pos - reader->cursor;
+   reader->cursor = commit_pos;
+}
+
+//----------------------------------------------------------------------------
+// wait until commit_pos moves past the cursor, or the deadline
+// return 1 when there may be something to read, 0 for a timeout, 
+// -1 for failure
+static int
+wait_for_commit(struct SkeeterRingReader * reader, int64_t deadline_ms) {
+//----------------------------------------------------------------------------
+   struct RingHeader * header = reader->header;
+   struct timespec timeout;
+   struct timespec * timeout_ptr = NULL;
+   int64_t remaining_ms;
+   uint32_t futex_value;
+   long result = 0;
+
+   if (deadline_ms != -1) {
+      remaining_ms = deadline_ms - monotonic_ms();
+      if (remaining_ms <= 0) {
+         return 0;
+      }
+      timeout.tv_sec = remaining_ms / 1000;
+      timeout.tv_nsec = (remaining_ms % 1000) * 1000000;
+      timeout_ptr = &timeout;
+   }
+
+   // register as a waiter before we look at the futex word, so the writer
+   // either sees us waiting or we see its commit
+   __atomic_add_fetch(&header->waiters, 1, __ATOMIC_SEQ_CST);
+   futex_value = __atomic_load_n(&header->futex, __ATOMIC_SEQ_CST);
+   if (__atomic_load_n(&header->commit_pos, __ATOMIC_SEQ_CST) == 
+          reader->cursor &&
+       !__atomic_load_n(&header->closed, __ATOMIC_SEQ_CST)) {
+      result = syscall(SYS_futex, 
+                       &header->futex, 
+                       FUTEX_WAIT, 
+                       futex_value, 
+                       timeout_ptr, 
+                       NULL, 
+                       0);
+   }
+   __atomic_sub_fetch(&header->waiters, 1, __ATOMIC_SEQ_CST);
+
+   if (result == -1) {
+      if (errno == ETIMEDOUT) {
+         return 0;
+      }
+      if (errno != EAGAIN) {
+         return -1;
+      }
+   }
+
+   return 1;
+}
+
+//----------------------------------------------------------------------------
+// read the next message, waiting up to timeout_ms milliseconds for one
+// (-1 waits forever, 0 doesn't wait)
+// the message is good until the next call
+// return 1 for a message, 0 for a timeout, -1 for failure (errno is set)
+int
+skeeter_ring_read(struct SkeeterRingReader * reader, 
+                  struct SkeeterRingMessage * message,
+                  int timeout_ms) {
+//----------------------------------------------------------------------------
+   struct RingHeader * header = reader->header;
+   const uint8_t * data = SHM_RING_DATA(header);
+   uint64_t mask = header->capacity - 1;
+   int64_t deadline_ms = (timeout_ms < 0) ? -1 : monotonic_ms() + timeout_ms;
+   struct RingRecordHeader record;
+   uint64_t offset;
+   uint32_t frame_size;
+   uint32_t i;
+   int result;
+
+   for (;;) {
+      if (__atomic_load_n(&header->commit_pos, __ATOMIC_ACQUIRE) == 
+             reader->cursor) {
+         if (__atomic_load_n(&header->closed, __ATOMIC_ACQUIRE)) {
+            errno = EPIPE;
+            return -1;
+         }
+         if (timeout_ms == 0) {
+            return 0;
+         }
+         result = wait_for_commit(reader, deadline_ms);
+         if (result != 1) {
+            return result;
+         }
+         continue;
+      }
+
+      memcpy(&record, data + (reader->cursor & mask), sizeof record);
+      if (overrun(reader)) {
+         skip_overrun(reader);
+         continue;
+      }
+
+      if (record.frame_qty == SHM_RING_PADDING) {
+         reader->cursor += record.length;
+         continue;
+      }
+
+      if (record.length < sizeof record || 
+          record.length > header->max_record ||
+          record.frame_qty > SKEETER_RING_MAX_FRAMES) {
+         errno = EPROTO;
+         return -1;
+      }
+
+      memcpy(reader->buffer, data + (reader->cursor & mask), record.length);
+      if (overrun(reader)) {
+         skip_overrun(reader);
+         continue;
+      }
+      break;
+   }
+
+   offset = sizeof record;
+   message->frame_qty = record.frame_qty;
+   for (i=0; i < record.frame_qty; i++) {
+      memcpy(&frame_size, reader->buffer + offset, sizeof frame_size);
+      offset += sizeof frame_size;
+      if (offset + frame_size > record.length) {
+         errno = EPROTO;
+         return -1;
+      }
+      message->frames[i] = reader->buffer + offset;
+      message->sizes[i] = frame_size;
+      offset += frame_size;
+   }
+
+   reader->cursor += record.length;
+   __atomic_store_n(&header->readers[reader->slot].cursor,
+                    reader->cursor,
+                    __ATOMIC_RELAXED);
+
+   return 1;
+}
@@ -0,0 +1,69 @@
+/*----------------------------------------------------------------------------
+ * skeeter_ring.h
+ * 
+ * read messages from skeeter's shared memory ring (shm_ring_name)
+ *
+ * Each message is the frames a zeromq subscriber would get: topic, meta
+ * data and (optional) data. There is no subscription filter: check the 
+ * topic. Link with -lskeeter_ring, and -lrt on older C libraries.
+ *--------------------------------------------------------------------------*/
+#if !defined(__SKEETER_RING_H__)
+#define __SKEETER_RING_H__
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "shm_ring_layout.h"
+
+#if defined(__cplusplus)
+extern "C" {
+#endif
+
+#define SKEETER_RING_MAX_FRAMES SHM_RING_MAX_FRAMES
+
+struct SkeeterRingReader {
+   struct RingHeader * header;
+   size_t map_size;
+   // our slot in header->readers
+   int slot;
+   // the position of the next record to read
+   uint64_t cursor;
+
+   // a copy of the last record read, the frames point into it
+   uint8_t * buffer;
+
+   // times the writer overran us, and the bytes we missed
+   uint64_t overruns;
+   uint64_t lost_bytes;
+};
+
+struct SkeeterRingMessage {
+   int frame_qty;
+   const uint8_t * frames[SKEETER_RING_MAX_FRAMES];
+   size_t sizes[SKEETER_RING_MAX_FRAMES];
+};
+
+// map the ring and take a reader slot
+// we start with the next message skeeter publishes
+// return 0 for success, -1 for failure (errno is set)
+extern int
+skeeter_ring_open(struct SkeeterRingReader * reader, const char * name);
+
+// release the slot and unmap the ring
+extern void
+skeeter_ring_close(struct SkeeterRingReader * reader);
+
+// read the next message, waiting up to timeout_ms milliseconds for one
+// (-1 waits forever, 0 doesn't wait)
+// the message is good until the next call
+// return 1 for a message, 0 for a timeout, -1 for failure (errno is set)
+extern int
+skeeter_ring_read(struct SkeeterRingReader * reader, 
+                  struct SkeeterRingMessage * message,
+                  int timeout_ms);
+
+#if defined(__cplusplus)
+}
+#endif
+
+#endif // !defined(__SKEETER_RING_H__)
@@ -0,0 +1,111 @@
+/*----------------------------------------------------------------------------
+ * batch.c
+ * 
+ * pack several notifications for a channel into one data frame
+ *--------------------------------------------------------------------------*/
+#include <arpa/inet.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "batch.h"
+#include "bstrlib.h"
+#include "dbg_syslog.h"
+
+//----------------------------------------------------------------------------
+// append a length prefixed field to the frame
+// return 0 for success, -1 for failure
+static int
+append_field(bstring frame, const void * field, int length) {
+//----------------------------------------------------------------------------
+   uint32_t network_length = htonl((uint32_t) length);
+
+   check(bcatblk(frame, &network_length, sizeof network_length) == BSTR_OK,
+         "bcatblk length");
+   check(bcatblk(frame, field, length) == BSTR_OK, "bcatblk field");
+
+   return 0;
+error:
+   return -1;
+}
+
+//----------------------------------------------------------------------------
+// return 0 for success, -1 for failure
+int
+initialize_batch(struct Batch * batch) {
+//----------------------------------------------------------------------------
+   batch->frame = bfromcstr("");
+   check_mem(batch->frame);
+   batch->count = 0;
+   batch->first_sequence = 0;
+   batch->received_us = NULL;
+   batch->received_capacity = 0;
+
+   return 0;
+error:
+   return -1;
+}
+
+//----------------------------------------------------------------------------
+// release resources used by the batch
+void
+clear_batch(struct Batch * batch) {
+//----------------------------------------------------------------------------
+   bdestroy(batch->frame);
+   batch->frame = NULL;
+   free(batch->received_us);
+   batch->received_us = NULL;
+   batch->received_capacity = 0;
+}
+
+//----------------------------------------------------------------------------
+// append one notification to the batch frame
+// received_us is when we read it, 0 if it wasn't a notification
+// data may be NULL
+// return 0 for success, -1 for failure
+int
+batch_append(struct Batch * batch, 
+             uint64_t sequence,
+             uint64_t received_us,
+             const_bstring meta, 
+             const char * data) {
+//----------------------------------------------------------------------------
+   uint64_t * received;
+   int capacity;
+
+   if (data == NULL) data = "";
+
+   if (batch->count == batch->received_capacity) {
+      capacity = (batch->received_capacity == 0) ? 
+         16 : batch->received_capacity * 2;
+      received = realloc(batch->received_us, capacity * sizeof(uint64_t));
+      check_mem(received);
+      batch->received_us = received;
+      batch->received_capacity = capacity;
+   }
+
+   if (batch->count == 0) {
+      batch->first_sequence = sequence;
+   }
+   batch->received_us[batch->count] = received_us;
+   check(append_field(batch->frame, meta->data, blength(meta)) == 0,
+         "append_field meta");
+   check(append_field(batch->frame, data, (int) strlen(data)) == 0,
+         "append_field data");
+   batch->count++;
+
+   return 0;
+error:
+   return -1;
+}
+
+//----------------------------------------------------------------------------
+// empty the batch after it has been published
+// received_us is left as it was, for the publisher to read
+// we keep the allocated space for the next batch
+void
+batch_reset(struct Batch * batch) {
+//----------------------------------------------------------------------------
+   batch->frame->slen = 0;
+   batch->frame->data[0] = '\0';
+   batch->count = 0;
+}
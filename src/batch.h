@@ -0,0 +1,54 @@
+/*----------------------------------------------------------------------------
+ * batch.h
+ * 
+ * pack several notifications for a channel into one data frame
+ *
+ * the batch frame is a sequence of entries, each one
+ *    4 byte meta data length (network byte order)
+ *    meta data
+ *    4 byte data length (network byte order)
+ *    data
+ *--------------------------------------------------------------------------*/
+#if !defined(__BATCH_H__)
+#define __BATCH_H__
+
+#include <stdint.h>
+
+#include "bstrlib.h"
+
+struct Batch {
+   bstring frame;
+   int count;
+   uint64_t first_sequence;
+
+   // when we read each notification in the frame (CLOCK_MONOTONIC us),
+   // 0 for those that weren't notifications
+   uint64_t * received_us;
+   int received_capacity;
+};
+
+// return 0 for success, -1 for failure
+extern int
+initialize_batch(struct Batch * batch);
+
+// release resources used by the batch
+extern void
+clear_batch(struct Batch * batch);
+
+// append one notification to the batch frame
+// received_us is when we read it, 0 if it wasn't a notification
+// data may be NULL
+// return 0 for success, -1 for failure
+extern int
+batch_append(struct Batch * batch, 
+             uint64_t sequence,
+             uint64_t received_us,
+             const_bstring meta, 
+             const char * data);
+
+// empty the batch after it has been published
+// received_us is left as it was, for the publisher to read
+extern void
+batch_reset(struct Batch * batch);
+
+#endif // !defined(__BATCH_H__)
@@ -0,0 +1,223 @@
+/*----------------------------------------------------------------------------
+ * compress.c
+ * 
+ * per channel compression of the data frame
+ *
+ * lz4 and zstd are optional: build with 'make WITH_LZ4=1 WITH_ZSTD=1'
+ *--------------------------------------------------------------------------*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <strings.h>
+
+#if defined(HAVE_LZ4)
+#include <lz4.h>
+#endif
+
+#if defined(HAVE_ZSTD)
+#include <zstd.h>
+#endif
+
+#include "bstrlib.h"
+#include "compress.h"
+#include "config.h"
+#include "dbg_syslog.h"
+
+const char * COMPRESSION_NAME[] = {
+   "none",
+   "lz4",
+   "zstd"
+};
+
+#if defined(HAVE_ZSTD)
+//----------------------------------------------------------------------------
+// read a zstd dictionary file into a CDict
+// return NULL on failure
+static ZSTD_CDict *
+load_zstd_dictionary(const char * path, int level) {
+//----------------------------------------------------------------------------
+   FILE * dictionary_stream = NULL;
+   bstring dictionary = NULL;
+   ZSTD_CDict * cdict = NULL;
+
+   dictionary_stream = fopen(path, "r");
+   check(dictionary_stream != NULL, "fopen(%s)", path);
+   dictionary = bread((bNread) fread, dictionary_stream);
+   check(dictionary != NULL, "bread(%s)", path);
+   check(fclose(dictionary_stream) == 0, "fclose");
+   dictionary_stream = NULL;
+
+   // the CDict makes its own copy of the dictionary
+   cdict = ZSTD_createCDict(dictionary->data, blength(dictionary), level);
+   check(cdict != NULL, "ZSTD_createCDict(%s)", path);
+   log_info("loaded zstd dictionary '%s' (%d bytes)", 
+            path, 
+            blength(dictionary));
+
+   bdestroy(dictionary);
+   return cdict;
+
+error:
+   if (dictionary_stream != NULL) fclose(dictionary_stream);
+   bdestroy(dictionary);
+   return NULL;
+}
+#endif // defined(HAVE_ZSTD)
+
+//----------------------------------------------------------------------------
+// set up a compressor from the channel config, loading the zstd dictionary
+// return 0 for success, -1 for failure (including a compression type
+// we were not built with)
+int
+initialize_compressor(struct Compressor * compressor,
+                      const struct ChannelConfig * channel_config) {
+//----------------------------------------------------------------------------
+   bzero(compressor, sizeof(struct Compressor));
+   compressor->type = channel_config->compression;
+   compressor->threshold = channel_config->compress_threshold;
+   compressor->level = channel_config->compress_level;
+
+   switch (compressor->type) {
+      case COMPRESSION_NONE:
+         break;
+
+      case COMPRESSION_LZ4:
+#if !defined(HAVE_LZ4)
+         sentinel("compression=lz4: skeeter was built without WITH_LZ4");
+#endif
+         break;
+
+      case COMPRESSION_ZSTD:
+#if defined(HAVE_ZSTD)
+         compressor->zstd_cctx = ZSTD_createCCtx();
+         check(compressor->zstd_cctx != NULL, "ZSTD_createCCtx");
+         if (channel_config->zstd_dictionary != NULL) {
+            compressor->zstd_cdict = \
+               load_zstd_dictionary(channel_config->zstd_dictionary,
+                                    compressor->level);
+            check(compressor->zstd_cdict != NULL, "load_zstd_dictionary");
+         }
+#else
+         sentinel("compression=zstd: skeeter was built without WITH_ZSTD");
+#endif
+         break;
+   }
+
+   return 0;
+
+error:
+   clear_compressor(compressor);
+   return -1;
+}
+
+//----------------------------------------------------------------------------
+// release resources used by the compressor
+void
+clear_compressor(struct Compressor * compressor) {
+//----------------------------------------------------------------------------
+#if defined(HAVE_ZSTD)
+   if (compressor->zstd_cdict != NULL) ZSTD_freeCDict(compressor->zstd_cdict);
+   if (compressor->zstd_cctx != NULL) ZSTD_freeCCtx(compressor->zstd_cctx);
+#endif
+   compressor->zstd_cdict = NULL;
+   compressor->zstd_cctx = NULL;
+}
+
+//----------------------------------------------------------------------------
+// compress data into *compressed if it is over the threshold
+// *compressed is set to NULL if we don't compress, or compressing
+// would not make it smaller.
+// the caller must bdestroy *compressed
+// return 0 for success, -1 for failure
+int
+compress_data(struct Compressor * compressor, 
+              const_bstring data, 
+              bstring * compressed) {
+//----------------------------------------------------------------------------
+   int bound = 0;
+   int compressed_size = 0;
+
+   *compressed = NULL;
+   if (compressor->type == COMPRESSION_NONE || 
+       blength(data) < compressor->threshold) {
+      return 0;
+   }
+
+   switch (compressor->type) {
+      case COMPRESSION_NONE:
+         break;
+
+      case COMPRESSION_LZ4:
+#if defined(HAVE_LZ4)
+         bound = LZ4_compressBound(blength(data));
+#endif
+         break;
+
+      case COMPRESSION_ZSTD:
+#if defined(HAVE_ZSTD)
+         bound = (int) ZSTD_compressBound(blength(data));
+#endif
+         break;
+   }
+   check(bound > 0, "compress bound");
+
+   *compressed = bfromcstralloc(bound, "");
+   check(*compressed != NULL, "bfromcstralloc");
+
+   switch (compressor->type) {
+      case COMPRESSION_NONE:
+         break;
+
+      case COMPRESSION_LZ4:
+#if defined(HAVE_LZ4)
+         compressed_size = LZ4_compress_default((const char *) data->data,
+                                                (char *) (*compressed)->data,
+                                                blength(data),
+                                                bound);
+         check(compressed_size > 0, "LZ4_compress_default");
+#endif
+         break;
+
+      case COMPRESSION_ZSTD:
+#if defined(HAVE_ZSTD)
+      {
+         size_t result;
+         if (compressor->zstd_cdict != NULL) {
+            result = ZSTD_compress_usingCDict(compressor->zstd_cctx,
+                                              (*compressed)->data,
+                                              bound,
+                                              data->data,
+                                              blength(data),
+                                              compressor->zstd_cdict);
+         } else {
+            result = ZSTD_compressCCtx(compressor->zstd_cctx,
+                                       (*compressed)->data,
+                                       bound,
+                                       data->data,
+                                       blength(data),
+                                       compressor->level);
+         }
+         check(!ZSTD_isError(result), 
+               "zstd compress %s", 
+               ZSTD_getErrorName(result));
+         compressed_size = (int) result;
+      }
+#endif
+         break;
+   }
+
+   if (compressed_size >= blength(data)) {
+      // not worth it, send the original
+      bdestroy(*compressed);
+      *compressed = NULL;
+      return 0;
+   }
+   (*compressed)->slen = compressed_size;
+   (*compressed)->data[compressed_size] = '\0';
+
+   return 0;
+
+error:
+   bdestroy(*compressed);
+   *compressed = NULL;
+   return -1;
+}
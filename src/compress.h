@@ -0,0 +1,46 @@
+/*----------------------------------------------------------------------------
+ * compress.h
+ * 
+ * per channel compression of the data frame
+ *--------------------------------------------------------------------------*/
+#if !defined(__COMPRESS_H__)
+#define __COMPRESS_H__
+
+#include "bstrlib.h"
+#include "config.h"
+
+struct Compressor {
+   enum COMPRESSION_TYPE type;
+   int threshold;
+   int level;
+
+   // zstd context and (optional) dictionary, NULL unless type is zstd
+   void * zstd_cctx;
+   void * zstd_cdict;
+};
+
+// the value of 'compression' in the meta data frame
+extern const char * COMPRESSION_NAME[];
+
+// set up a compressor from the channel config, loading the zstd dictionary
+// return 0 for success, -1 for failure (including a compression type
+// we were not built with)
+extern int
+initialize_compressor(struct Compressor * compressor,
+                      const struct ChannelConfig * channel_config);
+
+// release resources used by the compressor
+extern void
+clear_compressor(struct Compressor * compressor);
+
+// compress data into *compressed if it is over the threshold
+// *compressed is set to NULL if we don't compress, or compressing
+// would not make it smaller.
+// the caller must bdestroy *compressed
+// return 0 for success, -1 for failure
+extern int
+compress_data(struct Compressor * compressor, 
+              const_bstring data, 
+              bstring * compressed);
+
+#endif // !defined(__COMPRESS_H__)
@@ -3,8 +3,10 @@
  * 
  * configuration from skeeterrc
  *--------------------------------------------------------------------------*/
+#include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <strings.h>
 
 #include "bstrlib.h"
@@ -59,19 +61,430 @@ error:
    return -1;
 }
 
-int 
-parse_channel_list(struct Config * config, bstring entry) {
+//----------------------------------------------------------------------------
+// split a comma separated list of names
+// return NULL on failure
+struct bstrList *
+parse_name_list(bstring entry) {
+//----------------------------------------------------------------------------
+   struct bstrList * name_list;
+   int i;
+
+   name_list = bsplit(entry, ',');
+   check(name_list != NULL, "bsplit");
+   for (i=0; i < name_list->qty; i++) {
+      check(btrimws(name_list->entry[i]) == BSTR_OK, "btrimws");
+   }
+
+   return name_list;
+error:
+   return NULL;
+}
+
+//----------------------------------------------------------------------------
+// set config->zmq_io_cpus from a comma separated list of cpu numbers
+// return 0 for success, -1 for failure
+static int
+parse_cpu_list(struct Config * config, bstring entry) {
+//----------------------------------------------------------------------------
+   struct bstrList * cpu_list = NULL;
+   int i;
+
+   cpu_list = parse_name_list(entry);
+   check(cpu_list != NULL, "parse_name_list");
+
+   free(config->zmq_io_cpus);
+   config->zmq_io_cpus = calloc(cpu_list->qty, sizeof(int));
+   check_mem(config->zmq_io_cpus);
+   config->zmq_io_cpu_qty = cpu_list->qty;
+   for (i=0; i < cpu_list->qty; i++) {
+      config->zmq_io_cpus[i] = bstr2int(cpu_list->entry[i]);
+      check(config->zmq_io_cpus[i] >= 0, 
+            "invalid cpu '%s'", cpu_list->entry[i]->data);
+   }
+
+   bstrListDestroy(cpu_list);
+   return 0;
+
+error:
+   if (cpu_list != NULL) bstrListDestroy(cpu_list);
+   return -1;
+}
+
+//----------------------------------------------------------------------------
+// set one option in a ChannelConfig from a 'channel-<channel>-<option>' line
+// return 0 for success, -1 for an unknown option
+int
+channel_option(void * item, bstring option, bstring value) {
+//----------------------------------------------------------------------------
+   struct ChannelConfig * channel_config = item;
+
+   if (biseqcstr(option, "outbox_table")) {
+      bcstrfree((char *) channel_config->outbox_table);
+      channel_config->outbox_table = bstr2cstr(value, '?');
+   } else if (biseqcstr(option, "outbox_id_column")) {
+      bcstrfree((char *) channel_config->outbox_id_column);
+      channel_config->outbox_id_column = bstr2cstr(value, '?');
+   } else if (biseqcstr(option, "outbox_payload_column")) {
+      bcstrfree((char *) channel_config->outbox_payload_column);
+      channel_config->outbox_payload_column = bstr2cstr(value, '?');
+   } else if (biseqcstr(option, "compression")) {
+      if (biseqcstr(value, "lz4")) {
+         channel_config->compression = COMPRESSION_LZ4;
+      } else if (biseqcstr(value, "zstd")) {
+         channel_config->compression = COMPRESSION_ZSTD;
+      } else if (biseqcstr(value, "none")) {
+         channel_config->compression = COMPRESSION_NONE;
+      } else {
+         log_err("unknown compression '%s'", (char *) value->data);
+         return -1;
+      }
+   } else if (biseqcstr(option, "compress_threshold")) {
+      channel_config->compress_threshold = bstr2int(value);
+   } else if (biseqcstr(option, "compress_level")) {
+      channel_config->compress_level = bstr2int(value);
+   } else if (biseqcstr(option, "batch_max_bytes")) {
+      channel_config->batch_max_bytes = bstr2int(value);
+   } else if (biseqcstr(option, "conflate_window")) {
+      channel_config->conflate_window = bstr2int(value);
+   } else if (biseqcstr(option, "conflate_key_delimiter")) {
+      if (blength(value) != 1) {
+         log_err("conflate_key_delimiter must be one character");
+         return -1;
+      }
+      channel_config->conflate_key_delimiter = bchar(value, 0);
+   } else if (biseqcstr(option, "rate_limit")) {
+      channel_config->rate_limit = bstr2int(value);
+   } else if (biseqcstr(option, "rate_burst")) {
+      channel_config->rate_burst = bstr2int(value);
+   } else if (biseqcstr(option, "zstd_dictionary")) {
+      bcstrfree((char *) channel_config->zstd_dictionary);
+      channel_config->zstd_dictionary = bstr2cstr(value, '?');
+   } else if (biseqcstr(option, "priority_class")) {
+      bcstrfree((char *) channel_config->priority_class);
+      channel_config->priority_class = bstr2cstr(value, '?');
+   } else if (biseqcstr(option, "producer_timestamp")) {
+      bcstrfree((char *) channel_config->producer_timestamp);
+      channel_config->producer_timestamp = bstr2cstr(value, '?');
+   } else {
+      return -1;
+   }
+
+   return 0;
+}
+
+//----------------------------------------------------------------------------
+// set one option in an EndpointConfig from a 
+// 'pub_endpoint-<endpoint>-<option>' line
+// return 0 for success, -1 for an unknown option
+int
+endpoint_option(void * item, bstring option, bstring value) {
+//----------------------------------------------------------------------------
+   struct EndpointConfig * endpoint_config = item;
+
+   if (biseqcstr(option, "uri")) {
+      bcstrfree((char *) endpoint_config->uri);
+      endpoint_config->uri = bstr2cstr(value, '?');
+   } else if (biseqcstr(option, "hwm")) {
+      endpoint_config->hwm = bstr2int(value);
+   } else if (biseqcstr(option, "sndbuf")) {
+      endpoint_config->sndbuf = bstr2int(value);
+   } else if (biseqcstr(option, "tcp_keepalive")) {
+      endpoint_config->tcp_keepalive = bstr2int(value);
+   } else if (biseqcstr(option, "tcp_keepalive_idle")) {
+      endpoint_config->tcp_keepalive_idle = bstr2int(value);
+   } else if (biseqcstr(option, "tcp_keepalive_cnt")) {
+      endpoint_config->tcp_keepalive_cnt = bstr2int(value);
+   } else if (biseqcstr(option, "tcp_keepalive_intvl")) {
+      endpoint_config->tcp_keepalive_intvl = bstr2int(value);
+   } else if (biseqcstr(option, "dedicated_socket")) {
+      endpoint_config->dedicated_socket = bstr2int(value);
+   } else if (biseqcstr(option, "priority_class")) {
+      bcstrfree((char *) endpoint_config->priority_class);
+      endpoint_config->priority_class = bstr2cstr(value, '?');
+   } else {
+      return -1;
+   }
+
+   return 0;
+}
+
+//----------------------------------------------------------------------------
+// save a '<prefix><name>-<option>=<value>' line, so we can apply it once 
+// we have read the whole file: the list of names may follow the options.
+// keys get '<name>-<option>'
+// return 0 for success, -1 for failure
+int
+save_named_option(struct bstrList * keys, 
+                  struct bstrList * values,
+                  bstring prefix,
+                  struct bstrList * split_list) {
+//----------------------------------------------------------------------------
+   check(bstrListAlloc(keys, keys->qty+1) == BSTR_OK, "bstrListAlloc");
+   check(bstrListAlloc(values, values->qty+1) == BSTR_OK, "bstrListAlloc");
+   keys->entry[keys->qty] = bmidstr(split_list->entry[0], 
+                                    blength(prefix), 
+                                    blength(split_list->entry[0]));
+   check(keys->entry[keys->qty] != NULL, "bmidstr");
+   keys->qty++;
+   values->entry[values->qty] = bstrcpy(split_list->entry[1]);
+   check(values->entry[values->qty] != NULL, "bstrcpy");
+   values->qty++;
+
+   return 0;
+error:
+   return -1;
+}
+
+//----------------------------------------------------------------------------
+// apply the saved '<name>-<option>' lines to the items (an array parallel
+// to names) with setter
+// the name is everything up to the last '-'
+// unknown names and options are logged and skipped
+// return 0 for success, -1 for failure
+int
+apply_named_options(const struct bstrList * names,
+                    struct bstrList * keys,
+                    struct bstrList * values,
+                    option_setter setter,
+                    void * items,
+                    size_t item_size,
+                    const char * kind) {
+//----------------------------------------------------------------------------
+   int i;
+   int pos;
+   int index;
+   bstring name = NULL;
+   bstring option = NULL;
+
+   for (i=0; i < keys->qty; i++) {
+      pos = bstrrchr(keys->entry[i], '-');
+      if (pos == BSTR_ERR) {
+         log_err("Invalid %s option '%s'", 
+                 kind,
+                 (char *) keys->entry[i]->data);
+         continue;
+      }
+      name = bmidstr(keys->entry[i], 0, pos);
+      check(name != NULL, "bmidstr");
+      option = bmidstr(keys->entry[i], pos+1, blength(keys->entry[i]));
+      check(option != NULL, "bmidstr");
+
+      index = find_name_index(names, name);
+      if (index == -1) {
+         log_err("option for unknown %s '%s'", kind, (char *) name->data);
+      } else if (setter((char *) items + index * item_size,
+                        option,
+                        values->entry[i]) != 0) {
+         log_err("unknown %s option '%s'", kind, (char *) option->data);
+      }
+
+      check(bdestroy(name) == BSTR_OK, "bdestroy(name)");
+      name = NULL;
+      check(bdestroy(option) == BSTR_OK, "bdestroy(option)");
+      option = NULL;
+   }
+
+   return 0;
+error:
+   bdestroy(name);
+   bdestroy(option);
+   return -1;
+}
+
+//----------------------------------------------------------------------------
+// build config->channel_config from the saved 'channel-' lines
+int
+parse_channel_options(struct Config * config, 
+                      struct bstrList * keys,
+                      struct bstrList * values) {
+//----------------------------------------------------------------------------
+   int i;
+
+   check(config->channel_list != NULL, "no 'channels' in config");
+
+   config->channel_config = calloc(config->channel_list->qty, 
+                                   sizeof(struct ChannelConfig));
+   check_mem(config->channel_config);
+   for (i=0; i < config->channel_list->qty; i++) {
+      config->channel_config[i].compression = COMPRESSION_NONE;
+      config->channel_config[i].compress_threshold = 1024;
+      config->channel_config[i].compress_level = 1;
+      config->channel_config[i].conflate_key_delimiter = ':';
+   }
+
+   return apply_named_options(config->channel_list,
+                              keys,
+                              values,
+                              channel_option,
+                              config->channel_config,
+                              sizeof(struct ChannelConfig),
+                              "channel");
+error:
+   return -1;
+}
+
+//----------------------------------------------------------------------------
+// build config->endpoint_config from 'pub_endpoints' and the saved 
+// 'pub_endpoint-' lines. Without 'pub_endpoints' we have one endpoint, 
+// 'default', from pub_socket_uri and pub_socket_hwm, or none at all 
+// without pub_socket_uri (for in-process use of the library)
+int
+parse_endpoint_options(struct Config * config, 
+                       struct bstrList * keys,
+                       struct bstrList * values) {
+//----------------------------------------------------------------------------
+   int i;
+   struct EndpointConfig * endpoint_config;
+   bool default_endpoint = (config->endpoint_list == NULL);
+
+   if (default_endpoint) {
+      config->endpoint_list = bstrListCreate();
+      check(config->endpoint_list != NULL, "bstrListCreate");
+      if (config->pub_socket_uri == NULL) {
+         log_info("no pub_socket_uri or pub_endpoints: no PUB sockets");
+         return 0;
+      }
+      check(bstrListAlloc(config->endpoint_list, 1) == BSTR_OK, 
+            "bstrListAlloc");
+      config->endpoint_list->entry[0] = bfromcstr("default");
+      check(config->endpoint_list->entry[0] != NULL, "bfromcstr");
+      config->endpoint_list->qty = 1;
+   }
+
+   config->endpoint_config = calloc(config->endpoint_list->qty, 
+                                    sizeof(struct EndpointConfig));
+   check_mem(config->endpoint_config);
+   for (i=0; i < config->endpoint_list->qty; i++) {
+      endpoint_config = &config->endpoint_config[i];
+      endpoint_config->name = \
+         (const char *) config->endpoint_list->entry[i]->data;
+      endpoint_config->uri = NULL;
+      endpoint_config->hwm = config->pub_socket_hwm;
+      endpoint_config->sndbuf = -1;
+      endpoint_config->tcp_keepalive = -1;
+      endpoint_config->tcp_keepalive_idle = -1;
+      endpoint_config->tcp_keepalive_cnt = -1;
+      endpoint_config->tcp_keepalive_intvl = -1;
+      endpoint_config->dedicated_socket = 0;
+   }
+   if (default_endpoint) {
+      config->endpoint_config[0].uri = strdup(config->pub_socket_uri);
+      check_mem(config->endpoint_config[0].uri);
+   } else if (config->pub_socket_uri != NULL) {
+      log_err("pub_socket_uri is ignored when pub_endpoints is set");
+   }
+
+   check(apply_named_options(config->endpoint_list,
+                             keys,
+                             values,
+                             endpoint_option,
+                             config->endpoint_config,
+                             sizeof(struct EndpointConfig),
+                             "pub_endpoint") == 0,
+         "apply_named_options");
+
+   for (i=0; i < config->endpoint_list->qty; i++) {
+      check(config->endpoint_config[i].uri != NULL, 
+            "no uri for pub_endpoint '%s'", 
+            config->endpoint_config[i].name);
+   }
+
+   return 0;
+error:
+   return -1;
+}
+
+//----------------------------------------------------------------------------
+// find the position of a 'priority_class' option value in 
+// config->priority_class_list. Without the option, the lowest class.
+// return -1 for an unknown class
+static int
+priority_class_index(const struct Config * config, 
+                     const char * priority_class,
+                     const char * kind,
+                     const char * name) {
+//----------------------------------------------------------------------------
+   bstring class_name;
+   int index;
+
+   if (priority_class == NULL) {
+      return config->priority_class_list->qty - 1;
+   }
+
+   class_name = bfromcstr(priority_class);
+   check(class_name != NULL, "bfromcstr");
+   index = find_name_index(config->priority_class_list, class_name);
+   bdestroy(class_name);
+   check(index != -1, 
+         "unknown priority_class '%s' for %s '%s'", 
+         priority_class,
+         kind,
+         name);
+
+   return index;
+error:
+   return -1;
+}
+
+//----------------------------------------------------------------------------
+// resolve the 'priority_class' options of channels and endpoints.
+// Without 'priority_classes' there is one class, 'normal'.
+// Every class with channels needs an endpoint to publish them on, unless
+// there are no endpoints at all.
+int
+parse_priority_classes(struct Config * config) {
+//----------------------------------------------------------------------------
    int i;
+   int class_index;
+   struct EndpointConfig * endpoint_config;
+   int * endpoint_counts = NULL;
+
+   if (config->priority_class_list == NULL) {
+      config->priority_class_list = bstrListCreate();
+      check(config->priority_class_list != NULL, "bstrListCreate");
+      check(bstrListAlloc(config->priority_class_list, 1) == BSTR_OK, 
+            "bstrListAlloc");
+      config->priority_class_list->entry[0] = bfromcstr("normal");
+      check(config->priority_class_list->entry[0] != NULL, "bfromcstr");
+      config->priority_class_list->qty = 1;
+   }
+   check(config->priority_class_list->qty > 0, "empty priority_classes");
+
+   endpoint_counts = calloc(config->priority_class_list->qty, sizeof(int));
+   check_mem(endpoint_counts);
+
+   for (i=0; i < config->endpoint_list->qty; i++) {
+      endpoint_config = &config->endpoint_config[i];
+      class_index = priority_class_index(config,
+                                         endpoint_config->priority_class,
+                                         "pub_endpoint",
+                                         endpoint_config->name);
+      check(class_index != -1, "priority_class_index");
+      endpoint_config->priority_class_index = class_index;
+      endpoint_counts[class_index]++;
+   }
 
-   config->channel_list = bsplit(entry, ',');
-   check(config->channel_list != NULL, "bsplit");
    for (i=0; i < config->channel_list->qty; i++) {
-      check(btrimws(config->channel_list->entry[i]) == BSTR_OK,
-            "btrimws");
+      class_index = priority_class_index(
+         config,
+         config->channel_config[i].priority_class,
+         "channel",
+         (const char *) config->channel_list->entry[i]->data);
+      check(class_index != -1, "priority_class_index");
+      check(config->endpoint_list->qty == 0 || 
+               endpoint_counts[class_index] > 0, 
+            "no pub_endpoint for priority_class '%s' of channel '%s'",
+            (const char *) 
+               config->priority_class_list->entry[class_index]->data,
+            (const char *) config->channel_list->entry[i]->data);
+      config->channel_config[i].priority_class_index = class_index;
    }
 
+   free(endpoint_counts);
    return 0;
 error:
+   free(endpoint_counts);
    return -1;
 }
 
@@ -80,9 +493,19 @@ set_config_defaults(struct Config * config) {
    // set defaults
    config->zmq_thread_pool_size = 3;
    config->heartbeat_interval = 10;
-   config->epoll_timeout = 1;
+   config->epoll_timeout = -1;
+   config->epoll_batch_size = 64;
+   config->reactor_backend = REACTOR_EPOLL;
+   config->timer_slack = -1;
+   config->latency_cpu = -1;
+   config->zmq_io_cpus = NULL;
+   config->zmq_io_cpu_qty = 0;
+   config->busy_poll = 0;
+   config->lock_memory = 0;
    config->pub_socket_uri = NULL;
    config->pub_socket_hwm = 5;
+   config->pub_socket_nodrop = 0;
+   config->shutdown_linger = 1000;
 
    config->postgresql_keywords = malloc(sizeof(char *));
    check_mem(config->postgresql_keywords);
@@ -93,6 +516,52 @@ set_config_defaults(struct Config * config) {
    config->postgresql_values[0] = NULL;
 
    config->channel_list = NULL;
+   config->channel_config = NULL;
+
+   config->endpoint_list = NULL;
+   config->endpoint_config = NULL;
+
+   config->priority_class_list = NULL;
+
+   config->relay_upstream = NULL;
+   config->relay_hwm = -1;
+
+   config->gateway_uri = NULL;
+   config->gateway_batch_size = 1000;
+   config->gateway_hwm = -1;
+
+   config->pg_proxy_address = NULL;
+   config->pg_proxy_port = 0;
+   config->pg_proxy_max_clients = 1024;
+   config->pg_proxy_max_output = 1024 * 1024;
+
+   config->sse_address = NULL;
+   config->sse_port = 0;
+   config->sse_max_clients = 1024;
+   config->sse_max_output = 256 * 1024;
+   config->sse_allow_origin = NULL;
+
+   config->resp_address = NULL;
+   config->resp_port = 0;
+   config->resp_max_clients = 1024;
+   config->resp_max_output = 1024 * 1024;
+
+   config->metrics_address = NULL;
+   config->metrics_port = 0;
+
+   config->shm_ring_name = NULL;
+   config->shm_ring_size = 16 * 1024 * 1024;
+
+   config->handoff_path = NULL;
+
+   config->leader_lock_key = 0;
+   config->leader_retry_interval = 1;
+
+   config->outbox_batch_size = 100;
+   config->outbox_poll_interval = 5;
+   config->outbox_checkpoint_dir = NULL;
+
+   config->batch_max_latency = 5;
 
    return 0;
 
@@ -114,6 +583,12 @@ load_config(bstring config_path) {
    struct bstrList * split_list;
    bstring postgres_prefix = bfromcstr("postgresql-");
    int postgres_count = 0;
+   bstring channel_prefix = bfromcstr("channel-");
+   struct bstrList * channel_keys = bstrListCreate();
+   struct bstrList * channel_values = bstrListCreate();
+   bstring endpoint_prefix = bfromcstr("pub_endpoint-");
+   struct bstrList * endpoint_keys = bstrListCreate();
+   struct bstrList * endpoint_values = bstrListCreate();
 
    config_path_cstr = bstr2cstr(config_path, '?');
    check(config_path_cstr != NULL, "bstr2cstr");
@@ -123,6 +598,8 @@ load_config(bstring config_path) {
    bzero(config, sizeof(struct Config));
 
    check(set_config_defaults(config) == 0, "set_config_defaults");
+   check(channel_keys != NULL && channel_values != NULL, "bstrListCreate");
+   check(endpoint_keys != NULL && endpoint_values != NULL, "bstrListCreate");
 
    config_stream = fopen(config_path_cstr, "r");
    check(config_stream != NULL, "fopen(%s)", config_path_cstr);
@@ -160,8 +637,34 @@ load_config(bstring config_path) {
          config->pub_socket_uri = bstr2cstr(split_list->entry[1], '?');
       } else if (biseqcstr(split_list->entry[0], "pub_socket_hwm")) {
          config->pub_socket_hwm = bstr2int(split_list->entry[1]);
+      } else if (biseqcstr(split_list->entry[0], "pub_socket_nodrop")) {
+         config->pub_socket_nodrop = bstr2int(split_list->entry[1]);
+      } else if (biseqcstr(split_list->entry[0], "shutdown_linger")) {
+         config->shutdown_linger = bstr2int(split_list->entry[1]);
       } else if (biseqcstr(split_list->entry[0], "epoll_timeout")) {
          config->epoll_timeout = bstr2int(split_list->entry[1]);
+      } else if (biseqcstr(split_list->entry[0], "timer_slack")) {
+         config->timer_slack = bstr2int(split_list->entry[1]);
+      } else if (biseqcstr(split_list->entry[0], "latency_cpu")) {
+         config->latency_cpu = bstr2int(split_list->entry[1]);
+      } else if (biseqcstr(split_list->entry[0], "zmq_io_cpus")) {
+         check(parse_cpu_list(config, split_list->entry[1]) == 0,
+               "parse_cpu_list");
+      } else if (biseqcstr(split_list->entry[0], "busy_poll")) {
+         config->busy_poll = bstr2int(split_list->entry[1]);
+      } else if (biseqcstr(split_list->entry[0], "lock_memory")) {
+         config->lock_memory = bstr2int(split_list->entry[1]);
+      } else if (biseqcstr(split_list->entry[0], "epoll_batch_size")) {
+         config->epoll_batch_size = bstr2int(split_list->entry[1]);
+      } else if (biseqcstr(split_list->entry[0], "reactor_backend")) {
+         if (biseqcstr(split_list->entry[1], "io_uring")) {
+            config->reactor_backend = REACTOR_IO_URING;
+         } else {
+            check(biseqcstr(split_list->entry[1], "epoll"),
+                  "unknown reactor_backend '%s'", 
+                  (char *) split_list->entry[1]->data);
+            config->reactor_backend = REACTOR_EPOLL;
+         }
       } else if (biseqcstr(split_list->entry[0], "heartbeat_interval")) {
          config->heartbeat_interval = bstr2int(split_list->entry[1]);
       } else if (biseqcstr(split_list->entry[0], "database_retry_interval")) {
@@ -176,8 +679,89 @@ load_config(bstring config_path) {
                               split_list) == 0, 
                "postgres_entry");
       } else if (biseqcstr(split_list->entry[0], "channels")) {
-         check(parse_channel_list(config, split_list->entry[1]) == 0,
-               "parse_channel_list");
+         config->channel_list = parse_name_list(split_list->entry[1]);
+         check(config->channel_list != NULL, "parse_name_list");
+      } else if (bstrncmp(split_list->entry[0], 
+                          channel_prefix, 
+                          blength(channel_prefix)) == 0) {
+         check(save_named_option(channel_keys, 
+                                 channel_values,
+                                 channel_prefix, 
+                                 split_list) == 0,
+               "save_named_option");
+      } else if (biseqcstr(split_list->entry[0], "pub_endpoints")) {
+         config->endpoint_list = parse_name_list(split_list->entry[1]);
+         check(config->endpoint_list != NULL, "parse_name_list");
+      } else if (bstrncmp(split_list->entry[0], 
+                          endpoint_prefix, 
+                          blength(endpoint_prefix)) == 0) {
+         check(save_named_option(endpoint_keys, 
+                                 endpoint_values,
+                                 endpoint_prefix, 
+                                 split_list) == 0,
+               "save_named_option");
+      } else if (biseqcstr(split_list->entry[0], "relay_upstream")) {
+         config->relay_upstream = bstr2cstr(split_list->entry[1], '?');
+      } else if (biseqcstr(split_list->entry[0], "relay_hwm")) {
+         config->relay_hwm = bstr2int(split_list->entry[1]);
+      } else if (biseqcstr(split_list->entry[0], "gateway_uri")) {
+         config->gateway_uri = bstr2cstr(split_list->entry[1], '?');
+      } else if (biseqcstr(split_list->entry[0], "gateway_batch_size")) {
+         config->gateway_batch_size = bstr2int(split_list->entry[1]);
+      } else if (biseqcstr(split_list->entry[0], "gateway_hwm")) {
+         config->gateway_hwm = bstr2int(split_list->entry[1]);
+      } else if (biseqcstr(split_list->entry[0], "pg_proxy_address")) {
+         config->pg_proxy_address = bstr2cstr(split_list->entry[1], '?');
+      } else if (biseqcstr(split_list->entry[0], "pg_proxy_port")) {
+         config->pg_proxy_port = bstr2int(split_list->entry[1]);
+      } else if (biseqcstr(split_list->entry[0], "pg_proxy_max_clients")) {
+         config->pg_proxy_max_clients = bstr2int(split_list->entry[1]);
+      } else if (biseqcstr(split_list->entry[0], "pg_proxy_max_output")) {
+         config->pg_proxy_max_output = bstr2int(split_list->entry[1]);
+      } else if (biseqcstr(split_list->entry[0], "sse_address")) {
+         config->sse_address = bstr2cstr(split_list->entry[1], '?');
+      } else if (biseqcstr(split_list->entry[0], "sse_port")) {
+         config->sse_port = bstr2int(split_list->entry[1]);
+      } else if (biseqcstr(split_list->entry[0], "sse_max_clients")) {
+         config->sse_max_clients = bstr2int(split_list->entry[1]);
+      } else if (biseqcstr(split_list->entry[0], "sse_max_output")) {
+         config->sse_max_output = bstr2int(split_list->entry[1]);
+      } else if (biseqcstr(split_list->entry[0], "sse_allow_origin")) {
+         config->sse_allow_origin = bstr2cstr(split_list->entry[1], '?');
+      } else if (biseqcstr(split_list->entry[0], "resp_address")) {
+         config->resp_address = bstr2cstr(split_list->entry[1], '?');
+      } else if (biseqcstr(split_list->entry[0], "resp_port")) {
+         config->resp_port = bstr2int(split_list->entry[1]);
+      } else if (biseqcstr(split_list->entry[0], "resp_max_clients")) {
+         config->resp_max_clients = bstr2int(split_list->entry[1]);
+      } else if (biseqcstr(split_list->entry[0], "resp_max_output")) {
+         config->resp_max_output = bstr2int(split_list->entry[1]);
+      } else if (biseqcstr(split_list->entry[0], "metrics_address")) {
+         config->metrics_address = bstr2cstr(split_list->entry[1], '?');
+      } else if (biseqcstr(split_list->entry[0], "metrics_port")) {
+         config->metrics_port = bstr2int(split_list->entry[1]);
+      } else if (biseqcstr(split_list->entry[0], "shm_ring_name")) {
+         config->shm_ring_name = bstr2cstr(split_list->entry[1], '?');
+      } else if (biseqcstr(split_list->entry[0], "handoff_path")) {
+         config->handoff_path = bstr2cstr(split_list->entry[1], '?');
+      } else if (biseqcstr(split_list->entry[0], "leader_lock_key")) {
+         config->leader_lock_key = \
+            strtoll((const char *) split_list->entry[1]->data, NULL, 10);
+      } else if (biseqcstr(split_list->entry[0], "leader_retry_interval")) {
+         config->leader_retry_interval = bstr2int(split_list->entry[1]);
+      } else if (biseqcstr(split_list->entry[0], "shm_ring_size")) {
+         config->shm_ring_size = bstr2int(split_list->entry[1]);
+      } else if (biseqcstr(split_list->entry[0], "priority_classes")) {
+         config->priority_class_list = parse_name_list(split_list->entry[1]);
+         check(config->priority_class_list != NULL, "parse_name_list");
+      } else if (biseqcstr(split_list->entry[0], "outbox_batch_size")) {
+         config->outbox_batch_size = bstr2int(split_list->entry[1]);
+      } else if (biseqcstr(split_list->entry[0], "outbox_poll_interval")) {
+         config->outbox_poll_interval = bstr2int(split_list->entry[1]);
+      } else if (biseqcstr(split_list->entry[0], "batch_max_latency")) {
+         config->batch_max_latency = bstr2int(split_list->entry[1]);
+      } else if (biseqcstr(split_list->entry[0], "outbox_checkpoint_dir")) {
+         config->outbox_checkpoint_dir = bstr2cstr(split_list->entry[1], '?');
       } else {
          log_err("unknown keyword '%s", bstr2cstr(split_list->entry[0], '?'));
       }
@@ -185,8 +769,39 @@ load_config(bstring config_path) {
       check(bstrListDestroy(split_list) == BSTR_OK, "bstrListDestroy");
    }
 
+   check(parse_channel_options(config, channel_keys, channel_values) == 0,
+         "parse_channel_options");
+   check(parse_endpoint_options(config, endpoint_keys, endpoint_values) == 0,
+         "parse_endpoint_options");
+   check(parse_priority_classes(config) == 0, "parse_priority_classes");
+   // a relay forwards messages whole, it has no notifications of its own
+   // to proxy or stream
+   check(config->pg_proxy_port == 0 || config->relay_upstream == NULL,
+         "pg_proxy_port does not work with relay_upstream");
+   check(config->sse_port == 0 || config->relay_upstream == NULL,
+         "sse_port does not work with relay_upstream");
+   check(config->resp_port == 0 || config->relay_upstream == NULL,
+         "resp_port does not work with relay_upstream");
+   // the cutover is marked in the notification stream
+   check(config->handoff_path == NULL || config->relay_upstream == NULL,
+         "handoff_path does not work with relay_upstream");
+   // the lock is held by a database session
+   check(config->leader_lock_key == 0 || config->relay_upstream == NULL,
+         "leader_lock_key does not work with relay_upstream");
+   // the new process would wait for the lock with the old one gone
+   check(config->leader_lock_key == 0 || config->handoff_path == NULL,
+         "leader_lock_key does not work with handoff_path");
+   check(config->leader_retry_interval > 0, 
+         "leader_retry_interval must be positive");
+
    check(bdestroy(line) == BSTR_OK, "bdestroy(line)");
    check(bdestroy(postgres_prefix) == BSTR_OK, "bdestroy(postgres_prefix");
+   check(bdestroy(channel_prefix) == BSTR_OK, "bdestroy(channel_prefix");
+   check(bstrListDestroy(channel_keys) == BSTR_OK, "bstrListDestroy");
+   check(bstrListDestroy(channel_values) == BSTR_OK, "bstrListDestroy");
+   check(bdestroy(endpoint_prefix) == BSTR_OK, "bdestroy(endpoint_prefix");
+   check(bstrListDestroy(endpoint_keys) == BSTR_OK, "bstrListDestroy");
+   check(bstrListDestroy(endpoint_values) == BSTR_OK, "bstrListDestroy");
    check(bsclose(config_bstream) != NULL, "bsclose");
    check(fclose(config_stream) == 0, "fclose");
    check(bcstrfree((char *)config_path_cstr) == BSTR_OK, "bcstrfree");
@@ -197,10 +812,253 @@ error:
    if (config_bstream != NULL) bsclose(config_bstream);
    if (config_stream != NULL) fclose(config_stream);
    if (config_path_cstr != NULL) bcstrfree((char *)config_path_cstr);
+   if (channel_keys != NULL) bstrListDestroy(channel_keys);
+   if (channel_values != NULL) bstrListDestroy(channel_values);
+   if (endpoint_keys != NULL) bstrListDestroy(endpoint_keys);
+   if (endpoint_values != NULL) bstrListDestroy(endpoint_values);
+
+   return NULL;
+}
+
+//----------------------------------------------------------------------------
+// find the position of name in name_list, -1 if it is not there
+int
+find_name_index(const struct bstrList * name_list, const bstring name) {
+//----------------------------------------------------------------------------
+   int i;
+   for (i=0; i < name_list->qty; i++) {
+      if (bstrcmp(name, name_list->entry[i]) == 0) {
+         return i;
+      }
+   }
+   return -1;
+}
+
+//----------------------------------------------------------------------------
+// find the position of the channel name in config->channel_list
+// this is the corresponding position in the parallel arrays
+// (config->channel_config, state->channel_counts, ...)
+// TODO: if we sort the channel names we can do a binary search
+int
+find_channel_index(const struct Config * config, const bstring channel) {
+//----------------------------------------------------------------------------
+   return find_name_index(config->channel_list, channel);
+}
+
+//----------------------------------------------------------------------------
+// return the number of channels that batch notifications
+int
+batch_channel_count(const struct Config * config) {
+//----------------------------------------------------------------------------
+   int i;
+   int count = 0;
+
+   for (i=0; i < config->channel_list->qty; i++) {
+      if (config->channel_config[i].batch_max_bytes > 0) count++;
+   }
+
+   return count;
+}
+
+//----------------------------------------------------------------------------
+// return the number of channels that conflate notifications
+int
+conflate_channel_count(const struct Config * config) {
+//----------------------------------------------------------------------------
+   int i;
+   int count = 0;
+
+   for (i=0; i < config->channel_list->qty; i++) {
+      if (config->channel_config[i].conflate_window > 0) count++;
+   }
+
+   return count;
+}
+
+//----------------------------------------------------------------------------
+// return the number of channels that tail an outbox table
+int
+outbox_channel_count(const struct Config * config) {
+//----------------------------------------------------------------------------
+   int i;
+   int count = 0;
+
+   for (i=0; i < config->channel_list->qty; i++) {
+      if (config->channel_config[i].outbox_table != NULL) count++;
+   }
+
+   return count;
+}
+
+//----------------------------------------------------------------------------
+// compare two C strings, either of which may be NULL
+static bool
+strings_differ(const char * a, const char * b) {
+//----------------------------------------------------------------------------
+   if (a == NULL || b == NULL) {
+      return a != b;
+   }
+   return strcmp(a, b) != 0;
+}
+
+//----------------------------------------------------------------------------
+static bool
+name_lists_differ(const struct bstrList * a, const struct bstrList * b) {
+//----------------------------------------------------------------------------
+   int i;
+
+   if (a->qty != b->qty) {
+      return true;
+   }
+   for (i=0; i < a->qty; i++) {
+      if (bstrcmp(a->entry[i], b->entry[i]) != 0) {
+         return true;
+      }
+   }
+   return false;
+}
+
+// the option's name, if it differs between old_config and config
+#define FIXED_INT(O) if (old_config->O != config->O) return #O
+#define FIXED_STRING(O) \
+   if (strings_differ(old_config->O, config->O)) return #O
+
+//----------------------------------------------------------------------------
+// the name of an option that differs between the configs, other than 
+// those a running instance can change: the channels' rate_limit, 
+// rate_burst, batch_max_bytes and conflate_window (so long as batching
+// and conflation stay on or off), batch_max_latency, heartbeat_interval,
+// database_retry_interval and epoll_timeout
+// return NULL if there is none
+const char *
+fixed_option_changed(const struct Config * old_config, 
+                     const struct Config * config) {
+//----------------------------------------------------------------------------
+   const struct EndpointConfig * old_endpoint;
+   const struct EndpointConfig * endpoint;
+   const struct ChannelConfig * old_channel;
+   const struct ChannelConfig * channel;
+   int i;
+
+   FIXED_INT(zmq_thread_pool_size);
+   FIXED_STRING(pub_socket_uri);
+   FIXED_INT(pub_socket_hwm);
+   FIXED_INT(pub_socket_nodrop);
+   FIXED_INT(shutdown_linger);
+
+   if (name_lists_differ(old_config->endpoint_list, config->endpoint_list)) {
+      return "pub_endpoints";
+   }
+   for (i=0; i < config->endpoint_list->qty; i++) {
+      old_endpoint = &old_config->endpoint_config[i];
+      endpoint = &config->endpoint_config[i];
+      if (strings_differ(old_endpoint->uri, endpoint->uri) ||
+          old_endpoint->hwm != endpoint->hwm ||
+          old_endpoint->sndbuf != endpoint->sndbuf ||
+          old_endpoint->tcp_keepalive != endpoint->tcp_keepalive ||
+          old_endpoint->tcp_keepalive_idle != endpoint->tcp_keepalive_idle ||
+          old_endpoint->tcp_keepalive_cnt != endpoint->tcp_keepalive_cnt ||
+          old_endpoint->tcp_keepalive_intvl != 
+             endpoint->tcp_keepalive_intvl ||
+          old_endpoint->dedicated_socket != endpoint->dedicated_socket ||
+          strings_differ(old_endpoint->priority_class, 
+                         endpoint->priority_class)) {
+         return endpoint->name;
+      }
+   }
+
+   FIXED_STRING(relay_upstream);
+   FIXED_INT(relay_hwm);
+   FIXED_STRING(gateway_uri);
+   FIXED_INT(gateway_batch_size);
+   FIXED_INT(gateway_hwm);
+   FIXED_STRING(pg_proxy_address);
+   FIXED_INT(pg_proxy_port);
+   FIXED_INT(pg_proxy_max_clients);
+   FIXED_INT(pg_proxy_max_output);
+   FIXED_STRING(sse_address);
+   FIXED_INT(sse_port);
+   FIXED_INT(sse_max_clients);
+   FIXED_INT(sse_max_output);
+   FIXED_STRING(sse_allow_origin);
+   FIXED_STRING(resp_address);
+   FIXED_INT(resp_port);
+   FIXED_INT(resp_max_clients);
+   FIXED_INT(resp_max_output);
+   FIXED_STRING(metrics_address);
+   FIXED_INT(metrics_port);
+   FIXED_STRING(shm_ring_name);
+   FIXED_INT(shm_ring_size);
+   FIXED_STRING(handoff_path);
+   FIXED_INT(leader_lock_key);
+   FIXED_INT(leader_retry_interval);
+   if (name_lists_differ(old_config->priority_class_list, 
+                         config->priority_class_list)) {
+      return "priority_classes";
+   }
+   FIXED_INT(epoll_batch_size);
+   FIXED_INT(reactor_backend);
+   FIXED_INT(timer_slack);
+   FIXED_INT(latency_cpu);
+   FIXED_INT(zmq_io_cpu_qty);
+   for (i=0; i < config->zmq_io_cpu_qty; i++) {
+      FIXED_INT(zmq_io_cpus[i]);
+   }
+   FIXED_INT(busy_poll);
+   FIXED_INT(lock_memory);
+
+   for (i=0; ; i++) {
+      if (strings_differ(old_config->postgresql_keywords[i], 
+                         config->postgresql_keywords[i])) {
+         return "postgresql-*";
+      }
+      if (config->postgresql_keywords[i] == NULL) break;
+      if (strings_differ(old_config->postgresql_values[i], 
+                         config->postgresql_values[i])) {
+         return config->postgresql_keywords[i];
+      }
+   }
+
+   if (name_lists_differ(old_config->channel_list, config->channel_list)) {
+      return "channels";
+   }
+   for (i=0; i < config->channel_list->qty; i++) {
+      old_channel = &old_config->channel_config[i];
+      channel = &config->channel_config[i];
+      if (strings_differ(old_channel->outbox_table, channel->outbox_table) ||
+          strings_differ(old_channel->outbox_id_column, 
+                         channel->outbox_id_column) ||
+          strings_differ(old_channel->outbox_payload_column, 
+                         channel->outbox_payload_column) ||
+          old_channel->compression != channel->compression ||
+          old_channel->compress_threshold != channel->compress_threshold ||
+          old_channel->compress_level != channel->compress_level ||
+          strings_differ(old_channel->zstd_dictionary, 
+                         channel->zstd_dictionary) ||
+          (old_channel->batch_max_bytes > 0) != 
+             (channel->batch_max_bytes > 0) ||
+          (old_channel->conflate_window > 0) != 
+             (channel->conflate_window > 0) ||
+          old_channel->conflate_key_delimiter != 
+             channel->conflate_key_delimiter ||
+          strings_differ(old_channel->priority_class, 
+                         channel->priority_class) ||
+          strings_differ(old_channel->producer_timestamp, 
+                         channel->producer_timestamp)) {
+         return (const char *) config->channel_list->entry[i]->data;
+      }
+   }
+
+   FIXED_INT(outbox_batch_size);
+   FIXED_INT(outbox_poll_interval);
+   FIXED_STRING(outbox_checkpoint_dir);
 
    return NULL;
 }
 
+#undef FIXED_INT
+#undef FIXED_STRING
+
 //----------------------------------------------------------------------------
 // release resources used by config
 // we do this mostly to make it easier to read valgrind output
@@ -210,9 +1068,44 @@ clear_config(const struct Config * config) {
    int i;
 
    bcstrfree((char *) config->pub_socket_uri); 
+   bcstrfree((char *) config->shm_ring_name); 
+   bcstrfree((char *) config->handoff_path); 
+   bcstrfree((char *) config->relay_upstream); 
+   bcstrfree((char *) config->gateway_uri); 
+   bcstrfree((char *) config->pg_proxy_address); 
+   bcstrfree((char *) config->sse_address); 
+   bcstrfree((char *) config->sse_allow_origin); 
+   bcstrfree((char *) config->resp_address); 
+   bcstrfree((char *) config->metrics_address); 
+   if (config->endpoint_config != NULL) {
+      for (i=0; i < config->endpoint_list->qty; i++) {
+         bcstrfree((char *) config->endpoint_config[i].uri);
+         bcstrfree((char *) config->endpoint_config[i].priority_class);
+      }
+      free(config->endpoint_config);
+   }
+   if (config->endpoint_list != NULL) {
+      bstrListDestroy(config->endpoint_list);
+   }
+   free(config->zmq_io_cpus);
+   if (config->priority_class_list != NULL) {
+      bstrListDestroy(config->priority_class_list);
+   }
+   if (config->channel_config != NULL) {
+      for (i=0; i < config->channel_list->qty; i++) {
+         bcstrfree((char *) config->channel_config[i].outbox_table);
+         bcstrfree((char *) config->channel_config[i].outbox_id_column);
+         bcstrfree((char *) config->channel_config[i].outbox_payload_column);
+         bcstrfree((char *) config->channel_config[i].zstd_dictionary);
+         bcstrfree((char *) config->channel_config[i].priority_class);
+         bcstrfree((char *) config->channel_config[i].producer_timestamp);
+      }
+      free(config->channel_config);
+   }
    if (config->channel_list != NULL) {
       bstrListDestroy(config->channel_list);
    }
+   bcstrfree((char *) config->outbox_checkpoint_dir);
    for (i=0; ;i++) {
       if (config->postgresql_keywords[i] == NULL) break;
       bcstrfree((char *) config->postgresql_keywords[i]);
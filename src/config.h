@@ -13,24 +13,226 @@
 
 static const size_t MAX_POSTGRESQL_OPTIONS = 20;
 
+enum COMPRESSION_TYPE {
+   COMPRESSION_NONE,
+   COMPRESSION_LZ4,
+   COMPRESSION_ZSTD
+};
+
+enum REACTOR_BACKEND {
+   REACTOR_EPOLL,
+   REACTOR_IO_URING
+};
+
+// per channel options from 'channel-<channel>-<option>' lines
+struct ChannelConfig {
+   // if set, tail this table instead of publishing the NOTIFY payload
+   const char * outbox_table;
+   const char * outbox_id_column;
+   const char * outbox_payload_column;
+
+   // compress the data frame when it is at least compress_threshold bytes
+   enum COMPRESSION_TYPE compression;
+   int compress_threshold;
+   int compress_level;
+   // optional dictionary trained with 'zstd --train' on sample payloads
+   const char * zstd_dictionary;
+
+   // if > 0, pack notifications into one batch frame of up to this size
+   int batch_max_bytes;
+
+   // if > 0, hold the latest notification per key for this many
+   // milliseconds and publish only that one
+   int conflate_window;
+   // the key is the payload up to the first delimiter
+   char conflate_key_delimiter;
+
+   // if > 0, publish at most rate_limit notifications per second,
+   // with bursts of up to rate_burst (default rate_limit)
+   int rate_limit;
+   int rate_burst;
+
+   // a name from config.priority_class_list, and its position there
+   const char * priority_class;
+   int priority_class_index;
+
+   // if set, payloads carry the time they were sent: this field name, 
+   // then '=' or ':', then microseconds since the epoch
+   const char * producer_timestamp;
+};
+
+// a PUB endpoint from 'pub_endpoints' and 'pub_endpoint-<name>-<option>'
+struct EndpointConfig {
+   // points into config.endpoint_list
+   const char * name;
+   const char * uri;
+
+   // socket options, applied before binding this endpoint
+   // -1 means the OS default
+   int hwm;
+   int sndbuf;
+   int tcp_keepalive;
+   int tcp_keepalive_idle;
+   int tcp_keepalive_cnt;
+   int tcp_keepalive_intvl;
+
+   // bind on its own socket, served by its own zeromq io thread
+   int dedicated_socket;
+
+   // a name from config.priority_class_list, and its position there
+   const char * priority_class;
+   int priority_class_index;
+};
+
 struct Config {
    int zmq_thread_pool_size;
    const char *  pub_socket_uri;
    int pub_socket_hwm;
+   // return EAGAIN at the HWM instead of silently dropping, so we can
+   // count drops per channel
+   int pub_socket_nodrop;
+   // the most milliseconds closing a PUB socket waits to send what is 
+   // queued (ZMQ_LINGER), -1 for as long as it takes
+   int shutdown_linger;
+
+   struct bstrList * endpoint_list;
+   // parallel array to endpoint_list
+   struct EndpointConfig * endpoint_config;
+
+   // relay mode, if set: instead of LISTENing to postgres, subscribe to 
+   // the channels on this upstream skeeter and publish what it publishes
+   const char * relay_upstream;
+   // receive high water mark for the upstream, -1 for the zeromq default
+   int relay_hwm;
+
+   // the reverse gateway, if set: bind a PULL socket here and NOTIFY 
+   // for the (channel, payload) messages pushed to it
+   const char * gateway_uri;
+   // the most rows NOTIFYed by one query
+   int gateway_batch_size;
+   // receive high water mark for the PULL socket, -1 for the zeromq default
+   int gateway_hwm;
 
+   // the Postgres protocol front end for LISTEN clients, if the port is 
+   // not 0
+   const char * pg_proxy_address;
+   int pg_proxy_port;
+   int pg_proxy_max_clients;
+   // bytes a client can fall behind before we disconnect it
+   int pg_proxy_max_output;
+
+   // the server-sent events endpoint for browsers, if the port is not 0
+   const char * sse_address;
+   int sse_port;
+   int sse_max_clients;
+   // bytes a client can fall behind before we evict it
+   int sse_max_output;
+   // the Access-Control-Allow-Origin header, if set
+   const char * sse_allow_origin;
+
+   // the Redis pub/sub front end, if the port is not 0
+   const char * resp_address;
+   int resp_port;
+   int resp_max_clients;
+   // bytes a client can fall behind before we evict it
+   int resp_max_output;
+
+   // Prometheus metrics on GET /metrics, if the port is not 0
+   const char * metrics_address;
+   int metrics_port;
+
+   // publish into a shared memory ring too, if set
+   const char * shm_ring_name;
+   int shm_ring_size;
+
+   // the unix socket for zero downtime upgrades, if set: a new skeeter 
+   // takes over from the one listening here
+   const char * handoff_path;
+
+   // active/standby pairs: with a key other than 0, we publish only while
+   // we hold this advisory lock, and the standby tries for it every 
+   // leader_retry_interval seconds
+   long long leader_lock_key;
+   int leader_retry_interval;
+
+   // highest priority first. Each class publishes on its own sockets,
+   // and its notifications are published before those of lower classes
+   struct bstrList * priority_class_list;
+
+   // the longest (in seconds) we wait for events, -1 (or 0) to wait until
+   // something is ready or the next timer is due
    int epoll_timeout;
+   // the most events handled per epoll wakeup
+   int epoll_batch_size;
+   enum REACTOR_BACKEND reactor_backend;
+   // microseconds our timers may fire late so their wakeups coalesce: 0
+   // for the least the kernel allows, -1 to leave the kernel's default
+   int timer_slack;
+
+   // latency mode: the cpu the main thread is pinned to (-1 for none),
+   // the cpus for the zeromq io threads (none for any but that one), the
+   // microseconds we spin on the database socket before we sleep in 
+   // epoll (0 for none), and mlockall
+   int latency_cpu;
+   int * zmq_io_cpus;
+   int zmq_io_cpu_qty;
+   int busy_poll;
+   int lock_memory;
    time_t heartbeat_interval;
 
    time_t database_retry_interval;
    const char ** postgresql_keywords;
    const char ** postgresql_values;
    struct bstrList * channel_list;
+
+   // parallel array to channel_list
+   struct ChannelConfig * channel_config;
+
+   int outbox_batch_size;
+   time_t outbox_poll_interval;
+   const char * outbox_checkpoint_dir;
+
+   // max time (in milliseconds) a notification waits in a batch
+   int batch_max_latency;
 };
 
 // load config from skeeterrc
 extern const struct Config *
 load_config(bstring config_path);
 
+// set one option on an item of a per name config array
+// return 0 for success, -1 for an unknown option
+typedef int (* option_setter)(void * item, bstring option, bstring value);
+
+// find the position of name in name_list, -1 if it is not there
+extern int
+find_name_index(const struct bstrList * name_list, const bstring name);
+
+// find the position of the channel name in config->channel_list
+// return -1 if the channel is not found
+extern int
+find_channel_index(const struct Config * config, const bstring channel);
+
+// return the number of channels that batch notifications
+extern int
+batch_channel_count(const struct Config * config);
+
+// return the number of channels that conflate notifications
+extern int
+conflate_channel_count(const struct Config * config);
+
+// return the number of channels that tail an outbox table
+extern int
+outbox_channel_count(const struct Config * config);
+
+// the name of an option (or of the channel or endpoint with the option) 
+// that differs between the configs, other than those a running instance
+// can change (see skeeter_reconfigure)
+// return NULL if there is none
+extern const char *
+fixed_option_changed(const struct Config * old_config, 
+                     const struct Config * config);
+
 // release resources used by config
 extern void
 clear_config(const struct Config * config);
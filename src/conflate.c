@@ -0,0 +1,171 @@
+/*----------------------------------------------------------------------------
+ * conflate.c
+ * 
+ * hold the latest notification per key for 'latest value wins' channels
+ *--------------------------------------------------------------------------*/
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "bstrlib.h"
+#include "conflate.h"
+#include "dbg_syslog.h"
+
+//----------------------------------------------------------------------------
+// FNV-1a
+static uint32_t
+hash_key(const_bstring key) {
+//----------------------------------------------------------------------------
+   uint32_t hash = 2166136261u;
+   int i;
+
+   for (i=0; i < blength(key); i++) {
+      hash ^= key->data[i];
+      hash *= 16777619u;
+   }
+
+   return hash;
+}
+
+//----------------------------------------------------------------------------
+// return 0 for success, -1 for failure
+int
+initialize_conflate_table(struct ConflateTable * table, int bucket_count) {
+//----------------------------------------------------------------------------
+   table->buckets = calloc(bucket_count, sizeof(struct ConflateEntry *));
+   check_mem(table->buckets);
+   table->bucket_count = bucket_count;
+   table->first_pending = NULL;
+   table->last_pending = NULL;
+   table->count = 0;
+
+   return 0;
+error:
+   return -1;
+}
+
+//----------------------------------------------------------------------------
+// release resources used by the table, including pending entries
+void
+clear_conflate_table(struct ConflateTable * table) {
+//----------------------------------------------------------------------------
+   struct ConflateEntry * entry;
+
+   if (table->buckets == NULL) {
+      return;
+   }
+   while ((entry = conflate_take(table)) != NULL) {
+      free_conflate_entry(entry);
+   }
+   free(table->buckets);
+   table->buckets = NULL;
+}
+
+//----------------------------------------------------------------------------
+// extract the conflation key from the payload: everything up to the
+// first delimiter, or the whole payload if there is no delimiter
+// the caller must bdestroy the result
+// return NULL on failure
+bstring
+conflate_key(const char * data, char delimiter) {
+//----------------------------------------------------------------------------
+   const char * end;
+
+   if (data == NULL) {
+      return bfromcstr("");
+   }
+   end = strchr(data, delimiter);
+   if (end == NULL) {
+      return bfromcstr(data);
+   }
+   return blk2bstr(data, (int) (end - data));
+}
+
+//----------------------------------------------------------------------------
+// make data the pending value for key, replacing any pending value
+// a replaced value keeps the entry's received_us
+// the table takes ownership of key and data
+// return 0 for success, -1 for failure
+int
+conflate_add(struct ConflateTable * table, 
+             bstring key, 
+             bstring data,
+             uint64_t received_us) {
+//----------------------------------------------------------------------------
+   uint32_t bucket = hash_key(key) % table->bucket_count;
+   struct ConflateEntry * entry;
+
+   for (entry = table->buckets[bucket]; entry != NULL; entry = entry->next) {
+      if (bstrcmp(entry->key, key) == 0) {
+         bdestroy(entry->data);
+         entry->data = data;
+         entry->superseded++;
+         bdestroy(key);
+         return 0;
+      }
+   }
+
+   entry = malloc(sizeof(struct ConflateEntry));
+   check_mem(entry);
+   entry->key = key;
+   entry->data = data;
+   entry->superseded = 0;
+   entry->received_us = received_us;
+
+   entry->next = table->buckets[bucket];
+   table->buckets[bucket] = entry;
+
+   entry->next_pending = NULL;
+   if (table->last_pending == NULL) {
+      table->first_pending = entry;
+   } else {
+      table->last_pending->next_pending = entry;
+   }
+   table->last_pending = entry;
+   table->count++;
+
+   return 0;
+error:
+   bdestroy(key);
+   bdestroy(data);
+   return -1;
+}
+
+//----------------------------------------------------------------------------
+// remove and return the oldest pending entry, NULL if there are none
+// the caller must free it with free_conflate_entry
+struct ConflateEntry *
+conflate_take(struct ConflateTable * table) {
+//----------------------------------------------------------------------------
+   struct ConflateEntry * entry = table->first_pending;
+   struct ConflateEntry ** link;
+   uint32_t bucket;
+
+   if (entry == NULL) {
+      return NULL;
+   }
+
+   table->first_pending = entry->next_pending;
+   if (table->first_pending == NULL) {
+      table->last_pending = NULL;
+   }
+   table->count--;
+
+   // unlink it from the hash chain
+   bucket = hash_key(entry->key) % table->bucket_count;
+   for (link = &table->buckets[bucket]; *link != entry; link = &(*link)->next)
+      ;
+   *link = entry->next;
+
+   return entry;
+}
+
+//----------------------------------------------------------------------------
+// release an entry returned by conflate_take
+void
+free_conflate_entry(struct ConflateEntry * entry) {
+//----------------------------------------------------------------------------
+   bdestroy(entry->key);
+   bdestroy(entry->data);
+   free(entry);
+}
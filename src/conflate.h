@@ -0,0 +1,74 @@
+/*----------------------------------------------------------------------------
+ * conflate.h
+ * 
+ * hold the latest notification per key for 'latest value wins' channels
+ *--------------------------------------------------------------------------*/
+#if !defined(__CONFLATE_H__)
+#define __CONFLATE_H__
+
+#include <stdint.h>
+
+#include "bstrlib.h"
+
+struct ConflateEntry {
+   bstring key;
+   bstring data;
+
+   // the number of notifications this one replaced
+   int superseded;
+
+   // when we read the first of them (CLOCK_MONOTONIC us): the key's 
+   // update has been waiting since then
+   uint64_t received_us;
+
+   // hash chain
+   struct ConflateEntry * next;
+
+   // first arrival order, so we publish keys in the order they showed up
+   struct ConflateEntry * next_pending;
+};
+
+struct ConflateTable {
+   struct ConflateEntry ** buckets;
+   int bucket_count;
+
+   struct ConflateEntry * first_pending;
+   struct ConflateEntry * last_pending;
+   int count;
+};
+
+// return 0 for success, -1 for failure
+extern int
+initialize_conflate_table(struct ConflateTable * table, int bucket_count);
+
+// release resources used by the table, including pending entries
+extern void
+clear_conflate_table(struct ConflateTable * table);
+
+// extract the conflation key from the payload: everything up to the
+// first delimiter, or the whole payload if there is no delimiter
+// the caller must bdestroy the result
+// return NULL on failure
+extern bstring
+conflate_key(const char * data, char delimiter);
+
+// make data the pending value for key, replacing any pending value
+// a replaced value keeps the entry's received_us
+// the table takes ownership of key and data
+// return 0 for success, -1 for failure
+extern int
+conflate_add(struct ConflateTable * table, 
+             bstring key, 
+             bstring data,
+             uint64_t received_us);
+
+// remove and return the oldest pending entry, NULL if there are none
+// the caller must free it with free_conflate_entry
+extern struct ConflateEntry *
+conflate_take(struct ConflateTable * table);
+
+// release an entry returned by conflate_take
+extern void
+free_conflate_entry(struct ConflateEntry * entry);
+
+#endif // !defined(__CONFLATE_H__)
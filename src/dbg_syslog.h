@@ -28,7 +28,7 @@
                               clean_errno(), \
                               ##__VA_ARGS__)
 
-#define log_warn(M, ...) syslog(LOG_WARNING \
+#define log_warn(M, ...) syslog(LOG_WARNING, \
                                  "[WARN] %s:%d: errno: %s " M "\n", \
                                  __FILE__, \
                                  __LINE__, \
@@ -0,0 +1,376 @@
+/*----------------------------------------------------------------------------
+ * gateway.c
+ * 
+ * the reverse gateway: writers PUSH (channel, payload) messages to us and
+ * we NOTIFY for them, many rows per query, on a connection of our own
+ *
+ * A message is two or three frames: channel, payload and, optionally, a
+ * client id. Each query NOTIFYs for every row waiting when the previous
+ * one finished, so the busier the writers, the bigger the batches.
+ * Delivery is at most once: if a query fails, its rows are counted as 
+ * failed, not retried.
+ *--------------------------------------------------------------------------*/
+#include <errno.h>
+#include <stdbool.h>
+#include <stdlib.h>
+
+#include <zmq.h>
+
+#include "bstrlib.h"
+#include "config.h"
+#include "dbg_syslog.h"
+#include "gateway.h"
+#include "zmq_shim.h"
+
+// $1 is the channels, $2 the payloads
+static const char * GATEWAY_QUERY = \
+   "SELECT count(pg_notify(c, p)) FROM unnest($1::text[], $2::text[]) "
+   "AS t(c, p)";
+
+// the most frames in a gateway message: channel, payload, client
+static const int GATEWAY_MAX_FRAMES = 3;
+
+//----------------------------------------------------------------------------
+// bind the PULL socket
+// return 0 for success, -1 for failure
+int
+start_gateway(struct Gateway * gateway, 
+              const struct Config * config,
+              void * zmq_context) {
+//----------------------------------------------------------------------------
+   size_t fd_size = sizeof gateway->fd;
+   int result;
+
+   gateway->channels = bstrListCreate();
+   check(gateway->channels != NULL, "bstrListCreate");
+   gateway->payloads = bstrListCreate();
+   check(gateway->payloads != NULL, "bstrListCreate");
+   gateway->clients = bstrListCreate();
+   check(gateway->clients != NULL, "bstrListCreate");
+
+   gateway->zmq_socket = zmq_socket(zmq_context, ZMQ_PULL);
+   check(gateway->zmq_socket != NULL, "zmq_socket");
+
+   if (config->gateway_hwm != -1) {
+      result = zmq_setsockopt(gateway->zmq_socket,
+                              ZMQ_RCVHWM,
+                              &config->gateway_hwm,
+                              sizeof config->gateway_hwm);
+      check(result == 0, "zmq_setsockopt ZMQ_RCVHWM");
+   }
+
+   result = zmq_getsockopt(gateway->zmq_socket,
+                           ZMQ_FD,
+                           &gateway->fd,
+                           &fd_size);
+   check(result == 0, "zmq_getsockopt ZMQ_FD");
+
+   log_info("binding gateway to '%s'", config->gateway_uri);
+   result = zmq_bind(gateway->zmq_socket, config->gateway_uri);
+   check(result == 0, "bind %s", config->gateway_uri);
+
+   return 0;
+
+error:
+   return -1;
+}
+
+//----------------------------------------------------------------------------
+// close the socket and the connection, and release the rows
+void
+clear_gateway(struct Gateway * gateway) {
+//----------------------------------------------------------------------------
+   if (gateway->zmq_socket != NULL) {
+      zmq_close(gateway->zmq_socket);
+      gateway->zmq_socket = NULL;
+   }
+   if (gateway->connection != NULL) {
+      PQfinish(gateway->connection);
+      gateway->connection = NULL;
+   }
+   if (gateway->channels != NULL) bstrListDestroy(gateway->channels);
+   if (gateway->payloads != NULL) bstrListDestroy(gateway->payloads);
+   if (gateway->clients != NULL) bstrListDestroy(gateway->clients);
+   if (gateway->sent_clients != NULL) bstrListDestroy(gateway->sent_clients);
+   gateway->channels = NULL;
+   gateway->payloads = NULL;
+   gateway->clients = NULL;
+   gateway->sent_clients = NULL;
+}
+
+//----------------------------------------------------------------------------
+// append a string to a list
+// return 0 for success, -1 for failure
+static int
+list_append(struct bstrList * list, bstring entry) {
+//----------------------------------------------------------------------------
+   check(bstrListAlloc(list, list->qty+1) == BSTR_OK, "bstrListAlloc");
+   list->entry[list->qty++] = entry;
+   return 0;
+
+error:
+   bdestroy(entry);
+   return -1;
+}
+
+//----------------------------------------------------------------------------
+// move the first qty entries of a list to a new list
+// return NULL on failure
+static struct bstrList *
+list_take(struct bstrList * list, int qty) {
+//----------------------------------------------------------------------------
+   struct bstrList * taken = bstrListCreate();
+   int i;
+
+   check(taken != NULL, "bstrListCreate");
+   check(bstrListAlloc(taken, qty > 0 ? qty : 1) == BSTR_OK, "bstrListAlloc");
+   for (i=0; i < qty; i++) {
+      taken->entry[i] = list->entry[i];
+   }
+   taken->qty = qty;
+   for (i=qty; i < list->qty; i++) {
+      list->entry[i-qty] = list->entry[i];
+   }
+   list->qty -= qty;
+
+   return taken;
+
+error:
+   return NULL;
+}
+
+//----------------------------------------------------------------------------
+// read messages from the PULL socket into the waiting rows, until there
+// are none left or we have max_rows waiting (the writers then block at 
+// the HWM until we catch up)
+// return 0 for success, -1 for failure
+int
+receive_gateway_rows(struct Gateway * gateway, int max_rows) {
+//----------------------------------------------------------------------------
+   zmq_msg_t frame;
+   bool frame_open = false;
+   bstring frames[GATEWAY_MAX_FRAMES + 1];
+   int frame_qty = 0;
+   int more;
+   size_t more_size;
+   int result;
+   int i;
+
+   while (gateway->channels->qty < max_rows) {
+      frame_qty = 0;
+      do {
+         check(zmq_msg_init(&frame) == 0, "zmq_msg_init");
+         frame_open = true;
+         result = zmq_msg_recv(&frame, 
+                               gateway->zmq_socket, 
+                               frame_qty == 0 ? ZMQ_DONTWAIT : 0);
+         if (result == -1 && errno == EAGAIN) {
+            zmq_msg_close(&frame);
+            frame_open = false;
+            errno = 0;
+            return 0;
+         }
+         check(result != -1, "zmq_msg_recv");
+         // keep one frame too many, so we know to discard the message
+         if (frame_qty <= GATEWAY_MAX_FRAMES) {
+            frames[frame_qty] = blk2bstr(zmq_msg_data(&frame), 
+                                         zmq_msg_size(&frame));
+            check(frames[frame_qty] != NULL, "blk2bstr");
+            frame_qty++;
+         }
+         zmq_msg_close(&frame);
+         frame_open = false;
+         more_size = sizeof more;
+         check(zmq_getsockopt(gateway->zmq_socket, 
+                              ZMQ_RCVMORE, 
+                              &more, 
+                              &more_size) == 0,
+               "ZMQ_RCVMORE");
+      } while (more);
+      gateway->received++;
+
+      // postgres text can't hold a NUL
+      if (frame_qty < 2 || frame_qty > GATEWAY_MAX_FRAMES ||
+          bstrchr(frames[0], '\0') != BSTR_ERR ||
+          bstrchr(frames[1], '\0') != BSTR_ERR) {
+         gateway->discarded++;
+         for (i=0; i < frame_qty; i++) {
+            bdestroy(frames[i]);
+         }
+         continue;
+      }
+      if (frame_qty == 2) {
+         frames[2] = bfromcstr("");
+         check(frames[2] != NULL, "bfromcstr");
+         frame_qty = 3;
+      }
+      // make room in all three lists before we give them the frames, so 
+      // they stay the same length and the frames are ours until then
+      check(bstrListAlloc(gateway->channels, 
+                          gateway->channels->qty + 1) == BSTR_OK,
+            "bstrListAlloc");
+      check(bstrListAlloc(gateway->payloads, 
+                          gateway->payloads->qty + 1) == BSTR_OK,
+            "bstrListAlloc");
+      check(bstrListAlloc(gateway->clients, 
+                          gateway->clients->qty + 1) == BSTR_OK,
+            "bstrListAlloc");
+      gateway->channels->entry[gateway->channels->qty++] = frames[0];
+      gateway->payloads->entry[gateway->payloads->qty++] = frames[1];
+      gateway->clients->entry[gateway->clients->qty++] = frames[2];
+      frame_qty = 0;
+   }
+
+   return 0;
+
+error:
+   if (frame_open) zmq_msg_close(&frame);
+   for (i=0; i < frame_qty; i++) {
+      bdestroy(frames[i]);
+   }
+   return -1;
+}
+
+//----------------------------------------------------------------------------
+// a postgres array literal of the first qty entries: {"a","b\"c"}
+// return NULL on failure
+static bstring
+text_array(const struct bstrList * list, int qty) {
+//----------------------------------------------------------------------------
+   bstring array = bfromcstr("{");
+   int i;
+   int j;
+   unsigned char c;
+
+   check(array != NULL, "bfromcstr");
+   for (i=0; i < qty; i++) {
+      if (i > 0) check(bconchar(array, ',') == BSTR_OK, "bconchar");
+      check(bconchar(array, '"') == BSTR_OK, "bconchar");
+      for (j=0; j < blength(list->entry[i]); j++) {
+         c = list->entry[i]->data[j];
+         if (c == '"' || c == '\\') {
+            check(bconchar(array, '\\') == BSTR_OK, "bconchar");
+         }
+         check(bconchar(array, c) == BSTR_OK, "bconchar");
+      }
+      check(bconchar(array, '"') == BSTR_OK, "bconchar");
+   }
+   check(bconchar(array, '}') == BSTR_OK, "bconchar");
+
+   return array;
+
+error:
+   bdestroy(array);
+   return NULL;
+}
+
+//----------------------------------------------------------------------------
+// send the query for up to batch_size waiting rows
+// return 0 for success, -1 for failure
+int
+send_gateway_batch(struct Gateway * gateway, int batch_size) {
+//----------------------------------------------------------------------------
+   int qty = gateway->channels->qty;
+   struct bstrList * channels = NULL;
+   struct bstrList * payloads = NULL;
+   bstring channel_array = NULL;
+   bstring payload_array = NULL;
+   const char * param_values[2];
+
+   if (qty > batch_size) qty = batch_size;
+
+   channel_array = text_array(gateway->channels, qty);
+   check(channel_array != NULL, "text_array");
+   payload_array = text_array(gateway->payloads, qty);
+   check(payload_array != NULL, "text_array");
+
+   param_values[0] = (const char *) channel_array->data;
+   param_values[1] = (const char *) payload_array->data;
+   check(PQsendQueryParams(gateway->connection,
+                           GATEWAY_QUERY,
+                           2,
+                           NULL,
+                           param_values,
+                           NULL,
+                           NULL,
+                           0) == 1,
+         "PQsendQueryParams %s", PQerrorMessage(gateway->connection));
+   debug("gateway batch of %d", qty);
+
+   channels = list_take(gateway->channels, qty);
+   check(channels != NULL, "list_take");
+   payloads = list_take(gateway->payloads, qty);
+   check(payloads != NULL, "list_take");
+   gateway->sent_clients = list_take(gateway->clients, qty);
+   check(gateway->sent_clients != NULL, "list_take");
+
+   bstrListDestroy(channels);
+   bstrListDestroy(payloads);
+   bdestroy(channel_array);
+   bdestroy(payload_array);
+   return 0;
+
+error:
+   if (channels != NULL) bstrListDestroy(channels);
+   if (payloads != NULL) bstrListDestroy(payloads);
+   bdestroy(channel_array);
+   bdestroy(payload_array);
+   return -1;
+}
+
+//----------------------------------------------------------------------------
+// the query in flight is done: count the rows as notified or failed
+// client_list and client_counts get one entry per client to acknowledge
+// (the caller destroys client_list and frees client_counts)
+// return 0 for success, -1 for failure
+int
+finish_gateway_batch(struct Gateway * gateway, 
+                     bool succeeded,
+                     struct bstrList ** client_list,
+                     int ** client_counts) {
+//----------------------------------------------------------------------------
+   struct bstrList * sent_clients = gateway->sent_clients;
+   bstring client;
+   int index;
+   int i;
+
+   *client_list = NULL;
+   *client_counts = NULL;
+   if (sent_clients == NULL) {
+      return 0;
+   }
+   gateway->sent_clients = NULL;
+
+   if (succeeded) {
+      gateway->notified += sent_clients->qty;
+   } else {
+      gateway->failed += sent_clients->qty;
+   }
+
+   *client_list = bstrListCreate();
+   check(*client_list != NULL, "bstrListCreate");
+   *client_counts = calloc(sent_clients->qty, sizeof(int));
+   check_mem(*client_counts);
+
+   // a batch usually has a handful of writers, so a linear search will do
+   for (i=0; i < sent_clients->qty; i++) {
+      client = sent_clients->entry[i];
+      if (blength(client) == 0) {
+         continue;
+      }
+      index = find_name_index(*client_list, client);
+      if (index == -1) {
+         check(list_append(*client_list, bstrcpy(client)) == 0, 
+               "list_append");
+         index = (*client_list)->qty - 1;
+      }
+      (*client_counts)[index]++;
+   }
+
+   bstrListDestroy(sent_clients);
+   return 0;
+
+error:
+   bstrListDestroy(sent_clients);
+   return -1;
+}
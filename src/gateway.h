@@ -0,0 +1,79 @@
+/*----------------------------------------------------------------------------
+ * gateway.h
+ * 
+ * the reverse gateway: writers PUSH (channel, payload) messages to us and
+ * we NOTIFY for them, many rows per query, on a connection of our own
+ *--------------------------------------------------------------------------*/
+#if !defined(__GATEWAY_H__)
+#define __GATEWAY_H__
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <time.h>
+
+#include <libpq-fe.h>
+
+#include "bstrlib.h"
+#include "config.h"
+
+struct Gateway {
+   // a PULL socket bound to config.gateway_uri, NULL without a gateway
+   void * zmq_socket;
+   // ZMQ_FD of zmq_socket, for epoll
+   int fd;
+
+   PGconn * connection;
+   bool connected;
+   // when the last connection attempt failed, for the retry interval
+   time_t failed_time;
+
+   // rows waiting for the next query: parallel lists, client is "" for 
+   // writers that don't want an acknowledgement
+   struct bstrList * channels;
+   struct bstrList * payloads;
+   struct bstrList * clients;
+
+   // the clients of the rows in the query in flight, NULL when idle
+   struct bstrList * sent_clients;
+
+   uint64_t received;
+   uint64_t notified;
+   uint64_t failed;
+   // malformed messages
+   uint64_t discarded;
+};
+
+// bind the PULL socket
+// return 0 for success, -1 for failure
+extern int
+start_gateway(struct Gateway * gateway, 
+              const struct Config * config,
+              void * zmq_context);
+
+// close the socket and the connection, and release the rows
+extern void
+clear_gateway(struct Gateway * gateway);
+
+// read messages from the PULL socket into the waiting rows, until there
+// are none left or we have max_rows waiting (the writers then block at 
+// the HWM until we catch up)
+// return 0 for success, -1 for failure
+extern int
+receive_gateway_rows(struct Gateway * gateway, int max_rows);
+
+// send the query for up to batch_size waiting rows
+// return 0 for success, -1 for failure
+extern int
+send_gateway_batch(struct Gateway * gateway, int batch_size);
+
+// the query in flight is done: count the rows as notified or failed
+// client_list and client_counts get one entry per client to acknowledge
+// (the caller destroys client_list and frees client_counts)
+// return 0 for success, -1 for failure
+extern int
+finish_gateway_batch(struct Gateway * gateway, 
+                     bool succeeded,
+                     struct bstrList ** client_list,
+                     int ** client_counts);
+
+#endif // !defined(__GATEWAY_H__)
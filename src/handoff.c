@@ -0,0 +1,615 @@
+/*----------------------------------------------------------------------------
+ * handoff.c
+ *
+ * zero downtime upgrades: a new skeeter takes the listening sockets of
+ * the PUB endpoints and the sequence numbers from the running one, over
+ * a unix socket at config.handoff_path
+ *
+ * The new process connects and says hello with its marker; the old one
+ * answers with the endpoint URIs and their listening fds (SCM_RIGHTS),
+ * which the new one binds with ZMQ_USE_FD, so the endpoints are never
+ * closed, and shm://<name> with the shared memory ring's fd, which the
+ * new one carries on writing. The new process LISTENs and NOTIFYs 
+ * HANDOFF_CHANNEL with the marker in one transaction. Both processes get every notification in
+ * the same order: the old one publishes up to the marker, then sends its
+ * sequence numbers and stops; the new one drops what comes before the
+ * marker and publishes what comes after, once it has the sequence
+ * numbers. Subscribers reconnect to the new process (zeromq owns their
+ * connections), but nothing is lost or published twice, and the sequence
+ * numbers carry on. The outboxes go the same way: the old process 
+ * queries them until it hands off, and sends its last ids with the 
+ * sequence numbers; the new one queries them only after that.
+ *
+ * The messages, one per SOCK_SEQPACKET packet:
+ *    hello\n<marker>
+ *    endpoints\n<uri>\n...          (with one fd per uri)
+ *    state\n<name>=<value>\n...
+ *--------------------------------------------------------------------------*/
+#define _GNU_SOURCE // accept4, MSG_CMSG_CLOEXEC
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/types.h>
+#include <sys/un.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <zmq.h>
+
+#include "bstrlib.h"
+#include "config.h"
+#include "dbg_syslog.h"
+#include "handoff.h"
+#include "tcp_listen.h"
+
+// the biggest message: the state has a line per channel
+static const int MAX_MESSAGE = 256 * 1024;
+// the most endpoint fds we hand on
+#define MAX_FDS 64
+
+// how long the blocking exchanges at connect time wait for the other side
+static const int EXCHANGE_TIMEOUT_SECONDS = 5;
+
+static struct tagbstring HELLO = bsStatic("hello");
+static struct tagbstring ENDPOINTS = bsStatic("endpoints");
+// the uri of the shared memory ring in the endpoints message
+static struct tagbstring SHM_RING_SCHEME = bsStatic("shm://");
+
+//----------------------------------------------------------------------------
+// send one message, with fds (fd_qty may be 0)
+// return 0 for success, -1 for failure
+static int
+send_message(int fd, const_bstring message, const int * fds, int fd_qty) {
+//----------------------------------------------------------------------------
+   struct msghdr header;
+   struct iovec iov;
+   union {
+      char buffer[CMSG_SPACE(MAX_FDS * sizeof(int))];
+      struct cmsghdr align;
+   } control;
+   struct cmsghdr * control_header;
+
+   memset(&header, 0, sizeof header);
+   iov.iov_base = message->data;
+   iov.iov_len = blength(message);
+   header.msg_iov = &iov;
+   header.msg_iovlen = 1;
+
+   if (fd_qty > 0) {
+      header.msg_control = control.buffer;
+      header.msg_controllen = CMSG_SPACE(fd_qty * sizeof(int));
+      control_header = CMSG_FIRSTHDR(&header);
+      control_header->cmsg_level = SOL_SOCKET;
+      control_header->cmsg_type = SCM_RIGHTS;
+      control_header->cmsg_len = CMSG_LEN(fd_qty * sizeof(int));
+      memcpy(CMSG_DATA(control_header), fds, fd_qty * sizeof(int));
+   }
+
+   check(sendmsg(fd, &header, MSG_NOSIGNAL) == blength(message), "sendmsg");
+
+   return 0;
+
+error:
+   return -1;
+}
+
+//----------------------------------------------------------------------------
+// receive one message, and the fds that came with it (fds may be NULL if
+// we expect none)
+// return 1 for a message, 0 if none is waiting (with flags MSG_DONTWAIT),
+// -1 if the other side has hung up (or for failure)
+static int
+receive_message(int fd,
+                int flags,
+                bstring * message,
+                int * fds,
+                int * fd_qty) {
+//----------------------------------------------------------------------------
+   struct msghdr header;
+   struct iovec iov;
+   union {
+      char buffer[CMSG_SPACE(MAX_FDS * sizeof(int))];
+      struct cmsghdr align;
+   } control;
+   struct cmsghdr * control_header;
+   char * buffer = NULL;
+   ssize_t bytes_read;
+   int qty = 0;
+
+   *message = NULL;
+   buffer = malloc(MAX_MESSAGE);
+   check_mem(buffer);
+
+   memset(&header, 0, sizeof header);
+   iov.iov_base = buffer;
+   iov.iov_len = MAX_MESSAGE;
+   header.msg_iov = &iov;
+   header.msg_iovlen = 1;
+   header.msg_control = control.buffer;
+   header.msg_controllen = sizeof control.buffer;
+
+   bytes_read = recvmsg(fd, &header, flags | MSG_CMSG_CLOEXEC);
+   if (bytes_read == -1 && errno == EAGAIN && (flags & MSG_DONTWAIT)) {
+      free(buffer);
+      return 0;
+   }
+   check(bytes_read != -1, "recvmsg");
+
+   // close what we were sent but can't use
+   for (control_header = CMSG_FIRSTHDR(&header);
+        control_header != NULL;
+        control_header = CMSG_NXTHDR(&header, control_header)) {
+      if (control_header->cmsg_level != SOL_SOCKET ||
+          control_header->cmsg_type != SCM_RIGHTS) {
+         continue;
+      }
+      qty = (control_header->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+      if (fds != NULL) {
+         memcpy(fds, CMSG_DATA(control_header), qty * sizeof(int));
+         *fd_qty = qty;
+      } else {
+         while (qty > 0) {
+            close(((int *) CMSG_DATA(control_header))[--qty]);
+         }
+      }
+   }
+
+   if (bytes_read == 0) {
+      free(buffer);
+      return -1;
+   }
+   check((header.msg_flags & MSG_TRUNC) == 0, "handoff message too big");
+
+   *message = blk2bstr(buffer, bytes_read);
+   check_mem(*message);
+   free(buffer);
+
+   return 1;
+
+error:
+   free(buffer);
+   return -1;
+}
+
+//----------------------------------------------------------------------------
+// split the message into lines, the first of which is tag
+// return the lines, NULL for another tag (or failure)
+static struct bstrList *
+split_message(const_bstring message, const_bstring tag) {
+//----------------------------------------------------------------------------
+   struct bstrList * lines = bsplit(message, '\n');
+
+   check(lines != NULL, "bsplit");
+   check(lines->qty > 0 && biseq(lines->entry[0], tag) == 1,
+         "expected a '%s' message", (const char *) tag->data);
+
+   return lines;
+
+error:
+   if (lines != NULL) bstrListDestroy(lines);
+   return NULL;
+}
+
+//----------------------------------------------------------------------------
+// make the blocking exchanges at connect time give up on a stuck peer
+// return 0 for success, -1 for failure
+static int
+set_exchange_timeout(int fd) {
+//----------------------------------------------------------------------------
+   struct timeval timeout = {EXCHANGE_TIMEOUT_SECONDS, 0};
+
+   check(setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof timeout)
+         == 0, "SO_RCVTIMEO");
+   check(setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof timeout)
+         == 0, "SO_SNDTIMEO");
+
+   return 0;
+
+error:
+   return -1;
+}
+
+//----------------------------------------------------------------------------
+// fill in a unix socket address for path
+// return 0 for success, -1 for failure
+static int
+unix_address(const char * path, struct sockaddr_un * address) {
+//----------------------------------------------------------------------------
+   memset(address, 0, sizeof *address);
+   address->sun_family = AF_UNIX;
+   check(strlen(path) < sizeof address->sun_path, "path too long: %s", path);
+   strcpy(address->sun_path, path);
+
+   return 0;
+
+error:
+   return -1;
+}
+
+//----------------------------------------------------------------------------
+// listen on path (a stream socket, for zeromq's ipc://)
+// return the fd, -1 for failure
+static int
+unix_listen(const char * path, int type) {
+//----------------------------------------------------------------------------
+   struct sockaddr_un address;
+   int fd = -1;
+
+   check(unix_address(path, &address) == 0, "unix_address");
+   // whoever had it has gone, or we would have connected
+   unlink(path);
+
+   fd = socket(AF_UNIX, type | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+   check(fd != -1, "socket");
+   check(bind(fd, (struct sockaddr *) &address, sizeof address) == 0,
+         "bind %s", path);
+   check(listen(fd, SOMAXCONN) == 0, "listen");
+
+   return fd;
+
+error:
+   if (fd != -1) close(fd);
+   return -1;
+}
+
+//----------------------------------------------------------------------------
+// a listening socket for a PUB endpoint, for zeromq to bind with
+// ZMQ_USE_FD: tcp://<address>:<port> (* for any address) or ipc://<path>
+// *fd is -1 for other endpoints, zeromq binds them itself
+// return 0 for success, -1 for failure
+static int
+open_endpoint_fd(const char * uri, int * fd) {
+//----------------------------------------------------------------------------
+   bstring host = NULL;
+   const char * address;
+   const char * colon;
+
+   *fd = -1;
+
+   if (strncmp(uri, "ipc://", 6) == 0) {
+      *fd = unix_listen(uri + 6, SOCK_STREAM);
+      check(*fd != -1, "unix_listen %s", uri);
+   } else if (strncmp(uri, "tcp://", 6) == 0) {
+      address = uri + 6;
+      colon = strrchr(address, ':');
+      check(colon != NULL, "no port in %s", uri);
+      if (address[0] == '[') {
+         host = blk2bstr(address + 1, colon - address - 2);
+      } else {
+         host = blk2bstr(address, colon - address);
+      }
+      check_mem(host);
+      if (biseqcstr(host, "*")) {
+         check(bassigncstr(host, "0.0.0.0") == BSTR_OK, "bassigncstr");
+      }
+      *fd = tcp_listen("PUB endpoint", 
+                       (const char *) host->data,
+                       atoi(colon + 1),
+                       false);
+      check(*fd != -1, "tcp_listen %s", uri);
+   } else {
+      log_info("%s is bound by zeromq, it can't be handed off", uri);
+   }
+
+   bdestroy(host);
+   return 0;
+
+error:
+   bdestroy(host);
+   return -1;
+}
+
+//----------------------------------------------------------------------------
+// listen on handoff_path for the next process
+// return 0 for success, -1 for failure
+static int
+listen_handoff(struct Handoff * handoff) {
+//----------------------------------------------------------------------------
+   handoff->listen_fd = unix_listen(handoff->path, SOCK_SEQPACKET);
+   check(handoff->listen_fd != -1, "unix_listen %s", handoff->path);
+   log_info("waiting for handoff on %s", handoff->path);
+
+   return 0;
+
+error:
+   return -1;
+}
+
+//----------------------------------------------------------------------------
+// connect to the skeeter on handoff_path, if there is one, and take its
+// endpoint fds
+// return 0 for success (handoff->fd is -1 if there is no one to take
+// over from), -1 for failure
+static int
+connect_handoff(struct Handoff * handoff, const struct Config * config) {
+//----------------------------------------------------------------------------
+   struct sockaddr_un address;
+   bstring message = NULL;
+   struct bstrList * lines = NULL;
+   int fds[MAX_FDS];
+   int fd_qty = 0;
+   int result;
+   int i;
+   int j;
+
+   check(unix_address(handoff->path, &address) == 0, "unix_address");
+   handoff->fd = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+   check(handoff->fd != -1, "socket");
+   result = connect(handoff->fd, (struct sockaddr *) &address, sizeof address);
+   if (result == -1 && (errno == ENOENT || errno == ECONNREFUSED)) {
+      close(handoff->fd);
+      handoff->fd = -1;
+      return 0;
+   }
+   check(result == 0, "connect %s", handoff->path);
+   check(set_exchange_timeout(handoff->fd) == 0, "set_exchange_timeout");
+
+   handoff->marker = bformat("%d.%ld", (int) getpid(), (long) time(NULL));
+   check_mem(handoff->marker);
+   message = bformat("%s\n%s", HELLO.data, handoff->marker->data);
+   check_mem(message);
+   check(send_message(handoff->fd, message, NULL, 0) == 0, "send hello");
+   bdestroy(message);
+
+   result = receive_message(handoff->fd, 0, &message, fds, &fd_qty);
+   check(result == 1, "receive endpoints");
+   lines = split_message(message, &ENDPOINTS);
+   check(lines != NULL, "split_message");
+
+   // line i + 1 is the uri of fds[i]
+   for (i=0; i < fd_qty; i++) {
+      if (i + 1 < lines->qty && config->shm_ring_name != NULL &&
+          bstrncmp(lines->entry[i + 1], 
+                   &SHM_RING_SCHEME, 
+                   blength(&SHM_RING_SCHEME)) == 0 &&
+          strcmp((const char *) lines->entry[i + 1]->data + 
+                    blength(&SHM_RING_SCHEME),
+                 config->shm_ring_name) == 0) {
+         handoff->shm_ring_fd = fds[i];
+         fds[i] = -1;
+         continue;
+      }
+      for (j=0; j < config->endpoint_list->qty; j++) {
+         if (i + 1 < lines->qty && handoff->endpoint_fds[j] == -1 &&
+             biseqcstr(lines->entry[i + 1], config->endpoint_config[j].uri)) {
+            handoff->endpoint_fds[j] = fds[i];
+            fds[i] = -1;
+            log_info("took over %s", config->endpoint_config[j].uri);
+            break;
+         }
+      }
+      if (fds[i] != -1) close(fds[i]);
+   }
+
+   handoff->phase = HANDOFF_TAKING;
+   bstrListDestroy(lines);
+   bdestroy(message);
+   return 0;
+
+error:
+   if (lines != NULL) bstrListDestroy(lines);
+   bdestroy(message);
+   return -1;
+}
+
+//----------------------------------------------------------------------------
+// with config.handoff_path set, take the endpoint fds from the skeeter
+// running there, or listen for the next one
+// return 0 for success, -1 for failure
+int
+start_handoff(struct Handoff * handoff, const struct Config * config) {
+//----------------------------------------------------------------------------
+   int i;
+
+   handoff->phase = HANDOFF_IDLE;
+   handoff->path = config->handoff_path;
+   handoff->listen_fd = -1;
+   handoff->fd = -1;
+   handoff->marker = NULL;
+   handoff->state_received = false;
+   handoff->handed_off_us = 0;
+   handoff->marker_us = 0;
+   handoff->shm_ring_fd = -1;
+
+   handoff->endpoint_qty = config->endpoint_list->qty;
+   handoff->endpoint_fds = malloc((handoff->endpoint_qty + 1) * sizeof(int));
+   check_mem(handoff->endpoint_fds);
+   for (i=0; i < handoff->endpoint_qty; i++) {
+      handoff->endpoint_fds[i] = -1;
+   }
+
+   if (handoff->path == NULL) {
+      return 0;
+   }
+
+   check(connect_handoff(handoff, config) == 0, "connect_handoff");
+   if (handoff->fd == -1) {
+      check(listen_handoff(handoff) == 0, "listen_handoff");
+   } else {
+      log_info("taking over from the skeeter on %s", handoff->path);
+   }
+
+#if defined(ZMQ_USE_FD)
+   for (i=0; i < handoff->endpoint_qty; i++) {
+      if (handoff->endpoint_fds[i] == -1) {
+         check(open_endpoint_fd(config->endpoint_config[i].uri,
+                                &handoff->endpoint_fds[i]) == 0,
+               "open_endpoint_fd");
+      }
+   }
+#else
+   (void) open_endpoint_fd; // unused
+   log_info("zeromq has no ZMQ_USE_FD (4.2), the PUB endpoints are "
+            "rebound on handoff");
+#endif
+
+   return 0;
+
+error:
+   return -1;
+}
+
+//----------------------------------------------------------------------------
+// close the sockets, the endpoint fds are left to zeromq
+void
+clear_handoff(struct Handoff * handoff) {
+//----------------------------------------------------------------------------
+   if (handoff->fd != -1) close(handoff->fd);
+   handoff->fd = -1;
+   if (handoff->listen_fd != -1) {
+      close(handoff->listen_fd);
+      // after a handoff, the path is the new process's
+      if (handoff->phase != HANDOFF_DONE) unlink(handoff->path);
+   }
+   handoff->listen_fd = -1;
+   bdestroy(handoff->marker);
+   handoff->marker = NULL;
+   free(handoff->endpoint_fds);
+   handoff->endpoint_fds = NULL;
+}
+
+//----------------------------------------------------------------------------
+// a new process is connecting on listen_fd: send it the endpoint fds
+// return 0 for success, -1 for failure
+int
+accept_handoff(struct Handoff * handoff, const struct Config * config) {
+//----------------------------------------------------------------------------
+   bstring message = NULL;
+   struct bstrList * lines = NULL;
+   int fds[MAX_FDS];
+   int fd_qty = 0;
+   int fd;
+   int i;
+
+   fd = accept4(handoff->listen_fd, NULL, NULL, SOCK_CLOEXEC);
+   if (fd == -1) {
+      check(errno == EAGAIN || errno == ECONNABORTED, "accept4");
+      return 0;
+   }
+   if (handoff->phase != HANDOFF_IDLE) {
+      log_warn("a handoff is under way, refusing another");
+      close(fd);
+      return 0;
+   }
+   check(set_exchange_timeout(fd) == 0, "set_exchange_timeout");
+
+   check(receive_message(fd, 0, &message, NULL, NULL) == 1, "receive hello");
+   lines = split_message(message, &HELLO);
+   check(lines != NULL && lines->qty == 2, "hello");
+   handoff->marker = bstrcpy(lines->entry[1]);
+   check_mem(handoff->marker);
+   bstrListDestroy(lines);
+   lines = NULL;
+   bdestroy(message);
+
+   message = bstrcpy(&ENDPOINTS);
+   check_mem(message);
+   for (i=0; i < handoff->endpoint_qty && fd_qty < MAX_FDS; i++) {
+      if (handoff->endpoint_fds[i] == -1) continue;
+      check(bformata(message, "\n%s", config->endpoint_config[i].uri)
+            == BSTR_OK, "bformata");
+      fds[fd_qty++] = handoff->endpoint_fds[i];
+   }
+   if (handoff->shm_ring_fd != -1 && fd_qty < MAX_FDS) {
+      check(bformata(message, 
+                     "\n%s%s", 
+                     (const char *) SHM_RING_SCHEME.data,
+                     config->shm_ring_name) == BSTR_OK, 
+            "bformata");
+      fds[fd_qty++] = handoff->shm_ring_fd;
+   }
+   check(send_message(fd, message, fds, fd_qty) == 0, "send endpoints");
+
+   log_info("handing off to a new process, marker %s",
+            (const char *) handoff->marker->data);
+   handoff->fd = fd;
+   handoff->phase = HANDOFF_GIVING;
+   bdestroy(message);
+   return 0;
+
+error:
+   close(fd);
+   if (lines != NULL) bstrListDestroy(lines);
+   bdestroy(message);
+   bdestroy(handoff->marker);
+   handoff->marker = NULL;
+   return -1;
+}
+
+//----------------------------------------------------------------------------
+// read the next message from the other process
+// return 1 for a message in *message, 0 if none is waiting, -1 if the
+// other process has gone away (or for failure)
+int
+read_handoff_message(struct Handoff * handoff, bstring * message) {
+//----------------------------------------------------------------------------
+   return receive_message(handoff->fd, MSG_DONTWAIT, message, NULL, NULL);
+}
+
+//----------------------------------------------------------------------------
+// true if payload, on HANDOFF_CHANNEL, is the marker of our handoff
+bool
+is_handoff_marker(const struct Handoff * handoff, const char * payload) {
+//----------------------------------------------------------------------------
+   return (handoff->phase == HANDOFF_TAKING ||
+           handoff->phase == HANDOFF_GIVING) &&
+          handoff->marker != NULL &&
+          biseqcstr(handoff->marker, payload) == 1;
+}
+
+//----------------------------------------------------------------------------
+// false while the other process publishes for us
+bool
+handoff_may_publish(const struct Handoff * handoff) {
+//----------------------------------------------------------------------------
+   return handoff->phase == HANDOFF_IDLE || handoff->phase == HANDOFF_GIVING;
+}
+
+//----------------------------------------------------------------------------
+// old process: send our sequence numbers and hang up
+// return 0 for success, -1 for failure
+int
+send_handoff_state(struct Handoff * handoff, bstring state) {
+//----------------------------------------------------------------------------
+   int result;
+
+   result = send_message(handoff->fd, state, NULL, 0);
+   close(handoff->fd);
+   handoff->fd = -1;
+   handoff->phase = HANDOFF_DONE;
+   check(result == 0, "send state");
+
+   return 0;
+
+error:
+   return -1;
+}
+
+//----------------------------------------------------------------------------
+// hang up on the other process; a new process starts listening for the
+// next one
+// return 0 for success, -1 for failure
+int
+end_handoff(struct Handoff * handoff) {
+//----------------------------------------------------------------------------
+   bool taking_over = (handoff->phase == HANDOFF_TAKING ||
+                       handoff->phase == HANDOFF_RESUMING);
+
+   if (handoff->fd != -1) close(handoff->fd);
+   handoff->fd = -1;
+   bdestroy(handoff->marker);
+   handoff->marker = NULL;
+   handoff->state_received = false;
+   handoff->phase = HANDOFF_IDLE;
+
+   if (taking_over) {
+      check(listen_handoff(handoff) == 0, "listen_handoff");
+   }
+
+   return 0;
+
+error:
+   return -1;
+}
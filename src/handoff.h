@@ -0,0 +1,107 @@
+/*----------------------------------------------------------------------------
+ * handoff.h
+ *
+ * zero downtime upgrades: a new skeeter takes the listening sockets of
+ * the PUB endpoints and the sequence numbers from the running one, over
+ * a unix socket at config.handoff_path
+ *--------------------------------------------------------------------------*/
+#if !defined(__HANDOFF_H__)
+#define __HANDOFF_H__
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "bstrlib.h"
+#include "config.h"
+
+// both processes LISTEN on this channel for the marker NOTIFY
+#define HANDOFF_CHANNEL "skeeter_handoff"
+
+enum HANDOFF_PHASE {
+   // no upgrade under way
+   HANDOFF_IDLE,
+   // new process: LISTENing, waiting for our marker; the old process
+   // publishes the notifications that come before it
+   HANDOFF_TAKING,
+   // new process: past the marker, holding the notifications until the
+   // old process sends its sequence numbers
+   HANDOFF_RESUMING,
+   // old process: a new one is connected, we publish up to its marker
+   HANDOFF_GIVING,
+   // old process: handed off, we publish nothing more
+   HANDOFF_DONE
+};
+
+struct Handoff {
+   enum HANDOFF_PHASE phase;
+   // points into the config, NULL without handoff
+   const char * path;
+   // listening on path for the next process, -1 when we aren't
+   int listen_fd;
+   // connected to the other process, -1 when we aren't
+   int fd;
+   // the payload of the NOTIFY marking the cutover, the new process's
+   bstring marker;
+   // new process: the old one's sequence numbers came before the marker
+   bool state_received;
+   // new process: the old one's CLOCK_MONOTONIC microseconds when it
+   // stopped publishing, and ours when we saw the marker
+   uint64_t handed_off_us;
+   uint64_t marker_us;
+
+   // parallel to config.endpoint_config: the listening socket to bind
+   // the endpoint with (ZMQ_USE_FD), -1 to let zeromq make its own.
+   // zeromq closes them with the PUB sockets.
+   int * endpoint_fds;
+   int endpoint_qty;
+   // the shared memory ring: the fd we hand on with the endpoints, or the
+   // one the old process handed us, -1 for none. The ring owns it.
+   int shm_ring_fd;
+};
+
+// with config.handoff_path set, take the endpoint fds (and the shared 
+// memory ring's) from the skeeter running there, if there is one 
+// (HANDOFF_TAKING), and otherwise listen
+// there for the next one. The endpoints we didn't get an fd for get a
+// listening socket of our own, so we can hand it on.
+// return 0 for success, -1 for failure
+extern int
+start_handoff(struct Handoff * handoff, const struct Config * config);
+
+// close the sockets, the endpoint fds are left to zeromq
+extern void
+clear_handoff(struct Handoff * handoff);
+
+// a new process is connecting on listen_fd: send it the endpoint fds
+// and shm_ring_fd (HANDOFF_GIVING). We hand off to one process at a time.
+// return 0 for success, -1 for failure
+extern int
+accept_handoff(struct Handoff * handoff, const struct Config * config);
+
+// read the next message from the other process
+// return 1 for a message in *message, 0 if none is waiting, -1 if the
+// other process has gone away (or for failure)
+extern int
+read_handoff_message(struct Handoff * handoff, bstring * message);
+
+// true if payload, on HANDOFF_CHANNEL, is the marker of our handoff
+extern bool
+is_handoff_marker(const struct Handoff * handoff, const char * payload);
+
+// false while the other process publishes for us: before the new one
+// takes over, and after the old one has handed off
+extern bool
+handoff_may_publish(const struct Handoff * handoff);
+
+// old process: send our sequence numbers and hang up (HANDOFF_DONE)
+// return 0 for success, -1 for failure
+extern int
+send_handoff_state(struct Handoff * handoff, bstring state);
+
+// hang up on the other process (HANDOFF_IDLE); a new process starts
+// listening for the next one
+// return 0 for success, -1 for failure
+extern int
+end_handoff(struct Handoff * handoff);
+
+#endif // !defined(__HANDOFF_H__)
@@ -0,0 +1,111 @@
+/*----------------------------------------------------------------------------
+ * histogram.c
+ * 
+ * latency histograms in the style of HdrHistogram: each power of 2 is 
+ * split into 8 linear buckets, so a value is known to within 12.5% at any
+ * magnitude, and recording one is a few instructions
+ *--------------------------------------------------------------------------*/
+#include "histogram.h"
+
+//----------------------------------------------------------------------------
+// the bucket for value: below 2 * HISTOGRAM_SUB_BUCKETS the value itself,
+// then HISTOGRAM_SUB_BUCKETS for each power of 2
+static int
+bucket_index(uint64_t value) {
+//----------------------------------------------------------------------------
+   int exponent;
+   int index;
+
+   if (value < 2 * HISTOGRAM_SUB_BUCKETS) {
+      return (int) value;
+   }
+   exponent = 63 - __builtin_clzll(value);
+   index = (exponent - HISTOGRAM_SUB_BITS + 1) * HISTOGRAM_SUB_BUCKETS + 
+           (int) ((value >> (exponent - HISTOGRAM_SUB_BITS)) & 
+                  (HISTOGRAM_SUB_BUCKETS - 1));
+   return (index < HISTOGRAM_BUCKETS) ? index : HISTOGRAM_BUCKETS - 1;
+}
+
+//----------------------------------------------------------------------------
+// the largest value that goes in bucket index, the inverse of bucket_index
+static uint64_t
+bucket_top(int index) {
+//----------------------------------------------------------------------------
+   int shift;
+
+   if (index < 2 * HISTOGRAM_SUB_BUCKETS) {
+      return (uint64_t) index;
+   }
+   if (index == HISTOGRAM_BUCKETS - 1) {
+      return UINT64_MAX;
+   }
+   shift = index / HISTOGRAM_SUB_BUCKETS - 1;
+   return ((uint64_t) (HISTOGRAM_SUB_BUCKETS + 
+                       index % HISTOGRAM_SUB_BUCKETS + 1) << shift) - 1;
+}
+
+//----------------------------------------------------------------------------
+// count a value, usually microseconds
+void
+histogram_record(struct Histogram * histogram, uint64_t value) {
+//----------------------------------------------------------------------------
+   histogram->buckets[bucket_index(value)]++;
+   histogram->count++;
+   histogram->sum += value;
+   if (value > histogram->max) {
+      histogram->max = value;
+   }
+}
+
+//----------------------------------------------------------------------------
+// the number of values recorded below limit, which is exact when limit 
+// is a power of 2
+uint64_t
+histogram_count_below(const struct Histogram * histogram, uint64_t limit) {
+//----------------------------------------------------------------------------
+   uint64_t count = 0;
+   int end;
+   int i;
+
+   if (limit == 0) {
+      return 0;
+   }
+   // the bucket of limit - 1 is the last one entirely below limit when 
+   // limit starts a bucket, as powers of 2 do
+   end = bucket_index(limit - 1);
+   for (i=0; i <= end; i++) {
+      count += histogram->buckets[i];
+   }
+
+   return count;
+}
+
+//----------------------------------------------------------------------------
+// the value at percentile (0 to 100): the top of the bucket it falls in,
+// but no more than the largest value recorded; 0 when there are none
+uint64_t
+histogram_percentile(const struct Histogram * histogram, double percentile) {
+//----------------------------------------------------------------------------
+   uint64_t rank;
+   uint64_t count = 0;
+   uint64_t top;
+   int i;
+
+   if (histogram->count == 0) {
+      return 0;
+   }
+   // the rank of the value we want, counting from 1
+   rank = (uint64_t) (percentile / 100.0 * (double) histogram->count + 0.5);
+   if (rank == 0) {
+      rank = 1;
+   }
+   for (i=0; i < HISTOGRAM_BUCKETS; i++) {
+      count += histogram->buckets[i];
+      if (count >= rank) {
+         break;
+      }
+   }
+   top = bucket_top(i);
+
+   return (top < histogram->max) ? top : histogram->max;
+}
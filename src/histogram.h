@@ -0,0 +1,42 @@
+/*----------------------------------------------------------------------------
+ * histogram.h
+ * 
+ * latency histograms in the style of HdrHistogram: each power of 2 is 
+ * split into 8 linear buckets, so a value is known to within 12.5% at any
+ * magnitude, and recording one is a few instructions
+ *--------------------------------------------------------------------------*/
+#if !defined(__HISTOGRAM_H__)
+#define __HISTOGRAM_H__
+
+#include <stdint.h>
+
+#define HISTOGRAM_SUB_BITS 3
+#define HISTOGRAM_SUB_BUCKETS (1 << HISTOGRAM_SUB_BITS)
+// values below 16 have a bucket each, then 8 per power of 2 up to 2^36
+// (about 19 hours in microseconds); anything bigger goes in the last one
+#define HISTOGRAM_MAX_BITS 36
+#define HISTOGRAM_BUCKETS \
+   ((HISTOGRAM_MAX_BITS - HISTOGRAM_SUB_BITS + 1) * HISTOGRAM_SUB_BUCKETS)
+
+struct Histogram {
+   uint64_t count;
+   uint64_t sum;
+   uint64_t max;
+   uint64_t buckets[HISTOGRAM_BUCKETS];
+};
+
+// count a value, usually microseconds
+extern void
+histogram_record(struct Histogram * histogram, uint64_t value);
+
+// the number of values recorded below limit, which is exact when limit 
+// is a power of 2
+extern uint64_t
+histogram_count_below(const struct Histogram * histogram, uint64_t limit);
+
+// the value at percentile (0 to 100): the top of the bucket it falls in,
+// but no more than the largest value recorded; 0 when there are none
+extern uint64_t
+histogram_percentile(const struct Histogram * histogram, double percentile);
+
+#endif // !defined(__HISTOGRAM_H__)
@@ -7,42 +7,141 @@
 #include <zmq.h>
 
 #include "bstrlib.h"
+#include "compress.h"
 #include "dbg_syslog.h"
 #include "zmq_shim.h"
 
+//---------------------------------------------------------------------------
+// send one frame of a multipart message
+// we never block: a PUB socket drops at the HWM by itself, an XPUB socket
+// with ZMQ_XPUB_NODROP returns EAGAIN instead, so we can count the drop
+// return 0 for success, 1 if the socket is at its HWM, -1 for failure
+static int
+send_frame(const_bstring frame, void * zmq_pub_socket, int flag) {
+//---------------------------------------------------------------------------
+   zmq_msg_t message;
+   size_t message_size = blength(frame);
+   int result;
+
+   check(zmq_msg_init_size(&message, message_size) == 0,
+         "zmq_init_size %d",
+         (int) message_size);
+   memcpy(zmq_msg_data(&message), frame->data, message_size);
+   result = zmq_msg_send(&message, zmq_pub_socket, flag | ZMQ_DONTWAIT);
+   if (result == -1 && errno == EAGAIN) {
+      zmq_msg_close(&message);
+      errno = 0;
+      return 1;
+   }
+   check(result != -1, "zmq_send channel_message");
+   check(zmq_msg_close(&message) == 0, "close messge");
+
+   return 0;
+
+error:
+   return -1;
+}
+
+//---------------------------------------------------------------------------
+// compress the data frame (the third) in place, if the compressor decides
+// it is worthwhile, and append 'compression' and 'uncompressed_size' to 
+// the meta data frame (the second)
+// we do this once per message, before publishing on each socket
+// return 0 for success, -1 for failure
+int
+compress_message(struct bstrList * message_list, 
+                 struct Compressor * compressor) {
+//---------------------------------------------------------------------------
+   bstring compressed = NULL;
+   int uncompressed_size;
+
+   if (compressor == NULL || message_list->qty != 3) {
+      return 0;
+   }
+
+   check(compress_data(compressor, message_list->entry[2], &compressed) == 0,
+         "compress_data");
+   if (compressed == NULL) {
+      return 0;
+   }
+
+   uncompressed_size = blength(message_list->entry[2]);
+   check(bformata(message_list->entry[1], 
+                  ";compression=%s;uncompressed_size=%d",
+                  COMPRESSION_NAME[compressor->type],
+                  uncompressed_size) == BSTR_OK,
+         "bformata");
+   bdestroy(message_list->entry[2]);
+   message_list->entry[2] = compressed;
+
+   return 0;
+
+error:
+   bdestroy(compressed);
+   return -1;
+}
+
 //---------------------------------------------------------------------------
 // send a (possibly multipart) message over the pub socket
 // all strings are copied to zmq message structures
 // it is the responsibility of the caller to clean up message_list
-// return 0 for success, -1 for failure
+// return 0 for success, 1 if the message was dropped because a subscriber
+// is at the HWM, -1 for failure
 int
 publish_message(const struct bstrList * message_list, void * zmq_pub_socket) {
 //---------------------------------------------------------------------------
    int i;
-   zmq_msg_t message;
-   size_t message_size;
-   const char * cstr;
    int flag;
-   int result;
+   int result = 0;
 
    for (i=0; i < message_list->qty; i++) {
-      message_size = blength(message_list->entry[i]);
-      check(zmq_msg_init_size(&message, message_size) == 0,
-            "zmq_init_size %d",
-            (int) message_size);
-      cstr = bstr2cstr(message_list->entry[i], '?');
-      check(cstr != NULL, "bstr2cstr");
-      memcpy(zmq_msg_data(&message), cstr, message_size);
-      check(bcstrfree((char *)cstr) == BSTR_OK, "bcstrfree");
       flag = (i == (message_list->qty)-1) ? 0 : ZMQ_SNDMORE;
-      result = zmq_msg_send(&message, zmq_pub_socket, flag);
-      check(result != -1, "zmq_send channel_message");
-      check(zmq_msg_close(&message) == 0, "close messge");
+      result = send_frame(message_list->entry[i], zmq_pub_socket, flag);
+      check(result != -1, "send_frame");
+      // the HWM is checked for the whole message at the first frame
+      if (result == 1) {
+         check(i == 0, "EAGAIN after the first frame");
+         break;
+      }
+   }
+
+   return result;
 
+error:
+   return -1;
+}
+
+//---------------------------------------------------------------------------
+// send received frames on without copying their data: each frame is sent
+// as a zmq_msg_copy, which shares the buffer. The frames are not changed.
+// return 0 for success, 1 if the message was dropped because a subscriber
+// is at the HWM (only with ZMQ_XPUB_NODROP), -1 for failure
+int
+forward_message(zmq_msg_t * frames, int frame_qty, void * zmq_pub_socket) {
+//---------------------------------------------------------------------------
+   zmq_msg_t message;
+   int i;
+   int flag;
+   int result;
+
+   for (i=0; i < frame_qty; i++) {
+      flag = (i == frame_qty-1) ? 0 : ZMQ_SNDMORE;
+      check(zmq_msg_init(&message) == 0, "zmq_msg_init");
+      check(zmq_msg_copy(&message, &frames[i]) == 0, "zmq_msg_copy");
+      result = zmq_msg_send(&message, zmq_pub_socket, flag | ZMQ_DONTWAIT);
+      if (result == -1 && errno == EAGAIN) {
+         zmq_msg_close(&message);
+         // the HWM is checked for the whole message at the first frame
+         check(i == 0, "EAGAIN after the first frame");
+         errno = 0;
+         return 1;
+      }
+      check(result != -1, "zmq_send forward");
+      check(zmq_msg_close(&message) == 0, "close messge");
    }
+
    return 0;
 
 error:
    return -1;
 }
-
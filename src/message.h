@@ -6,13 +6,32 @@
 #if !defined(__MESSAGE__H__)
 #define __MESSAGE__H__
 
+#include <zmq.h>
+
 #include "bstrlib.h"
+#include "compress.h"
+
+// compress the data frame (the third) in place, if the compressor decides
+// it is worthwhile, and append 'compression' and 'uncompressed_size' to 
+// the meta data frame (the second)
+// return 0 for success, -1 for failure
+int
+compress_message(struct bstrList * message_list, 
+                 struct Compressor * compressor);
 
 // send a (possibly multipart) message over the pub socket
 // all stringws are copied to zmq message structures
 // it is the responsibility of the caller to clean up message_list
-// return 0 for success, -1 for failure
+// return 0 for success, 1 if the message was dropped because a subscriber
+// is at the HWM (only with ZMQ_XPUB_NODROP), -1 for failure
 int
 publish_message(const struct bstrList * message_list, void * zmq_pub_socket);
 
+// send received frames on without copying their data: each frame is sent
+// as a zmq_msg_copy, which shares the buffer. The frames are not changed.
+// return 0 for success, 1 if the message was dropped because a subscriber
+// is at the HWM (only with ZMQ_XPUB_NODROP), -1 for failure
+int
+forward_message(zmq_msg_t * frames, int frame_qty, void * zmq_pub_socket);
+
 #endif // !defined(__MESSAGE__H__)
@@ -0,0 +1,519 @@
+/*----------------------------------------------------------------------------
+ * metrics.c
+ *
+ * a minimal HTTP/1.1 server for Prometheus: GET /metrics answers with 
+ * what the caller formats, in the text exposition format
+ *
+ * The counters themselves are plain integers in the state, bumped by the 
+ * one thread that runs the event loop: no locks, no atomics. They are 
+ * only read, and formatted, when a scrape comes in.
+ *--------------------------------------------------------------------------*/
+#define _GNU_SOURCE // accept4
+#include <errno.h>
+#include <inttypes.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+#include "bstrlib.h"
+#include "config.h"
+#include "dbg_syslog.h"
+#include "metrics.h"
+#include "tcp_listen.h"
+
+// the biggest request header we read
+static const int MAX_REQUEST = 8192;
+
+// scrapers are few
+static const int MAX_CLIENTS = 16;
+
+static const int METRICS_EPOLL_EVENTS = 16;
+static const int READ_CHUNK = 4096;
+
+// histogram buckets from 1us to 2^23us (8.4 seconds)
+static const int HISTOGRAM_LE_QTY = 24;
+
+static struct tagbstring LINE_END = bsStatic("\r\n");
+static struct tagbstring HEADER_END = bsStatic("\r\n\r\n");
+static struct tagbstring HTTP_1 = bsStatic("HTTP/1.");
+
+// what to do with a client after reading or writing
+enum CLIENT_RESULT {
+   CLIENT_OK,
+   CLIENT_CLOSE,
+   CLIENT_ERROR
+};
+
+//----------------------------------------------------------------------------
+// disconnect a client and free it
+static void
+close_client(struct Metrics * metrics, struct MetricsClient * client) {
+//----------------------------------------------------------------------------
+   // closing the fd takes it out of the epoll set
+   close(client->fd);
+   if (client->prev != NULL) {
+      client->prev->next = client->next;
+   } else {
+      metrics->clients = client->next;
+   }
+   if (client->next != NULL) client->next->prev = client->prev;
+   metrics->client_qty--;
+   if (client->waiting) metrics->waiting_qty--;
+
+   bdestroy(client->request);
+   bdestroy(client->response);
+   free(client);
+}
+
+//----------------------------------------------------------------------------
+// write as much of the response as the socket takes, and poll for 
+// writable while some is left
+// return CLIENT_OK, CLIENT_CLOSE once it is written (or the client is 
+// gone), CLIENT_ERROR
+static enum CLIENT_RESULT
+flush_client(struct Metrics * metrics, struct MetricsClient * client) {
+//----------------------------------------------------------------------------
+   struct epoll_event event;
+   ssize_t sent;
+
+   if (client->response == NULL) {
+      return CLIENT_OK;
+   }
+
+   while (client->written < blength(client->response)) {
+      sent = send(client->fd, 
+                  client->response->data + client->written,
+                  blength(client->response) - client->written,
+                  MSG_DONTWAIT | MSG_NOSIGNAL);
+      if (sent == -1) {
+         if (errno == EAGAIN || errno == EWOULDBLOCK) {
+            errno = 0;
+            break;
+         }
+         errno = 0;
+         return CLIENT_CLOSE;
+      }
+      client->written += sent;
+   }
+   if (client->written == blength(client->response)) {
+      return CLIENT_CLOSE;
+   }
+
+   if (!client->want_write) {
+      event.events = EPOLLIN | EPOLLOUT;
+      event.data.ptr = client;
+      check(epoll_ctl(metrics->epoll_fd, 
+                      EPOLL_CTL_MOD, 
+                      client->fd, 
+                      &event) == 0,
+            "epoll_ctl");
+      client->want_write = true;
+   }
+
+   return CLIENT_OK;
+
+error:
+   return CLIENT_ERROR;
+}
+
+//----------------------------------------------------------------------------
+// the response to send, and close once it is written
+// return 0 for success, -1 for failure
+static int
+set_response(struct MetricsClient * client,
+             const char * status,
+             const char * content_type,
+             const_bstring body) {
+//----------------------------------------------------------------------------
+   client->response = bformat("HTTP/1.1 %s\r\n"
+                              "Content-Type: %s\r\n"
+                              "Content-Length: %d\r\n"
+                              "Connection: close\r\n"
+                              "\r\n",
+                              status,
+                              content_type,
+                              blength(body));
+   check(client->response != NULL, "bformat");
+   check(bconcat(client->response, body) == BSTR_OK, "bconcat");
+   client->written = 0;
+
+   return 0;
+
+error:
+   return -1;
+}
+
+//----------------------------------------------------------------------------
+// answer with an error
+// return 0 for success, -1 for failure
+static int
+respond_error(struct MetricsClient * client, const char * status) {
+//----------------------------------------------------------------------------
+   bstring body;
+   int result;
+
+   body = bformat("%s\n", status);
+   check(body != NULL, "bformat");
+   result = set_response(client, status, "text/plain", body);
+   bdestroy(body);
+
+   return result;
+
+error:
+   return -1;
+}
+
+//----------------------------------------------------------------------------
+// we have the whole request header: GET /metrics waits for 
+// metrics_respond, anything else gets an error
+// return 0 for success, -1 for failure
+static int
+handle_request(struct Metrics * metrics, struct MetricsClient * client) {
+//----------------------------------------------------------------------------
+   struct bstrList * request_line = NULL;
+   int line_end;
+
+   line_end = binstr(client->request, 0, &LINE_END);
+   check(line_end != BSTR_ERR, "no request line");
+   client->request->slen = line_end;
+   request_line = bsplit(client->request, ' ');
+   check(request_line != NULL, "bsplit");
+
+   if (request_line->qty != 3 ||
+       bstrncmp(request_line->entry[2],
+                &HTTP_1, blength(&HTTP_1)) != 0) {
+      check(respond_error(client, "400 Bad Request") == 0, "respond_error");
+   } else if (!biseqcstr(request_line->entry[0], "GET")) {
+      check(respond_error(client, "405 Method Not Allowed") == 0,
+            "respond_error");
+   } else if (!biseqcstr(request_line->entry[1], "/metrics")) {
+      check(respond_error(client, "404 Not Found") == 0, "respond_error");
+   } else {
+      client->waiting = true;
+      metrics->waiting_qty++;
+   }
+
+   bstrListDestroy(request_line);
+   bdestroy(client->request);
+   client->request = NULL;
+   return 0;
+
+error:
+   if (request_line != NULL) bstrListDestroy(request_line);
+   return -1;
+}
+
+//----------------------------------------------------------------------------
+// read the request; after it, input is ignored
+// return CLIENT_OK, CLIENT_CLOSE to disconnect the client, CLIENT_ERROR
+static enum CLIENT_RESULT
+read_client(struct Metrics * metrics, struct MetricsClient * client) {
+//----------------------------------------------------------------------------
+   unsigned char buffer[READ_CHUNK];
+   ssize_t received;
+
+   for (;;) {
+      received = recv(client->fd, buffer, sizeof buffer, MSG_DONTWAIT);
+      if (received == 0) {
+         return CLIENT_CLOSE;
+      }
+      if (received == -1) {
+         if (errno == EAGAIN || errno == EWOULDBLOCK) {
+            errno = 0;
+            break;
+         }
+         errno = 0;
+         return CLIENT_CLOSE;
+      }
+      if (client->request == NULL) {
+         continue;
+      }
+      check(bcatblk(client->request, buffer, received) == BSTR_OK,
+            "bcatblk");
+      if (binstr(client->request, 0, &HEADER_END) != BSTR_ERR) {
+         check(handle_request(metrics, client) == 0, "handle_request");
+      } else if (blength(client->request) > MAX_REQUEST) {
+         bdestroy(client->request);
+         client->request = NULL;
+         check(respond_error(client, 
+                             "431 Request Header Fields Too Large") == 0,
+               "respond_error");
+      }
+   }
+
+   return flush_client(metrics, client);
+
+error:
+   return CLIENT_ERROR;
+}
+
+//----------------------------------------------------------------------------
+// accept every client waiting on the listening socket
+// return 0 for success, -1 for failure
+static int
+accept_clients(struct Metrics * metrics) {
+//----------------------------------------------------------------------------
+   struct MetricsClient * client = NULL;
+   struct epoll_event event;
+   int fd;
+
+   for (;;) {
+      fd = accept4(metrics->listen_fd, 
+                   NULL, 
+                   NULL, 
+                   SOCK_NONBLOCK | SOCK_CLOEXEC);
+      if (fd == -1) {
+         if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR ||
+             errno == ECONNABORTED) {
+            errno = 0;
+            return 0;
+         }
+         sentinel("accept4");
+      }
+      if (metrics->client_qty >= MAX_CLIENTS) {
+         log_info("metrics at %d clients, refusing client", MAX_CLIENTS);
+         close(fd);
+         continue;
+      }
+
+      client = calloc(1, sizeof(struct MetricsClient));
+      check_mem(client);
+      client->fd = fd;
+      client->request = bfromcstr("");
+      check(client->request != NULL, "bfromcstr");
+
+      event.events = EPOLLIN;
+      event.data.ptr = client;
+      check(epoll_ctl(metrics->epoll_fd, EPOLL_CTL_ADD, fd, &event) == 0,
+            "epoll_ctl");
+
+      client->next = metrics->clients;
+      if (metrics->clients != NULL) metrics->clients->prev = client;
+      metrics->clients = client;
+      metrics->client_qty++;
+      client = NULL;
+   }
+
+error:
+   if (client != NULL) {
+      bdestroy(client->request);
+      free(client);
+      close(fd);
+   }
+   return -1;
+}
+
+//----------------------------------------------------------------------------
+// listen on config.metrics_address, config.metrics_port
+// return 0 for success, -1 for failure
+int
+start_metrics(struct Metrics * metrics, const struct Config * config) {
+//----------------------------------------------------------------------------
+   struct epoll_event listen_event;
+
+   metrics->listen_fd = -1;
+   metrics->epoll_fd = -1;
+   metrics->clients = NULL;
+   metrics->client_qty = 0;
+   metrics->waiting_qty = 0;
+   metrics->scrapes = 0;
+
+   metrics->listen_fd = tcp_listen("metrics", 
+                                   config->metrics_address, 
+                                   config->metrics_port,
+                                   config->handoff_path != NULL);
+   check(metrics->listen_fd != -1, "tcp_listen");
+
+   metrics->epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+   check(metrics->epoll_fd != -1, "epoll_create1");
+
+   // a NULL ptr is the listening socket
+   listen_event.events = EPOLLIN;
+   listen_event.data.ptr = NULL;
+   check(epoll_ctl(metrics->epoll_fd,
+                   EPOLL_CTL_ADD,
+                   metrics->listen_fd,
+                   &listen_event) == 0,
+         "epoll_ctl");
+
+   return 0;
+
+error:
+   return -1;
+}
+
+//----------------------------------------------------------------------------
+// disconnect the clients and close the sockets
+void
+clear_metrics(struct Metrics * metrics) {
+//----------------------------------------------------------------------------
+   while (metrics->clients != NULL) {
+      close_client(metrics, metrics->clients);
+   }
+   if (metrics->epoll_fd != -1) close(metrics->epoll_fd);
+   if (metrics->listen_fd != -1) close(metrics->listen_fd);
+   metrics->epoll_fd = -1;
+   metrics->listen_fd = -1;
+}
+
+//----------------------------------------------------------------------------
+// accept new clients, and read from and write to the ones that are ready
+// afterwards, waiting_qty clients want metrics_respond
+// return 0 for success, -1 for failure
+int
+metrics_handle_events(struct Metrics * metrics) {
+//----------------------------------------------------------------------------
+   struct epoll_event event_list[METRICS_EPOLL_EVENTS];
+   struct MetricsClient * client;
+   enum CLIENT_RESULT result;
+   int event_qty;
+   int i;
+
+   do {
+      event_qty = epoll_wait(metrics->epoll_fd, 
+                             event_list, 
+                             METRICS_EPOLL_EVENTS, 
+                             0);
+      if (event_qty == -1 && errno == EINTR) {
+         errno = 0;
+         return 0;
+      }
+      check(event_qty != -1, "epoll_wait");
+
+      for (i=0; i < event_qty; i++) {
+         client = event_list[i].data.ptr;
+         if (client == NULL) {
+            check(accept_clients(metrics) == 0, "accept_clients");
+            continue;
+         }
+         if (event_list[i].events & (EPOLLIN | EPOLLERR | EPOLLHUP)) {
+            result = read_client(metrics, client);
+         } else {
+            result = flush_client(metrics, client);
+         }
+         check(result != CLIENT_ERROR, "metrics client");
+         if (result == CLIENT_CLOSE) {
+            close_client(metrics, client);
+         }
+      }
+   } while (event_qty == METRICS_EPOLL_EVENTS);
+
+   return 0;
+
+error:
+   return -1;
+}
+
+//----------------------------------------------------------------------------
+// answer the clients waiting for the metrics with body
+// return 0 for success, -1 for failure
+int
+metrics_respond(struct Metrics * metrics, const_bstring body) {
+//----------------------------------------------------------------------------
+   struct MetricsClient * client;
+   struct MetricsClient * next;
+   enum CLIENT_RESULT result;
+
+   for (client=metrics->clients; client != NULL; client=next) {
+      next = client->next;
+      if (!client->waiting) {
+         continue;
+      }
+      client->waiting = false;
+      metrics->waiting_qty--;
+      metrics->scrapes++;
+      check(set_response(client, 
+                         "200 OK", 
+                         "text/plain; version=0.0.4", 
+                         body) == 0,
+            "set_response");
+      result = flush_client(metrics, client);
+      check(result != CLIENT_ERROR, "flush_client");
+      if (result == CLIENT_CLOSE) {
+         close_client(metrics, client);
+      }
+   }
+
+   return 0;
+
+error:
+   return -1;
+}
+
+//----------------------------------------------------------------------------
+// append a metric's HELP and TYPE lines
+// return 0 for success, -1 for failure
+int
+format_metric_header(bstring output,
+                     const char * name,
+                     const char * type,
+                     const char * help) {
+//----------------------------------------------------------------------------
+   return bformata(output, 
+                   "# HELP %s %s\n# TYPE %s %s\n", 
+                   name, 
+                   help, 
+                   name, 
+                   type) == BSTR_OK ? 0 : -1;
+}
+
+//----------------------------------------------------------------------------
+// append a histogram of microseconds as a Prometheus histogram in 
+// seconds, with buckets at powers of 2; labels is 'name="value",...' or
+// empty
+// return 0 for success, -1 for failure
+int
+format_histogram(bstring output, 
+                 const char * name,
+                 const char * labels,
+                 const struct Histogram * histogram) {
+//----------------------------------------------------------------------------
+   bool has_labels = (labels[0] != '\0');
+   const char * separator = has_labels ? "," : "";
+   // no braces without labels
+   const char * open_brace = has_labels ? "{" : "";
+   const char * close_brace = has_labels ? "}" : "";
+   uint64_t limit;
+   int i;
+
+   for (i=0; i < HISTOGRAM_LE_QTY; i++) {
+      limit = 1ULL << i;
+      check(bformata(output,
+                     "%s_bucket{%s%sle=\"%.6f\"} %" PRIu64 "\n",
+                     name,
+                     labels,
+                     separator,
+                     limit / 1e6,
+                     histogram_count_below(histogram, limit)) == BSTR_OK,
+            "bformata");
+   }
+   check(bformata(output,
+                  "%s_bucket{%s%sle=\"+Inf\"} %" PRIu64 "\n",
+                  name,
+                  labels,
+                  separator,
+                  histogram->count) == BSTR_OK,
+         "bformata");
+   check(bformata(output,
+                  "%s_sum%s%s%s %.6f\n"
+                  "%s_count%s%s%s %" PRIu64 "\n",
+                  name,
+                  open_brace,
+                  labels,
+                  close_brace,
+                  histogram->sum / 1e6,
+                  name,
+                  open_brace,
+                  labels,
+                  close_brace,
+                  histogram->count) == BSTR_OK,
+         "bformata");
+
+   return 0;
+
+error:
+   return -1;
+}
@@ -0,0 +1,84 @@
+/*----------------------------------------------------------------------------
+ * metrics.h
+ *
+ * a minimal HTTP/1.1 server for Prometheus: GET /metrics answers with 
+ * what the caller formats, in the text exposition format
+ *--------------------------------------------------------------------------*/
+#if !defined(__METRICS_H__)
+#define __METRICS_H__
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "bstrlib.h"
+#include "config.h"
+#include "histogram.h"
+
+struct MetricsClient {
+   int fd;
+   // the request so far, until we have the whole header
+   bstring request;
+   // the response, and how much of it we have written
+   bstring response;
+   int written;
+   // the request is for the metrics, and waits for metrics_respond
+   bool waiting;
+   // EPOLLOUT is set while some of the response is left
+   bool want_write;
+   struct MetricsClient * prev;
+   struct MetricsClient * next;
+};
+
+struct Metrics {
+   // listening TCP socket, -1 without metrics
+   int listen_fd;
+   // the listening socket and the clients are polled on their own epoll
+   // fd, so we can find the client from the event; this fd is polled in
+   // the main loop
+   int epoll_fd;
+   struct MetricsClient * clients;
+   int client_qty;
+   // clients waiting for metrics_respond
+   int waiting_qty;
+   uint64_t scrapes;
+};
+
+// listen on config.metrics_address, config.metrics_port
+// return 0 for success, -1 for failure
+extern int
+start_metrics(struct Metrics * metrics, const struct Config * config);
+
+// disconnect the clients and close the sockets
+extern void
+clear_metrics(struct Metrics * metrics);
+
+// accept new clients, and read from and write to the ones that are ready
+// afterwards, waiting_qty clients want metrics_respond
+// return 0 for success, -1 for failure
+extern int
+metrics_handle_events(struct Metrics * metrics);
+
+// answer the clients waiting for the metrics with body
+// return 0 for success, -1 for failure
+extern int
+metrics_respond(struct Metrics * metrics, const_bstring body);
+
+// append a metric's HELP and TYPE lines
+// return 0 for success, -1 for failure
+extern int
+format_metric_header(bstring output,
+                     const char * name,
+                     const char * type,
+                     const char * help);
+
+// append a histogram of microseconds as a Prometheus histogram in 
+// seconds, with buckets at powers of 2; labels is 'name="value",...' or
+// empty
+// return 0 for success, -1 for failure
+extern int
+format_histogram(bstring output, 
+                 const char * name,
+                 const char * labels,
+                 const struct Histogram * histogram);
+
+#endif // !defined(__METRICS_H__)
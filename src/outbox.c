@@ -0,0 +1,156 @@
+/*----------------------------------------------------------------------------
+ * outbox.c
+ * 
+ * tail an outbox table: query construction and checkpoints
+ *--------------------------------------------------------------------------*/
+#include <fcntl.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "bstrlib.h"
+#include "config.h"
+#include "dbg_syslog.h"
+#include "outbox.h"
+
+//----------------------------------------------------------------------------
+// build the query for the next batch of rows from the channel's outbox table
+// $1 is the last id we published, $2 is the batch size
+// the caller must bdestroy the result
+// return NULL on failure
+bstring
+outbox_query(const struct Config * config, int channel_index) {
+//----------------------------------------------------------------------------
+   const struct ChannelConfig * channel_config = \
+      &config->channel_config[channel_index];
+   const char * id_column = channel_config->outbox_id_column;
+   const char * payload_column = channel_config->outbox_payload_column;
+
+   if (id_column == NULL) id_column = "id";
+   if (payload_column == NULL) payload_column = "payload";
+
+   return bformat("SELECT %s, %s FROM %s "
+                  "WHERE %s > $1::bigint ORDER BY %s LIMIT $2::integer",
+                  id_column,
+                  payload_column,
+                  channel_config->outbox_table,
+                  id_column,
+                  id_column);
+}
+
+//----------------------------------------------------------------------------
+// the checkpoint file for a channel is <outbox_checkpoint_dir>/<channel>
+// return NULL on failure
+static bstring
+checkpoint_path(const struct Config * config, int channel_index) {
+//----------------------------------------------------------------------------
+   return bformat("%s/%s", 
+                  config->outbox_checkpoint_dir,
+                  (const char *) config->channel_list->entry[channel_index]->data);
+}
+
+//----------------------------------------------------------------------------
+// load the last published id for the channel from outbox_checkpoint_dir
+// *last_id is set to 0 if there is no checkpoint
+// return 0 for success, -1 for failure
+int
+load_outbox_checkpoint(const struct Config * config, 
+                       int channel_index,
+                       uint64_t * last_id) {
+//----------------------------------------------------------------------------
+   bstring path = NULL;
+   FILE * checkpoint_stream = NULL;
+
+   *last_id = 0;
+   if (config->outbox_checkpoint_dir == NULL) {
+      return 0;
+   }
+
+   path = checkpoint_path(config, channel_index);
+   check(path != NULL, "checkpoint_path");
+
+   checkpoint_stream = fopen((const char *) path->data, "r");
+   if (checkpoint_stream == NULL) {
+      log_info("no outbox checkpoint at '%s'", (const char *) path->data);
+   } else {
+      check(fscanf(checkpoint_stream, "%" SCNu64, last_id) == 1, 
+            "invalid checkpoint '%s'", 
+            (const char *) path->data);
+      check(fclose(checkpoint_stream) == 0, "fclose");
+      checkpoint_stream = NULL;
+      log_info("outbox checkpoint '%s' = %" PRIu64, 
+               (const char *) path->data, 
+               *last_id);
+   }
+
+   check(bdestroy(path) == BSTR_OK, "bdestroy(path)");
+   return 0;
+
+error:
+   if (checkpoint_stream != NULL) fclose(checkpoint_stream);
+   bdestroy(path);
+   return -1;
+}
+
+//----------------------------------------------------------------------------
+// save the last published id for the channel to outbox_checkpoint_dir
+// a no-op if outbox_checkpoint_dir is not configured
+// we write a temporary file, sync it and rename it, then sync the 
+// directory, so a crash or a power loss leaves either the old checkpoint 
+// or the new one
+// return 0 for success, -1 for failure
+int
+save_outbox_checkpoint(const struct Config * config, 
+                       int channel_index,
+                       uint64_t last_id) {
+//----------------------------------------------------------------------------
+   bstring path = NULL;
+   bstring temp_path = NULL;
+   FILE * checkpoint_stream = NULL;
+   int dir_fd = -1;
+   int result;
+
+   if (config->outbox_checkpoint_dir == NULL) {
+      return 0;
+   }
+
+   path = checkpoint_path(config, channel_index);
+   check(path != NULL, "checkpoint_path");
+   temp_path = bformat("%s.tmp", (const char *) path->data);
+   check(temp_path != NULL, "bformat");
+
+   checkpoint_stream = fopen((const char *) temp_path->data, "w");
+   check(checkpoint_stream != NULL, "fopen(%s)", (const char *) temp_path->data);
+   check(fprintf(checkpoint_stream, "%" PRIu64 "\n", last_id) > 0, "fprintf");
+   check(fflush(checkpoint_stream) == 0, "fflush");
+   check(fsync(fileno(checkpoint_stream)) == 0, 
+         "fsync(%s)", 
+         (const char *) temp_path->data);
+   result = fclose(checkpoint_stream);
+   checkpoint_stream = NULL;
+   check(result == 0, "fclose");
+
+   check(rename((const char *) temp_path->data, 
+                (const char *) path->data) == 0, 
+         "rename(%s)", 
+         (const char *) path->data);
+
+   // the rename itself is only durable once the directory is
+   dir_fd = open(config->outbox_checkpoint_dir, O_RDONLY | O_DIRECTORY);
+   check(dir_fd != -1, "open(%s)", config->outbox_checkpoint_dir);
+   check(fsync(dir_fd) == 0, "fsync(%s)", config->outbox_checkpoint_dir);
+   check(close(dir_fd) == 0, "close");
+   dir_fd = -1;
+
+   check(bdestroy(path) == BSTR_OK, "bdestroy(path)");
+   check(bdestroy(temp_path) == BSTR_OK, "bdestroy(temp_path)");
+   return 0;
+
+error:
+   if (checkpoint_stream != NULL) fclose(checkpoint_stream);
+   if (dir_fd != -1) close(dir_fd);
+   bdestroy(path);
+   bdestroy(temp_path);
+   return -1;
+}
@@ -0,0 +1,37 @@
+/*----------------------------------------------------------------------------
+ * outbox.h
+ * 
+ * tail an outbox table: query construction and checkpoints
+ *--------------------------------------------------------------------------*/
+#if !defined(__OUTBOX_H__)
+#define __OUTBOX_H__
+
+#include <stdint.h>
+
+#include "bstrlib.h"
+#include "config.h"
+
+// build the query for the next batch of rows from the channel's outbox table
+// $1 is the last id we published, $2 is the batch size
+// the caller must bdestroy the result
+// return NULL on failure
+extern bstring
+outbox_query(const struct Config * config, int channel_index);
+
+// load the last published id for the channel from outbox_checkpoint_dir
+// *last_id is set to 0 if there is no checkpoint
+// return 0 for success, -1 for failure
+extern int
+load_outbox_checkpoint(const struct Config * config, 
+                       int channel_index,
+                       uint64_t * last_id);
+
+// save the last published id for the channel to outbox_checkpoint_dir
+// a no-op if outbox_checkpoint_dir is not configured
+// return 0 for success, -1 for failure
+extern int
+save_outbox_checkpoint(const struct Config * config, 
+                       int channel_index,
+                       uint64_t last_id);
+
+#endif // !defined(__OUTBOX_H__)
@@ -0,0 +1,146 @@
+/*----------------------------------------------------------------------------
+ * output_queue.c
+ * 
+ * what the TCP front ends have yet to write to a client: a queue of 
+ * buffers shared with the other clients, so a message is encoded once 
+ * however many clients get it
+ *--------------------------------------------------------------------------*/
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/types.h>
+#include <sys/uio.h>
+
+#include "bstrlib.h"
+#include "dbg_syslog.h"
+#include "output_queue.h"
+
+// the most buffers in one sendmsg
+#define OUTPUT_IOV_QTY 64
+
+//----------------------------------------------------------------------------
+// a buffer holding data (which it now owns), with one reference: the 
+// caller's
+// return NULL on failure
+struct SharedBuffer *
+create_shared_buffer(bstring data) {
+//----------------------------------------------------------------------------
+   struct SharedBuffer * buffer;
+
+   check(data != NULL, "no data");
+   buffer = malloc(sizeof(struct SharedBuffer));
+   check_mem(buffer);
+   buffer->refcount = 1;
+   buffer->data = data;
+   return buffer;
+
+error:
+   bdestroy(data);
+   return NULL;
+}
+
+//----------------------------------------------------------------------------
+// drop a reference, freeing the buffer with the last
+void
+release_shared_buffer(struct SharedBuffer * buffer) {
+//----------------------------------------------------------------------------
+   if (--buffer->refcount == 0) {
+      bdestroy(buffer->data);
+      free(buffer);
+   }
+}
+
+//----------------------------------------------------------------------------
+// add a reference to buffer at the end of the queue
+// return 0 for success, 1 if the queue would have more than 
+// OUTPUT_QUEUE_SIZE buffers or max_bytes bytes
+int
+output_queue_push(struct OutputQueue * queue, 
+                  struct SharedBuffer * buffer, 
+                  size_t max_bytes) {
+//----------------------------------------------------------------------------
+   size_t length = blength(buffer->data);
+
+   if (queue->qty == OUTPUT_QUEUE_SIZE || queue->bytes + length > max_bytes) {
+      return 1;
+   }
+   queue->entries[(queue->head + queue->qty) % OUTPUT_QUEUE_SIZE] = buffer;
+   queue->qty++;
+   queue->bytes += length;
+   buffer->refcount++;
+   return 0;
+}
+
+//----------------------------------------------------------------------------
+// write as much of the queue to fd as it takes without blocking
+// return 0 for success, -1 if the peer is gone
+int
+output_queue_write(struct OutputQueue * queue, int fd) {
+//----------------------------------------------------------------------------
+   struct iovec iov[OUTPUT_IOV_QTY];
+   struct msghdr header;
+   struct SharedBuffer * first;
+   ssize_t written;
+   size_t remaining;
+   int iov_qty;
+   int i;
+
+   while (queue->qty > 0) {
+      iov_qty = queue->qty < OUTPUT_IOV_QTY ? queue->qty : OUTPUT_IOV_QTY;
+      for (i=0; i < iov_qty; i++) {
+         first = queue->entries[(queue->head + i) % OUTPUT_QUEUE_SIZE];
+         iov[i].iov_base = first->data->data;
+         iov[i].iov_len = blength(first->data);
+      }
+      iov[0].iov_base = (char *) iov[0].iov_base + queue->first_offset;
+      iov[0].iov_len -= queue->first_offset;
+
+      // a writev, but one that can't raise SIGPIPE when the client has
+      // gone, or block
+      memset(&header, 0, sizeof header);
+      header.msg_iov = iov;
+      header.msg_iovlen = iov_qty;
+      written = sendmsg(fd, &header, MSG_DONTWAIT | MSG_NOSIGNAL);
+      if (written == -1) {
+         if (errno == EAGAIN || errno == EWOULDBLOCK) {
+            errno = 0;
+            return 0;
+         }
+         errno = 0;
+         return -1;
+      }
+
+      queue->bytes -= written;
+      remaining = written;
+      while (remaining > 0) {
+         first = queue->entries[queue->head];
+         if (remaining < blength(first->data) - queue->first_offset) {
+            queue->first_offset += remaining;
+            // the socket is full
+            return 0;
+         }
+         remaining -= blength(first->data) - queue->first_offset;
+         queue->first_offset = 0;
+         release_shared_buffer(first);
+         queue->head = (queue->head + 1) % OUTPUT_QUEUE_SIZE;
+         queue->qty--;
+      }
+   }
+
+   return 0;
+}
+
+//----------------------------------------------------------------------------
+// release everything in the queue
+void
+clear_output_queue(struct OutputQueue * queue) {
+//----------------------------------------------------------------------------
+   while (queue->qty > 0) {
+      release_shared_buffer(queue->entries[queue->head]);
+      queue->head = (queue->head + 1) % OUTPUT_QUEUE_SIZE;
+      queue->qty--;
+   }
+   queue->first_offset = 0;
+   queue->bytes = 0;
+}
@@ -0,0 +1,60 @@
+/*----------------------------------------------------------------------------
+ * output_queue.h
+ * 
+ * what the TCP front ends have yet to write to a client: a queue of 
+ * buffers shared with the other clients, so a message is encoded once 
+ * however many clients get it
+ *--------------------------------------------------------------------------*/
+#if !defined(__OUTPUT_QUEUE_H__)
+#define __OUTPUT_QUEUE_H__
+
+#include <stddef.h>
+
+#include "bstrlib.h"
+
+// the most buffers waiting for one client
+#define OUTPUT_QUEUE_SIZE 256
+
+// an encoded message, freed with its last reference
+struct SharedBuffer {
+   int refcount;
+   bstring data;
+};
+
+struct OutputQueue {
+   // circular, the first partly written
+   struct SharedBuffer * entries[OUTPUT_QUEUE_SIZE];
+   int head;
+   int qty;
+   size_t first_offset;
+   size_t bytes;
+};
+
+// a buffer holding data (which it now owns), with one reference: the 
+// caller's
+// return NULL on failure
+extern struct SharedBuffer *
+create_shared_buffer(bstring data);
+
+// drop a reference, freeing the buffer with the last
+extern void
+release_shared_buffer(struct SharedBuffer * buffer);
+
+// add a reference to buffer at the end of the queue
+// return 0 for success, 1 if the queue would have more than 
+// OUTPUT_QUEUE_SIZE buffers or max_bytes bytes
+extern int
+output_queue_push(struct OutputQueue * queue, 
+                  struct SharedBuffer * buffer, 
+                  size_t max_bytes);
+
+// write as much of the queue to fd as it takes without blocking
+// return 0 for success, -1 if the peer is gone
+extern int
+output_queue_write(struct OutputQueue * queue, int fd);
+
+// release everything in the queue
+extern void
+clear_output_queue(struct OutputQueue * queue);
+
+#endif // !defined(__OUTPUT_QUEUE_H__)
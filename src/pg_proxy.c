@@ -0,0 +1,862 @@
+/*----------------------------------------------------------------------------
+ * pg_proxy.c
+ *
+ * a Postgres protocol front end for LISTEN clients: programs using plain
+ * libpq (or psycopg2, ...) connect to us instead of the database, LISTEN,
+ * and get the notifications from our one upstream connection
+ *
+ * We speak just enough of protocol 3.0 for that: the startup handshake
+ * (no SSL, no authentication, so bind to a local address), and simple
+ * queries made of LISTEN, UNLISTEN, SET and transaction commands. LISTEN
+ * takes effect at once, not at commit, and only for channels in our
+ * config. Anything else gets an error. A client that falls
+ * pg_proxy_max_output bytes behind is disconnected.
+ *--------------------------------------------------------------------------*/
+#define _GNU_SOURCE // accept4
+#include <arpa/inet.h>
+#include <ctype.h>
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+#include "bstrlib.h"
+#include "config.h"
+#include "dbg_syslog.h"
+#include "pg_proxy.h"
+#include "tcp_listen.h"
+
+// protocol codes in the startup packet
+static const uint32_t PROTOCOL_3_0 = 196608;
+static const uint32_t CANCEL_REQUEST_CODE = 80877102;
+static const uint32_t SSL_REQUEST_CODE = 80877103;
+static const uint32_t GSSENC_REQUEST_CODE = 80877104;
+
+// the biggest message we accept from a client: LISTEN commands are small
+static const int MAX_CLIENT_MESSAGE = 64 * 1024;
+
+static const int PROXY_EPOLL_EVENTS = 64;
+static const int READ_CHUNK = 4096;
+
+static struct tagbstring EMPTY_BODY = bsStatic("");
+
+// what to do with a client after handling its input
+enum CLIENT_RESULT {
+   CLIENT_OK,
+   CLIENT_CLOSE,
+   CLIENT_ERROR
+};
+
+//----------------------------------------------------------------------------
+// big endian 32 bit integer at data
+static uint32_t
+get_uint32(const unsigned char * data) {
+//----------------------------------------------------------------------------
+   uint32_t value;
+
+   memcpy(&value, data, sizeof value);
+   return ntohl(value);
+}
+
+//----------------------------------------------------------------------------
+// append a big endian 32 bit integer
+// return 0 for success, -1 for failure
+static int
+put_uint32(bstring buffer, uint32_t value) {
+//----------------------------------------------------------------------------
+   uint32_t network_value = htonl(value);
+
+   return bcatblk(buffer, &network_value, sizeof network_value) == BSTR_OK ?
+      0 : -1;
+}
+
+//----------------------------------------------------------------------------
+// append a NUL terminated string
+// return 0 for success, -1 for failure
+static int
+put_string(bstring buffer, const char * value) {
+//----------------------------------------------------------------------------
+   return bcatblk(buffer, value, strlen(value) + 1) == BSTR_OK ? 0 : -1;
+}
+
+//----------------------------------------------------------------------------
+// append a message: type byte, length, body
+// return 0 for success, -1 for failure
+static int
+put_message(bstring buffer, char type, const_bstring body) {
+//----------------------------------------------------------------------------
+   check(bconchar(buffer, type) == BSTR_OK, "bconchar");
+   check(put_uint32(buffer, blength(body) + 4) == 0, "put_uint32");
+   check(bconcat(buffer, body) == BSTR_OK, "bconcat");
+   return 0;
+
+error:
+   return -1;
+}
+
+//----------------------------------------------------------------------------
+// append a message whose body is NUL terminated strings
+// return 0 for success, -1 for failure
+static int
+put_string_message(bstring buffer,
+                   char type,
+                   const char * first,
+                   const char * second) {
+//----------------------------------------------------------------------------
+   bstring body = bfromcstr("");
+   int result;
+
+   check(body != NULL, "bfromcstr");
+   check(put_string(body, first) == 0, "put_string");
+   if (second != NULL) check(put_string(body, second) == 0, "put_string");
+   result = put_message(buffer, type, body);
+   bdestroy(body);
+   return result;
+
+error:
+   bdestroy(body);
+   return -1;
+}
+
+//----------------------------------------------------------------------------
+// append an ErrorResponse
+// return 0 for success, -1 for failure
+static int
+put_error(bstring buffer, const char * sqlstate, const char * message) {
+//----------------------------------------------------------------------------
+   bstring body = bfromcstr("");
+   int result;
+
+   check(body != NULL, "bfromcstr");
+   check(put_string(body, "SERROR") == 0, "put_string");
+   check(put_string(body, "VERROR") == 0, "put_string");
+   check(bconchar(body, 'C') == BSTR_OK, "bconchar");
+   check(put_string(body, sqlstate) == 0, "put_string");
+   check(bconchar(body, 'M') == BSTR_OK, "bconchar");
+   check(put_string(body, message) == 0, "put_string");
+   check(bconchar(body, '\0') == BSTR_OK, "bconchar");
+   result = put_message(buffer, 'E', body);
+   bdestroy(body);
+   return result;
+
+error:
+   bdestroy(body);
+   return -1;
+}
+
+//----------------------------------------------------------------------------
+// append ReadyForQuery
+// return 0 for success, -1 for failure
+static int
+put_ready(struct ProxyClient * client) {
+//----------------------------------------------------------------------------
+   struct tagbstring body;
+
+   blk2tbstr(body, &client->transaction_status, 1);
+   return put_message(client->output, 'Z', &body);
+}
+
+//----------------------------------------------------------------------------
+// write as much of the client's output as the socket takes, and poll for
+// writable while some is left
+// return CLIENT_OK, or CLIENT_CLOSE if the client is gone
+static enum CLIENT_RESULT
+flush_client(struct PgProxy * proxy, struct ProxyClient * client) {
+//----------------------------------------------------------------------------
+   struct epoll_event event;
+   ssize_t sent = 0;
+   bool want_write;
+
+   if (blength(client->output) > 0) {
+      sent = send(client->fd,
+                  client->output->data,
+                  blength(client->output),
+                  MSG_DONTWAIT | MSG_NOSIGNAL);
+      if (sent == -1) {
+         if (errno != EAGAIN && errno != EWOULDBLOCK) {
+            errno = 0;
+            return CLIENT_CLOSE;
+         }
+         errno = 0;
+         sent = 0;
+      }
+      if (sent == blength(client->output)) {
+         client->output->slen = 0;
+      } else {
+         check(bdelete(client->output, 0, sent) == BSTR_OK, "bdelete");
+      }
+   }
+
+   want_write = blength(client->output) > 0;
+   if (want_write != client->want_write) {
+      event.events = EPOLLIN | (want_write ? EPOLLOUT : 0);
+      event.data.ptr = client;
+      check(epoll_ctl(proxy->epoll_fd,
+                      EPOLL_CTL_MOD,
+                      client->fd,
+                      &event) == 0,
+            "epoll_ctl");
+      client->want_write = want_write;
+   }
+
+   return CLIENT_OK;
+
+error:
+   return CLIENT_ERROR;
+}
+
+//----------------------------------------------------------------------------
+// disconnect a client and free it
+static void
+close_client(struct PgProxy * proxy, struct ProxyClient * client) {
+//----------------------------------------------------------------------------
+   // closing the fd takes it out of the epoll set
+   close(client->fd);
+   if (client->prev != NULL) {
+      client->prev->next = client->next;
+   } else {
+      proxy->clients = client->next;
+   }
+   if (client->next != NULL) client->next->prev = client->prev;
+   proxy->client_qty--;
+
+   bdestroy(client->input);
+   bdestroy(client->output);
+   free(client->listening);
+   free(client);
+}
+
+//----------------------------------------------------------------------------
+// answer the startup message: no authentication, a few parameters the
+// client libraries look at, our key, and ready
+// return 0 for success, -1 for failure
+static int
+start_client(struct PgProxy * proxy, struct ProxyClient * client) {
+//----------------------------------------------------------------------------
+   static const char * parameters[][2] = {
+      {"client_encoding", "UTF8"},
+      {"server_encoding", "UTF8"},
+      {"DateStyle", "ISO, MDY"},
+      {"integer_datetimes", "on"},
+      {"standard_conforming_strings", "on"},
+      {"application_name", "skeeter"},
+   };
+   bstring body = bfromcstr("");
+   size_t i;
+
+   check(body != NULL, "bfromcstr");
+
+   // AuthenticationOk
+   check(put_uint32(body, 0) == 0, "put_uint32");
+   check(put_message(client->output, 'R', body) == 0, "put_message");
+
+   check(put_string_message(client->output,
+                            'S',
+                            "server_version",
+                            proxy->server_version) == 0,
+         "put_string_message");
+   for (i=0; i < sizeof parameters / sizeof parameters[0]; i++) {
+      check(put_string_message(client->output,
+                               'S',
+                               parameters[i][0],
+                               parameters[i][1]) == 0,
+            "put_string_message");
+   }
+
+   // BackendKeyData: we don't support cancel, but clients expect one
+   body->slen = 0;
+   check(put_uint32(body, getpid()) == 0, "put_uint32");
+   check(put_uint32(body, proxy->next_key++) == 0, "put_uint32");
+   check(put_message(client->output, 'K', body) == 0, "put_message");
+
+   client->started = true;
+   check(put_ready(client) == 0, "put_ready");
+
+   bdestroy(body);
+   return 0;
+
+error:
+   bdestroy(body);
+   return -1;
+}
+
+//----------------------------------------------------------------------------
+// skip spaces, return the new position
+static int
+skip_space(const_bstring text, int pos) {
+//----------------------------------------------------------------------------
+   while (pos < blength(text) && isspace(text->data[pos])) pos++;
+   return pos;
+}
+
+//----------------------------------------------------------------------------
+// read an SQL identifier at pos: "quoted" as it is, otherwise folded to
+// lower case; a lone * reads as "*"
+// return the identifier, or NULL if there isn't one
+static bstring
+read_identifier(const_bstring text, int * pos) {
+//----------------------------------------------------------------------------
+   bstring identifier = bfromcstr("");
+   int i = skip_space(text, *pos);
+   unsigned char c;
+
+   check(identifier != NULL, "bfromcstr");
+
+   if (i < blength(text) && text->data[i] == '"') {
+      for (i++; i < blength(text); i++) {
+         c = text->data[i];
+         if (c == '"') {
+            if (i+1 < blength(text) && text->data[i+1] == '"') {
+               i++;
+            } else {
+               break;
+            }
+         }
+         check(bconchar(identifier, c) == BSTR_OK, "bconchar");
+      }
+      if (i == blength(text)) goto error; // no closing quote
+      i++;
+   } else if (i < blength(text) && text->data[i] == '*') {
+      check(bconchar(identifier, '*') == BSTR_OK, "bconchar");
+      i++;
+   } else {
+      for (; i < blength(text); i++) {
+         c = text->data[i];
+         if (!isalnum(c) && c != '_' && c != '$' && c < 0x80) break;
+         check(bconchar(identifier, tolower(c)) == BSTR_OK, "bconchar");
+      }
+   }
+
+   if (blength(identifier) == 0) goto error;
+   *pos = i;
+   return identifier;
+
+error:
+   bdestroy(identifier);
+   return NULL;
+}
+
+//----------------------------------------------------------------------------
+// handle one statement of a simple query
+// return 0 if it succeeded, 1 if we sent an error, -1 for failure
+static int
+handle_statement(struct ProxyClient * client,
+                 const struct Config * config,
+                 const_bstring statement) {
+//----------------------------------------------------------------------------
+   bstring command = NULL;
+   bstring channel = NULL;
+   const char * tag = NULL;
+   int pos = 0;
+   int channel_index;
+   int i;
+
+   command = read_identifier(statement, &pos);
+   if (command == NULL) {
+      goto syntax_error;
+   }
+
+   // in a failed transaction, only the end of it will do
+   if (client->transaction_status == 'E' &&
+       !biseqcstr(command, "commit") && !biseqcstr(command, "end") &&
+       !biseqcstr(command, "rollback") && !biseqcstr(command, "abort")) {
+      check(put_error(client->output,
+                      "25P02",
+                      "current transaction is aborted, commands ignored "
+                      "until end of transaction block") == 0,
+            "put_error");
+      bdestroy(command);
+      return 1;
+   }
+
+   if (biseqcstr(command, "listen") || biseqcstr(command, "unlisten")) {
+      channel = read_identifier(statement, &pos);
+      if (channel == NULL) goto syntax_error;
+      if (biseqcstr(command, "unlisten") && biseqcstr(channel, "*")) {
+         for (i=0; i < config->channel_list->qty; i++) {
+            client->listening[i] = false;
+         }
+      } else {
+         channel_index = find_channel_index(config, channel);
+         if (channel_index == -1) {
+            check(put_error(client->output,
+                            "42704",
+                            "skeeter does not LISTEN to this channel") == 0,
+                  "put_error");
+            goto statement_error;
+         }
+         client->listening[channel_index] = biseqcstr(command, "listen");
+      }
+      tag = biseqcstr(command, "listen") ? "LISTEN" : "UNLISTEN";
+   } else if (biseqcstr(command, "begin") || biseqcstr(command, "start")) {
+      // START TRANSACTION, BEGIN [WORK | TRANSACTION] [modes]
+      pos = blength(statement);
+      client->transaction_status = 'T';
+      tag = biseqcstr(command, "begin") ? "BEGIN" : "START TRANSACTION";
+   } else if (biseqcstr(command, "commit") || biseqcstr(command, "end")) {
+      pos = blength(statement);
+      tag = client->transaction_status == 'E' ? "ROLLBACK" : "COMMIT";
+      client->transaction_status = 'I';
+   } else if (biseqcstr(command, "rollback") || biseqcstr(command, "abort")) {
+      pos = blength(statement);
+      client->transaction_status = 'I';
+      tag = "ROLLBACK";
+   } else if (biseqcstr(command, "set")) {
+      // client libraries set things like extra_float_digits on connect
+      pos = blength(statement);
+      tag = "SET";
+   } else {
+      check(put_error(client->output,
+                      "0A000",
+                      "skeeter supports only LISTEN and UNLISTEN") == 0,
+            "put_error");
+      goto statement_error;
+   }
+
+   if (skip_space(statement, pos) != blength(statement)) {
+      goto syntax_error;
+   }
+
+   check(put_string_message(client->output, 'C', tag, NULL) == 0,
+         "put_string_message");
+   bdestroy(command);
+   bdestroy(channel);
+   return 0;
+
+syntax_error:
+   check(put_error(client->output, "42601", "syntax error") == 0,
+         "put_error");
+statement_error:
+   if (client->transaction_status == 'T') client->transaction_status = 'E';
+   bdestroy(command);
+   bdestroy(channel);
+   return 1;
+
+error:
+   bdestroy(command);
+   bdestroy(channel);
+   return -1;
+}
+
+//----------------------------------------------------------------------------
+// handle a simple query: statements separated by ';', stopping at the
+// first error, then ReadyForQuery
+// return 0 for success, -1 for failure
+static int
+handle_query(struct ProxyClient * client,
+             const struct Config * config,
+             const_bstring query) {
+//----------------------------------------------------------------------------
+   bstring statement = NULL;
+   bool in_identifier = false;
+   bool in_literal = false;
+   bool empty = true;
+   int start = 0;
+   int result = 0;
+   int i;
+
+   for (i=0; i <= blength(query) && result == 0; i++) {
+      if (i < blength(query)) {
+         if (query->data[i] == '"' && !in_literal) {
+            in_identifier = !in_identifier;
+         } else if (query->data[i] == '\'' && !in_identifier) {
+            in_literal = !in_literal;
+         }
+         if (query->data[i] != ';' || in_identifier || in_literal) {
+            continue;
+         }
+      }
+      statement = bmidstr(query, start, i - start);
+      check(statement != NULL, "bmidstr");
+      start = i + 1;
+      if (skip_space(statement, 0) < blength(statement)) {
+         empty = false;
+         result = handle_statement(client, config, statement);
+         check(result != -1, "handle_statement");
+      }
+      bdestroy(statement);
+      statement = NULL;
+   }
+
+   if (empty) {
+      check(put_message(client->output, 'I', &EMPTY_BODY) == 0,
+            "put_message");
+   }
+   check(put_ready(client) == 0, "put_ready");
+
+   return 0;
+
+error:
+   bdestroy(statement);
+   return -1;
+}
+
+//----------------------------------------------------------------------------
+// handle the complete messages in the client's input
+// return CLIENT_OK, CLIENT_CLOSE to disconnect the client, CLIENT_ERROR
+static enum CLIENT_RESULT
+handle_input(struct PgProxy * proxy,
+             struct ProxyClient * client,
+             const struct Config * config) {
+//----------------------------------------------------------------------------
+   const unsigned char * data;
+   struct tagbstring body;
+   uint32_t length;
+   uint32_t code;
+   int header_size;
+   char type;
+
+   for (;;) {
+      data = client->input->data;
+      // the startup message has no type byte
+      header_size = client->started ? 5 : 4;
+      if (blength(client->input) < header_size) {
+         break;
+      }
+      length = get_uint32(data + header_size - 4);
+      if (length < 4 || length > (uint32_t) MAX_CLIENT_MESSAGE) {
+         log_info("pg_proxy client message length %u", length);
+         return CLIENT_CLOSE;
+      }
+      if ((uint32_t) blength(client->input) < length + header_size - 4) {
+         break;
+      }
+      blk2tbstr(body, data + header_size, length - 4);
+
+      if (!client->started) {
+         if (length < 8) return CLIENT_CLOSE;
+         code = get_uint32(data + 4);
+         if (code == SSL_REQUEST_CODE || code == GSSENC_REQUEST_CODE) {
+            check(bconchar(client->output, 'N') == BSTR_OK, "bconchar");
+         } else if (code >> 16 == PROTOCOL_3_0 >> 16) {
+            check(start_client(proxy, client) == 0, "start_client");
+         } else {
+            // cancel requests, and protocols we don't speak
+            if (code != CANCEL_REQUEST_CODE) {
+               check(put_error(client->output,
+                               "0A000",
+                               "unsupported frontend protocol") == 0,
+                     "put_error");
+               flush_client(proxy, client);
+            }
+            return CLIENT_CLOSE;
+         }
+      } else {
+         type = data[0];
+         if (type == 'X') {
+            return CLIENT_CLOSE;
+         } else if (type == 'Q') {
+            // the body is a NUL terminated string
+            if (body.slen > 0) body.slen--;
+            check(handle_query(client, config, &body) == 0, "handle_query");
+         } else if (type == 'S') {
+            client->skip_to_sync = false;
+            check(put_ready(client) == 0, "put_ready");
+         } else if (type == 'H') {
+            // Flush: we always flush
+         } else if (!client->skip_to_sync) {
+            // Parse, Bind, Execute, ... : we don't support prepared
+            // statements
+            check(put_error(client->output,
+                            "0A000",
+                            "skeeter supports only simple queries") == 0,
+                  "put_error");
+            client->skip_to_sync = true;
+            if (client->transaction_status == 'T') {
+               client->transaction_status = 'E';
+            }
+         }
+      }
+
+      check(bdelete(client->input, 0, length + header_size - 4) == BSTR_OK,
+            "bdelete");
+   }
+
+   return CLIENT_OK;
+
+error:
+   return CLIENT_ERROR;
+}
+
+//----------------------------------------------------------------------------
+// read what the client has sent and answer it
+// return CLIENT_OK, CLIENT_CLOSE to disconnect the client, CLIENT_ERROR
+static enum CLIENT_RESULT
+read_client(struct PgProxy * proxy,
+            struct ProxyClient * client,
+            const struct Config * config) {
+//----------------------------------------------------------------------------
+   unsigned char buffer[READ_CHUNK];
+   enum CLIENT_RESULT result;
+   ssize_t received;
+
+   for (;;) {
+      received = recv(client->fd, buffer, sizeof buffer, MSG_DONTWAIT);
+      if (received == 0) {
+         return CLIENT_CLOSE;
+      }
+      if (received == -1) {
+         if (errno == EAGAIN || errno == EWOULDBLOCK) {
+            errno = 0;
+            break;
+         }
+         errno = 0;
+         return CLIENT_CLOSE;
+      }
+      check(bcatblk(client->input, buffer, received) == BSTR_OK, "bcatblk");
+      result = handle_input(proxy, client, config);
+      if (result != CLIENT_OK) {
+         return result;
+      }
+   }
+
+   return flush_client(proxy, client);
+
+error:
+   return CLIENT_ERROR;
+}
+
+//----------------------------------------------------------------------------
+// accept every client waiting on the listening socket
+// return 0 for success, -1 for failure
+static int
+accept_clients(struct PgProxy * proxy, const struct Config * config) {
+//----------------------------------------------------------------------------
+   struct ProxyClient * client = NULL;
+   struct epoll_event event;
+   int fd;
+
+   for (;;) {
+      fd = accept4(proxy->listen_fd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+      if (fd == -1) {
+         if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR ||
+             errno == ECONNABORTED) {
+            errno = 0;
+            return 0;
+         }
+         sentinel("accept4");
+      }
+      if (proxy->client_qty >= config->pg_proxy_max_clients) {
+         log_info("pg_proxy at pg_proxy_max_clients (%d), refusing client",
+                  config->pg_proxy_max_clients);
+         close(fd);
+         continue;
+      }
+
+      client = calloc(1, sizeof(struct ProxyClient));
+      check_mem(client);
+      client->fd = fd;
+      client->transaction_status = 'I';
+      client->listening = calloc(config->channel_list->qty, sizeof(bool));
+      check_mem(client->listening);
+      client->input = bfromcstr("");
+      check(client->input != NULL, "bfromcstr");
+      client->output = bfromcstr("");
+      check(client->output != NULL, "bfromcstr");
+
+      event.events = EPOLLIN;
+      event.data.ptr = client;
+      check(epoll_ctl(proxy->epoll_fd, EPOLL_CTL_ADD, fd, &event) == 0,
+            "epoll_ctl");
+
+      client->next = proxy->clients;
+      if (proxy->clients != NULL) proxy->clients->prev = client;
+      proxy->clients = client;
+      proxy->client_qty++;
+      proxy->accepted++;
+      client = NULL;
+   }
+
+error:
+   if (client != NULL) {
+      bdestroy(client->input);
+      bdestroy(client->output);
+      free(client->listening);
+      free(client);
+      close(fd);
+   }
+   return -1;
+}
+
+//----------------------------------------------------------------------------
+// listen on config.pg_proxy_address, config.pg_proxy_port
+// return 0 for success, -1 for failure
+int
+start_pg_proxy(struct PgProxy * proxy, const struct Config * config) {
+//----------------------------------------------------------------------------
+   struct epoll_event listen_event;
+
+   proxy->listen_fd = -1;
+   proxy->epoll_fd = -1;
+   proxy->clients = NULL;
+   proxy->client_qty = 0;
+   proxy->next_key = 1;
+   proxy->accepted = 0;
+   proxy->notified = 0;
+   proxy->disconnected = 0;
+   set_pg_proxy_server_version(proxy, "9.0.0");
+
+   proxy->listen_fd = tcp_listen("pg_proxy", 
+                                 config->pg_proxy_address, 
+                                 config->pg_proxy_port,
+                                 config->handoff_path != NULL);
+   check(proxy->listen_fd != -1, "tcp_listen");
+
+   proxy->epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+   check(proxy->epoll_fd != -1, "epoll_create1");
+
+   // a NULL ptr is the listening socket
+   listen_event.events = EPOLLIN;
+   listen_event.data.ptr = NULL;
+   check(epoll_ctl(proxy->epoll_fd,
+                   EPOLL_CTL_ADD,
+                   proxy->listen_fd,
+                   &listen_event) == 0,
+         "epoll_ctl");
+
+   return 0;
+
+error:
+   return -1;
+}
+
+//----------------------------------------------------------------------------
+// disconnect the clients and close the sockets
+void
+clear_pg_proxy(struct PgProxy * proxy) {
+//----------------------------------------------------------------------------
+   while (proxy->clients != NULL) {
+      close_client(proxy, proxy->clients);
+   }
+   if (proxy->epoll_fd != -1) close(proxy->epoll_fd);
+   if (proxy->listen_fd != -1) close(proxy->listen_fd);
+   proxy->epoll_fd = -1;
+   proxy->listen_fd = -1;
+}
+
+//----------------------------------------------------------------------------
+// accept new clients, and read from and write to the ones that are ready
+// return 0 for success, -1 for failure
+int
+pg_proxy_handle_events(struct PgProxy * proxy, const struct Config * config) {
+//----------------------------------------------------------------------------
+   struct epoll_event event_list[PROXY_EPOLL_EVENTS];
+   struct ProxyClient * client;
+   enum CLIENT_RESULT result;
+   int event_qty;
+   int i;
+
+   do {
+      event_qty = epoll_wait(proxy->epoll_fd,
+                             event_list,
+                             PROXY_EPOLL_EVENTS,
+                             0);
+      if (event_qty == -1 && errno == EINTR) {
+         errno = 0;
+         return 0;
+      }
+      check(event_qty != -1, "epoll_wait");
+
+      for (i=0; i < event_qty; i++) {
+         client = event_list[i].data.ptr;
+         if (client == NULL) {
+            check(accept_clients(proxy, config) == 0, "accept_clients");
+            continue;
+         }
+         if (event_list[i].events & (EPOLLIN | EPOLLERR | EPOLLHUP)) {
+            result = read_client(proxy, client, config);
+         } else {
+            result = flush_client(proxy, client);
+         }
+         check(result != CLIENT_ERROR, "pg_proxy client");
+         if (result == CLIENT_CLOSE) {
+            close_client(proxy, client);
+         }
+      }
+   } while (event_qty == PROXY_EPOLL_EVENTS);
+
+   return 0;
+
+error:
+   return -1;
+}
+
+//----------------------------------------------------------------------------
+// send a notification to every client LISTENing to the channel
+// return 0 for success, -1 for failure
+int
+pg_proxy_notify(struct PgProxy * proxy,
+                const struct Config * config,
+                int channel_index,
+                int be_pid,
+                const char * channel,
+                const char * payload) {
+//----------------------------------------------------------------------------
+   struct ProxyClient * client;
+   struct ProxyClient * next;
+   bstring message = NULL;
+   bstring body = NULL;
+   enum CLIENT_RESULT result;
+
+   for (client = proxy->clients; client != NULL; client = next) {
+      next = client->next;
+      if (!client->listening[channel_index]) {
+         continue;
+      }
+
+      // encode once, for the first listener
+      if (message == NULL) {
+         body = bfromcstr("");
+         check(body != NULL, "bfromcstr");
+         check(put_uint32(body, be_pid) == 0, "put_uint32");
+         check(put_string(body, channel) == 0, "put_string");
+         check(put_string(body, payload) == 0, "put_string");
+         message = bfromcstr("");
+         check(message != NULL, "bfromcstr");
+         check(put_message(message, 'A', body) == 0, "put_message");
+      }
+
+      if (blength(client->output) + blength(message) >
+          config->pg_proxy_max_output) {
+         log_info("pg_proxy client fd %d too slow, disconnecting",
+                  client->fd);
+         proxy->disconnected++;
+         close_client(proxy, client);
+         continue;
+      }
+      check(bconcat(client->output, message) == BSTR_OK, "bconcat");
+      proxy->notified++;
+      result = flush_client(proxy, client);
+      check(result != CLIENT_ERROR, "flush_client");
+      if (result == CLIENT_CLOSE) {
+         close_client(proxy, client);
+      }
+   }
+
+   bdestroy(body);
+   bdestroy(message);
+   return 0;
+
+error:
+   bdestroy(body);
+   bdestroy(message);
+   return -1;
+}
+
+//----------------------------------------------------------------------------
+// the server_version we report to clients that connect from now on
+void
+set_pg_proxy_server_version(struct PgProxy * proxy, const char * version) {
+//----------------------------------------------------------------------------
+   if (version == NULL) {
+      return;
+   }
+   snprintf(proxy->server_version,
+            sizeof proxy->server_version,
+            "%s",
+            version);
+}
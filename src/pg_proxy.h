@@ -0,0 +1,89 @@
+/*----------------------------------------------------------------------------
+ * pg_proxy.h
+ *
+ * a Postgres protocol front end for LISTEN clients: programs using plain
+ * libpq (or psycopg2, ...) connect to us instead of the database, LISTEN,
+ * and get the notifications from our one upstream connection
+ *--------------------------------------------------------------------------*/
+#if !defined(__PG_PROXY_H__)
+#define __PG_PROXY_H__
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "bstrlib.h"
+#include "config.h"
+
+struct ProxyClient {
+   int fd;
+   // false until we have answered the startup message
+   bool started;
+   // for ReadyForQuery: 'I' idle, 'T' in a transaction, 'E' failed
+   char transaction_status;
+   // an extended protocol message failed: skip to the next Sync
+   bool skip_to_sync;
+   // parallel array to config.channel_list
+   bool * listening;
+
+   // what we have read and not yet handled, and what we have not yet
+   // been able to write
+   bstring input;
+   bstring output;
+   // EPOLLOUT is set while output is not empty
+   bool want_write;
+
+   struct ProxyClient * prev;
+   struct ProxyClient * next;
+};
+
+struct PgProxy {
+   // listening TCP socket, -1 without a proxy
+   int listen_fd;
+   // the listening socket and the clients are polled on their own epoll
+   // fd, so we can find the client from the event; this fd is polled in
+   // the main loop
+   int epoll_fd;
+
+   struct ProxyClient * clients;
+   int client_qty;
+
+   // reported to clients at startup, from the upstream connection
+   char server_version[32];
+   // for BackendKeyData
+   uint32_t next_key;
+
+   uint64_t accepted;
+   uint64_t notified;
+   // clients we disconnected because they could not keep up
+   uint64_t disconnected;
+};
+
+// listen on config.pg_proxy_address, config.pg_proxy_port
+// return 0 for success, -1 for failure
+extern int
+start_pg_proxy(struct PgProxy * proxy, const struct Config * config);
+
+// disconnect the clients and close the sockets
+extern void
+clear_pg_proxy(struct PgProxy * proxy);
+
+// accept new clients, and read from and write to the ones that are ready
+// return 0 for success, -1 for failure
+extern int
+pg_proxy_handle_events(struct PgProxy * proxy, const struct Config * config);
+
+// send a notification to every client LISTENing to the channel
+// return 0 for success, -1 for failure
+extern int
+pg_proxy_notify(struct PgProxy * proxy,
+                const struct Config * config,
+                int channel_index,
+                int be_pid,
+                const char * channel,
+                const char * payload);
+
+// the server_version we report to clients that connect from now on
+extern void
+set_pg_proxy_server_version(struct PgProxy * proxy, const char * version);
+
+#endif // !defined(__PG_PROXY_H__)
@@ -0,0 +1,97 @@
+/*----------------------------------------------------------------------------
+ * priority.c
+ * 
+ * priority classes: notifications waiting to be published, and the 
+ * latency of the ones we have handled
+ *--------------------------------------------------------------------------*/
+#include <stdlib.h>
+
+#include "dbg_syslog.h"
+#include "priority.h"
+
+//----------------------------------------------------------------------------
+// queue a notification, the class takes ownership of it
+// return 0 for success, -1 for failure
+int
+push_pending_notification(struct PriorityClass * priority_class,
+                          PGnotify * notification,
+                          int channel_index,
+                          uint64_t received_us) {
+//----------------------------------------------------------------------------
+   struct PendingNotification * pending;
+
+   pending = malloc(sizeof(struct PendingNotification));
+   check_mem(pending);
+   pending->notification = notification;
+   pending->channel_index = channel_index;
+   pending->received_us = received_us;
+   pending->next = NULL;
+
+   if (priority_class->tail == NULL) {
+      priority_class->head = pending;
+   } else {
+      priority_class->tail->next = pending;
+   }
+   priority_class->tail = pending;
+
+   return 0;
+
+error:
+   PQfreemem(notification);
+   return -1;
+}
+
+//----------------------------------------------------------------------------
+// take the oldest notification, NULL if there is none
+// the caller frees it with free()
+struct PendingNotification *
+pop_pending_notification(struct PriorityClass * priority_class) {
+//----------------------------------------------------------------------------
+   struct PendingNotification * pending = priority_class->head;
+
+   if (pending != NULL) {
+      priority_class->head = pending->next;
+      if (priority_class->head == NULL) {
+         priority_class->tail = NULL;
+      }
+   }
+
+   return pending;
+}
+
+//----------------------------------------------------------------------------
+// count a handled notification
+void
+record_class_latency(struct PriorityClass * priority_class, 
+                     uint64_t latency_us) {
+//----------------------------------------------------------------------------
+   priority_class->handled++;
+   priority_class->interval_count++;
+   priority_class->interval_latency_sum_us += latency_us;
+   if (latency_us > priority_class->interval_latency_max_us) {
+      priority_class->interval_latency_max_us = latency_us;
+   }
+}
+
+//----------------------------------------------------------------------------
+// start a new heartbeat interval
+void
+reset_class_latency(struct PriorityClass * priority_class) {
+//----------------------------------------------------------------------------
+   priority_class->interval_count = 0;
+   priority_class->interval_latency_sum_us = 0;
+   priority_class->interval_latency_max_us = 0;
+}
+
+//----------------------------------------------------------------------------
+// release the notifications still waiting
+void
+clear_priority_class(struct PriorityClass * priority_class) {
+//----------------------------------------------------------------------------
+   struct PendingNotification * pending;
+
+   while ((pending = pop_pending_notification(priority_class)) != NULL) {
+      PQfreemem(pending->notification);
+      free(pending);
+   }
+}
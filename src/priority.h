@@ -0,0 +1,63 @@
+/*----------------------------------------------------------------------------
+ * priority.h
+ * 
+ * priority classes: notifications waiting to be published, and the 
+ * latency of the ones we have handled
+ *--------------------------------------------------------------------------*/
+#if !defined(__PRIORITY_H__)
+#define __PRIORITY_H__
+
+#include <stdint.h>
+
+#include <libpq-fe.h>
+
+struct PendingNotification {
+   PGnotify * notification;
+   int channel_index;
+   // monotonic microseconds when we read it from the connection
+   uint64_t received_us;
+   struct PendingNotification * next;
+};
+
+struct PriorityClass {
+   // notifications in arrival order
+   struct PendingNotification * head;
+   struct PendingNotification * tail;
+
+   // notifications handled since we started
+   uint64_t handled;
+
+   // latency from reading a notification to handing it on, since the 
+   // last heartbeat
+   uint64_t interval_count;
+   uint64_t interval_latency_sum_us;
+   uint64_t interval_latency_max_us;
+};
+
+// queue a notification, the class takes ownership of it
+// return 0 for success, -1 for failure
+extern int
+push_pending_notification(struct PriorityClass * priority_class,
+                          PGnotify * notification,
+                          int channel_index,
+                          uint64_t received_us);
+
+// take the oldest notification, NULL if there is none
+// the caller frees it with free()
+extern struct PendingNotification *
+pop_pending_notification(struct PriorityClass * priority_class);
+
+// count a handled notification
+extern void
+record_class_latency(struct PriorityClass * priority_class, 
+                     uint64_t latency_us);
+
+// start a new heartbeat interval
+extern void
+reset_class_latency(struct PriorityClass * priority_class);
+
+// release the notifications still waiting
+extern void
+clear_priority_class(struct PriorityClass * priority_class);
+
+#endif // !defined(__PRIORITY_H__)
@@ -0,0 +1,272 @@
+/*----------------------------------------------------------------------------
+ * pub_monitor.c
+ * 
+ * watch the PUB socket: subscriber connections (from the zeromq socket 
+ * monitor) and subscriptions (from XPUB)
+ *
+ * requires zeromq 4.x
+ *--------------------------------------------------------------------------*/
+#include <stdlib.h>
+#include <string.h>
+
+#include <zmq.h>
+
+#include "bstrlib.h"
+#include "dbg_syslog.h"
+#include "pub_monitor.h"
+#include "zmq_shim.h"
+
+//----------------------------------------------------------------------------
+// start monitoring connections to pub_socket
+// address is the inproc address for the monitor, it must be unique
+// return 0 for success, -1 for failure
+int
+start_pub_monitor(struct PubMonitor * monitor,
+                  void * zmq_context, 
+                  void * pub_socket,
+                  const char * address) {
+//----------------------------------------------------------------------------
+   size_t fd_size = sizeof monitor->fd;
+   int result;
+
+   monitor->monitor_socket = NULL;
+   monitor->fd = -1;
+   monitor->endpoints = NULL;
+   monitor->endpoint_qty = 0;
+
+#if ZMQ_VERSION_MAJOR < 4
+   (void) zmq_context; // unused
+   (void) pub_socket; // unused
+   (void) address; // unused
+   sentinel("the socket monitor requires zeromq 4");
+#else
+   result = zmq_socket_monitor(pub_socket, 
+                               address, 
+                               ZMQ_EVENT_ACCEPTED | ZMQ_EVENT_DISCONNECTED);
+   check(result == 0, "zmq_socket_monitor %s", address);
+
+   monitor->monitor_socket = zmq_socket(zmq_context, ZMQ_PAIR);
+   check(monitor->monitor_socket != NULL, "zmq_socket");
+   check(zmq_connect(monitor->monitor_socket, address) == 0, 
+         "zmq_connect %s", 
+         address);
+
+   result = zmq_getsockopt(monitor->monitor_socket, 
+                           ZMQ_FD, 
+                           &monitor->fd, 
+                           &fd_size);
+   check(result == 0, "zmq_getsockopt ZMQ_FD");
+#endif
+
+   return 0;
+
+error:
+   return -1;
+}
+
+//----------------------------------------------------------------------------
+// release resources used by the monitor
+void
+clear_pub_monitor(struct PubMonitor * monitor) {
+//----------------------------------------------------------------------------
+   int i;
+
+   if (monitor->monitor_socket != NULL) zmq_close(monitor->monitor_socket);
+   monitor->monitor_socket = NULL;
+   for (i=0; i < monitor->endpoint_qty; i++) {
+      bdestroy(monitor->endpoints[i].endpoint);
+   }
+   free(monitor->endpoints);
+   monitor->endpoints = NULL;
+   monitor->endpoint_qty = 0;
+}
+
+//----------------------------------------------------------------------------
+// find the stats for the endpoint, adding them if this is the first event
+// return NULL on failure
+static struct EndpointStats *
+find_endpoint_stats(struct PubMonitor * monitor, const_bstring endpoint) {
+//----------------------------------------------------------------------------
+   struct EndpointStats * stats;
+   int i;
+
+   for (i=0; i < monitor->endpoint_qty; i++) {
+      if (bstrcmp(monitor->endpoints[i].endpoint, endpoint) == 0) {
+         return &monitor->endpoints[i];
+      }
+   }
+
+   stats = realloc(monitor->endpoints, 
+                   (monitor->endpoint_qty+1) * sizeof(struct EndpointStats));
+   check_mem(stats);
+   monitor->endpoints = stats;
+   stats = &monitor->endpoints[monitor->endpoint_qty++];
+   stats->endpoint = bstrcpy(endpoint);
+   check(stats->endpoint != NULL, "bstrcpy");
+   stats->connections = 0;
+   stats->accepted = 0;
+   stats->disconnected = 0;
+
+   return stats;
+
+error:
+   return NULL;
+}
+
+//----------------------------------------------------------------------------
+// read every event the monitor has queued, updating the endpoint stats
+// each event is two frames: 16 bit event, 32 bit value; endpoint
+// return 0 for success, -1 for failure
+int
+process_monitor_events(struct PubMonitor * monitor) {
+//----------------------------------------------------------------------------
+   zmq_msg_t event_message;
+   zmq_msg_t endpoint_message;
+   uint16_t event;
+   bstring endpoint = NULL;
+   struct EndpointStats * stats;
+   int result;
+
+   for (;;) {
+      check(zmq_msg_init(&event_message) == 0, "zmq_msg_init");
+      result = zmq_msg_recv(&event_message, 
+                            monitor->monitor_socket, 
+                            ZMQ_DONTWAIT);
+      if (result == -1 && errno == EAGAIN) {
+         zmq_msg_close(&event_message);
+         errno = 0;
+         break;
+      }
+      check(result != -1, "zmq_msg_recv monitor event");
+      check(zmq_msg_more(&event_message), "monitor event has no endpoint");
+      memcpy(&event, zmq_msg_data(&event_message), sizeof event);
+      zmq_msg_close(&event_message);
+
+      check(zmq_msg_init(&endpoint_message) == 0, "zmq_msg_init");
+      result = zmq_msg_recv(&endpoint_message, monitor->monitor_socket, 0);
+      check(result != -1, "zmq_msg_recv monitor endpoint");
+      endpoint = blk2bstr(zmq_msg_data(&endpoint_message), 
+                          (int) zmq_msg_size(&endpoint_message));
+      zmq_msg_close(&endpoint_message);
+      check(endpoint != NULL, "blk2bstr");
+
+      stats = find_endpoint_stats(monitor, endpoint);
+      check(stats != NULL, "find_endpoint_stats");
+      if (event == ZMQ_EVENT_ACCEPTED) {
+         stats->accepted++;
+         stats->connections++;
+      } else if (event == ZMQ_EVENT_DISCONNECTED) {
+         stats->disconnected++;
+         if (stats->connections > 0) stats->connections--;
+      }
+      debug("monitor event %d %s connections = %d", 
+            event, 
+            (const char *) endpoint->data,
+            stats->connections);
+
+      check(bdestroy(endpoint) == BSTR_OK, "bdestroy");
+      endpoint = NULL;
+   }
+
+   return 0;
+
+error:
+   bdestroy(endpoint);
+   return -1;
+}
+
+//----------------------------------------------------------------------------
+// the number of subscribers connected to all endpoints
+int
+monitor_connection_count(const struct PubMonitor * monitor) {
+//----------------------------------------------------------------------------
+   int i;
+   int count = 0;
+
+   for (i=0; i < monitor->endpoint_qty; i++) {
+      count += monitor->endpoints[i].connections;
+   }
+
+   return count;
+}
+
+//----------------------------------------------------------------------------
+// read every subscribe/unsubscribe message queued on an XPUB socket
+// subscriptions holds the topic prefixes that have at least one subscriber
+// XPUB only tells us about the first subscribe and the last unsubscribe 
+// for a prefix, which is what we want here
+// return 0 for success, -1 for failure
+int
+process_subscriptions(void * xpub_socket, struct bstrList * subscriptions) {
+//----------------------------------------------------------------------------
+   zmq_msg_t message;
+   const unsigned char * data;
+   bstring prefix = NULL;
+   int result;
+   int i;
+
+   for (;;) {
+      check(zmq_msg_init(&message) == 0, "zmq_msg_init");
+      result = zmq_msg_recv(&message, xpub_socket, ZMQ_DONTWAIT);
+      if (result == -1 && errno == EAGAIN) {
+         zmq_msg_close(&message);
+         errno = 0;
+         break;
+      }
+      check(result != -1, "zmq_msg_recv subscription");
+      if (zmq_msg_size(&message) == 0) {
+         zmq_msg_close(&message);
+         continue;
+      }
+
+      data = zmq_msg_data(&message);
+      prefix = blk2bstr(data+1, (int) zmq_msg_size(&message)-1);
+      check(prefix != NULL, "blk2bstr");
+
+      if (data[0] == 1) {
+         debug("subscribe '%s'", (const char *) prefix->data);
+         check(bstrListAlloc(subscriptions, subscriptions->qty+1) == BSTR_OK,
+               "bstrListAlloc");
+         subscriptions->entry[subscriptions->qty++] = prefix;
+         prefix = NULL;
+      } else {
+         debug("unsubscribe '%s'", (const char *) prefix->data);
+         for (i=0; i < subscriptions->qty; i++) {
+            if (bstrcmp(subscriptions->entry[i], prefix) == 0) {
+               bdestroy(subscriptions->entry[i]);
+               subscriptions->entry[i] = \
+                  subscriptions->entry[--subscriptions->qty];
+               break;
+            }
+         }
+         check(bdestroy(prefix) == BSTR_OK, "bdestroy");
+         prefix = NULL;
+      }
+      zmq_msg_close(&message);
+   }
+
+   return 0;
+
+error:
+   bdestroy(prefix);
+   return -1;
+}
+
+//----------------------------------------------------------------------------
+// return 1 if any subscription prefix matches topic, 0 if none does
+int
+is_subscribed(const struct bstrList * subscriptions, const_bstring topic) {
+//----------------------------------------------------------------------------
+   int i;
+
+   for (i=0; i < subscriptions->qty; i++) {
+      if (bstrncmp(subscriptions->entry[i], 
+                   topic, 
+                   blength(subscriptions->entry[i])) == 0 &&
+          blength(subscriptions->entry[i]) <= blength(topic)) {
+         return 1;
+      }
+   }
+
+   return 0;
+}
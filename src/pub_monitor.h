@@ -0,0 +1,66 @@
+/*----------------------------------------------------------------------------
+ * pub_monitor.h
+ * 
+ * watch the PUB socket: subscriber connections (from the zeromq socket 
+ * monitor) and subscriptions (from XPUB)
+ *
+ * requires zeromq 4.x
+ *--------------------------------------------------------------------------*/
+#if !defined(__PUB_MONITOR_H__)
+#define __PUB_MONITOR_H__
+
+#include <stdint.h>
+
+#include "bstrlib.h"
+
+struct EndpointStats {
+   bstring endpoint;
+   // subscribers connected now
+   int connections;
+   uint64_t accepted;
+   uint64_t disconnected;
+};
+
+struct PubMonitor {
+   // PAIR socket connected to the zmq_socket_monitor address
+   void * monitor_socket;
+   // ZMQ_FD of monitor_socket, for epoll
+   int fd;
+
+   struct EndpointStats * endpoints;
+   int endpoint_qty;
+};
+
+// start monitoring connections to pub_socket
+// address is the inproc address for the monitor, it must be unique
+// return 0 for success, -1 for failure
+extern int
+start_pub_monitor(struct PubMonitor * monitor,
+                  void * zmq_context, 
+                  void * pub_socket,
+                  const char * address);
+
+// release resources used by the monitor
+extern void
+clear_pub_monitor(struct PubMonitor * monitor);
+
+// read every event the monitor has queued, updating the endpoint stats
+// return 0 for success, -1 for failure
+extern int
+process_monitor_events(struct PubMonitor * monitor);
+
+// the number of subscribers connected to all endpoints
+extern int
+monitor_connection_count(const struct PubMonitor * monitor);
+
+// read every subscribe/unsubscribe message queued on an XPUB socket
+// subscriptions holds the topic prefixes that have at least one subscriber
+// return 0 for success, -1 for failure
+extern int
+process_subscriptions(void * xpub_socket, struct bstrList * subscriptions);
+
+// return 1 if any subscription prefix matches topic, 0 if none does
+extern int
+is_subscribed(const struct bstrList * subscriptions, const_bstring topic);
+
+#endif // !defined(__PUB_MONITOR_H__)
@@ -0,0 +1,370 @@
+/*----------------------------------------------------------------------------
+ * pub_socket.c
+ * 
+ * the sockets we publish on, one per dedicated endpoint, and one per 
+ * priority class shared by the other endpoints of that class
+ *
+ * zeromq copies the socket options when we bind, so endpoints that share
+ * a socket can still have their own HWM, SNDBUF and keepalive settings.
+ * Each socket gets ZMQ_AFFINITY for its own io thread, so a slow remote
+ * network, or a bulk channel at its HWM, can't add latency for the 
+ * subscribers on another socket.
+ *--------------------------------------------------------------------------*/
+#include <stdbool.h>
+#include <stdlib.h>
+
+#include <zmq.h>
+
+#include "bstrlib.h"
+#include "config.h"
+#include "dbg_syslog.h"
+#include "message.h"
+#include "pub_monitor.h"
+#include "pub_socket.h"
+#include "zmq_shim.h"
+
+//----------------------------------------------------------------------------
+// set an int socket option
+// return 0 for success, -1 for failure
+static int
+set_int_option(void * zmq_socket, int option, int value) {
+//----------------------------------------------------------------------------
+   return zmq_setsockopt(zmq_socket, option, &value, sizeof value);
+}
+
+//----------------------------------------------------------------------------
+// apply the endpoint's socket options and bind it, on listen_fd if it 
+// isn't -1
+// we set every option, even the defaults, so an endpoint on the shared 
+// socket doesn't pick up the options of the one bound before it
+// return 0 for success, -1 for failure
+static int
+bind_endpoint(void * zmq_socket, 
+              const struct EndpointConfig * endpoint,
+              int listen_fd) {
+//----------------------------------------------------------------------------
+   check(set_int_option(zmq_socket, ZMQ_SNDHWM, endpoint->hwm) == 0,
+         "ZMQ_SNDHWM");
+   check(set_int_option(zmq_socket, ZMQ_SNDBUF, endpoint->sndbuf) == 0,
+         "ZMQ_SNDBUF");
+   check(set_int_option(zmq_socket, 
+                        ZMQ_TCP_KEEPALIVE, 
+                        endpoint->tcp_keepalive) == 0,
+         "ZMQ_TCP_KEEPALIVE");
+   check(set_int_option(zmq_socket, 
+                        ZMQ_TCP_KEEPALIVE_IDLE, 
+                        endpoint->tcp_keepalive_idle) == 0,
+         "ZMQ_TCP_KEEPALIVE_IDLE");
+   check(set_int_option(zmq_socket, 
+                        ZMQ_TCP_KEEPALIVE_CNT, 
+                        endpoint->tcp_keepalive_cnt) == 0,
+         "ZMQ_TCP_KEEPALIVE_CNT");
+   check(set_int_option(zmq_socket, 
+                        ZMQ_TCP_KEEPALIVE_INTVL, 
+                        endpoint->tcp_keepalive_intvl) == 0,
+         "ZMQ_TCP_KEEPALIVE_INTVL");
+#if defined(ZMQ_USE_FD)
+   check(set_int_option(zmq_socket, ZMQ_USE_FD, listen_fd) == 0,
+         "ZMQ_USE_FD");
+#else
+   check(listen_fd == -1, "binding on an fd requires zeromq 4.2");
+#endif
+
+   log_info("binding PUB endpoint '%s' to '%s'", endpoint->name, endpoint->uri);
+   check(zmq_bind(zmq_socket, endpoint->uri) == 0, "bind %s", endpoint->uri);
+
+   return 0;
+
+error:
+   return -1;
+}
+
+//----------------------------------------------------------------------------
+// create one XPUB socket, with its monitor
+// affinity 0 lets zeromq pick the io thread
+// return 0 for success, -1 for failure
+static int
+create_pub_socket(const struct Config * config,
+                  void * zmq_context,
+                  struct PubSocket * pub_socket,
+                  int socket_index,
+                  uint64_t affinity) {
+//----------------------------------------------------------------------------
+   size_t fd_size = sizeof pub_socket->fd;
+   bstring monitor_address = NULL;
+   int result;
+
+   pub_socket->zmq_socket = zmq_socket(zmq_context, ZMQ_XPUB);
+   check(pub_socket->zmq_socket != NULL, "zmq_socket");
+
+   // so closing the socket can't hold up shutdown indefinitely
+   result = set_int_option(pub_socket->zmq_socket, 
+                           ZMQ_LINGER, 
+                           config->shutdown_linger);
+   check(result == 0, "zmq_setsockopt ZMQ_LINGER");
+
+   if (affinity != 0) {
+      result = zmq_setsockopt(pub_socket->zmq_socket,
+                              ZMQ_AFFINITY,
+                              &affinity,
+                              sizeof affinity);
+      check(result == 0, "zmq_setsockopt ZMQ_AFFINITY");
+   }
+
+   if (config->pub_socket_nodrop) {
+#if defined(ZMQ_XPUB_NODROP)
+      result = zmq_setsockopt(pub_socket->zmq_socket,
+                              ZMQ_XPUB_NODROP,
+                              &config->pub_socket_nodrop,
+                              sizeof config->pub_socket_nodrop);
+      check(result == 0, "zmq_setsockopt ZMQ_XPUB_NODROP");
+#else
+      sentinel("pub_socket_nodrop requires zeromq 4.1");
+#endif
+   }
+
+   result = zmq_getsockopt(pub_socket->zmq_socket,
+                           ZMQ_FD,
+                           &pub_socket->fd,
+                           &fd_size);
+   check(result == 0, "zmq_getsockopt ZMQ_FD");
+
+   pub_socket->subscriptions = bstrListCreate();
+   check_mem(pub_socket->subscriptions);
+
+   monitor_address = bformat("inproc://skeeter-pub-monitor-%d", socket_index);
+   check(monitor_address != NULL, "bformat");
+   result = start_pub_monitor(&pub_socket->monitor,
+                              zmq_context,
+                              pub_socket->zmq_socket,
+                              (const char *) monitor_address->data);
+   check(result == 0, "start_pub_monitor");
+
+   bdestroy(monitor_address);
+   return 0;
+
+error:
+   bdestroy(monitor_address);
+   return -1;
+}
+
+//----------------------------------------------------------------------------
+// create the sockets and bind every endpoint in config->endpoint_config
+// first the shared socket of each priority class that has shared 
+// endpoints, then one socket per dedicated endpoint
+// return 0 for success, -1 for failure
+int
+create_pub_sockets(const struct Config * config,
+                   void * zmq_context,
+                   const int * listen_fds,
+                   struct PubSocket ** pub_sockets,
+                   int * pub_socket_qty) {
+//----------------------------------------------------------------------------
+   const struct EndpointConfig * endpoint;
+   struct PubSocket * pub_socket;
+   int class_qty = config->priority_class_list->qty;
+   int * shared_index = NULL;
+   bool use_affinity;
+   int qty = 0;
+   int i;
+   int socket_index;
+
+   *pub_sockets = NULL;
+   *pub_socket_qty = 0;
+   if (config->endpoint_list->qty == 0) {
+      return 0;
+   }
+
+   // the socket index of each class's shared socket, -1 if it has none
+   shared_index = malloc(class_qty * sizeof(int));
+   check_mem(shared_index);
+   for (i=0; i < class_qty; i++) {
+      shared_index[i] = -1;
+   }
+   for (i=0; i < config->endpoint_list->qty; i++) {
+      endpoint = &config->endpoint_config[i];
+      if (!endpoint->dedicated_socket && 
+          shared_index[endpoint->priority_class_index] == -1) {
+         shared_index[endpoint->priority_class_index] = 0;
+      }
+   }
+   for (i=0; i < class_qty; i++) {
+      if (shared_index[i] != -1) {
+         shared_index[i] = qty++;
+      }
+   }
+   for (i=0; i < config->endpoint_list->qty; i++) {
+      if (config->endpoint_config[i].dedicated_socket) qty++;
+   }
+
+   // socket n is served by io thread n
+   use_affinity = qty > 1;
+   if (use_affinity && qty > config->zmq_thread_pool_size) {
+      log_err("zmq_thread_pool_size %d is too small for %d PUB sockets, "
+              "not setting io thread affinity",
+              config->zmq_thread_pool_size,
+              qty);
+      use_affinity = false;
+   }
+
+   *pub_sockets = calloc(qty, sizeof(struct PubSocket));
+   check_mem(*pub_sockets);
+   for (i=0; i < qty; i++) {
+      (*pub_sockets)[i].fd = -1;
+      (*pub_sockets)[i].monitor.fd = -1;
+   }
+   *pub_socket_qty = qty;
+
+   for (i=0; i < class_qty; i++) {
+      socket_index = shared_index[i];
+      if (socket_index == -1) {
+         continue;
+      }
+      pub_socket = &(*pub_sockets)[socket_index];
+      pub_socket->name = \
+         (const char *) config->priority_class_list->entry[i]->data;
+      pub_socket->priority_class = i;
+      check(create_pub_socket(config, 
+                              zmq_context, 
+                              pub_socket, 
+                              socket_index,
+                              use_affinity ? 
+                                 (uint64_t) 1 << socket_index : 0) == 0,
+            "create_pub_socket");
+   }
+
+   // the dedicated sockets follow the shared ones
+   socket_index = 0;
+   for (i=0; i < class_qty; i++) {
+      if (shared_index[i] != -1) socket_index++;
+   }
+
+   for (i=0; i < config->endpoint_list->qty; i++) {
+      endpoint = &config->endpoint_config[i];
+      if (endpoint->dedicated_socket) {
+         pub_socket = &(*pub_sockets)[socket_index];
+         pub_socket->name = endpoint->name;
+         pub_socket->priority_class = endpoint->priority_class_index;
+         check(create_pub_socket(config, 
+                                 zmq_context, 
+                                 pub_socket, 
+                                 socket_index,
+                                 use_affinity ? 
+                                    (uint64_t) 1 << socket_index : 0) == 0,
+               "create_pub_socket");
+         socket_index++;
+      } else {
+         pub_socket = \
+            &(*pub_sockets)[shared_index[endpoint->priority_class_index]];
+      }
+      check(bind_endpoint(pub_socket->zmq_socket, endpoint, listen_fds[i]) 
+            == 0, "bind_endpoint");
+   }
+
+   free(shared_index);
+   return 0;
+
+error:
+   free(shared_index);
+   return -1;
+}
+
+//----------------------------------------------------------------------------
+// close the sockets and release resources
+void
+clear_pub_sockets(struct PubSocket * pub_sockets, int pub_socket_qty) {
+//----------------------------------------------------------------------------
+   int i;
+
+   if (pub_sockets == NULL) {
+      return;
+   }
+   for (i=0; i < pub_socket_qty; i++) {
+      clear_pub_monitor(&pub_sockets[i].monitor);
+      if (pub_sockets[i].zmq_socket != NULL) {
+         zmq_close(pub_sockets[i].zmq_socket);
+      }
+      if (pub_sockets[i].subscriptions != NULL) {
+         bstrListDestroy(pub_sockets[i].subscriptions);
+      }
+   }
+   free(pub_sockets);
+}
+
+//----------------------------------------------------------------------------
+// publish the message on every socket of the priority class
+// *dropped is set to the number of sockets that dropped it at the HWM
+// return the number of sockets we published on, -1 for failure
+int
+publish_on_sockets(const struct bstrList * message_list,
+                   struct PubSocket * pub_sockets,
+                   int pub_socket_qty,
+                   int priority_class,
+                   int * dropped) {
+//----------------------------------------------------------------------------
+   int i;
+   int result;
+   int published = 0;
+
+   *dropped = 0;
+   for (i=0; i < pub_socket_qty; i++) {
+      if (priority_class != ALL_PRIORITY_CLASSES && 
+          pub_sockets[i].priority_class != priority_class) {
+         continue;
+      }
+      result = publish_message(message_list, pub_sockets[i].zmq_socket);
+      check(result != -1, "publish_message on '%s'", pub_sockets[i].name);
+      if (result == 1) {
+         pub_sockets[i].dropped++;
+         (*dropped)++;
+      } else {
+         pub_sockets[i].published++;
+         published++;
+      }
+   }
+
+   return published;
+
+error:
+   return -1;
+}
+
+//----------------------------------------------------------------------------
+// forward received frames on every socket of the priority class, 
+// sharing their buffers (see forward_message)
+// *dropped is set to the number of sockets that dropped it at the HWM
+// return the number of sockets we forwarded on, -1 for failure
+int
+forward_on_sockets(zmq_msg_t * frames,
+                   int frame_qty,
+                   struct PubSocket * pub_sockets,
+                   int pub_socket_qty,
+                   int priority_class,
+                   int * dropped) {
+//----------------------------------------------------------------------------
+   int i;
+   int result;
+   int published = 0;
+
+   *dropped = 0;
+   for (i=0; i < pub_socket_qty; i++) {
+      if (priority_class != ALL_PRIORITY_CLASSES && 
+          pub_sockets[i].priority_class != priority_class) {
+         continue;
+      }
+      result = forward_message(frames, frame_qty, pub_sockets[i].zmq_socket);
+      check(result != -1, "forward_message on '%s'", pub_sockets[i].name);
+      if (result == 1) {
+         pub_sockets[i].dropped++;
+         (*dropped)++;
+      } else {
+         pub_sockets[i].published++;
+         published++;
+      }
+   }
+
+   return published;
+
+error:
+   return -1;
+}
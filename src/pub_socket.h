@@ -0,0 +1,79 @@
+/*----------------------------------------------------------------------------
+ * pub_socket.h
+ * 
+ * the sockets we publish on, one per dedicated endpoint, and one per 
+ * priority class shared by the other endpoints of that class
+ *--------------------------------------------------------------------------*/
+#if !defined(__PUB_SOCKET_H__)
+#define __PUB_SOCKET_H__
+
+#include <stdint.h>
+
+#include <zmq.h>
+
+#include "bstrlib.h"
+#include "config.h"
+#include "pub_monitor.h"
+
+struct PubSocket {
+   // the endpoint name for a dedicated socket, the priority class name 
+   // for a shared one
+   const char * name;
+   // position in config.priority_class_list
+   int priority_class;
+
+   // an XPUB socket, so we learn about subscriptions
+   void * zmq_socket;
+   // ZMQ_FD of zmq_socket, for epoll
+   int fd;
+   // topic prefixes with at least one subscriber
+   struct bstrList * subscriptions;
+
+   struct PubMonitor monitor;
+
+   // send outcomes: dropped is only counted with pub_socket_nodrop
+   uint64_t published;
+   uint64_t dropped;
+};
+
+// create the sockets and bind every endpoint in config->endpoint_config,
+// on its fd in listen_fds (parallel to config->endpoint_config) unless 
+// that is -1
+// return 0 for success, -1 for failure
+extern int
+create_pub_sockets(const struct Config * config,
+                   void * zmq_context,
+                   const int * listen_fds,
+                   struct PubSocket ** pub_sockets,
+                   int * pub_socket_qty);
+
+// close the sockets and release resources
+extern void
+clear_pub_sockets(struct PubSocket * pub_sockets, int pub_socket_qty);
+
+// the value of priority_class for publish_on_sockets to use every socket
+static const int ALL_PRIORITY_CLASSES = -1;
+
+// publish the message on every socket of the priority class
+// *dropped is set to the number of sockets that dropped it at the HWM
+// return the number of sockets we published on, -1 for failure
+extern int
+publish_on_sockets(const struct bstrList * message_list,
+                   struct PubSocket * pub_sockets,
+                   int pub_socket_qty,
+                   int priority_class,
+                   int * dropped);
+
+// forward received frames on every socket of the priority class, 
+// sharing their buffers (see forward_message)
+// *dropped is set to the number of sockets that dropped it at the HWM
+// return the number of sockets we forwarded on, -1 for failure
+extern int
+forward_on_sockets(zmq_msg_t * frames,
+                   int frame_qty,
+                   struct PubSocket * pub_sockets,
+                   int pub_socket_qty,
+                   int priority_class,
+                   int * dropped);
+
+#endif // !defined(__PUB_SOCKET_H__)
@@ -0,0 +1,50 @@
+/*----------------------------------------------------------------------------
+ * rate_limit.c
+ * 
+ * per channel token bucket
+ *--------------------------------------------------------------------------*/
+#include "rate_limit.h"
+
+//----------------------------------------------------------------------------
+// start with a full bucket
+void
+initialize_token_bucket(struct TokenBucket * bucket, 
+                        int rate, 
+                        int burst,
+                        uint64_t now_us) {
+//----------------------------------------------------------------------------
+   bucket->rate = rate;
+   bucket->burst = (burst > 0) ? burst : rate;
+   bucket->tokens = bucket->burst;
+   bucket->last_refill_us = now_us;
+   bucket->dropped = 0;
+}
+
+//----------------------------------------------------------------------------
+// take a token if there is one
+// return true if the message may be published, false (and count it as 
+// dropped) if it is over the limit
+bool
+token_bucket_take(struct TokenBucket * bucket, uint64_t now_us) {
+//----------------------------------------------------------------------------
+   if (bucket->rate == 0) {
+      return true;
+   }
+
+   if (now_us > bucket->last_refill_us) {
+      bucket->tokens += \
+         bucket->rate * (double) (now_us - bucket->last_refill_us) / 1e6;
+      if (bucket->tokens > bucket->burst) {
+         bucket->tokens = bucket->burst;
+      }
+      bucket->last_refill_us = now_us;
+   }
+
+   if (bucket->tokens < 1.0) {
+      bucket->dropped++;
+      return false;
+   }
+
+   bucket->tokens -= 1.0;
+   return true;
+}
@@ -0,0 +1,37 @@
+/*----------------------------------------------------------------------------
+ * rate_limit.h
+ * 
+ * per channel token bucket
+ *--------------------------------------------------------------------------*/
+#if !defined(__RATE_LIMIT_H__)
+#define __RATE_LIMIT_H__
+
+#include <stdbool.h>
+#include <stdint.h>
+
+struct TokenBucket {
+   // tokens per second, 0 means no limit
+   double rate;
+   double burst;
+
+   double tokens;
+   uint64_t last_refill_us;
+
+   // messages over the limit since the last summary
+   uint64_t dropped;
+};
+
+// start with a full bucket
+extern void
+initialize_token_bucket(struct TokenBucket * bucket, 
+                        int rate, 
+                        int burst,
+                        uint64_t now_us);
+
+// take a token if there is one
+// return true if the message may be published, false (and count it as 
+// dropped) if it is over the limit
+extern bool
+token_bucket_take(struct TokenBucket * bucket, uint64_t now_us);
+
+#endif // !defined(__RATE_LIMIT_H__)
@@ -0,0 +1,757 @@
+/*----------------------------------------------------------------------------
+ * reactor.c
+ *
+ * the event loop: an epoll fd (or an io_uring) whose registered fds each
+ * have a handler, carrying the callback and its context
+ *
+ * With io_uring, each handler has a poll request in flight: one-shot, and
+ * re-armed after the callback, for level triggered handlers (like epoll,
+ * the poll completes at once if the fd is still ready) and multishot for
+ * EPOLLET. The requests queued by the callbacks go in with the next wait,
+ * so changing what we poll for costs no syscall of its own.
+ *--------------------------------------------------------------------------*/
+#include <errno.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+
+#if defined(HAVE_IO_URING)
+#include <linux/io_uring.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#endif
+
+#include "dbg_syslog.h"
+#include "reactor.h"
+
+//----------------------------------------------------------------------------
+// note when we woke up with something to dispatch
+static void
+set_woke(struct Reactor * reactor) {
+//----------------------------------------------------------------------------
+   struct timespec now;
+
+   clock_gettime(CLOCK_MONOTONIC, &now);
+   reactor->woke_us = (uint64_t) now.tv_sec * 1000000 + now.tv_nsec / 1000;
+}
+
+#if defined(HAVE_IO_URING)
+
+// user_data of requests whose completions we ignore (POLL_REMOVE)
+#define URING_IGNORE 0
+
+struct UringSlot {
+   // NULL for a free slot
+   struct ReactorHandler * handler;
+   // in the user_data of the slot's requests, bumped whenever the slot's
+   // poll is removed, so we ignore completions of earlier requests
+   uint32_t generation;
+};
+
+struct Uring {
+   int ring_fd;
+
+   void * sq_ring;
+   size_t sq_ring_size;
+   void * cq_ring;
+   size_t cq_ring_size;
+   struct io_uring_sqe * sqes;
+   size_t sqes_size;
+
+   unsigned * sq_head;
+   unsigned * sq_tail;
+   unsigned * sq_mask;
+   unsigned * sq_entries;
+   unsigned * sq_array;
+   unsigned * cq_head;
+   unsigned * cq_tail;
+   unsigned * cq_mask;
+   struct io_uring_cqe * cqes;
+
+   // queued and not yet taken by the kernel
+   unsigned to_submit;
+
+   struct UringSlot * slots;
+   int slot_qty;
+};
+
+//----------------------------------------------------------------------------
+// io_uring_enter(2): there is no libc wrapper
+static int
+uring_enter(struct Uring * uring,
+            unsigned min_complete,
+            unsigned flags,
+            void * arg,
+            size_t arg_size) {
+//----------------------------------------------------------------------------
+   int result = (int) syscall(__NR_io_uring_enter,
+                              uring->ring_fd,
+                              uring->to_submit,
+                              min_complete,
+                              flags,
+                              arg,
+                              arg_size);
+   int saved_errno = errno;
+
+   // whatever happened to the wait, the kernel took what it could
+   uring->to_submit = \
+      *uring->sq_tail - __atomic_load_n(uring->sq_head, __ATOMIC_ACQUIRE);
+   errno = saved_errno;
+   return result;
+}
+
+//----------------------------------------------------------------------------
+// give the kernel what we have queued
+// return 0 for success, -1 for failure
+static int
+uring_submit(struct Uring * uring) {
+//----------------------------------------------------------------------------
+   while (uring->to_submit > 0) {
+      if (uring_enter(uring, 0, 0, NULL, 0) == -1) {
+         check(errno == EINTR, "io_uring_enter");
+      }
+   }
+
+   return 0;
+
+error:
+   return -1;
+}
+
+//----------------------------------------------------------------------------
+// the next submission queue entry, cleared
+// return NULL for failure
+static struct io_uring_sqe *
+uring_get_sqe(struct Uring * uring) {
+//----------------------------------------------------------------------------
+   unsigned tail = *uring->sq_tail;
+   struct io_uring_sqe * sqe;
+   unsigned index;
+
+   if (tail - __atomic_load_n(uring->sq_head, __ATOMIC_ACQUIRE) ==
+       *uring->sq_entries) {
+      // full: make room
+      check(uring_submit(uring) == 0, "uring_submit");
+   }
+
+   index = tail & *uring->sq_mask;
+   sqe = &uring->sqes[index];
+   memset(sqe, 0, sizeof(struct io_uring_sqe));
+   uring->sq_array[index] = index;
+   __atomic_store_n(uring->sq_tail, tail + 1, __ATOMIC_RELEASE);
+   uring->to_submit++;
+
+   return sqe;
+
+error:
+   return NULL;
+}
+
+//----------------------------------------------------------------------------
+static uint64_t
+uring_user_data(const struct Uring * uring, int slot) {
+//----------------------------------------------------------------------------
+   // slot + 1, so no poll of ours is URING_IGNORE
+   return ((uint64_t) uring->slots[slot].generation << 32) |
+          (uint64_t) (slot + 1);
+}
+
+//----------------------------------------------------------------------------
+// queue a poll request for the handler
+// return 0 for success, -1 for failure
+static int
+uring_poll_add(struct Uring * uring, struct ReactorHandler * handler) {
+//----------------------------------------------------------------------------
+   struct io_uring_sqe * sqe = uring_get_sqe(uring);
+
+   check(sqe != NULL, "uring_get_sqe");
+   sqe->opcode = IORING_OP_POLL_ADD;
+   sqe->fd = handler->fd;
+   sqe->poll32_events = handler->events & ~EPOLLET;
+   if ((handler->events & EPOLLET) != 0) {
+      sqe->len = IORING_POLL_ADD_MULTI;
+   }
+   sqe->user_data = uring_user_data(uring, handler->uring_slot);
+
+   return 0;
+
+error:
+   return -1;
+}
+
+//----------------------------------------------------------------------------
+// queue the removal of the handler's poll request, and forget about it
+// return 0 for success, -1 for failure
+static int
+uring_poll_remove(struct Uring * uring, struct ReactorHandler * handler) {
+//----------------------------------------------------------------------------
+   uint64_t user_data = uring_user_data(uring, handler->uring_slot);
+   struct io_uring_sqe * sqe;
+
+   // ignore its completions, even if we can't remove it
+   uring->slots[handler->uring_slot].generation++;
+
+   sqe = uring_get_sqe(uring);
+   check(sqe != NULL, "uring_get_sqe");
+   sqe->opcode = IORING_OP_POLL_REMOVE;
+   sqe->fd = -1;
+   sqe->addr = user_data;
+   sqe->user_data = URING_IGNORE;
+
+   return 0;
+
+error:
+   return -1;
+}
+
+//----------------------------------------------------------------------------
+// a free slot for handler
+// return the slot, -1 for failure
+static int
+uring_allocate_slot(struct Uring * uring, struct ReactorHandler * handler) {
+//----------------------------------------------------------------------------
+   struct UringSlot * slots;
+   int slot_qty;
+   int slot;
+
+   for (slot=0; slot < uring->slot_qty; slot++) {
+      if (uring->slots[slot].handler == NULL) {
+         break;
+      }
+   }
+   if (slot == uring->slot_qty) {
+      slot_qty = uring->slot_qty == 0 ? 16 : 2 * uring->slot_qty;
+      slots = realloc(uring->slots, slot_qty * sizeof(struct UringSlot));
+      check_mem(slots);
+      memset(&slots[uring->slot_qty],
+             0,
+             (slot_qty - uring->slot_qty) * sizeof(struct UringSlot));
+      uring->slots = slots;
+      uring->slot_qty = slot_qty;
+   }
+   uring->slots[slot].handler = handler;
+
+   return slot;
+
+error:
+   return -1;
+}
+
+//----------------------------------------------------------------------------
+static void
+clear_uring(struct Uring * uring) {
+//----------------------------------------------------------------------------
+   if (uring == NULL) {
+      return;
+   }
+   if (uring->sqes != NULL) munmap(uring->sqes, uring->sqes_size);
+   if (uring->cq_ring != NULL && uring->cq_ring != uring->sq_ring) {
+      munmap(uring->cq_ring, uring->cq_ring_size);
+   }
+   if (uring->sq_ring != NULL) munmap(uring->sq_ring, uring->sq_ring_size);
+   if (uring->ring_fd != -1) close(uring->ring_fd);
+   free(uring->slots);
+   free(uring);
+}
+
+//----------------------------------------------------------------------------
+// map one of the io_uring's regions
+// return NULL for failure
+static void *
+map_uring(int ring_fd, size_t size, off_t offset) {
+//----------------------------------------------------------------------------
+   void * region = mmap(NULL,
+                        size,
+                        PROT_READ | PROT_WRITE,
+                        MAP_SHARED | MAP_POPULATE,
+                        ring_fd,
+                        offset);
+   return region == MAP_FAILED ? NULL : region;
+}
+
+//----------------------------------------------------------------------------
+// set up an io_uring with room for entries requests
+// return NULL for failure, with errno saying why
+static struct Uring *
+start_uring(unsigned entries) {
+//----------------------------------------------------------------------------
+   struct io_uring_params params;
+   struct Uring * uring;
+   char * sq_ring;
+   char * cq_ring;
+   int saved_errno;
+
+   uring = calloc(1, sizeof(struct Uring));
+   if (uring == NULL) {
+      return NULL;
+   }
+
+   memset(&params, 0, sizeof(params));
+   uring->ring_fd = (int) syscall(__NR_io_uring_setup, entries, &params);
+   if (uring->ring_fd == -1) {
+      goto error;
+   }
+   // we wait with a timeout through IORING_ENTER_EXT_ARG (linux 5.11),
+   // multishot polls want 5.13, which has IORING_FEAT_NATIVE_WORKERS
+   if ((params.features & IORING_FEAT_EXT_ARG) == 0 ||
+       (params.features & IORING_FEAT_NATIVE_WORKERS) == 0) {
+      errno = ENOSYS;
+      goto error;
+   }
+
+   uring->sq_ring_size = \
+      params.sq_off.array + params.sq_entries * sizeof(unsigned);
+   uring->cq_ring_size = \
+      params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+   if (uring->cq_ring_size > uring->sq_ring_size) {
+      uring->sq_ring_size = uring->cq_ring_size;
+   }
+   // IORING_FEAT_SINGLE_MMAP (linux 5.4) is implied by the features above
+   uring->sq_ring = map_uring(uring->ring_fd,
+                              uring->sq_ring_size,
+                              IORING_OFF_SQ_RING);
+   if (uring->sq_ring == NULL) {
+      goto error;
+   }
+   uring->cq_ring = uring->sq_ring;
+   uring->sqes_size = params.sq_entries * sizeof(struct io_uring_sqe);
+   uring->sqes = map_uring(uring->ring_fd, uring->sqes_size, IORING_OFF_SQES);
+   if (uring->sqes == NULL) {
+      goto error;
+   }
+
+   sq_ring = (char *) uring->sq_ring;
+   uring->sq_head = (unsigned *) (sq_ring + params.sq_off.head);
+   uring->sq_tail = (unsigned *) (sq_ring + params.sq_off.tail);
+   uring->sq_mask = (unsigned *) (sq_ring + params.sq_off.ring_mask);
+   uring->sq_entries = (unsigned *) (sq_ring + params.sq_off.ring_entries);
+   uring->sq_array = (unsigned *) (sq_ring + params.sq_off.array);
+   cq_ring = (char *) uring->cq_ring;
+   uring->cq_head = (unsigned *) (cq_ring + params.cq_off.head);
+   uring->cq_tail = (unsigned *) (cq_ring + params.cq_off.tail);
+   uring->cq_mask = (unsigned *) (cq_ring + params.cq_off.ring_mask);
+   uring->cqes = (struct io_uring_cqe *) (cq_ring + params.cq_off.cqes);
+
+   return uring;
+
+error:
+   saved_errno = errno;
+   clear_uring(uring);
+   errno = saved_errno;
+   return NULL;
+}
+
+//----------------------------------------------------------------------------
+// submit what we have queued and wait up to timeout_ms milliseconds
+// (-1 forever) for a completion
+// return 0 for success, 1 on timeout or an interrupted wait, -1 for failure
+static int
+uring_wait(struct Uring * uring, int timeout_ms) {
+//----------------------------------------------------------------------------
+   struct io_uring_getevents_arg arg;
+   struct __kernel_timespec timeout;
+
+   memset(&arg, 0, sizeof(arg));
+   if (timeout_ms >= 0) {
+      timeout.tv_sec = timeout_ms / 1000;
+      timeout.tv_nsec = (timeout_ms % 1000) * 1000000L;
+      arg.ts = (uint64_t) (uintptr_t) &timeout;
+   }
+   if (uring_enter(uring,
+                   timeout_ms == 0 ? 0 : 1,
+                   IORING_ENTER_GETEVENTS | IORING_ENTER_EXT_ARG,
+                   &arg,
+                   sizeof(arg)) == -1) {
+      // as with epoll_wait, an interrupted wait is not an error
+      if (errno == EINTR || errno == ETIME) {
+         return 1;
+      }
+      // the completion queue overflowed: we are about to drain it
+      check(errno == EBUSY, "io_uring_enter");
+   }
+
+   return 0;
+
+error:
+   return -1;
+}
+
+//----------------------------------------------------------------------------
+// call the handlers of up to batch_size completions
+// return the number of handlers called, -1 for failure
+static int
+uring_reap(struct Reactor * reactor) {
+//----------------------------------------------------------------------------
+   struct Uring * uring = reactor->uring;
+   struct io_uring_cqe cqe;
+   struct ReactorHandler * handler;
+   uint32_t generation;
+   unsigned head;
+   int slot;
+   int dispatched = 0;
+
+   head = *uring->cq_head;
+   while (dispatched < reactor->batch_size &&
+          head != __atomic_load_n(uring->cq_tail, __ATOMIC_ACQUIRE)) {
+      cqe = uring->cqes[head & *uring->cq_mask];
+      head++;
+      // release the entry before the callback, which may queue requests
+      __atomic_store_n(uring->cq_head, head, __ATOMIC_RELEASE);
+
+      if (cqe.user_data == URING_IGNORE) {
+         continue;
+      }
+      // an index, not a pointer: a callback adding handlers may move
+      // the slots
+      slot = (int) (cqe.user_data & 0xffffffff) - 1;
+      generation = (uint32_t) (cqe.user_data >> 32);
+      handler = uring->slots[slot].handler;
+      // removed (or modified) since the request went in
+      if (handler == NULL || uring->slots[slot].generation != generation) {
+         continue;
+      }
+
+      dispatched++;
+      check(handler->callback(handler,
+                              cqe.res < 0 ? EPOLLERR : (uint32_t) cqe.res)
+            == 0, "callback");
+
+      // a one-shot poll is done, and so is a multishot poll without
+      // IORING_CQE_F_MORE: arm another, unless the callback removed or
+      // modified the handler (which may be gone, so don't look at it)
+      if ((cqe.flags & IORING_CQE_F_MORE) == 0 &&
+          uring->slots[slot].handler == handler &&
+          uring->slots[slot].generation == generation) {
+         check(uring_poll_add(uring, handler) == 0, "uring_poll_add");
+      }
+   }
+
+   return dispatched;
+
+error:
+   return -1;
+}
+
+//----------------------------------------------------------------------------
+// wait up to timeout_ms milliseconds for completions, and call the
+// handlers of up to batch_size of them
+// return the number of handlers called, 0 on timeout or an interrupted
+// wait, -1 for failure
+static int
+uring_dispatch(struct Reactor * reactor, int timeout_ms) {
+//----------------------------------------------------------------------------
+   struct timespec now;
+   int64_t deadline_ms = 0;
+   int wait_ms = timeout_ms;
+   int result;
+
+   if (timeout_ms > 0) {
+      clock_gettime(CLOCK_MONOTONIC, &now);
+      deadline_ms = now.tv_sec * 1000LL + now.tv_nsec / 1000000 + timeout_ms;
+   }
+
+   for (;;) {
+      result = uring_wait(reactor->uring, wait_ms);
+      check(result != -1, "uring_wait");
+      if (result == 1) {
+         return 0;
+      }
+      set_woke(reactor);
+      result = uring_reap(reactor);
+      check(result != -1, "uring_reap");
+      // the completions of removed polls wake us too: unless it's time,
+      // wait for one that matters
+      if (result > 0 || timeout_ms == 0) {
+         break;
+      }
+      if (timeout_ms > 0) {
+         clock_gettime(CLOCK_MONOTONIC, &now);
+         wait_ms = (int) (deadline_ms - 
+                          (now.tv_sec * 1000LL + now.tv_nsec / 1000000));
+         if (wait_ms <= 0) {
+            break;
+         }
+      }
+   }
+
+   // a host polling reactor_fd won't call us again until a poll completes,
+   // so it can't wait for the next call to submit the polls we re-armed
+   if (timeout_ms == 0) {
+      check(uring_submit(reactor->uring) == 0, "uring_submit");
+   }
+
+   return result;
+
+error:
+   return -1;
+}
+
+#endif // defined(HAVE_IO_URING)
+
+//----------------------------------------------------------------------------
+void
+initialize_reactor_handler(struct ReactorHandler * handler,
+                           reactor_callback callback,
+                           void * context) {
+//----------------------------------------------------------------------------
+   handler->fd = -1;
+   handler->events = 0;
+   handler->callback = callback;
+   handler->context = context;
+   handler->uring_slot = -1;
+}
+
+//----------------------------------------------------------------------------
+// create the epoll fd (or io_uring), with room for batch_size events
+// per wait
+// return 0 for success, -1 for failure
+int
+start_reactor(struct Reactor * reactor,
+              enum REACTOR_BACKEND backend,
+              int batch_size) {
+//----------------------------------------------------------------------------
+   reactor->epoll_fd = -1;
+   reactor->uring = NULL;
+   reactor->event_list = NULL;
+   reactor->dispatch_next = 0;
+   reactor->dispatch_qty = 0;
+   reactor->woke_us = 0;
+   check(batch_size > 0, "invalid batch size %d", batch_size);
+   reactor->batch_size = batch_size;
+
+   if (backend == REACTOR_IO_URING) {
+#if defined(HAVE_IO_URING)
+      // the polls of a batch's callbacks, with the removals of the ones
+      // they changed, all wait for the next io_uring_enter
+      reactor->uring = start_uring(batch_size < 64 ? 128 : 2 * batch_size);
+      if (reactor->uring != NULL) {
+         log_info("reactor using io_uring");
+         return 0;
+      }
+      log_info("io_uring unavailable (%s), using epoll", strerror(errno));
+#else
+      log_info("skeeter was built without WITH_IO_URING, using epoll");
+#endif
+   }
+
+   reactor->epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+   check(reactor->epoll_fd != -1, "epoll_create1");
+
+   reactor->event_list = calloc(batch_size, sizeof(struct epoll_event));
+   check_mem(reactor->event_list);
+
+   return 0;
+
+error:
+   clear_reactor(reactor);
+   return -1;
+}
+
+//----------------------------------------------------------------------------
+void
+clear_reactor(struct Reactor * reactor) {
+//----------------------------------------------------------------------------
+   if (reactor->epoll_fd != -1) close(reactor->epoll_fd);
+   reactor->epoll_fd = -1;
+#if defined(HAVE_IO_URING)
+   clear_uring(reactor->uring);
+#endif
+   reactor->uring = NULL;
+   free(reactor->event_list);
+   reactor->event_list = NULL;
+   reactor->dispatch_next = 0;
+   reactor->dispatch_qty = 0;
+}
+
+//----------------------------------------------------------------------------
+// the fd that is readable when reactor_dispatch has something to do
+int
+reactor_fd(struct Reactor * reactor) {
+//----------------------------------------------------------------------------
+#if defined(HAVE_IO_URING)
+   if (reactor->uring != NULL) {
+      // the host waits on the ring for our polls, so they must be in
+      if (uring_submit(reactor->uring) != 0) {
+         log_err("uring_submit");
+      }
+      return reactor->uring->ring_fd;
+   }
+#endif
+   return reactor->epoll_fd;
+}
+
+//----------------------------------------------------------------------------
+// start polling fd for events, calling the handler
+// return 0 for success, -1 for failure
+int
+reactor_add(struct Reactor * reactor,
+            struct ReactorHandler * handler,
+            int fd,
+            uint32_t events) {
+//----------------------------------------------------------------------------
+   struct epoll_event event;
+
+   check(handler->fd == -1, "handler already registered for fd %d",
+         handler->fd);
+   check(handler->callback != NULL, "NULL callback");
+
+#if defined(HAVE_IO_URING)
+   if (reactor->uring != NULL) {
+      handler->uring_slot = uring_allocate_slot(reactor->uring, handler);
+      check(handler->uring_slot != -1, "uring_allocate_slot");
+      handler->fd = fd;
+      handler->events = events;
+      if (uring_poll_add(reactor->uring, handler) != 0) {
+         reactor->uring->slots[handler->uring_slot].handler = NULL;
+         handler->uring_slot = -1;
+         handler->fd = -1;
+         handler->events = 0;
+         return -1;
+      }
+      return 0;
+   }
+#endif
+
+   event.events = events;
+   event.data.ptr = handler;
+   check(epoll_ctl(reactor->epoll_fd, EPOLL_CTL_ADD, fd, &event) == 0,
+         "epoll_ctl add %d", fd);
+   handler->fd = fd;
+   handler->events = events;
+
+   return 0;
+
+error:
+   return -1;
+}
+
+//----------------------------------------------------------------------------
+// poll the handler's fd for other events
+// return 0 for success, -1 for failure
+int
+reactor_modify(struct Reactor * reactor,
+               struct ReactorHandler * handler,
+               uint32_t events) {
+//----------------------------------------------------------------------------
+   struct epoll_event event;
+
+   check(handler->fd != -1, "handler not registered");
+
+#if defined(HAVE_IO_URING)
+   if (reactor->uring != NULL) {
+      check(uring_poll_remove(reactor->uring, handler) == 0,
+            "uring_poll_remove");
+      handler->events = events;
+      check(uring_poll_add(reactor->uring, handler) == 0, "uring_poll_add");
+      return 0;
+   }
+#endif
+
+   event.events = events;
+   event.data.ptr = handler;
+   check(epoll_ctl(reactor->epoll_fd, EPOLL_CTL_MOD, handler->fd, &event)
+         == 0, "epoll_ctl mod %d", handler->fd);
+   handler->events = events;
+
+   return 0;
+
+error:
+   return -1;
+}
+
+//----------------------------------------------------------------------------
+// stop polling the handler's fd, dropping its events still in the batch
+// return 0 for success, -1 for failure (the handler is unregistered anyway)
+int
+reactor_remove(struct Reactor * reactor, struct ReactorHandler * handler) {
+//----------------------------------------------------------------------------
+   struct epoll_event event;
+   int result;
+   int i;
+
+   if (handler->fd == -1) {
+      return 0;
+   }
+
+#if defined(HAVE_IO_URING)
+   if (reactor->uring != NULL) {
+      // the new generation drops the completions still in the ring
+      result = uring_poll_remove(reactor->uring, handler);
+      reactor->uring->slots[handler->uring_slot].handler = NULL;
+      handler->uring_slot = -1;
+      handler->fd = -1;
+      handler->events = 0;
+      return result;
+   }
+#endif
+
+   // the event is ignored, but kernels before 2.6.9 want one
+   event.events = 0;
+   event.data.ptr = NULL;
+   result = epoll_ctl(reactor->epoll_fd, EPOLL_CTL_DEL, handler->fd, &event);
+   handler->fd = -1;
+   handler->events = 0;
+
+   for (i=reactor->dispatch_next; i < reactor->dispatch_qty; i++) {
+      if (reactor->event_list[i].data.ptr == handler) {
+         reactor->event_list[i].data.ptr = NULL;
+      }
+   }
+
+   return result == 0 ? 0 : -1;
+}
+
+//----------------------------------------------------------------------------
+// wait up to timeout_ms milliseconds for events, and call their handlers
+// return the number of events, 0 on timeout or an interrupted wait,
+// -1 for failure
+int
+reactor_dispatch(struct Reactor * reactor, int timeout_ms) {
+//----------------------------------------------------------------------------
+   struct epoll_event * event;
+   struct ReactorHandler * handler;
+   int event_qty;
+
+#if defined(HAVE_IO_URING)
+   if (reactor->uring != NULL) {
+      return uring_dispatch(reactor, timeout_ms);
+   }
+#endif
+
+   event_qty = epoll_wait(reactor->epoll_fd,
+                          reactor->event_list,
+                          reactor->batch_size,
+                          timeout_ms);
+   // we can get 'interrupted system call' from zeromq at shutdown
+   // we don't treat it as an error
+   if (event_qty == -1 && errno == EINTR) {
+      return 0;
+   }
+   check(event_qty != -1, "epoll_wait");
+   if (event_qty > 0) {
+      set_woke(reactor);
+   }
+
+   reactor->dispatch_next = 0;
+   reactor->dispatch_qty = event_qty;
+   while (reactor->dispatch_next < reactor->dispatch_qty) {
+      // past this event before the callback, which may remove its handler
+      event = &reactor->event_list[reactor->dispatch_next++];
+      handler = (struct ReactorHandler *) event->data.ptr;
+      // removed by an earlier callback in this batch
+      if (handler == NULL) {
+         continue;
+      }
+      check(handler->callback(handler, event->events) == 0, "callback");
+   }
+
+   reactor->dispatch_next = 0;
+   reactor->dispatch_qty = 0;
+   return event_qty;
+
+error:
+   reactor->dispatch_next = 0;
+   reactor->dispatch_qty = 0;
+   return -1;
+}
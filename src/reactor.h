@@ -0,0 +1,107 @@
+/*----------------------------------------------------------------------------
+ * reactor.h
+ *
+ * the event loop: an epoll fd (or an io_uring) whose registered fds each 
+ * have a handler, carrying the callback and its context
+ *--------------------------------------------------------------------------*/
+#if !defined(__REACTOR_H__)
+#define __REACTOR_H__
+
+#include <stdint.h>
+#include <sys/epoll.h>
+
+#include "config.h"
+
+struct ReactorHandler;
+struct Uring;
+
+// called with the events reported for the handler's fd (with io_uring,
+// the poll(2) flags, which have the same values)
+// return 0 for success, -1 for failure
+typedef int (* reactor_callback)(struct ReactorHandler * handler,
+                                 uint32_t events);
+
+struct ReactorHandler {
+   // -1 while the handler is not registered
+   int fd;
+   // as registered: EPOLLIN, EPOLLOUT, ..., with EPOLLET for edge triggered
+   uint32_t events;
+   reactor_callback callback;
+   void * context;
+   // the handler's entry in the io_uring's table, -1 with epoll
+   int uring_slot;
+};
+
+struct Reactor {
+   // -1 with the io_uring backend
+   int epoll_fd;
+   // NULL with the epoll backend
+   struct Uring * uring;
+   // the events from one epoll_wait
+   struct epoll_event * event_list;
+   int batch_size;
+   // while dispatching: the events of the batch still to dispatch, so a
+   // handler can be removed (and freed) by a callback in the same batch
+   int dispatch_next;
+   int dispatch_qty;
+   // CLOCK_MONOTONIC microseconds when the last wait returned something
+   // to dispatch, for timing how long we take over it
+   uint64_t woke_us;
+};
+
+// an unregistered handler
+extern void
+initialize_reactor_handler(struct ReactorHandler * handler,
+                           reactor_callback callback,
+                           void * context);
+
+// create the epoll fd (or io_uring, falling back to epoll if the kernel
+// won't give us one), with room for batch_size events per wait
+// return 0 for success, -1 for failure
+extern int
+start_reactor(struct Reactor * reactor,
+              enum REACTOR_BACKEND backend,
+              int batch_size);
+
+// close the epoll fd (or io_uring), the registered fds are left to their 
+// owners
+extern void
+clear_reactor(struct Reactor * reactor);
+
+// the fd that is readable when reactor_dispatch has something to do, for
+// a host's event loop. With io_uring, only reactor_dispatch with a 
+// timeout of 0 submits what the callbacks queued before returning.
+extern int
+reactor_fd(struct Reactor * reactor);
+
+// start polling fd for events, calling the handler; handlers may be added
+// from a callback
+// return 0 for success, -1 for failure
+extern int
+reactor_add(struct Reactor * reactor,
+            struct ReactorHandler * handler,
+            int fd,
+            uint32_t events);
+
+// poll the handler's fd for other events
+// return 0 for success, -1 for failure
+extern int
+reactor_modify(struct Reactor * reactor,
+               struct ReactorHandler * handler,
+               uint32_t events);
+
+// stop polling the handler's fd; events for it still waiting in the batch
+// being dispatched are dropped, so the handler may be freed from a
+// callback. Call this before closing the fd.
+// return 0 for success, -1 for failure (the handler is unregistered anyway)
+extern int
+reactor_remove(struct Reactor * reactor, struct ReactorHandler * handler);
+
+// wait up to timeout_ms milliseconds (-1 forever) for events, and call
+// their handlers, stopping at the first that fails
+// return the number of events, 0 on timeout or an interrupted wait,
+// -1 for failure
+extern int
+reactor_dispatch(struct Reactor * reactor, int timeout_ms);
+
+#endif // !defined(__REACTOR_H__)
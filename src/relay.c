@@ -0,0 +1,178 @@
+/*----------------------------------------------------------------------------
+ * relay.c
+ * 
+ * relay mode: subscribe to an upstream skeeter, so we can publish its 
+ * messages to our own subscribers
+ *
+ * The frames go out as they came in (sequence numbers, batches and
+ * compression are untouched), and zeromq shares their buffers between
+ * the sockets we forward them on.
+ *--------------------------------------------------------------------------*/
+#include <errno.h>
+#include <stdbool.h>
+
+#include <zmq.h>
+
+#include "config.h"
+#include "dbg_syslog.h"
+#include "relay.h"
+#include "zmq_shim.h"
+
+//----------------------------------------------------------------------------
+// connect to the upstream and subscribe to every channel in 
+// config.channel_list
+// return 0 for success, -1 for failure
+int
+start_relay(struct Relay * relay, 
+            const struct Config * config, 
+            void * zmq_context) {
+//----------------------------------------------------------------------------
+   size_t fd_size = sizeof relay->fd;
+   int linger = 0;
+   bstring channel;
+   int result;
+   int i;
+
+   relay->received = 0;
+   relay->discarded = 0;
+
+   relay->zmq_socket = zmq_socket(zmq_context, ZMQ_SUB);
+   check(relay->zmq_socket != NULL, "zmq_socket");
+
+   // the subscriptions queued for an upstream we never reached are not 
+   // worth holding up shutdown for
+   result = zmq_setsockopt(relay->zmq_socket, 
+                           ZMQ_LINGER, 
+                           &linger, 
+                           sizeof linger);
+   check(result == 0, "zmq_setsockopt ZMQ_LINGER");
+
+   if (config->relay_hwm != -1) {
+      result = zmq_setsockopt(relay->zmq_socket,
+                              ZMQ_RCVHWM,
+                              &config->relay_hwm,
+                              sizeof config->relay_hwm);
+      check(result == 0, "zmq_setsockopt ZMQ_RCVHWM");
+   }
+
+   // not the upstream heartbeat: we publish our own
+   for (i=0; i < config->channel_list->qty; i++) {
+      channel = config->channel_list->entry[i];
+      result = zmq_setsockopt(relay->zmq_socket,
+                              ZMQ_SUBSCRIBE,
+                              channel->data,
+                              blength(channel));
+      check(result == 0, "zmq_setsockopt ZMQ_SUBSCRIBE");
+   }
+
+   result = zmq_getsockopt(relay->zmq_socket,
+                           ZMQ_FD,
+                           &relay->fd,
+                           &fd_size);
+   check(result == 0, "zmq_getsockopt ZMQ_FD");
+
+   log_info("relaying from '%s'", config->relay_upstream);
+   result = zmq_connect(relay->zmq_socket, config->relay_upstream);
+   check(result == 0, "zmq_connect %s", config->relay_upstream);
+
+   return 0;
+
+error:
+   return -1;
+}
+
+//----------------------------------------------------------------------------
+// close the socket
+void
+clear_relay(struct Relay * relay) {
+//----------------------------------------------------------------------------
+   if (relay->zmq_socket != NULL) {
+      zmq_close(relay->zmq_socket);
+      relay->zmq_socket = NULL;
+   }
+}
+
+//----------------------------------------------------------------------------
+// close received frames
+void
+close_frames(zmq_msg_t * frames, int frame_qty) {
+//----------------------------------------------------------------------------
+   int i;
+
+   for (i=0; i < frame_qty; i++) {
+      zmq_msg_close(&frames[i]);
+   }
+}
+
+//----------------------------------------------------------------------------
+// true if there is another frame of the message we are receiving
+static bool
+more_frames(void * zmq_socket) {
+//----------------------------------------------------------------------------
+   int more = 0;
+   size_t more_size = sizeof more;
+
+   if (zmq_getsockopt(zmq_socket, ZMQ_RCVMORE, &more, &more_size) != 0) {
+      return false;
+   }
+   return more != 0;
+}
+
+//----------------------------------------------------------------------------
+// receive the next message without waiting
+// messages with more than MAX_RELAY_FRAMES frames are discarded
+// on success the caller owns the frames, and closes them with close_frames
+// return 1 for a message, 0 if there is none, -1 for failure
+int
+receive_relay_message(struct Relay * relay, 
+                      zmq_msg_t * frames, 
+                      int * frame_qty) {
+//----------------------------------------------------------------------------
+   zmq_msg_t discard;
+   bool too_many;
+   int result;
+
+   for (;;) {
+      *frame_qty = 0;
+      check(zmq_msg_init(&frames[0]) == 0, "zmq_msg_init");
+      result = zmq_msg_recv(&frames[0], relay->zmq_socket, ZMQ_DONTWAIT);
+      if (result == -1 && errno == EAGAIN) {
+         zmq_msg_close(&frames[0]);
+         errno = 0;
+         return 0;
+      }
+      check(result != -1, "zmq_msg_recv");
+      *frame_qty = 1;
+      relay->received++;
+
+      // the rest of a multipart message is already here
+      too_many = false;
+      while (more_frames(relay->zmq_socket)) {
+         if (*frame_qty == MAX_RELAY_FRAMES) {
+            too_many = true;
+            check(zmq_msg_init(&discard) == 0, "zmq_msg_init");
+            result = zmq_msg_recv(&discard, relay->zmq_socket, 0);
+            zmq_msg_close(&discard);
+            check(result != -1, "zmq_msg_recv");
+            continue;
+         }
+         check(zmq_msg_init(&frames[*frame_qty]) == 0, "zmq_msg_init");
+         (*frame_qty)++;
+         result = zmq_msg_recv(&frames[*frame_qty-1], relay->zmq_socket, 0);
+         check(result != -1, "zmq_msg_recv");
+      }
+
+      if (!too_many) {
+         return 1;
+      }
+      log_err("discarding a relayed message of more than %d frames",
+              MAX_RELAY_FRAMES);
+      relay->discarded++;
+      close_frames(frames, *frame_qty);
+   }
+
+error:
+   close_frames(frames, *frame_qty);
+   *frame_qty = 0;
+   return -1;
+}
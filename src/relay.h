@@ -0,0 +1,57 @@
+/*----------------------------------------------------------------------------
+ * relay.h
+ * 
+ * relay mode: subscribe to an upstream skeeter, so we can publish its 
+ * messages to our own subscribers
+ *--------------------------------------------------------------------------*/
+#if !defined(__RELAY_H__)
+#define __RELAY_H__
+
+#include <stdint.h>
+
+#include <zmq.h>
+
+#include "config.h"
+
+// the most frames in a message we relay
+#define MAX_RELAY_FRAMES 8
+
+struct Relay {
+   // a SUB socket connected to config.relay_upstream, NULL if we are 
+   // not relaying
+   void * zmq_socket;
+   // ZMQ_FD of zmq_socket, for epoll
+   int fd;
+
+   uint64_t received;
+   // messages that are not for one of our channels, or have too many 
+   // frames
+   uint64_t discarded;
+};
+
+// connect to the upstream and subscribe to every channel in 
+// config.channel_list
+// return 0 for success, -1 for failure
+extern int
+start_relay(struct Relay * relay, 
+            const struct Config * config, 
+            void * zmq_context);
+
+// close the socket
+extern void
+clear_relay(struct Relay * relay);
+
+// receive the next message without waiting
+// messages with more than MAX_RELAY_FRAMES frames are discarded
+// on success the caller owns the frames, and closes them with close_frames
+// return 1 for a message, 0 if there is none, -1 for failure
+extern int
+receive_relay_message(struct Relay * relay, 
+                      zmq_msg_t * frames, 
+                      int * frame_qty);
+
+// close received frames
+extern void
+close_frames(zmq_msg_t * frames, int frame_qty);
+
+#endif // !defined(__RELAY_H__)
@@ -0,0 +1,1017 @@
+/*----------------------------------------------------------------------------
+ * resp.c
+ *
+ * a Redis pub/sub front end: clients speak RESP, SUBSCRIBE or PSUBSCRIBE,
+ * and get our messages as Redis message and pmessage replies
+ *
+ * We take SUBSCRIBE, UNSUBSCRIBE, PSUBSCRIBE, PUNSUBSCRIBE, PING and QUIT,
+ * as RESP arrays or inline commands. Anything else gets an error, as
+ * Redis gives a client in subscribed mode. A client can SUBSCRIBE to any
+ * name, but only our channels have messages.
+ *
+ * Each message is encoded once per channel (and once per pattern that
+ * matches it), and the same buffer is queued for every subscriber. Since
+ * our channels are fixed, a pattern is matched against all of them when
+ * it is subscribed; publishing only looks up the result. A client whose
+ * output reaches OUTPUT_QUEUE_SIZE messages or resp_max_output bytes is
+ * evicted.
+ *--------------------------------------------------------------------------*/
+#define _GNU_SOURCE // accept4
+#include <errno.h>
+#include <fnmatch.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+#include "bstrlib.h"
+#include "config.h"
+#include "dbg_syslog.h"
+#include "output_queue.h"
+#include "resp.h"
+#include "tcp_listen.h"
+
+// limits on what a client sends us: commands are small
+static const int MAX_ARGUMENTS = 1024;
+static const int MAX_BULK = 64 * 1024;
+static const int MAX_RESP_INPUT = 1024 * 1024;
+
+static const int RESP_EPOLL_EVENTS = 64;
+static const int READ_CHUNK = 4096;
+
+static struct tagbstring LINE_END = bsStatic("\r\n");
+static struct tagbstring SUBSCRIBE = bsStatic("subscribe");
+static struct tagbstring UNSUBSCRIBE = bsStatic("unsubscribe");
+static struct tagbstring PSUBSCRIBE = bsStatic("psubscribe");
+static struct tagbstring PUNSUBSCRIBE = bsStatic("punsubscribe");
+static struct tagbstring PING = bsStatic("ping");
+static struct tagbstring QUIT = bsStatic("quit");
+
+// what to do with a client after reading or writing
+enum CLIENT_RESULT {
+   CLIENT_OK,
+   CLIENT_CLOSE,
+   CLIENT_ERROR
+};
+
+//----------------------------------------------------------------------------
+// append a bulk string: $<length>\r\n<data>\r\n
+// return 0 for success, -1 for failure
+static int
+put_bulk(bstring buffer, const void * data, int length) {
+//----------------------------------------------------------------------------
+   check(bformata(buffer, "$%d\r\n", length) == BSTR_OK, "bformata");
+   check(bcatblk(buffer, data, length) == BSTR_OK, "bcatblk");
+   check(bconcat(buffer, &LINE_END) == BSTR_OK, "bconcat");
+   return 0;
+
+error:
+   return -1;
+}
+
+//----------------------------------------------------------------------------
+// append a subscribe style reply: [kind, name, count]
+// name NULL is a null bulk string
+// return 0 for success, -1 for failure
+static int
+put_subscription_reply(bstring buffer,
+                       const_bstring kind,
+                       const_bstring name,
+                       int count) {
+//----------------------------------------------------------------------------
+   check(bcatcstr(buffer, "*3\r\n") == BSTR_OK, "bcatcstr");
+   check(put_bulk(buffer, kind->data, blength(kind)) == 0, "put_bulk");
+   if (name != NULL) {
+      check(put_bulk(buffer, name->data, blength(name)) == 0, "put_bulk");
+   } else {
+      check(bcatcstr(buffer, "$-1\r\n") == BSTR_OK, "bcatcstr");
+   }
+   check(bformata(buffer, ":%d\r\n", count) == BSTR_OK, "bformata");
+   return 0;
+
+error:
+   return -1;
+}
+
+//----------------------------------------------------------------------------
+// the number of subscriptions, as Redis counts them
+static int
+subscription_count(const struct RespClient * client) {
+//----------------------------------------------------------------------------
+   return client->channels->qty + client->pattern_qty;
+}
+
+//----------------------------------------------------------------------------
+// write as much of the client's output as the socket takes, and poll for
+// writable while some is left
+// return CLIENT_OK, CLIENT_CLOSE if the client is gone (or done),
+// CLIENT_ERROR
+static enum CLIENT_RESULT
+flush_client(struct Resp * resp, struct RespClient * client) {
+//----------------------------------------------------------------------------
+   struct epoll_event event;
+   bool want_write;
+
+   if (output_queue_write(&client->output, client->fd) != 0) {
+      return CLIENT_CLOSE;
+   }
+   if (client->output.qty == 0 && client->close_when_flushed) {
+      return CLIENT_CLOSE;
+   }
+
+   want_write = client->output.qty > 0;
+   if (want_write != client->want_write) {
+      event.events = EPOLLIN | (want_write ? EPOLLOUT : 0);
+      event.data.ptr = client;
+      check(epoll_ctl(resp->epoll_fd, EPOLL_CTL_MOD, client->fd, &event) == 0,
+            "epoll_ctl");
+      client->want_write = want_write;
+   }
+
+   return CLIENT_OK;
+
+error:
+   return CLIENT_ERROR;
+}
+
+//----------------------------------------------------------------------------
+// remove a channel subscription
+static void
+remove_channel(struct Resp * resp,
+               struct RespClient * client,
+               const struct Config * config,
+               int list_index) {
+//----------------------------------------------------------------------------
+   int channel_index = find_channel_index(config,
+                                          client->channels->entry[list_index]);
+   int i;
+
+   if (channel_index != -1) {
+      client->subscribed[channel_index] = false;
+      resp->channel_interest[channel_index]--;
+   }
+   bdestroy(client->channels->entry[list_index]);
+   for (i=list_index+1; i < client->channels->qty; i++) {
+      client->channels->entry[i-1] = client->channels->entry[i];
+   }
+   client->channels->qty--;
+}
+
+//----------------------------------------------------------------------------
+// remove a pattern subscription
+static void
+remove_pattern(struct Resp * resp,
+               struct RespClient * client,
+               const struct Config * config,
+               int pattern_index) {
+//----------------------------------------------------------------------------
+   struct RespPattern * pattern = &client->patterns[pattern_index];
+   int i;
+
+   for (i=0; i < config->channel_list->qty; i++) {
+      if (pattern->matches[i]) resp->channel_interest[i]--;
+   }
+   bdestroy(pattern->pattern);
+   free(pattern->matches);
+   for (i=pattern_index+1; i < client->pattern_qty; i++) {
+      client->patterns[i-1] = client->patterns[i];
+   }
+   client->pattern_qty--;
+}
+
+//----------------------------------------------------------------------------
+// SUBSCRIBE channel [channel ...]
+// return 0 for success, -1 for failure
+static int
+subscribe_channels(struct Resp * resp,
+                   struct RespClient * client,
+                   const struct Config * config,
+                   const struct bstrList * args,
+                   bstring reply) {
+//----------------------------------------------------------------------------
+   int channel_index;
+   int i;
+
+   for (i=1; i < args->qty; i++) {
+      if (find_name_index(client->channels, args->entry[i]) == -1) {
+         check(bstrListAlloc(client->channels, client->channels->qty+1)
+               == BSTR_OK,
+               "bstrListAlloc");
+         client->channels->entry[client->channels->qty] = \
+            bstrcpy(args->entry[i]);
+         check(client->channels->entry[client->channels->qty] != NULL,
+               "bstrcpy");
+         client->channels->qty++;
+         channel_index = find_channel_index(config, args->entry[i]);
+         if (channel_index != -1) {
+            client->subscribed[channel_index] = true;
+            resp->channel_interest[channel_index]++;
+         }
+      }
+      check(put_subscription_reply(reply,
+                                   &SUBSCRIBE,
+                                   args->entry[i],
+                                   subscription_count(client)) == 0,
+            "put_subscription_reply");
+   }
+
+   return 0;
+
+error:
+   return -1;
+}
+
+//----------------------------------------------------------------------------
+// UNSUBSCRIBE [channel ...], without channels from all of them
+// return 0 for success, -1 for failure
+static int
+unsubscribe_channels(struct Resp * resp,
+                     struct RespClient * client,
+                     const struct Config * config,
+                     const struct bstrList * args,
+                     bstring reply) {
+//----------------------------------------------------------------------------
+   int list_index;
+   int i;
+
+   if (args->qty == 1) {
+      if (client->channels->qty == 0) {
+         return put_subscription_reply(reply,
+                                       &UNSUBSCRIBE,
+                                       NULL,
+                                       subscription_count(client));
+      }
+      while (client->channels->qty > 0) {
+         check(put_subscription_reply(reply,
+                                      &UNSUBSCRIBE,
+                                      client->channels->entry[0],
+                                      subscription_count(client) - 1) == 0,
+               "put_subscription_reply");
+         remove_channel(resp, client, config, 0);
+      }
+      return 0;
+   }
+
+   for (i=1; i < args->qty; i++) {
+      list_index = find_name_index(client->channels, args->entry[i]);
+      if (list_index != -1) {
+         remove_channel(resp, client, config, list_index);
+      }
+      check(put_subscription_reply(reply,
+                                   &UNSUBSCRIBE,
+                                   args->entry[i],
+                                   subscription_count(client)) == 0,
+            "put_subscription_reply");
+   }
+
+   return 0;
+
+error:
+   return -1;
+}
+
+//----------------------------------------------------------------------------
+// the position of a client's pattern, -1 if it has no such pattern
+static int
+find_pattern_index(const struct RespClient * client, const_bstring pattern) {
+//----------------------------------------------------------------------------
+   int i;
+
+   for (i=0; i < client->pattern_qty; i++) {
+      if (biseq(client->patterns[i].pattern, pattern)) {
+         return i;
+      }
+   }
+   return -1;
+}
+
+//----------------------------------------------------------------------------
+// PSUBSCRIBE pattern [pattern ...]
+// the glob runs here, once per channel; glob syntax is fnmatch's, which
+// is Redis' for *, ?, [...] and backslash escapes
+// return 0 for success, -1 for failure
+static int
+subscribe_patterns(struct Resp * resp,
+                   struct RespClient * client,
+                   const struct Config * config,
+                   const struct bstrList * args,
+                   bstring reply) {
+//----------------------------------------------------------------------------
+   struct RespPattern * patterns;
+   struct RespPattern * pattern;
+   int i;
+   int j;
+
+   for (i=1; i < args->qty; i++) {
+      if (find_pattern_index(client, args->entry[i]) == -1) {
+         patterns = realloc(client->patterns,
+                            (client->pattern_qty + 1) *
+                            sizeof(struct RespPattern));
+         check_mem(patterns);
+         client->patterns = patterns;
+         pattern = &client->patterns[client->pattern_qty];
+         pattern->matches = calloc(config->channel_list->qty, sizeof(bool));
+         check_mem(pattern->matches);
+         pattern->pattern = bstrcpy(args->entry[i]);
+         if (pattern->pattern == NULL) {
+            free(pattern->matches);
+            sentinel("bstrcpy");
+         }
+         for (j=0; j < config->channel_list->qty; j++) {
+            pattern->matches[j] = fnmatch(
+               (const char *) pattern->pattern->data,
+               (const char *) config->channel_list->entry[j]->data,
+               0) == 0;
+            if (pattern->matches[j]) resp->channel_interest[j]++;
+         }
+         client->pattern_qty++;
+      }
+      check(put_subscription_reply(reply,
+                                   &PSUBSCRIBE,
+                                   args->entry[i],
+                                   subscription_count(client)) == 0,
+            "put_subscription_reply");
+   }
+
+   return 0;
+
+error:
+   return -1;
+}
+
+//----------------------------------------------------------------------------
+// PUNSUBSCRIBE [pattern ...], without patterns from all of them
+// return 0 for success, -1 for failure
+static int
+unsubscribe_patterns(struct Resp * resp,
+                     struct RespClient * client,
+                     const struct Config * config,
+                     const struct bstrList * args,
+                     bstring reply) {
+//----------------------------------------------------------------------------
+   int pattern_index;
+   int i;
+
+   if (args->qty == 1) {
+      if (client->pattern_qty == 0) {
+         return put_subscription_reply(reply,
+                                       &PUNSUBSCRIBE,
+                                       NULL,
+                                       subscription_count(client));
+      }
+      while (client->pattern_qty > 0) {
+         check(put_subscription_reply(reply,
+                                      &PUNSUBSCRIBE,
+                                      client->patterns[0].pattern,
+                                      subscription_count(client) - 1) == 0,
+               "put_subscription_reply");
+         remove_pattern(resp, client, config, 0);
+      }
+      return 0;
+   }
+
+   for (i=1; i < args->qty; i++) {
+      pattern_index = find_pattern_index(client, args->entry[i]);
+      if (pattern_index != -1) {
+         remove_pattern(resp, client, config, pattern_index);
+      }
+      check(put_subscription_reply(reply,
+                                   &PUNSUBSCRIBE,
+                                   args->entry[i],
+                                   subscription_count(client)) == 0,
+            "put_subscription_reply");
+   }
+
+   return 0;
+
+error:
+   return -1;
+}
+
+//----------------------------------------------------------------------------
+// handle one command, appending the reply
+// return 0 for success, -1 for failure
+static int
+handle_command(struct Resp * resp,
+               struct RespClient * client,
+               const struct Config * config,
+               const struct bstrList * args,
+               bstring reply) {
+//----------------------------------------------------------------------------
+   const_bstring command = args->entry[0];
+
+   if (biseqcaseless(command, &SUBSCRIBE) && args->qty > 1) {
+      return subscribe_channels(resp, client, config, args, reply);
+   }
+   if (biseqcaseless(command, &UNSUBSCRIBE)) {
+      return unsubscribe_channels(resp, client, config, args, reply);
+   }
+   if (biseqcaseless(command, &PSUBSCRIBE) && args->qty > 1) {
+      return subscribe_patterns(resp, client, config, args, reply);
+   }
+   if (biseqcaseless(command, &PUNSUBSCRIBE)) {
+      return unsubscribe_patterns(resp, client, config, args, reply);
+   }
+
+   if (biseqcaseless(command, &PING) && args->qty <= 2) {
+      // subscribed clients get an array, as from Redis
+      if (subscription_count(client) > 0) {
+         check(bcatcstr(reply, "*2\r\n$4\r\npong\r\n") == BSTR_OK,
+               "bcatcstr");
+         if (args->qty == 2) {
+            return put_bulk(reply,
+                            args->entry[1]->data,
+                            blength(args->entry[1]));
+         }
+         return put_bulk(reply, "", 0);
+      }
+      if (args->qty == 2) {
+         return put_bulk(reply, args->entry[1]->data, blength(args->entry[1]));
+      }
+      return bcatcstr(reply, "+PONG\r\n") == BSTR_OK ? 0 : -1;
+   }
+
+   if (biseqcaseless(command, &QUIT)) {
+      client->close_when_flushed = true;
+      return bcatcstr(reply, "+OK\r\n") == BSTR_OK ? 0 : -1;
+   }
+
+   check(bformata(reply,
+                  "-ERR unknown command '%.64s', skeeter supports only "
+                  "(P)SUBSCRIBE, (P)UNSUBSCRIBE, PING and QUIT\r\n",
+                  (const char *) command->data) == BSTR_OK,
+         "bformata");
+   return 0;
+
+error:
+   return -1;
+}
+
+//----------------------------------------------------------------------------
+// parse a decimal number from text up to end
+// return the number, -1 if it isn't one
+static int
+parse_length(const unsigned char * text, const unsigned char * end) {
+//----------------------------------------------------------------------------
+   int value = 0;
+
+   if (text == end) return -1;
+   if (end - text == 2 && text[0] == '-' && text[1] == '1') return -1;
+   for (; text < end; text++) {
+      if (*text < '0' || *text > '9' || value > MAX_RESP_INPUT) return -1;
+      value = value * 10 + (*text - '0');
+   }
+   return value;
+}
+
+//----------------------------------------------------------------------------
+// take one command from the front of the client's input: a RESP array of
+// bulk strings, or an inline command (words on a line)
+// return 1 with *args set, 0 if the command isn't all here yet,
+// -1 for a protocol error
+static int
+take_command(struct RespClient * client, struct bstrList ** args) {
+//----------------------------------------------------------------------------
+   const unsigned char * data = client->input->data;
+   int length = blength(client->input);
+   struct bstrList * list = NULL;
+   int line_end;
+   int arg_qty;
+   int bulk_length;
+   int pos;
+   int i;
+
+   *args = NULL;
+   line_end = binstr(client->input, 0, &LINE_END);
+   if (line_end == BSTR_ERR) {
+      return length > MAX_RESP_INPUT ? -1 : 0;
+   }
+
+   if (data[0] != '*') {
+      // inline: split on spaces, dropping the empty words
+      list = bstrListCreate();
+      check(list != NULL, "bstrListCreate");
+      pos = 0;
+      while (pos < line_end) {
+         while (pos < line_end && (data[pos] == ' ' || data[pos] == '\t')) {
+            pos++;
+         }
+         i = pos;
+         while (i < line_end && data[i] != ' ' && data[i] != '\t') i++;
+         if (i > pos) {
+            check(bstrListAlloc(list, list->qty+1) == BSTR_OK,
+                  "bstrListAlloc");
+            list->entry[list->qty] = blk2bstr(data + pos, i - pos);
+            check(list->entry[list->qty] != NULL, "blk2bstr");
+            list->qty++;
+         }
+         pos = i;
+      }
+      check(bdelete(client->input, 0, line_end + 2) == BSTR_OK, "bdelete");
+      *args = list;
+      return 1;
+   }
+
+   arg_qty = parse_length(data + 1, data + line_end);
+   if (arg_qty < 0 || arg_qty > MAX_ARGUMENTS) {
+      return -1;
+   }
+   list = bstrListCreate();
+   check(list != NULL, "bstrListCreate");
+   check(bstrListAlloc(list, arg_qty > 0 ? arg_qty : 1) == BSTR_OK,
+         "bstrListAlloc");
+   pos = line_end + 2;
+   for (i=0; i < arg_qty; i++) {
+      line_end = binstr(client->input, pos, &LINE_END);
+      if (line_end == BSTR_ERR) {
+         bstrListDestroy(list);
+         return length > MAX_RESP_INPUT ? -1 : 0;
+      }
+      if (data[pos] != '$') {
+         bstrListDestroy(list);
+         return -1;
+      }
+      bulk_length = parse_length(data + pos + 1, data + line_end);
+      if (bulk_length < 0 || bulk_length > MAX_BULK) {
+         bstrListDestroy(list);
+         return -1;
+      }
+      pos = line_end + 2;
+      if (length < pos + bulk_length + 2) {
+         bstrListDestroy(list);
+         return length > MAX_RESP_INPUT ? -1 : 0;
+      }
+      if (data[pos + bulk_length] != '\r' ||
+          data[pos + bulk_length + 1] != '\n') {
+         bstrListDestroy(list);
+         return -1;
+      }
+      list->entry[i] = blk2bstr(data + pos, bulk_length);
+      check(list->entry[i] != NULL, "blk2bstr");
+      list->qty++;
+      pos += bulk_length + 2;
+   }
+
+   check(bdelete(client->input, 0, pos) == BSTR_OK, "bdelete");
+   *args = list;
+   return 1;
+
+error:
+   if (list != NULL) bstrListDestroy(list);
+   return -1;
+}
+
+//----------------------------------------------------------------------------
+// handle every complete command in the client's input, and queue the
+// replies as one buffer
+// return CLIENT_OK, CLIENT_CLOSE to disconnect the client, CLIENT_ERROR
+static enum CLIENT_RESULT
+handle_input(struct Resp * resp,
+             struct RespClient * client,
+             const struct Config * config) {
+//----------------------------------------------------------------------------
+   struct SharedBuffer * buffer;
+   struct bstrList * args = NULL;
+   bstring reply = bfromcstr("");
+   int result = 0;
+
+   check(reply != NULL, "bfromcstr");
+
+   while (!client->close_when_flushed &&
+          (result = take_command(client, &args)) == 1) {
+      if (args->qty > 0) {
+         check(handle_command(resp, client, config, args, reply) == 0,
+               "handle_command");
+      }
+      bstrListDestroy(args);
+      args = NULL;
+   }
+   if (result == -1) {
+      check(bcatcstr(reply, "-ERR Protocol error\r\n") == BSTR_OK,
+            "bcatcstr");
+      client->close_when_flushed = true;
+   }
+
+   if (blength(reply) == 0) {
+      bdestroy(reply);
+      return CLIENT_OK;
+   }
+   buffer = create_shared_buffer(reply);
+   check(buffer != NULL, "create_shared_buffer");
+   result = output_queue_push(&client->output,
+                              buffer,
+                              config->resp_max_output);
+   release_shared_buffer(buffer);
+   if (result != 0) {
+      resp->evicted++;
+      return CLIENT_CLOSE;
+   }
+
+   return CLIENT_OK;
+
+error:
+   if (args != NULL) bstrListDestroy(args);
+   bdestroy(reply);
+   return CLIENT_ERROR;
+}
+
+//----------------------------------------------------------------------------
+// read commands and answer them
+// return CLIENT_OK, CLIENT_CLOSE to disconnect the client, CLIENT_ERROR
+static enum CLIENT_RESULT
+read_client(struct Resp * resp,
+            struct RespClient * client,
+            const struct Config * config) {
+//----------------------------------------------------------------------------
+   unsigned char buffer[READ_CHUNK];
+   enum CLIENT_RESULT result;
+   ssize_t received;
+
+   for (;;) {
+      received = recv(client->fd, buffer, sizeof buffer, MSG_DONTWAIT);
+      if (received == 0) {
+         return CLIENT_CLOSE;
+      }
+      if (received == -1) {
+         if (errno == EAGAIN || errno == EWOULDBLOCK) {
+            errno = 0;
+            break;
+         }
+         errno = 0;
+         return CLIENT_CLOSE;
+      }
+      if (client->close_when_flushed) {
+         continue;
+      }
+      check(bcatblk(client->input, buffer, received) == BSTR_OK, "bcatblk");
+      result = handle_input(resp, client, config);
+      if (result != CLIENT_OK) {
+         return result;
+      }
+   }
+
+   return flush_client(resp, client);
+
+error:
+   return CLIENT_ERROR;
+}
+
+//----------------------------------------------------------------------------
+// disconnect a client and free it
+static void
+close_client(struct Resp * resp,
+             struct RespClient * client,
+             const struct Config * config) {
+//----------------------------------------------------------------------------
+   // closing the fd takes it out of the epoll set
+   close(client->fd);
+   if (client->prev != NULL) {
+      client->prev->next = client->next;
+   } else {
+      resp->clients = client->next;
+   }
+   if (client->next != NULL) client->next->prev = client->prev;
+   resp->client_qty--;
+
+   if (client->channels != NULL) {
+      while (client->channels->qty > 0) {
+         remove_channel(resp, client, config, 0);
+      }
+      bstrListDestroy(client->channels);
+   }
+   while (client->pattern_qty > 0) {
+      remove_pattern(resp, client, config, 0);
+   }
+   free(client->patterns);
+   free(client->subscribed);
+   clear_output_queue(&client->output);
+   bdestroy(client->input);
+   free(client);
+}
+
+//----------------------------------------------------------------------------
+// accept every client waiting on the listening socket
+// return 0 for success, -1 for failure
+static int
+accept_clients(struct Resp * resp, const struct Config * config) {
+//----------------------------------------------------------------------------
+   struct RespClient * client = NULL;
+   struct epoll_event event;
+   int fd;
+
+   for (;;) {
+      fd = accept4(resp->listen_fd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+      if (fd == -1) {
+         if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR ||
+             errno == ECONNABORTED) {
+            errno = 0;
+            return 0;
+         }
+         sentinel("accept4");
+      }
+      if (resp->client_qty >= config->resp_max_clients) {
+         log_info("resp at resp_max_clients (%d), refusing client",
+                  config->resp_max_clients);
+         close(fd);
+         continue;
+      }
+
+      client = calloc(1, sizeof(struct RespClient));
+      check_mem(client);
+      client->fd = fd;
+      client->input = bfromcstr("");
+      check(client->input != NULL, "bfromcstr");
+      client->channels = bstrListCreate();
+      check(client->channels != NULL, "bstrListCreate");
+      client->subscribed = calloc(config->channel_list->qty, sizeof(bool));
+      check_mem(client->subscribed);
+
+      event.events = EPOLLIN;
+      event.data.ptr = client;
+      check(epoll_ctl(resp->epoll_fd, EPOLL_CTL_ADD, fd, &event) == 0,
+            "epoll_ctl");
+
+      client->next = resp->clients;
+      if (resp->clients != NULL) resp->clients->prev = client;
+      resp->clients = client;
+      resp->client_qty++;
+      resp->accepted++;
+      client = NULL;
+   }
+
+error:
+   if (client != NULL) {
+      bdestroy(client->input);
+      if (client->channels != NULL) bstrListDestroy(client->channels);
+      free(client->subscribed);
+      free(client);
+      close(fd);
+   }
+   return -1;
+}
+
+//----------------------------------------------------------------------------
+// listen on config.resp_address, config.resp_port
+// return 0 for success, -1 for failure
+int
+start_resp(struct Resp * resp, const struct Config * config) {
+//----------------------------------------------------------------------------
+   struct epoll_event listen_event;
+
+   resp->listen_fd = -1;
+   resp->epoll_fd = -1;
+   resp->clients = NULL;
+   resp->client_qty = 0;
+   resp->accepted = 0;
+   resp->messages = 0;
+   resp->evicted = 0;
+
+   resp->channel_interest = calloc(config->channel_list->qty, sizeof(int));
+   check_mem(resp->channel_interest);
+
+   resp->listen_fd = tcp_listen("resp",
+                                config->resp_address,
+                                config->resp_port,
+                                config->handoff_path != NULL);
+   check(resp->listen_fd != -1, "tcp_listen");
+
+   resp->epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+   check(resp->epoll_fd != -1, "epoll_create1");
+
+   // a NULL ptr is the listening socket
+   listen_event.events = EPOLLIN;
+   listen_event.data.ptr = NULL;
+   check(epoll_ctl(resp->epoll_fd,
+                   EPOLL_CTL_ADD,
+                   resp->listen_fd,
+                   &listen_event) == 0,
+         "epoll_ctl");
+
+   return 0;
+
+error:
+   return -1;
+}
+
+//----------------------------------------------------------------------------
+// disconnect the clients and close the sockets
+// (without close_client, which keeps channel_interest up to date: we are
+// throwing it away)
+void
+clear_resp(struct Resp * resp) {
+//----------------------------------------------------------------------------
+   struct RespClient * client;
+   int i;
+
+   while ((client = resp->clients) != NULL) {
+      resp->clients = client->next;
+      close(client->fd);
+      bstrListDestroy(client->channels);
+      for (i=0; i < client->pattern_qty; i++) {
+         bdestroy(client->patterns[i].pattern);
+         free(client->patterns[i].matches);
+      }
+      free(client->patterns);
+      free(client->subscribed);
+      clear_output_queue(&client->output);
+      bdestroy(client->input);
+      free(client);
+   }
+   resp->client_qty = 0;
+   if (resp->epoll_fd != -1) close(resp->epoll_fd);
+   if (resp->listen_fd != -1) close(resp->listen_fd);
+   free(resp->channel_interest);
+   resp->epoll_fd = -1;
+   resp->listen_fd = -1;
+   resp->channel_interest = NULL;
+}
+
+//----------------------------------------------------------------------------
+// accept new clients, and read from and write to the ones that are ready
+// return 0 for success, -1 for failure
+int
+resp_handle_events(struct Resp * resp, const struct Config * config) {
+//----------------------------------------------------------------------------
+   struct epoll_event event_list[RESP_EPOLL_EVENTS];
+   struct RespClient * client;
+   enum CLIENT_RESULT result;
+   int event_qty;
+   int i;
+
+   do {
+      event_qty = epoll_wait(resp->epoll_fd,
+                             event_list,
+                             RESP_EPOLL_EVENTS,
+                             0);
+      if (event_qty == -1 && errno == EINTR) {
+         errno = 0;
+         return 0;
+      }
+      check(event_qty != -1, "epoll_wait");
+
+      for (i=0; i < event_qty; i++) {
+         client = event_list[i].data.ptr;
+         if (client == NULL) {
+            check(accept_clients(resp, config) == 0, "accept_clients");
+            continue;
+         }
+         if (event_list[i].events & (EPOLLIN | EPOLLERR | EPOLLHUP)) {
+            result = read_client(resp, client, config);
+         } else {
+            result = flush_client(resp, client);
+         }
+         check(result != CLIENT_ERROR, "resp client");
+         if (result == CLIENT_CLOSE) {
+            close_client(resp, client, config);
+         }
+      }
+   } while (event_qty == RESP_EPOLL_EVENTS);
+
+   return 0;
+
+error:
+   return -1;
+}
+
+//----------------------------------------------------------------------------
+// encode a message, or a pmessage if pattern is not NULL
+// return NULL on failure
+static struct SharedBuffer *
+encode_message(const_bstring pattern, const_bstring channel, const char * data) {
+//----------------------------------------------------------------------------
+   bstring encoded = bfromcstr(pattern != NULL ?
+                               "*4\r\n$8\r\npmessage\r\n" :
+                               "*3\r\n$7\r\nmessage\r\n");
+
+   check(encoded != NULL, "bfromcstr");
+   if (pattern != NULL) {
+      check(put_bulk(encoded, pattern->data, blength(pattern)) == 0,
+            "put_bulk");
+   }
+   check(put_bulk(encoded, channel->data, blength(channel)) == 0, "put_bulk");
+   if (data == NULL) data = "";
+   check(put_bulk(encoded, data, strlen(data)) == 0, "put_bulk");
+
+   return create_shared_buffer(encoded);
+
+error:
+   bdestroy(encoded);
+   return NULL;
+}
+
+//----------------------------------------------------------------------------
+// send a message to every client subscribed to the channel or to a
+// pattern matching it
+// data may be NULL
+// return 0 for success, -1 for failure
+int
+resp_publish(struct Resp * resp,
+             const struct Config * config,
+             int channel_index,
+             const char * data) {
+//----------------------------------------------------------------------------
+   const_bstring channel = config->channel_list->entry[channel_index];
+   struct SharedBuffer * message = NULL;
+   // one pmessage per distinct pattern, encoded for the first client
+   // that has it
+   struct SharedBuffer ** pmessages = NULL;
+   struct SharedBuffer ** grown;
+   struct bstrList * pmessage_patterns = NULL;
+   struct SharedBuffer * buffer;
+   struct RespClient * client;
+   struct RespClient * next;
+   enum CLIENT_RESULT result;
+   bool evicted;
+   int index;
+   int i;
+
+   if (resp->channel_interest[channel_index] == 0) {
+      return 0;
+   }
+   resp->messages++;
+
+   pmessage_patterns = bstrListCreate();
+   check(pmessage_patterns != NULL, "bstrListCreate");
+
+   for (client = resp->clients; client != NULL; client = next) {
+      next = client->next;
+      if (client->close_when_flushed) {
+         continue;
+      }
+      evicted = false;
+
+      if (client->subscribed[channel_index]) {
+         if (message == NULL) {
+            message = encode_message(NULL, channel, data);
+            check(message != NULL, "encode_message");
+         }
+         evicted = output_queue_push(&client->output,
+                                     message,
+                                     config->resp_max_output) != 0;
+      }
+
+      for (i=0; i < client->pattern_qty && !evicted; i++) {
+         if (!client->patterns[i].matches[channel_index]) {
+            continue;
+         }
+         index = find_name_index(pmessage_patterns,
+                                 client->patterns[i].pattern);
+         if (index == -1) {
+            buffer = encode_message(client->patterns[i].pattern,
+                                    channel,
+                                    data);
+            check(buffer != NULL, "encode_message");
+            index = pmessage_patterns->qty;
+            grown = realloc(pmessages,
+                            (index + 1) * sizeof(struct SharedBuffer *));
+            if (grown == NULL ||
+                bstrListAlloc(pmessage_patterns, index+1) != BSTR_OK ||
+                (pmessage_patterns->entry[index] = \
+                   bstrcpy(client->patterns[i].pattern)) == NULL) {
+               if (grown != NULL) pmessages = grown;
+               release_shared_buffer(buffer);
+               sentinel("out of memory");
+            }
+            pmessages = grown;
+            pmessages[index] = buffer;
+            pmessage_patterns->qty++;
+         }
+         evicted = output_queue_push(&client->output,
+                                     pmessages[index],
+                                     config->resp_max_output) != 0;
+      }
+
+      if (evicted) {
+         log_info("resp client fd %d too slow, evicting", client->fd);
+         resp->evicted++;
+         close_client(resp, client, config);
+         continue;
+      }
+      result = flush_client(resp, client);
+      check(result != CLIENT_ERROR, "flush_client");
+      if (result == CLIENT_CLOSE) {
+         close_client(resp, client, config);
+      }
+   }
+
+   if (message != NULL) release_shared_buffer(message);
+   for (i=0; i < pmessage_patterns->qty; i++) {
+      release_shared_buffer(pmessages[i]);
+   }
+   free(pmessages);
+   bstrListDestroy(pmessage_patterns);
+   return 0;
+
+error:
+   if (message != NULL) release_shared_buffer(message);
+   if (pmessage_patterns != NULL) {
+      for (i=0; i < pmessage_patterns->qty; i++) {
+         release_shared_buffer(pmessages[i]);
+      }
+      bstrListDestroy(pmessage_patterns);
+   }
+   free(pmessages);
+   return -1;
+}
@@ -0,0 +1,91 @@
+/*----------------------------------------------------------------------------
+ * resp.h
+ *
+ * a Redis pub/sub front end: clients speak RESP, SUBSCRIBE or PSUBSCRIBE,
+ * and get our messages as Redis message and pmessage replies
+ *--------------------------------------------------------------------------*/
+#if !defined(__RESP_H__)
+#define __RESP_H__
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "bstrlib.h"
+#include "config.h"
+#include "output_queue.h"
+
+// a PSUBSCRIBE pattern, matched against every channel in our config when
+// the client subscribes, so publishing never runs the glob
+struct RespPattern {
+   bstring pattern;
+   // parallel array to config.channel_list
+   bool * matches;
+};
+
+struct RespClient {
+   int fd;
+   // what we have read and not yet handled
+   bstring input;
+   // close once output is written (after QUIT or a protocol error)
+   bool close_when_flushed;
+
+   // SUBSCRIBEd channel names, ours or not, as Redis counts them
+   struct bstrList * channels;
+   // parallel array to config.channel_list: SUBSCRIBEd to that channel
+   bool * subscribed;
+   struct RespPattern * patterns;
+   int pattern_qty;
+
+   struct OutputQueue output;
+   // EPOLLOUT is set while output is not empty
+   bool want_write;
+
+   struct RespClient * prev;
+   struct RespClient * next;
+};
+
+struct Resp {
+   // listening TCP socket, -1 without RESP
+   int listen_fd;
+   // the listening socket and the clients are polled on their own epoll
+   // fd, so we can find the client from the event; this fd is polled in
+   // the main loop
+   int epoll_fd;
+
+   struct RespClient * clients;
+   int client_qty;
+   // parallel array to config.channel_list: subscriptions and matching
+   // patterns, over all clients, so we skip encoding for nobody
+   int * channel_interest;
+
+   uint64_t accepted;
+   uint64_t messages;
+   // clients we disconnected because they could not keep up
+   uint64_t evicted;
+};
+
+// listen on config.resp_address, config.resp_port
+// return 0 for success, -1 for failure
+extern int
+start_resp(struct Resp * resp, const struct Config * config);
+
+// disconnect the clients and close the sockets
+extern void
+clear_resp(struct Resp * resp);
+
+// accept new clients, and read from and write to the ones that are ready
+// return 0 for success, -1 for failure
+extern int
+resp_handle_events(struct Resp * resp, const struct Config * config);
+
+// send a message to every client subscribed to the channel or to a
+// pattern matching it
+// data may be NULL
+// return 0 for success, -1 for failure
+extern int
+resp_publish(struct Resp * resp,
+             const struct Config * config,
+             int channel_index,
+             const char * data);
+
+#endif // !defined(__RESP_H__)
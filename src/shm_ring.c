@@ -0,0 +1,368 @@
+/*----------------------------------------------------------------------------
+ * shm_ring.c
+ * 
+ * publish messages into a shared memory ring for subscribers on this host
+ *
+ * Publishing a message is one copy into the ring and, only if a reader is
+ * waiting, one FUTEX_WAKE: the cost doesn't grow with the number of 
+ * readers. See shm_ring_layout.h for the protocol.
+ *--------------------------------------------------------------------------*/
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <limits.h>
+#include <linux/futex.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include "dbg_syslog.h"
+#include "shm_ring.h"
+
+//----------------------------------------------------------------------------
+// round up to the record alignment
+static uint64_t
+record_align(uint64_t size) {
+//----------------------------------------------------------------------------
+   return (size + SHM_RING_RECORD_ALIGN - 1) & ~(uint64_t) 
+      (SHM_RING_RECORD_ALIGN - 1);
+}
+
+//----------------------------------------------------------------------------
+// create (or replace) the shared memory object and map it
+// capacity must be a power of 2
+// return 0 for success, -1 for failure
+int
+create_shm_ring(struct ShmRing * ring, const char * name, size_t capacity) {
+//----------------------------------------------------------------------------
+   int fd = -1;
+   void * map;
+
+   ring->fd = -1;
+
+   check(capacity >= 4096 && (capacity & (capacity - 1)) == 0,
+         "shm ring size %zu must be a power of 2, at least 4096", capacity);
+
+   ring->map_size = sizeof(struct RingHeader) + capacity;
+
+   // a new object each time, so a reader of the old one can tell it is 
+   // stale (it keeps its mapping of the unlinked object)
+   if (shm_unlink(name) != 0) {
+      check(errno == ENOENT, "shm_unlink %s", name);
+   }
+   fd = shm_open(name, O_RDWR | O_CREAT | O_EXCL, 0644);
+   check(fd != -1, "shm_open %s", name);
+   check(ftruncate(fd, ring->map_size) == 0, "ftruncate");
+
+   map = mmap(NULL, ring->map_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+   check(map != MAP_FAILED, "mmap");
+
+   // ftruncate gives us zeros, so the positions, futex and slots start 
+   // at 0. Readers check the magic last.
+   ring->header = map;
+   ring->header->capacity = capacity;
+   ring->header->max_record = capacity / 4;
+   ring->header->version = SHM_RING_VERSION;
+   __atomic_store_n(&ring->header->magic, SHM_RING_MAGIC, __ATOMIC_RELEASE);
+
+   ring->name = name;
+   ring->fd = fd;
+   ring->published = 0;
+   ring->dropped = 0;
+
+   log_info("shared memory ring '%s' %zu bytes", name, capacity);
+   return 0;
+
+error:
+   if (fd != -1) close(fd);
+   ring->header = NULL;
+   return -1;
+}
+
+//----------------------------------------------------------------------------
+// carry on with the ring of the skeeter we are taking over from, on the
+// fd it handed us, if it has the same capacity; otherwise create our own
+// The old skeeter stops writing before we start, so the ring has one 
+// writer at a time, and its readers never see the handoff.
+// return 0 for success, -1 for failure
+int
+take_shm_ring(struct ShmRing * ring, 
+              const char * name, 
+              size_t capacity, 
+              int fd) {
+//----------------------------------------------------------------------------
+   struct RingHeader * header;
+   struct stat status;
+   void * map;
+
+   ring->map_size = sizeof(struct RingHeader) + capacity;
+
+   check(fstat(fd, &status) == 0, "fstat");
+   if ((size_t) status.st_size != ring->map_size) {
+      log_info("shared memory ring '%s' has changed size, replacing it", 
+               name);
+      close(fd);
+      return create_shm_ring(ring, name, capacity);
+   }
+
+   map = mmap(NULL, ring->map_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+   check(map != MAP_FAILED, "mmap");
+   header = map;
+   if (__atomic_load_n(&header->magic, __ATOMIC_ACQUIRE) != SHM_RING_MAGIC ||
+       header->version != SHM_RING_VERSION || 
+       header->capacity != capacity) {
+      log_info("shared memory ring '%s' is not ours to carry on, "
+               "replacing it", 
+               name);
+      munmap(map, ring->map_size);
+      close(fd);
+      return create_shm_ring(ring, name, capacity);
+   }
+
+   ring->header = header;
+   ring->name = name;
+   ring->fd = fd;
+   ring->published = 0;
+   ring->dropped = 0;
+
+   log_info("carrying on with shared memory ring '%s' at %" PRIu64, 
+            name, 
+            header->commit_pos);
+   return 0;
+
+error:
+   close(fd);
+   ring->fd = -1;
+   ring->header = NULL;
+   return -1;
+}
+
+//----------------------------------------------------------------------------
+// bump the futex word, and wake the readers waiting on it
+// return 0 for success, -1 for failure
+static int
+wake_readers(struct RingHeader * header) {
+//----------------------------------------------------------------------------
+   __atomic_add_fetch(&header->futex, 1, __ATOMIC_SEQ_CST);
+   if (__atomic_load_n(&header->waiters, __ATOMIC_SEQ_CST) == 0) {
+      return 0;
+   }
+   // not FUTEX_PRIVATE_FLAG: the waiters are in other processes
+   return syscall(SYS_futex, 
+                  &header->futex, 
+                  FUTEX_WAKE, 
+                  INT_MAX, 
+                  NULL, 
+                  NULL, 
+                  0) == -1 ? -1 : 0;
+}
+
+//----------------------------------------------------------------------------
+// unmap and remove the shared memory object
+void
+clear_shm_ring(struct ShmRing * ring) {
+//----------------------------------------------------------------------------
+   if (ring->header == NULL) {
+      return;
+   }
+   // readers keep their mapping: tell them to look for a new ring
+   __atomic_store_n(&ring->header->closed, 1, __ATOMIC_SEQ_CST);
+   wake_readers(ring->header);
+   munmap(ring->header, ring->map_size);
+   ring->header = NULL;
+   close(ring->fd);
+   ring->fd = -1;
+   shm_unlink(ring->name);
+}
+
+//----------------------------------------------------------------------------
+// unmap the ring during or after a handoff, leaving it to the other 
+// skeeter if its name is still ours (it carries on with it), otherwise 
+// closing it for the readers; the name is the other skeeter's
+void
+release_shm_ring(struct ShmRing * ring) {
+//----------------------------------------------------------------------------
+   struct stat ours;
+   struct stat named;
+   bool taken = false;
+   int fd;
+
+   if (ring->header == NULL) {
+      return;
+   }
+   fd = shm_open(ring->name, O_RDONLY, 0);
+   if (fd != -1) {
+      taken = fstat(ring->fd, &ours) == 0 && fstat(fd, &named) == 0 &&
+              ours.st_dev == named.st_dev && ours.st_ino == named.st_ino;
+      close(fd);
+   }
+   if (!taken) {
+      __atomic_store_n(&ring->header->closed, 1, __ATOMIC_SEQ_CST);
+      wake_readers(ring->header);
+   }
+   munmap(ring->header, ring->map_size);
+   ring->header = NULL;
+   close(ring->fd);
+   ring->fd = -1;
+}
+
+//----------------------------------------------------------------------------
+// copy bytes into the ring at position, wrapping at the end
+// (records never wrap, but a padding record can end exactly at the end)
+static void
+ring_copy(struct ShmRing * ring, 
+          uint64_t position, 
+          const void * source, 
+          size_t size) {
+//----------------------------------------------------------------------------
+   uint8_t * data = SHM_RING_DATA(ring->header);
+   memcpy(data + (position & (ring->header->capacity - 1)), source, size);
+}
+
+//----------------------------------------------------------------------------
+// write the message frames as one record and wake waiting readers
+// return 0 for success, 1 if the message is too big for the ring, 
+// -1 for failure
+int
+shm_ring_publish(struct ShmRing * ring, const struct bstrList * message_list) {
+//----------------------------------------------------------------------------
+   const void * frames[SHM_RING_MAX_FRAMES];
+   size_t sizes[SHM_RING_MAX_FRAMES];
+   int i;
+
+   check(message_list->qty <= SHM_RING_MAX_FRAMES, 
+         "%d frames", 
+         message_list->qty);
+   for (i=0; i < message_list->qty; i++) {
+      frames[i] = message_list->entry[i]->data;
+      sizes[i] = blength(message_list->entry[i]);
+   }
+
+   return shm_ring_publish_frames(ring, frames, sizes, message_list->qty);
+
+error:
+   return -1;
+}
+
+//----------------------------------------------------------------------------
+// the same, for frames that are not bstrings (at most SHM_RING_MAX_FRAMES)
+int
+shm_ring_publish_frames(struct ShmRing * ring, 
+                        const void * const * frames,
+                        const size_t * sizes,
+                        int frame_qty) {
+//----------------------------------------------------------------------------
+   struct RingHeader * header = ring->header;
+   struct RingRecordHeader record;
+   struct RingRecordHeader padding;
+   uint64_t capacity = header->capacity;
+   uint64_t position;
+   uint64_t frame_position;
+   uint64_t room;
+   uint64_t length;
+   uint32_t frame_size;
+   int i;
+
+   check(frame_qty <= SHM_RING_MAX_FRAMES, "%d frames", frame_qty);
+
+   length = sizeof record;
+   for (i=0; i < frame_qty; i++) {
+      length += sizeof frame_size + sizes[i];
+   }
+   length = record_align(length);
+   if (length > header->max_record) {
+      ring->dropped++;
+      return 1;
+   }
+
+   // we are the only writer, so our own positions need no atomics
+   position = header->reserve_pos;
+   room = capacity - (position & (capacity - 1));
+   if (room < length) {
+      padding.length = room;
+      padding.frame_qty = SHM_RING_PADDING;
+      __atomic_store_n(&header->reserve_pos, 
+                       position + room + length, 
+                       __ATOMIC_SEQ_CST);
+      ring_copy(ring, position, &padding, sizeof padding);
+      position += room;
+   } else {
+      __atomic_store_n(&header->reserve_pos, 
+                       position + length, 
+                       __ATOMIC_SEQ_CST);
+   }
+   // readers must see the new reserve_pos before any of the bytes we
+   // overwrite
+   __atomic_thread_fence(__ATOMIC_RELEASE);
+
+   record.length = length;
+   record.frame_qty = frame_qty;
+   ring_copy(ring, position, &record, sizeof record);
+   frame_position = position + sizeof record;
+   for (i=0; i < frame_qty; i++) {
+      frame_size = sizes[i];
+      ring_copy(ring, frame_position, &frame_size, sizeof frame_size);
+      frame_position += sizeof frame_size;
+      ring_copy(ring, frame_position, frames[i], frame_size);
+      frame_position += frame_size;
+   }
+
+   __atomic_store_n(&header->commit_pos, position + length, __ATOMIC_SEQ_CST);
+   check(wake_readers(header) == 0, "wake_readers");
+
+   ring->published++;
+   return 0;
+
+error:
+   return -1;
+}
+
+//----------------------------------------------------------------------------
+// free the slots of readers that have exited without closing the ring
+// return the number of live readers, and the most bytes one of them 
+// is behind
+int
+shm_ring_readers(struct ShmRing * ring, uint64_t * max_lag) {
+//----------------------------------------------------------------------------
+   struct RingReaderSlot * slot;
+   uint64_t commit_pos;
+   uint64_t pid;
+   uint64_t cursor;
+   int count = 0;
+   int i;
+
+   *max_lag = 0;
+   if (ring->header == NULL) {
+      return 0;
+   }
+
+   commit_pos = __atomic_load_n(&ring->header->commit_pos, __ATOMIC_ACQUIRE);
+   for (i=0; i < SHM_RING_MAX_READERS; i++) {
+      slot = &ring->header->readers[i];
+      pid = __atomic_load_n(&slot->pid, __ATOMIC_ACQUIRE);
+      if (pid == 0) {
+         continue;
+      }
+      if (kill((pid_t) pid, 0) == -1 && errno == ESRCH) {
+         debug("freeing shm ring slot %d of exited reader %" PRIu64, i, pid);
+         __atomic_compare_exchange_n(&slot->pid, 
+                                     &pid, 
+                                     0, 
+                                     false, 
+                                     __ATOMIC_RELEASE, 
+                                     __ATOMIC_RELAXED);
+         continue;
+      }
+      count++;
+      cursor = __atomic_load_n(&slot->cursor, __ATOMIC_RELAXED);
+      if (commit_pos > cursor && commit_pos - cursor > *max_lag) {
+         *max_lag = commit_pos - cursor;
+      }
+   }
+
+   return count;
+}
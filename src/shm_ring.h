@@ -0,0 +1,72 @@
+/*----------------------------------------------------------------------------
+ * shm_ring.h
+ * 
+ * publish messages into a shared memory ring for subscribers on this host
+ *--------------------------------------------------------------------------*/
+#if !defined(__SHM_RING_H__)
+#define __SHM_RING_H__
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "bstrlib.h"
+#include "shm_ring_layout.h"
+
+struct ShmRing {
+   // the shm_open name, NULL when we have no ring
+   const char * name;
+   // the shared memory object, kept open to hand on to a new skeeter
+   int fd;
+   struct RingHeader * header;
+   size_t map_size;
+
+   uint64_t published;
+   // messages bigger than header->max_record
+   uint64_t dropped;
+};
+
+// create (or replace) the shared memory object and map it
+// capacity must be a power of 2
+// return 0 for success, -1 for failure
+extern int
+create_shm_ring(struct ShmRing * ring, const char * name, size_t capacity);
+
+// carry on with the ring of the skeeter we are taking over from, on the
+// fd it handed us, if it has the same capacity; otherwise create our own
+// return 0 for success, -1 for failure
+extern int
+take_shm_ring(struct ShmRing * ring, 
+              const char * name, 
+              size_t capacity, 
+              int fd);
+
+// unmap and remove the shared memory object
+extern void
+clear_shm_ring(struct ShmRing * ring);
+
+// unmap the ring during or after a handoff, leaving it to the other 
+// skeeter if its name is still ours, otherwise closing it for the 
+// readers; the name is the other skeeter's
+extern void
+release_shm_ring(struct ShmRing * ring);
+
+// write the message frames as one record and wake waiting readers
+// return 0 for success, 1 if the message is too big for the ring, 
+// -1 for failure
+extern int
+shm_ring_publish(struct ShmRing * ring, const struct bstrList * message_list);
+
+// the same, for frames that are not bstrings (at most SHM_RING_MAX_FRAMES)
+extern int
+shm_ring_publish_frames(struct ShmRing * ring, 
+                        const void * const * frames,
+                        const size_t * sizes,
+                        int frame_qty);
+
+// free the slots of readers that have exited without closing the ring
+// return the number of live readers, and the most bytes one of them 
+// is behind
+extern int
+shm_ring_readers(struct ShmRing * ring, uint64_t * max_lag);
+
+#endif // !defined(__SHM_RING_H__)
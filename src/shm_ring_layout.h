@@ -0,0 +1,77 @@
+/*----------------------------------------------------------------------------
+ * shm_ring_layout.h
+ * 
+ * the layout of the shared memory ring, shared by skeeter (the only 
+ * writer) and the reader library
+ *
+ * The ring is a POSIX shared memory object (/dev/shm/<name>): a header,
+ * then capacity bytes of records. Positions are byte offsets that only
+ * grow; a position's place in the ring is position % capacity.
+ *
+ * The writer never waits for readers. It advances reserve_pos, writes the
+ * record, then advances commit_pos. A reader may read records up to 
+ * commit_pos; once it has copied a record, the copy is good if the writer
+ * had not reserved past it by a full lap (reserve_pos <= cursor + 
+ * capacity). Otherwise the reader was overrun and skips ahead, like a 
+ * PUB subscriber past its HWM.
+ *
+ * A record is a RingRecordHeader followed by frame_qty frames of 
+ * 4 byte size + data, padded to 8 bytes. A record that would not fit
+ * before the end of the ring is preceded by a padding record.
+ *--------------------------------------------------------------------------*/
+#if !defined(__SHM_RING_LAYOUT_H__)
+#define __SHM_RING_LAYOUT_H__
+
+#include <stdint.h>
+
+#define SHM_RING_MAGIC 0x534b5252 // 'SKRR'
+#define SHM_RING_VERSION 1
+#define SHM_RING_CACHE_LINE 64
+#define SHM_RING_MAX_READERS 64
+#define SHM_RING_RECORD_ALIGN 8
+// the most frames in a message
+#define SHM_RING_MAX_FRAMES 8
+// frame_qty of a padding record
+#define SHM_RING_PADDING 0xffffffff
+
+// a reader's cursor, on its own cache line so readers don't contend
+struct RingReaderSlot {
+   // 0 when the slot is free
+   uint64_t pid;
+   uint64_t cursor;
+   uint8_t pad[SHM_RING_CACHE_LINE - 2 * sizeof(uint64_t)];
+} __attribute__((aligned(SHM_RING_CACHE_LINE)));
+
+struct RingHeader {
+   uint32_t magic;
+   uint32_t version;
+   // bytes of record space, a power of 2
+   uint64_t capacity;
+   // the biggest record the writer will write
+   uint64_t max_record;
+
+   // the fields the writer changes for every record are on cache lines
+   // of their own
+   uint64_t reserve_pos __attribute__((aligned(SHM_RING_CACHE_LINE)));
+   uint64_t commit_pos __attribute__((aligned(SHM_RING_CACHE_LINE)));
+
+   // futex word, incremented after each commit. The writer only makes
+   // the FUTEX_WAKE system call when waiters > 0
+   uint32_t futex __attribute__((aligned(SHM_RING_CACHE_LINE)));
+   uint32_t waiters;
+   // set when skeeter exits: it makes a new ring when it starts again
+   uint32_t closed;
+
+   struct RingReaderSlot readers[SHM_RING_MAX_READERS];
+};
+
+struct RingRecordHeader {
+   // bytes in the record, including this header and padding
+   uint32_t length;
+   uint32_t frame_qty;
+};
+
+// the record space follows the header
+#define SHM_RING_DATA(header) ((uint8_t *) (header) + sizeof(struct RingHeader))
+
+#endif // !defined(__SHM_RING_LAYOUT_H__)
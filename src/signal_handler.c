@@ -1,40 +1,68 @@
 /*----------------------------------------------------------------------------
  * signal_handler.c
- * creatge and install a signal handler to set halt_signal to 1 on
- * SIGKILL or SIGTERM
+ * take SIGINT, SIGTERM, SIGHUP and SIGUSR1 through a signalfd, so they 
+ * come to the event loop as ordinary events
  *
  *--------------------------------------------------------------------------*/
 
+#include <errno.h>
 #include <signal.h>
-#include <stdbool.h>
+#include <sys/signalfd.h>
+#include <unistd.h>
 
 #include "dbg_syslog.h"
+#include "signal_handler.h"
 
-bool halt_signal = false;
-
-static void
-signal_handler(int signal) {
-   (void) signal; // unused
-   debug("signal %d", signal);
-   halt_signal = true;
-}
-
-// install the same signal handler for SIGINT and SIGTERM
+//----------------------------------------------------------------------------
+// block the signals we handle and create a signalfd for them, and ignore
+// SIGPIPE
+// return the fd (non-blocking) on success, -1 on failure
 int 
-install_signal_handler() {
+create_signal_fd(void) {
+//----------------------------------------------------------------------------
+   sigset_t mask;
+   int signal_fd;
 
-   struct sigaction action;
-   action.sa_handler = signal_handler;
-   sigemptyset(&action.sa_mask); 
-   action.sa_flags = 0;
+   sigemptyset(&mask); 
+   sigaddset(&mask, SIGINT);
+   sigaddset(&mask, SIGTERM);
+   sigaddset(&mask, SIGHUP);
+   sigaddset(&mask, SIGUSR1);
 
-   check(sigaction(SIGINT, &action, NULL) == 0, "sigaction, SIGINT");
-   check(sigaction(SIGTERM, &action, NULL) == 0, "sigaction, SIGTERM");
+   check(sigprocmask(SIG_BLOCK, &mask, NULL) == 0, "sigprocmask");
 
-   return 0;
+   // the front ends write to sockets whose clients may have gone: that
+   // must fail with EPIPE, not kill us
+   check(signal(SIGPIPE, SIG_IGN) != SIG_ERR, "signal SIGPIPE");
+   signal_fd = signalfd(-1, &mask, SFD_NONBLOCK | SFD_CLOEXEC);
+   check(signal_fd != -1, "signalfd");
+
+   return signal_fd;
 
 error:
 
    return -1;
 }
 
+//----------------------------------------------------------------------------
+// read the next signal from the signalfd
+// return the signal number, 0 if none is waiting, -1 on failure
+int
+read_signal(int signal_fd) {
+//----------------------------------------------------------------------------
+   struct signalfd_siginfo info;
+   ssize_t bytes_read;
+
+   bytes_read = read(signal_fd, &info, sizeof info);
+   if (bytes_read == -1 && errno == EAGAIN) {
+      return 0;
+   }
+   check(bytes_read == sizeof info, "read signalfd");
+   debug("signal %d", info.ssi_signo);
+
+   return (int) info.ssi_signo;
+
+error:
+
+   return -1;
+}
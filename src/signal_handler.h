@@ -1,16 +1,23 @@
 /*----------------------------------------------------------------------------
  * signal_handler.h
- * create and install a signal handler to set halt_signal to 1 on
- * SIGKILL or SIGTERM
+ * take SIGINT, SIGTERM, SIGHUP and SIGUSR1 through a signalfd, so they 
+ * come to the event loop as ordinary events
  *
  *--------------------------------------------------------------------------*/
 #if !defined(__SIGNAL_HANDLER_H__)
 #define __SIGNAL_HANDLER_H__
-#include <stdbool.h>
 
-extern bool halt_signal;
+// block the signals we handle and create a signalfd for them, and ignore
+// SIGPIPE
+// call this before starting any threads, so they inherit the blocked 
+// signals and leave them to the signalfd
+// return the fd (non-blocking) on success, -1 on failure
+int
+create_signal_fd(void);
 
-int 
-install_signal_handler();
+// read the next signal from the signalfd
+// return the signal number, 0 if none is waiting, -1 on failure
+int
+read_signal(int signal_fd);
 
 #endif // !defined(__SIGNAL_HANDLER_H__)
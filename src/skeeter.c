@@ -0,0 +1,3949 @@
+/*----------------------------------------------------------------------------
+ * skeeter.c
+ * 
+ * LISTEN to postgres and publish the notifications: everything but the 
+ * command line, so another program can embed it
+ *--------------------------------------------------------------------------*/
+#define _GNU_SOURCE // sched_setaffinity
+#include <errno.h>
+#include <inttypes.h>
+#include <sched.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <sys/epoll.h>
+#include <sys/mman.h>
+#include <sys/prctl.h>
+#include <sys/socket.h>
+#include <sys/types.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <zmq.h>
+
+#include <libpq-fe.h>
+
+#include "bstrlib.h"
+#include "config.h"
+#include "conflate.h"
+#include "dbg_syslog.h"
+#include "display_strings.h"
+#include "gateway.h"
+#include "handoff.h"
+#include "histogram.h"
+#include "message.h"
+#include "metrics.h"
+#include "outbox.h"
+#include "pg_proxy.h"
+#include "pub_monitor.h"
+#include "pub_socket.h"
+#include "reactor.h"
+#include "relay.h"
+#include "resp.h"
+#include "skeeter.h"
+#include "sse.h"
+#include "state.h"
+#include "timer_wheel.h"
+#include "zmq_shim.h"
+
+enum EPOLL_ACTION {
+   EPOLL_READ,
+   EPOLL_WRITE
+};
+
+// hash buckets per conflating channel
+static const int CONFLATE_BUCKET_COUNT = 1024;
+
+// both skeeters of an active/standby pair LISTEN on this channel for the
+// leader's marks
+#define LEADER_CHANNEL "skeeter_leader"
+
+struct Skeeter {
+   // owned by the caller
+   const struct Config * config;
+   struct State * state;
+   void * zmq_context;
+};
+
+// forward reference for callbacks
+int
+start_postgres_connection(const struct Config * config, struct State * state);
+
+CALLBACK_RESULT_TYPE
+check_query_cb(const struct Config * config, struct State * state);
+
+int
+set_up_database_retry(const struct Config * config, struct State * state);
+
+//---------------------------------------------------------------------------
+// call a state callback with the config and state, and reconnect after a 
+// database error
+// returns 0 on success, -1 on error
+static int
+run_state_callback(struct Skeeter * skeeter, state_callback callback) {
+//---------------------------------------------------------------------------
+   CALLBACK_RESULT_TYPE callback_result;
+
+   check(callback != NULL, "NULL callback");
+   callback_result = callback(skeeter->config, skeeter->state);
+   if (callback_result == CALLBACK_DATABASE_ERROR) {
+      log_err("database error");
+      check(set_up_database_retry(skeeter->config, skeeter->state) == 0, 
+            "retry");
+   } else {
+      check(callback_result == CALLBACK_OK, "callback");
+   }
+
+   return 0;
+
+error:
+   return -1;
+}
+
+//---------------------------------------------------------------------------
+// the reactor callback for our own fds
+// returns 0 on success, -1 on error
+static int
+state_handler_cb(struct ReactorHandler * reactor_handler, uint32_t events) {
+//---------------------------------------------------------------------------
+   (void) events; // unused, the callbacks find out for themselves
+   struct StateHandler * handler = (struct StateHandler *) reactor_handler;
+
+   return run_state_callback((struct Skeeter *) reactor_handler->context,
+                             handler->callback);
+}
+
+//---------------------------------------------------------------------------
+// the timer wheel callback for our own timers
+// returns 0 on success, -1 on error
+static int
+state_timer_cb(struct Timer * timer) {
+//---------------------------------------------------------------------------
+   struct StateTimer * state_timer = (struct StateTimer *) timer;
+
+   return run_state_callback((struct Skeeter *) timer->context,
+                             state_timer->callback);
+}
+
+//---------------------------------------------------------------------------
+// poll fd for events, calling the handler's callback
+// returns 0 on success, -1 on error
+static int
+add_state_handler(struct State * state,
+                  struct StateHandler * handler,
+                  int fd,
+                  uint32_t events) {
+//---------------------------------------------------------------------------
+   return reactor_add(&state->reactor, &handler->handler, fd, events);
+}
+
+//---------------------------------------------------------------------------
+// utility function for setting up epoll for a postgres connection
+// the handler is registered when the connection's socket is first polled, 
+// and again if libpq moves to another socket while connecting
+// returns 0 on success, -1 on error
+static int
+set_epoll_ctl_for_connection(enum EPOLL_ACTION action, 
+                             state_callback callback,
+                             PGconn * connection,
+                             struct StateHandler * handler,
+                             struct State * state) {
+//---------------------------------------------------------------------------
+   uint32_t events = \
+      action == EPOLL_READ ? EPOLLIN | EPOLLERR : EPOLLOUT | EPOLLERR;
+   int fd = PQsocket(connection);
+
+   handler->callback = callback;
+   // libpq may have closed the socket and opened another under the same 
+   // fd, which epoll forgets with the close
+   if (handler->handler.fd == fd && 
+       reactor_modify(&state->reactor, &handler->handler, events) == 0) {
+      return 0;
+   }
+   reactor_remove(&state->reactor, &handler->handler);
+   return add_state_handler(state, handler, fd, events);
+}
+
+//---------------------------------------------------------------------------
+// utility function for setting up epoll for postgres
+// returns 0 on success, -1 on error
+static int
+set_epoll_ctl_for_postgres(enum EPOLL_ACTION action, 
+                           state_callback callback,
+                           struct State * state) {
+//---------------------------------------------------------------------------
+   return set_epoll_ctl_for_connection(action,
+                                       callback,
+                                       state->postgres_connection,
+                                       &state->postgres_handler,
+                                       state);
+}
+
+//---------------------------------------------------------------------------
+// utility function for setting up epoll for the gateway's connection
+// returns 0 on success, -1 on error
+static int
+set_epoll_ctl_for_gateway(enum EPOLL_ACTION action, 
+                          state_callback callback,
+                          struct State * state) {
+//---------------------------------------------------------------------------
+   return set_epoll_ctl_for_connection(action,
+                                       callback,
+                                       state->gateway.connection,
+                                       &state->gateway_postgres_handler,
+                                       state);
+}
+
+//----------------------------------------------------------------------------
+// the current CLOCK_MONOTONIC time in microseconds
+static uint64_t
+monotonic_us(void) {
+//----------------------------------------------------------------------------
+   struct timespec now;
+
+   clock_gettime(CLOCK_MONOTONIC, &now);
+   return (uint64_t) now.tv_sec * 1000000 + now.tv_nsec / 1000;
+}
+
+//----------------------------------------------------------------------------
+// publish one multipart message on a channel: topic, meta data and 
+// (optional) data
+// received_us holds when we read each of the received_qty notifications 
+// in the message, 0 for those that weren't notifications; their latency 
+// runs to here, after any batch or conflation window
+// the message list takes ownership of meta and data
+// return 0 on success, -1 on failure
+static int
+send_channel_message(const struct Config * config, 
+                     struct State * state,
+                     int channel_index,
+                     const uint64_t * received_us,
+                     int received_qty,
+                     bstring meta,
+                     bstring data) {
+//----------------------------------------------------------------------------
+   int message_list_size;
+   struct bstrList * message_list;
+   int published;
+   int dropped;
+   int result;
+   uint64_t now_us;
+   uint64_t latency_us;
+   int i;
+
+   // build the message list
+   message_list = bstrListCreate();
+   check(message_list != NULL, "bstrListCreate");
+
+   message_list_size = (data == NULL) ? 2 : 3;
+   check(bstrListAlloc(message_list, message_list_size) == BSTR_OK,
+         "bstrListAlloc");
+
+   // first message: topic
+   message_list->entry[0] = bstrcpy(config->channel_list->entry[channel_index]);
+   check(message_list->entry[0] != NULL, "bstrcpy 0");
+
+   // second message: meta data
+   message_list->entry[1] = meta;
+   meta = NULL;
+
+   // third message: data (if present)
+   if (data != NULL) {
+      message_list->entry[2] = data;
+      data = NULL;
+   }
+   message_list->qty = message_list_size; 
+
+   // publish the message list
+   check(compress_message(message_list, 
+                          &state->compressors[channel_index]) == 0,
+         "compress_message");
+   published = publish_on_sockets(
+      message_list, 
+      state->pub_sockets,
+      state->pub_socket_qty,
+      config->channel_config[channel_index].priority_class_index,
+      &dropped);
+   check(published != -1, "publish_on_sockets");
+   state->channel_dropped[channel_index] += dropped;
+
+   // and for subscribers on this host
+   if (state->shm_ring.header != NULL) {
+      result = shm_ring_publish(&state->shm_ring, message_list);
+      check(result != -1, "shm_ring_publish");
+      if (result == 0) {
+         published++;
+      } else {
+         state->channel_dropped[channel_index]++;
+      }
+   }
+
+   if (published > 0) {
+      state->channel_published[channel_index]++;
+      for (i=0; i < message_list->qty; i++) {
+         state->channel_bytes[channel_index] += \
+            blength(message_list->entry[i]);
+      }
+   }
+
+   now_us = monotonic_us();
+   for (i=0; i < received_qty; i++) {
+      if (received_us[i] == 0) {
+         continue;
+      }
+      latency_us = (received_us[i] < now_us) ? now_us - received_us[i] : 0;
+      histogram_record(&state->channel_latency[channel_index], latency_us);
+      histogram_record(&state->interval_latency[channel_index], latency_us);
+   }
+
+   // clean up the message list
+   check(bstrListDestroy(message_list) == BSTR_OK, "bstrListDestroy");
+
+   return 0;
+
+error:
+
+   bdestroy(meta);
+   bdestroy(data);
+   if (message_list != NULL) bstrListDestroy(message_list);
+   return -1;
+}
+
+//----------------------------------------------------------------------------
+// publish the channel's batch (if it has anything in it) as one message
+// return 0 on success, -1 on failure
+static int
+flush_batch(const struct Config * config, 
+            struct State * state,
+            int channel_index) {
+//----------------------------------------------------------------------------
+   struct Batch * batch = &state->batches[channel_index];
+   bstring meta = NULL;
+   bstring data = NULL;
+   int count = batch->count;
+
+   if (batch->count == 0) {
+      return 0;
+   }
+
+   meta = bformat("timestamp=%ld;sequence=%" PRIu64 ";batch=%d",
+                  (long) time(NULL),
+                  batch->first_sequence,
+                  batch->count);
+   check(meta != NULL, "bformat");
+   data = bstrcpy(batch->frame);
+   check(data != NULL, "bstrcpy");
+   debug("flush batch %s %d messages %d bytes",
+         (const char *) config->channel_list->entry[channel_index]->data,
+         batch->count,
+         blength(data));
+   batch_reset(batch);
+
+   // batch_reset leaves received_us as it was
+   return send_channel_message(config, 
+                               state, 
+                               channel_index, 
+                               batch->received_us,
+                               count,
+                               meta, 
+                               data);
+
+error:
+
+   bdestroy(meta);
+   return -1;
+}
+
+//----------------------------------------------------------------------------
+// publish one notification on a channel, or add it to the channel's batch
+// received_us is when we read the notification, 0 for an outbox row
+// extra_meta (if not NULL) is appended to the meta data
+// return 0 on success, -1 on failure
+static int
+publish_channel_message(const struct Config * config, 
+                        struct State * state,
+                        int channel_index,
+                        uint64_t sequence,
+                        uint64_t received_us,
+                        const char * data,
+                        const char * extra_meta) {
+//----------------------------------------------------------------------------
+   const struct ChannelConfig * channel_config = \
+      &config->channel_config[channel_index];
+   struct Batch * batch = &state->batches[channel_index];
+   const struct ChannelCallbacks * callbacks;
+   bstring meta = NULL;
+   bstring data_frame = NULL;
+   int i;
+
+   // the standby counts the sequence numbers, the leader publishes
+   if (!state->leader) {
+      return 0;
+   }
+
+   meta = bformat("timestamp=%ld;sequence=%" PRIu64,
+                  (long) time(NULL),
+                  sequence);
+   check(meta != NULL, "bformat");
+   if (extra_meta != NULL) {
+      check(bcatcstr(meta, extra_meta) == BSTR_OK, "bcatcstr");
+   }
+
+   // in-process subscribers get every message, unbatched
+   callbacks = &state->channel_callbacks[channel_index];
+   for (i=0; i < callbacks->qty; i++) {
+      callbacks->entries[i].callback(
+         (const char *) config->channel_list->entry[channel_index]->data,
+         (const char *) meta->data,
+         data,
+         callbacks->entries[i].arg);
+   }
+
+   // browsers too
+   if (state->sse.listen_fd != -1) {
+      check(sse_publish(&state->sse, config, channel_index, sequence, data) 
+            == 0,
+            "sse_publish");
+   }
+   if (state->resp.listen_fd != -1) {
+      check(resp_publish(&state->resp, config, channel_index, data) == 0,
+            "resp_publish");
+   }
+
+   if (channel_config->batch_max_bytes == 0) {
+      if (data != NULL) {
+         data_frame = bfromcstr(data);
+         check(data_frame != NULL, "bfromcstr");
+      }
+      return send_channel_message(config, 
+                                  state, 
+                                  channel_index, 
+                                  &received_us,
+                                  1,
+                                  meta, 
+                                  data_frame);
+   }
+
+   check(batch_append(batch, sequence, received_us, meta, data) == 0, 
+         "batch_append");
+   check(bdestroy(meta) == BSTR_OK, "bdestroy(meta)");
+   meta = NULL;
+
+   if (blength(batch->frame) >= channel_config->batch_max_bytes) {
+      check(flush_batch(config, state, channel_index) == 0, "flush_batch");
+   } else if (!timer_scheduled(&state->batch_timer.timer)) {
+      check(schedule_timer(&state->timer_wheel, 
+                           &state->batch_timer.timer,
+                           config->batch_max_latency,
+                           0) == 0,
+            "schedule_timer");
+   }
+
+   return 0;
+
+error:
+
+   bdestroy(meta);
+   return -1;
+}
+
+//----------------------------------------------------------------------------
+// the current CLOCK_REALTIME time in microseconds since the epoch, to 
+// compare with producers' timestamps
+static uint64_t
+realtime_us(void) {
+//----------------------------------------------------------------------------
+   struct timespec now;
+
+   clock_gettime(CLOCK_REALTIME, &now);
+   return (uint64_t) now.tv_sec * 1000000 + now.tv_nsec / 1000;
+}
+
+//----------------------------------------------------------------------------
+// find the producer's timestamp in a payload: field, then '=' or ':' 
+// (an optional closing quote first, for JSON), then microseconds since
+// the epoch. 'sent_us=1700000000000000;...' and 
+// '{"sent_us": 1700000000000000, ...}' both work for 'sent_us'
+// return true and set timestamp_us if we found one
+static bool
+find_producer_timestamp(const char * field, 
+                        const char * payload,
+                        uint64_t * timestamp_us) {
+//----------------------------------------------------------------------------
+   size_t field_len = strlen(field);
+   const char * p = payload;
+
+   while ((p = strstr(p, field)) != NULL) {
+      p += field_len;
+      if (*p == '"') p++;
+      if (*p != '=' && *p != ':') {
+         continue;
+      }
+      p++;
+      while (*p == ' ') p++;
+      if (*p >= '0' && *p <= '9') {
+         *timestamp_us = strtoull(p, NULL, 10);
+         return true;
+      }
+   }
+
+   return false;
+}
+
+//----------------------------------------------------------------------------
+// make this notification the pending one for its key
+// the conflation window starts when the channel gets its first pending key
+// return 0 on success, -1 on failure
+static int
+conflate_notification(const struct Config * config, 
+                      struct State * state,
+                      int channel_index,
+                      uint64_t received_us,
+                      const char * data) {
+//----------------------------------------------------------------------------
+   const struct ChannelConfig * channel_config = \
+      &config->channel_config[channel_index];
+   struct ConflateTable * table = &state->conflate_tables[channel_index];
+   bstring key = NULL;
+   bstring data_copy = NULL;
+   bool first_pending = (table->count == 0);
+
+   key = conflate_key(data, channel_config->conflate_key_delimiter);
+   check(key != NULL, "conflate_key");
+   if (data != NULL) {
+      data_copy = bfromcstr(data);
+      check(data_copy != NULL, "bfromcstr");
+   }
+   check(conflate_add(table, key, data_copy, received_us) == 0, 
+         "conflate_add");
+
+   if (first_pending) {
+      check(schedule_timer(&state->timer_wheel,
+                           &state->conflate_timers[channel_index],
+                           channel_config->conflate_window,
+                           0) == 0,
+            "schedule_timer");
+   }
+
+   return 0;
+
+error:
+   bdestroy(key);
+   return -1;
+}
+
+//----------------------------------------------------------------------------
+// publish the latest notification for every pending key in the channel
+// 'conflated' in the meta data is the number of notifications it replaced
+// return 0 on success, -1 on failure
+static int
+flush_conflated(const struct Config * config, 
+                struct State * state,
+                int channel_index) {
+//----------------------------------------------------------------------------
+   struct ConflateEntry * entry = NULL;
+   bstring extra_meta = NULL;
+   int result;
+
+   cancel_timer(&state->timer_wheel, &state->conflate_timers[channel_index]);
+
+   while ((entry = conflate_take(&state->conflate_tables[channel_index]))) {
+      extra_meta = bformat(";conflated=%d", entry->superseded);
+      check(extra_meta != NULL, "bformat");
+
+      state->channel_counts[channel_index]++;
+      result = publish_channel_message(
+         config, 
+         state,
+         channel_index,
+         state->channel_counts[channel_index],
+         entry->received_us,
+         (entry->data == NULL) ? NULL : (const char *) entry->data->data,
+         (const char *) extra_meta->data);
+      check(result == 0, "publish_channel_message");
+
+      free_conflate_entry(entry);
+      entry = NULL;
+      check(bdestroy(extra_meta) == BSTR_OK, "bdestroy");
+      extra_meta = NULL;
+   }
+
+   return 0;
+
+error:
+   if (entry != NULL) free_conflate_entry(entry);
+   bdestroy(extra_meta);
+   return -1;
+}
+
+//----------------------------------------------------------------------------
+// publish one notification, through conflation, the rate limit and 
+// batching if the channel uses them
+// received_us is when we read it
+// return 0 on success, -1 on failure
+static int
+publish_notification(const struct Config * config, 
+                     struct State * state,
+                     int channel_index,
+                     uint64_t received_us,
+                     const PGnotify * notification) {
+//----------------------------------------------------------------------------
+   if (config->channel_config[channel_index].conflate_window > 0) {
+      return conflate_notification(config, 
+                                   state, 
+                                   channel_index, 
+                                   received_us,
+                                   notification->extra);
+   }
+
+   // over the limit: counted in the bucket and reported in a summary
+   if (!token_bucket_take(&state->token_buckets[channel_index], 
+                          monotonic_us())) {
+      return 0;
+   }
+
+   state->channel_counts[channel_index]++;
+   debug("%s %ld", 
+         notification->relname, 
+         state->channel_counts[channel_index]);
+   return publish_channel_message(config, 
+                                  state,
+                                  channel_index,
+                                  state->channel_counts[channel_index],
+                                  received_us,
+                                  notification->extra,
+                                  NULL);
+}
+
+//----------------------------------------------------------------------------
+// publish the notifications waiting in a priority class, recording how 
+// long each one waited in the class since we read it; the channel 
+// latency is recorded as it is sent, after any batch or conflation window
+// return 0 on success, -1 on failure
+static int
+drain_priority_class(const struct Config * config, 
+                     struct State * state,
+                     int class_index) {
+//----------------------------------------------------------------------------
+   struct PriorityClass * priority_class = \
+      &state->priority_classes[class_index];
+   struct PendingNotification * pending;
+   uint64_t latency_us;
+   int result;
+
+   while ((pending = pop_pending_notification(priority_class)) != NULL) {
+      latency_us = monotonic_us() - pending->received_us;
+      record_class_latency(priority_class, latency_us);
+      result = publish_notification(config, 
+                                    state, 
+                                    pending->channel_index, 
+                                    pending->received_us,
+                                    pending->notification);
+      PQfreemem(pending->notification);
+      free(pending);
+      check(result == 0, "publish_notification");
+   }
+
+   return 0;
+
+error:
+
+   return -1;
+}
+
+//----------------------------------------------------------------------------
+// publish the notifications waiting in every priority class, highest first
+// return 0 on success, -1 on failure
+static int
+drain_priority_classes(const struct Config * config, struct State * state) {
+//----------------------------------------------------------------------------
+   int i;
+
+   for (i=0; i < state->priority_class_qty; i++) {
+      check(drain_priority_class(config, state, i) == 0, 
+            "drain_priority_class");
+   }
+
+   return 0;
+
+error:
+
+   return -1;
+}
+
+//----------------------------------------------------------------------------
+// append an 'outbox=<name>;last_id=<n>' line for each outbox channel
+// return 0 on success, -1 on failure
+static int
+format_outbox_last_ids(const struct Config * config, 
+                       const struct State * state,
+                       bstring message) {
+//----------------------------------------------------------------------------
+   int i;
+
+   for (i=0; i < config->channel_list->qty; i++) {
+      if (config->channel_config[i].outbox_table == NULL) {
+         continue;
+      }
+      check(bformata(message, 
+                     "\noutbox=%s;last_id=%" PRIu64,
+                     (const char *) config->channel_list->entry[i]->data,
+                     state->outbox_last_ids[i]) == BSTR_OK,
+            "bformata");
+   }
+
+   return 0;
+
+error:
+   return -1;
+}
+
+//----------------------------------------------------------------------------
+// read an 'outbox=<name>;last_id=<n>' line
+// *channel_index is -1 for a channel that isn't an outbox in our config
+// return 0 on success, -1 on failure
+static int
+parse_outbox_last_id(const struct Config * config,
+                     const char * line,
+                     int * channel_index,
+                     uint64_t * last_id) {
+//----------------------------------------------------------------------------
+   const char * last_id_field;
+   bstring channel = NULL;
+
+   last_id_field = strstr(line, ";last_id=");
+   check(last_id_field != NULL, "no last_id in '%s'", line);
+   channel = blk2bstr(line + 7, last_id_field - line - 7);
+   check(channel != NULL, "blk2bstr");
+   *channel_index = find_channel_index(config, channel);
+   if (*channel_index != -1 && 
+       config->channel_config[*channel_index].outbox_table == NULL) {
+      *channel_index = -1;
+   }
+   *last_id = strtoull(last_id_field + 9, NULL, 10);
+   check(bdestroy(channel) == BSTR_OK, "bdestroy");
+
+   return 0;
+
+error:
+   bdestroy(channel);
+   return -1;
+}
+
+//----------------------------------------------------------------------------
+// the old process's sequence numbers, for the new one:
+//    state
+//    handed_off_us=<CLOCK_MONOTONIC microseconds when we stopped>
+//    heartbeat=<n>
+//    channel=<name>;sequence=<n>
+//    ...
+//    outbox=<name>;last_id=<the last row we published>
+//    ...
+// return NULL on failure
+static bstring
+format_handoff_state(const struct Config * config, struct State * state) {
+//----------------------------------------------------------------------------
+   bstring message;
+   int i;
+
+   message = bformat("state\nhanded_off_us=%" PRIu64 "\nheartbeat=%" PRIu64,
+                     monotonic_us(),
+                     state->heartbeat_count);
+   check(message != NULL, "bformat");
+   for (i=0; i < config->channel_list->qty; i++) {
+      check(bformata(message, 
+                     "\nchannel=%s;sequence=%" PRIu64,
+                     (const char *) config->channel_list->entry[i]->data,
+                     state->channel_counts[i]) == BSTR_OK,
+            "bformata");
+   }
+   check(format_outbox_last_ids(config, state, message) == 0,
+         "format_outbox_last_ids");
+
+   return message;
+
+error:
+   bdestroy(message);
+   return NULL;
+}
+
+//----------------------------------------------------------------------------
+// read a 'channel=<name>;sequence=<n>' line
+// *channel_index is -1 for a channel not in our config
+// return 0 on success, -1 on failure
+static int
+parse_channel_sequence(const struct Config * config,
+                       const char * line,
+                       int * channel_index,
+                       uint64_t * sequence) {
+//----------------------------------------------------------------------------
+   const char * sequence_field;
+   bstring channel = NULL;
+
+   sequence_field = strstr(line, ";sequence=");
+   check(sequence_field != NULL, "no sequence in '%s'", line);
+   channel = blk2bstr(line + 8, sequence_field - line - 8);
+   check(channel != NULL, "blk2bstr");
+   *channel_index = find_channel_index(config, channel);
+   *sequence = strtoull(sequence_field + 10, NULL, 10);
+   check(bdestroy(channel) == BSTR_OK, "bdestroy");
+
+   return 0;
+
+error:
+   bdestroy(channel);
+   return -1;
+}
+
+//----------------------------------------------------------------------------
+// carry on from the old process's sequence numbers and outbox rows
+// channels the old process didn't have start from 0, outboxes from our 
+// checkpoint
+// return 0 on success, -1 on failure
+static int
+apply_handoff_state(const struct Config * config, 
+                    struct State * state,
+                    const_bstring message) {
+//----------------------------------------------------------------------------
+   struct bstrList * lines = NULL;
+   const char * line;
+   uint64_t sequence;
+   int channel_index;
+   int i;
+
+   lines = bsplit(message, '\n');
+   check(lines != NULL, "bsplit");
+   check(lines->qty > 0 && biseqcstr(lines->entry[0], "state"), 
+         "expected a 'state' message");
+
+   for (i=1; i < lines->qty; i++) {
+      line = (const char *) lines->entry[i]->data;
+      if (strncmp(line, "handed_off_us=", 14) == 0) {
+         state->handoff.handed_off_us = strtoull(line + 14, NULL, 10);
+      } else if (strncmp(line, "heartbeat=", 10) == 0) {
+         state->heartbeat_count = strtoull(line + 10, NULL, 10);
+      } else if (strncmp(line, "channel=", 8) == 0) {
+         check(parse_channel_sequence(config, 
+                                      line, 
+                                      &channel_index, 
+                                      &sequence) == 0,
+               "parse_channel_sequence");
+         if (channel_index != -1) {
+            state->channel_counts[channel_index] = sequence;
+         }
+      } else if (strncmp(line, "outbox=", 7) == 0) {
+         check(parse_outbox_last_id(config, 
+                                    line, 
+                                    &channel_index, 
+                                    &sequence) == 0,
+               "parse_outbox_last_id");
+         if (channel_index != -1) {
+            state->outbox_last_ids[channel_index] = sequence;
+         }
+      }
+   }
+
+   bstrListDestroy(lines);
+   return 0;
+
+error:
+   if (lines != NULL) bstrListDestroy(lines);
+   return -1;
+}
+
+//----------------------------------------------------------------------------
+// the new process has the marker and the sequence numbers: we publish 
+// from here on, tail the outboxes from where the old process stopped, 
+// and wait for the next handoff
+// return 0 on success, -1 on failure
+static int
+finish_taking_over(const struct Config * config, struct State * state) {
+//----------------------------------------------------------------------------
+   int result;
+   int i;
+
+   log_info("took over: publishing resumed %" PRIu64 
+            "us after the old process stopped",
+            monotonic_us() - state->handoff.handed_off_us);
+
+   reactor_remove(&state->reactor, &state->handoff_handler.handler);
+   check(end_handoff(&state->handoff) == 0, "end_handoff");
+   result = add_state_handler(state,
+                              &state->handoff_listen_handler,
+                              state->handoff.listen_fd,
+                              EPOLLIN);
+   check(result == 0, "epoll handoff listen");
+
+   for (i=0; i < config->channel_list->qty; i++) {
+      if (config->channel_config[i].outbox_table != NULL) {
+         state->outbox_pending[i] = true;
+      }
+   }
+
+   return 0;
+
+error:
+   return -1;
+}
+
+//----------------------------------------------------------------------------
+// a notification on HANDOFF_CHANNEL: if it is the marker, the old process
+// publishes everything before it and hands off, the new process 
+// everything after it
+// return 0 on success, -1 on failure
+static int
+handoff_notification(const struct Config * config, 
+                     struct State * state,
+                     const char * payload) {
+//----------------------------------------------------------------------------
+   bstring handoff_state = NULL;
+   int i;
+
+   if (!is_handoff_marker(&state->handoff, payload)) {
+      return 0;
+   }
+
+   if (state->handoff.phase == HANDOFF_GIVING) {
+      check(drain_priority_classes(config, state) == 0, 
+            "drain_priority_classes");
+      for (i=0; i < config->channel_list->qty; i++) {
+         check(flush_conflated(config, state, i) == 0, "flush_conflated");
+         check(flush_batch(config, state, i) == 0, "flush_batch");
+      }
+      handoff_state = format_handoff_state(config, state);
+      check(handoff_state != NULL, "format_handoff_state");
+      reactor_remove(&state->reactor, &state->handoff_handler.handler);
+      check(send_handoff_state(&state->handoff, handoff_state) == 0,
+            "send_handoff_state");
+      log_info("handed off");
+   } else {
+      state->handoff.marker_us = monotonic_us();
+      if (state->handoff.state_received) {
+         check(finish_taking_over(config, state) == 0, "finish_taking_over");
+      } else {
+         state->handoff.phase = HANDOFF_RESUMING;
+      }
+   }
+
+   bdestroy(handoff_state);
+   return 0;
+
+error:
+   bdestroy(handoff_state);
+   return -1;
+}
+
+//----------------------------------------------------------------------------
+// the mark the leader NOTIFYs on LEADER_CHANNEL with each heartbeat:
+//    mark=<backend pid>.<n>
+//    heartbeat=<n>
+//    outbox=<name>;last_id=<n>
+//    ...
+//    prev=<the mark before>
+//    channel=<name>;sequence=<n>
+//    ...
+// with the last outbox rows we published, and our sequence numbers at 
+// the mark before, if we saw one
+// return NULL on failure
+static bstring
+format_leader_mark(const struct Config * config, struct State * state) {
+//----------------------------------------------------------------------------
+   bstring mark;
+   int i;
+
+   state->leader_mark_count++;
+   mark = bformat("mark=%d.%" PRIu64 "\nheartbeat=%" PRIu64,
+                  PQbackendPID(state->postgres_connection),
+                  state->leader_mark_count,
+                  state->heartbeat_count);
+   check(mark != NULL, "bformat");
+   check(format_outbox_last_ids(config, state, mark) == 0,
+         "format_outbox_last_ids");
+   if (state->leader_mark == NULL) {
+      return mark;
+   }
+
+   check(bformata(mark, 
+                  "\nprev=%s", 
+                  (const char *) state->leader_mark->data) == BSTR_OK,
+         "bformata");
+   for (i=0; i < config->channel_list->qty; i++) {
+      check(bformata(mark, 
+                     "\nchannel=%s;sequence=%" PRIu64,
+                     (const char *) config->channel_list->entry[i]->data,
+                     state->leader_mark_counts[i]) == BSTR_OK,
+            "bformata");
+   }
+
+   return mark;
+
+error:
+   bdestroy(mark);
+   return NULL;
+}
+
+//----------------------------------------------------------------------------
+// a mark on LEADER_CHANNEL. The leader and the standby see it at the same
+// place in the notification stream, and note their sequence numbers 
+// there. From the leader's at the mark before, the standby moves its own
+// into step. Outbox ids are the table's own, so the standby takes the 
+// leader's as they are, to carry on from if it takes over.
+// return 0 on success, -1 on failure
+static int
+leader_notification(const struct Config * config, 
+                    struct State * state,
+                    int be_pid,
+                    const char * payload) {
+//----------------------------------------------------------------------------
+   struct bstrList * lines = NULL;
+   bstring message = NULL;
+   const char * line;
+   uint64_t sequence;
+   int channel_index;
+   bool from_leader;
+   bool mirror;
+   int i;
+
+   // the notifications before the mark get their sequence numbers first
+   check(drain_priority_classes(config, state) == 0, 
+         "drain_priority_classes");
+
+   message = bfromcstr(payload);
+   check(message != NULL, "bfromcstr");
+   lines = bsplit(message, '\n');
+   check(lines != NULL, "bsplit");
+   check(lines->qty > 0 && 
+         strncmp((const char *) lines->entry[0]->data, "mark=", 5) == 0,
+         "expected a mark on " LEADER_CHANNEL);
+
+   from_leader = !state->leader && 
+                 be_pid != PQbackendPID(state->postgres_connection);
+   mirror = false;
+   for (i=1; from_leader && i < lines->qty; i++) {
+      line = (const char *) lines->entry[i]->data;
+      if (strncmp(line, "heartbeat=", 10) == 0) {
+         state->heartbeat_count = strtoull(line + 10, NULL, 10);
+      } else if (strncmp(line, "outbox=", 7) == 0) {
+         check(parse_outbox_last_id(config, 
+                                    line, 
+                                    &channel_index, 
+                                    &sequence) == 0,
+               "parse_outbox_last_id");
+         if (channel_index != -1 && 
+             sequence > state->outbox_last_ids[channel_index]) {
+            state->outbox_last_ids[channel_index] = sequence;
+         }
+      } else if (strncmp(line, "prev=", 5) == 0) {
+         mirror = state->leader_mark != NULL &&
+                  biseqcstr(state->leader_mark, line + 5);
+      } else if (mirror && strncmp(line, "channel=", 8) == 0) {
+         check(parse_channel_sequence(config, 
+                                      line, 
+                                      &channel_index, 
+                                      &sequence) == 0,
+               "parse_channel_sequence");
+         if (channel_index != -1) {
+            state->channel_counts[channel_index] += \
+               sequence - state->leader_mark_counts[channel_index];
+         }
+      }
+   }
+
+   bdestroy(state->leader_mark);
+   state->leader_mark = bmidstr(lines->entry[0], 5, blength(lines->entry[0]));
+   check(state->leader_mark != NULL, "bmidstr");
+   memcpy(state->leader_mark_counts, 
+          state->channel_counts, 
+          config->channel_list->qty * sizeof(uint64_t));
+
+   bstrListDestroy(lines);
+   bdestroy(message);
+   return 0;
+
+error:
+   if (lines != NULL) bstrListDestroy(lines);
+   bdestroy(message);
+   return -1;
+}
+
+//----------------------------------------------------------------------------
+// take every notification libpq has queued
+// for outbox channels, the notification is only a wakeup: we mark the
+// channel pending and publish the rows from the table instead.
+// The others wait in their priority class. We publish the highest class
+// now; skeeter_step publishes the rest once it has handled every event
+// of this wakeup, so a busy low priority channel can't delay a high 
+// priority one.
+// During a handoff, the new process drops the notifications before the
+// marker, and leaves the ones after it queued in libpq until it has the
+// old process's sequence numbers; the old process stops at the marker.
+// A standby numbers the notifications as the leader does, and publishes
+// none of them.
+// For channels with producer_timestamp, the time from the producer to us
+// is taken against the clock as PQconsumeInput returned.
+// return 0 on success, -1 on failure
+static int
+publish_notifications(const struct Config * config, struct State * state) {
+//----------------------------------------------------------------------------
+   PGnotify * notification;
+   bstring channel = NULL;
+   int channel_index = -1;
+   uint64_t received_us = monotonic_us();
+   uint64_t received_realtime_us = realtime_us();
+   uint64_t producer_us;
+   uint64_t database_us;
+   int result;
+
+   if (state->handoff.phase == HANDOFF_RESUMING ||
+       state->handoff.phase == HANDOFF_DONE) {
+      return 0;
+   }
+
+   while ((notification = PQnotifies(state->postgres_connection)) != NULL) {
+      if (strcmp(notification->relname, HANDOFF_CHANNEL) == 0) {
+         result = handoff_notification(config, state, notification->extra);
+         PQfreemem(notification);
+         check(result == 0, "handoff_notification");
+         if (state->handoff.phase == HANDOFF_RESUMING ||
+             state->handoff.phase == HANDOFF_DONE) {
+            break;
+         }
+         continue;
+      }
+      if (config->leader_lock_key != 0 &&
+          strcmp(notification->relname, LEADER_CHANNEL) == 0) {
+         result = leader_notification(config, 
+                                      state, 
+                                      notification->be_pid,
+                                      notification->extra);
+         PQfreemem(notification);
+         check(result == 0, "leader_notification");
+         continue;
+      }
+      if (state->handoff.phase == HANDOFF_TAKING) {
+         // the old process publishes this one
+         PQfreemem(notification);
+         continue;
+      }
+
+      channel = bfromcstr(notification->relname);
+      check(channel != NULL, "bfromcstr");
+      channel_index = find_channel_index(config, channel);
+      check(channel_index != -1, "channel_index");
+      check(bdestroy(channel) == BSTR_OK, "bdestroy");
+      channel = NULL;
+
+      // a producer clock ahead of ours counts as no time at all
+      if (config->channel_config[channel_index].producer_timestamp != NULL &&
+          find_producer_timestamp(
+             config->channel_config[channel_index].producer_timestamp,
+             notification->extra,
+             &producer_us)) {
+         database_us = (producer_us < received_realtime_us) ? 
+            received_realtime_us - producer_us : 0;
+         histogram_record(&state->channel_database_latency[channel_index],
+                          database_us);
+         histogram_record(&state->interval_database_latency[channel_index],
+                          database_us);
+      }
+
+      // proxy clients get every notification as it comes, as they would 
+      // from postgres
+      if (state->pg_proxy.listen_fd != -1 && state->leader) {
+         result = pg_proxy_notify(&state->pg_proxy,
+                                  config,
+                                  channel_index,
+                                  notification->be_pid,
+                                  notification->relname,
+                                  notification->extra);
+         check(result == 0, "pg_proxy_notify");
+      }
+
+      if (config->channel_config[channel_index].outbox_table != NULL) {
+         debug("%s outbox wakeup", notification->relname);
+         state->outbox_pending[channel_index] = true;
+         PQfreemem(notification);
+         continue;
+      }
+
+      result = push_pending_notification(
+         &state->priority_classes[
+            config->channel_config[channel_index].priority_class_index],
+         notification,
+         channel_index,
+         received_us);
+      check(result == 0, "push_pending_notification");
+   }
+
+   return drain_priority_class(config, state, 0);
+
+error:
+
+   bdestroy(channel);
+   return -1;
+}
+
+//----------------------------------------------------------------------------
+// publish a batch of rows from an outbox table, using the row ids
+// as sequence numbers, and checkpoint the last id
+// return 0 on success, -1 on failure
+int
+outbox_result_cb(const struct Config * config, 
+                 struct State * state,
+                 const PGresult * result) {
+//----------------------------------------------------------------------------
+   int channel_index = state->query_channel_index;
+   ExecStatusType exec_status = PQresultStatus(result);
+   int row_count;
+   int i;
+   uint64_t id;
+   const char * data;
+
+   if (exec_status != PGRES_TUPLES_OK) {
+      // a bad table definition should not take the other channels down:
+      // log it and try again on the next wakeup
+      log_err("outbox query %s %s", 
+              EXEC_STATUS[exec_status], 
+              PQresultErrorMessage(result));
+      return 0;
+   }
+
+   // we handed off while the query was in flight: the new process 
+   // carries on from the last id we sent it
+   if (!handoff_may_publish(&state->handoff)) {
+      return 0;
+   }
+
+   row_count = PQntuples(result);
+   for (i=0; i < row_count; i++) {
+      id = strtoull(PQgetvalue(result, i, 0), NULL, 10);
+      data = PQgetisnull(result, i, 1) ? NULL : PQgetvalue(result, i, 1);
+      check(publish_channel_message(config, 
+                                    state, 
+                                    channel_index, 
+                                    id, 
+                                    0,
+                                    data, 
+                                    NULL) == 0,
+            "publish_channel_message");
+      state->outbox_last_ids[channel_index] = id;
+   }
+
+   if (row_count > 0) {
+      debug("outbox %s %d rows last_id = %" PRIu64,
+            (const char *) config->channel_list->entry[channel_index]->data,
+            row_count,
+            state->outbox_last_ids[channel_index]);
+      // a batched channel may only have buffered the rows: send them 
+      // before the checkpoint moves past them
+      check(flush_batch(config, state, channel_index) == 0, "flush_batch");
+      check(save_outbox_checkpoint(config, 
+                                   channel_index, 
+                                   state->outbox_last_ids[channel_index]) == 0,
+            "save_outbox_checkpoint");
+   }
+
+   // a full batch means there are probably more rows waiting
+   if (row_count == config->outbox_batch_size) {
+      state->outbox_pending[channel_index] = true;
+   }
+
+   return 0;
+
+error:
+
+   return -1;
+}
+
+//----------------------------------------------------------------------------
+// send the outbox query for the next pending channel
+// returns 0 on success, -1 on failure
+static int
+send_outbox_query(const struct Config * config, 
+                  struct State * state, 
+                  int channel_index) {
+//----------------------------------------------------------------------------
+   bstring query = NULL;
+   bstring last_id = NULL;
+   bstring batch_size = NULL;
+   const char * param_values[2];
+
+   query = outbox_query(config, channel_index);
+   check(query != NULL, "outbox_query");
+   last_id = bformat("%" PRIu64, state->outbox_last_ids[channel_index]);
+   check(last_id != NULL, "bformat");
+   batch_size = bformat("%d", config->outbox_batch_size);
+   check(batch_size != NULL, "bformat");
+
+   param_values[0] = (const char *) last_id->data;
+   param_values[1] = (const char *) batch_size->data;
+
+   debug("query = %s", (const char *) query->data);
+   check(PQsendQueryParams(state->postgres_connection,
+                           (const char *) query->data,
+                           2,
+                           NULL,
+                           param_values,
+                           NULL,
+                           NULL,
+                           0) == 1,
+         "PQsendQueryParams %s", PQerrorMessage(state->postgres_connection));
+
+   state->outbox_pending[channel_index] = false;
+   state->query_channel_index = channel_index;
+   state->query_result_cb = outbox_result_cb;
+
+   bdestroy(query);
+   bdestroy(last_id);
+   bdestroy(batch_size);
+   return 0;
+
+error:
+
+   bdestroy(query);
+   bdestroy(last_id);
+   bdestroy(batch_size);
+   return -1;
+}
+
+//----------------------------------------------------------------------------
+// we hold the advisory lock: publish, and catch up on the outboxes the 
+// leader before us may not have finished
+static void
+become_leader(const struct Config * config, struct State * state) {
+//----------------------------------------------------------------------------
+   int i;
+
+   log_info("leader: holding advisory lock %lld", config->leader_lock_key);
+   state->leader = true;
+   for (i=0; i < config->channel_list->qty; i++) {
+      if (config->channel_config[i].outbox_table != NULL) {
+         state->outbox_pending[i] = true;
+      }
+   }
+}
+
+//----------------------------------------------------------------------------
+// the result of pg_try_advisory_lock
+// return 0 on success, -1 on failure
+int
+leader_lock_result_cb(const struct Config * config, 
+                      struct State * state,
+                      const PGresult * result) {
+//----------------------------------------------------------------------------
+   ExecStatusType exec_status = PQresultStatus(result);
+
+   if (exec_status != PGRES_TUPLES_OK) {
+      log_err("advisory lock query %s %s", 
+              EXEC_STATUS[exec_status], 
+              PQresultErrorMessage(result));
+      return 0;
+   }
+   if (!state->leader && strcmp(PQgetvalue(result, 0, 0), "t") == 0) {
+      become_leader(config, state);
+   }
+
+   return 0;
+}
+
+//----------------------------------------------------------------------------
+// the result of the leader's mark
+// return 0 on success, -1 on failure
+int
+leader_mark_result_cb(const struct Config * config, 
+                      struct State * state,
+                      const PGresult * result) {
+//----------------------------------------------------------------------------
+   (void) config; // unused
+   (void) state; // unused
+   ExecStatusType exec_status = PQresultStatus(result);
+
+   // the standby catches up at the next one
+   if (exec_status != PGRES_TUPLES_OK) {
+      log_err("leader mark %s %s", 
+              EXEC_STATUS[exec_status], 
+              PQresultErrorMessage(result));
+   }
+
+   return 0;
+}
+
+//----------------------------------------------------------------------------
+// send the query the standby tries for the advisory lock with, or the
+// leader's mark
+// returns 0 on success, -1 on failure
+static int
+send_leader_query(const struct Config * config, struct State * state) {
+//----------------------------------------------------------------------------
+   bstring query = NULL;
+   bstring mark = NULL;
+   const char * param_values[2];
+
+   if (state->leader_lock_pending) {
+      query = bformat("SELECT pg_try_advisory_lock(%lld)", 
+                      config->leader_lock_key);
+      check(query != NULL, "bformat");
+      debug("query = %s", (const char *) query->data);
+      check(PQsendQuery(state->postgres_connection, 
+                        (const char *) query->data) == 1,
+            "PQsendQuery %s", PQerrorMessage(state->postgres_connection));
+      state->leader_lock_pending = false;
+      state->query_result_cb = leader_lock_result_cb;
+   } else {
+      mark = format_leader_mark(config, state);
+      check(mark != NULL, "format_leader_mark");
+      param_values[0] = LEADER_CHANNEL;
+      param_values[1] = (const char *) mark->data;
+      check(PQsendQueryParams(state->postgres_connection,
+                              "SELECT pg_notify($1, $2)",
+                              2,
+                              NULL,
+                              param_values,
+                              NULL,
+                              NULL,
+                              0) == 1,
+            "PQsendQueryParams %s", 
+            PQerrorMessage(state->postgres_connection));
+      state->leader_mark_pending = false;
+      state->query_result_cb = leader_mark_result_cb;
+   }
+
+   bdestroy(query);
+   bdestroy(mark);
+   return 0;
+
+error:
+
+   bdestroy(query);
+   bdestroy(mark);
+   return -1;
+}
+
+//----------------------------------------------------------------------------
+// if the connection is idle, start the next query we have pending
+// returns 0 on success, -1 on failure
+static int
+start_next_query(const struct Config * config, struct State * state) {
+//----------------------------------------------------------------------------
+   int i;
+   int channel_index;
+   int ctl_result;
+
+   if (!state->postgres_listening || state->query_result_cb != NULL) {
+      return 0;
+   }
+
+   if (state->leader_lock_pending || state->leader_mark_pending) {
+      check(send_leader_query(config, state) == 0, "send_leader_query");
+      ctl_result = set_epoll_ctl_for_postgres(EPOLL_READ, 
+                                              check_query_cb,
+                                              state);
+      check(ctl_result == 0, "start_next_query");
+      return 0;
+   }
+
+   // the standby leaves the outboxes to the leader, and during a handoff
+   // the process that publishes the notifications tails them
+   if (!state->leader || !handoff_may_publish(&state->handoff)) {
+      return 0;
+   }
+
+   // start after the last channel we queried, so one busy outbox
+   // can't starve the others
+   for (i=1; i <= config->channel_list->qty; i++) {
+      channel_index = \
+         (state->query_channel_index + i) % config->channel_list->qty;
+      if (state->outbox_pending[channel_index]) {
+         check(send_outbox_query(config, state, channel_index) == 0,
+               "send_outbox_query");
+         ctl_result = set_epoll_ctl_for_postgres(EPOLL_READ, 
+                                                 check_query_cb,
+                                                 state);
+         check(ctl_result == 0, "start_next_query");
+         break;
+      }
+   }
+
+   return 0;
+
+error:
+
+   return -1;
+}
+
+//----------------------------------------------------------------------------
+CALLBACK_RESULT_TYPE
+check_notifications_cb(const struct Config * config, struct State * state) {
+//----------------------------------------------------------------------------
+   ConnStatusType status = PQstatus(state->postgres_connection);
+   check(status == CONNECTION_OK, 
+         "Invalid status in callback '%s'", CONN_STATUS[status]);
+   
+   if (PQconsumeInput(state->postgres_connection) != 1) {
+      log_err("PQconsumeInput %s", 
+              PQerrorMessage(state->postgres_connection));
+      return CALLBACK_DATABASE_ERROR;
+   }
+
+   check(publish_notifications(config, state) == 0, "publish_notifications");
+   check(start_next_query(config, state) == 0, "start_next_query");
+
+   return CALLBACK_OK;
+
+error:
+
+   return CALLBACK_ERROR;
+}
+
+//----------------------------------------------------------------------------
+// read the results of the query in flight
+// notifications keep arriving while we wait, so we publish them as we go
+CALLBACK_RESULT_TYPE
+check_query_cb(const struct Config * config, struct State * state) {
+//----------------------------------------------------------------------------
+   PGresult * result = NULL;
+   int ctl_result;
+
+   ConnStatusType status = PQstatus(state->postgres_connection);
+   if (status != CONNECTION_OK) { 
+      log_err("Invalid status in callback '%s'", CONN_STATUS[status]);
+      return CALLBACK_DATABASE_ERROR;
+   }
+
+   if (PQconsumeInput(state->postgres_connection) != 1) {
+      log_err("PQconsumeInput %s", 
+              PQerrorMessage(state->postgres_connection));
+      return CALLBACK_DATABASE_ERROR;
+   }
+
+   check(publish_notifications(config, state) == 0, "publish_notifications");
+
+   while (!PQisBusy(state->postgres_connection)) {
+      result = PQgetResult(state->postgres_connection);
+      if (result == NULL) {
+         // query complete
+         state->query_result_cb = NULL;
+         ctl_result = set_epoll_ctl_for_postgres(EPOLL_READ, 
+                                                 check_notifications_cb,
+                                                 state);
+         check(ctl_result == 0, "query complete");
+         check(start_next_query(config, state) == 0, "start_next_query");
+         break;
+      }
+      check(state->query_result_cb(config, state, result) == 0,
+            "query_result_cb");
+      PQclear(result);
+      result = NULL;
+   }
+
+   return CALLBACK_OK;
+
+error:
+
+   if (result != NULL) PQclear(result);
+   return CALLBACK_ERROR;
+}
+
+//----------------------------------------------------------------------------
+// latency mode: SO_BUSY_POLL on the database socket, so a read polls the
+// network device for up to busy_poll microseconds instead of waiting for
+// its interrupt. Raising it past net.core.busy_read takes CAP_NET_ADMIN;
+// without it we still spin in skeeter_step, on the interrupts.
+// return 0 on success, -1 on failure
+static int
+set_busy_poll(const struct Config * config, struct State * state) {
+//----------------------------------------------------------------------------
+   int busy_poll = config->busy_poll;
+   int result;
+
+   if (busy_poll <= 0) {
+      return 0;
+   }
+
+   result = setsockopt(PQsocket(state->postgres_connection),
+                       SOL_SOCKET,
+                       SO_BUSY_POLL,
+                       &busy_poll,
+                       sizeof(busy_poll));
+   if (result != 0) {
+      log_warn("setsockopt(SO_BUSY_POLL) %s", strerror(errno));
+   }
+
+   return 0;
+}
+
+//----------------------------------------------------------------------------
+// read the results of the LISTEN query; they usually arrive together, so 
+// take every one libpq has, or we wait for a readable socket that never
+// comes
+CALLBACK_RESULT_TYPE
+check_listen_command_cb(const struct Config * config, struct State * state) {
+//----------------------------------------------------------------------------
+   PGresult * result = NULL;
+   int ctl_result;
+   int i;
+
+   ConnStatusType status = PQstatus(state->postgres_connection);
+   if (status != CONNECTION_OK) { 
+      log_err("Invalid status in callback '%s'", CONN_STATUS[status]);
+      return CALLBACK_DATABASE_ERROR;
+   }
+
+   if (PQconsumeInput(state->postgres_connection) != 1) { 
+      log_err("PQconsumeInput %s", 
+              PQerrorMessage(state->postgres_connection));
+      return CALLBACK_DATABASE_ERROR;
+   }
+
+   while (!PQisBusy(state->postgres_connection)) {
+      result = PQgetResult(state->postgres_connection);
+      if (result == NULL) {
+         break;
+      }
+      // pg_try_advisory_lock, the rest are LISTENs
+      if (PQresultStatus(result) == PGRES_TUPLES_OK) {
+         check(leader_lock_result_cb(config, state, result) == 0,
+               "leader_lock_result_cb");
+      }
+      PQclear(result);
+      result = NULL;
+   }
+   if (PQisBusy(state->postgres_connection)) {
+      return CALLBACK_OK;
+   }
+
+   ctl_result = set_epoll_ctl_for_postgres(EPOLL_READ, 
+                                           check_notifications_cb,
+                                           state);
+   check(ctl_result == 0, "query complete");
+
+   check(set_busy_poll(config, state) == 0, "set_busy_poll");
+
+   if (!state->leader) {
+      log_info("standby: another skeeter holds advisory lock %lld",
+               config->leader_lock_key);
+   }
+
+   // catch up on anything written to the outboxes while we were away
+   state->postgres_listening = true;
+   for (i=0; i < config->channel_list->qty; i++) {
+      if (config->channel_config[i].outbox_table != NULL) {
+         state->outbox_pending[i] = true;
+      }
+   }
+   check(start_next_query(config, state) == 0, "start_next_query");
+
+   // anything that came in behind the results
+   check(publish_notifications(config, state) == 0, "publish_notifications");
+
+   return CALLBACK_OK;
+
+error:
+
+   if (result != NULL) PQclear(result);
+   return CALLBACK_ERROR;
+}
+
+//----------------------------------------------------------------------------
+int
+send_listen_command(const struct Config * config, struct State * state) {
+//----------------------------------------------------------------------------
+   bstring bquery = NULL;
+   bstring item = NULL;
+   const char * item_str;
+   const char * query = NULL;
+   int i;
+
+   ConnStatusType status = PQstatus(state->postgres_connection);
+   check(status == CONNECTION_OK, 
+         "Invalid status '%s'", CONN_STATUS[status]);
+   
+   bquery = bfromcstr("");
+   for (i=0; i < config->channel_list->qty; i++) {
+      item_str = bstr2cstr(config->channel_list->entry[i], '?');
+      check_mem(item_str);
+      item = bformat("LISTEN %s;", item_str);
+      check(bcstrfree((char *) item_str) == BSTR_OK, "bcstrfree");
+      check(bconcat(bquery, item) == BSTR_OK, "bconcat");
+      check(bdestroy(item) == BSTR_OK, "bdestroy(item)");
+   }
+   if (config->handoff_path != NULL) {
+      check(bcatcstr(bquery, "LISTEN " HANDOFF_CHANNEL ";") == BSTR_OK,
+            "bcatcstr");
+   }
+   // in the same transaction, so the leader's marks reach us from where 
+   // the lock is decided
+   if (config->leader_lock_key != 0) {
+      check(bformata(bquery,
+                     "LISTEN " LEADER_CHANNEL ";"
+                     "SELECT pg_try_advisory_lock(%lld);",
+                     config->leader_lock_key) == BSTR_OK,
+            "bformata");
+   }
+   // in the same transaction, so the marker comes after everything we 
+   // miss and before everything we get
+   if (state->handoff.phase == HANDOFF_TAKING) {
+      check(bformata(bquery, 
+                     "NOTIFY " HANDOFF_CHANNEL ", '%s';", 
+                     (const char *) state->handoff.marker->data) == BSTR_OK,
+            "bformata");
+   }
+   query = bstr2cstr(bquery, '?');
+   check_mem(query);
+
+   debug("query = %s", query);
+   check(PQsendQuery(state->postgres_connection, query) == 1,
+         "PQsendQuery");
+   
+   bdestroy(bquery);
+   bcstrfree((char *) query);
+
+   return 0;
+
+error:
+
+   bdestroy(bquery);
+   bcstrfree((char *) query);
+   return 1;
+}
+
+//----------------------------------------------------------------------------
+// for each channel that has dropped messages over its rate limit since the
+// last heartbeat, publish a control message on the channel's topic with
+// ';control=rate_limit;dropped=<n>' in the meta data and no data frame
+// return 0 on success, -1 on failure
+static int
+publish_rate_limit_summaries(const struct Config * config, 
+                             struct State * state) {
+//----------------------------------------------------------------------------
+   int i;
+   bstring meta = NULL;
+
+   for (i=0; i < config->channel_list->qty; i++) {
+      if (state->token_buckets[i].dropped == 0) continue;
+
+      log_warn("%s dropped %" PRIu64 " messages over rate_limit",
+               (const char *) config->channel_list->entry[i]->data,
+               state->token_buckets[i].dropped);
+      state->channel_counts[i]++;
+      meta = bformat("timestamp=%ld;sequence=%" PRIu64 
+                     ";control=rate_limit;dropped=%" PRIu64,
+                     (long) time(NULL),
+                     state->channel_counts[i],
+                     state->token_buckets[i].dropped);
+      check(meta != NULL, "bformat");
+      state->token_buckets[i].dropped = 0;
+
+      // the summary skips the batch, it should not wait behind the flood
+      check(send_channel_message(config, state, i, NULL, 0, meta, NULL) == 0,
+            "send_channel_message");
+   }
+
+   return 0;
+
+error:
+   return -1;
+}
+
+//----------------------------------------------------------------------------
+// return 1 if the channel has a subscriber on any PUB socket of its 
+// priority class
+static int
+channel_is_subscribed(const struct Config * config, 
+                      const struct State * state,
+                      int channel_index) {
+//----------------------------------------------------------------------------
+   int i;
+
+   for (i=0; i < state->pub_socket_qty; i++) {
+      if (state->pub_sockets[i].priority_class != 
+          config->channel_config[channel_index].priority_class_index) {
+         continue;
+      }
+      if (is_subscribed(state->pub_sockets[i].subscriptions, 
+                        config->channel_list->entry[channel_index])) {
+         return 1;
+      }
+   }
+
+   return 0;
+}
+
+//----------------------------------------------------------------------------
+// tell the gateway's writers how their rows went: one message per client
+//    topic: gateway_ack.<client>
+//    meta:  timestamp=<t>;notified=<n> or timestamp=<t>;failed=<n>
+//    data:  empty
+// return 0 on success, -1 on failure
+static int
+acknowledge_gateway_batch(struct State * state, bool succeeded) {
+//----------------------------------------------------------------------------
+   struct bstrList * client_list = NULL;
+   int * client_counts = NULL;
+   struct bstrList * message_list = NULL;
+   int dropped_sockets;
+   int i;
+
+   check(finish_gateway_batch(&state->gateway, 
+                              succeeded, 
+                              &client_list, 
+                              &client_counts) == 0,
+         "finish_gateway_batch");
+   if (client_list == NULL) {
+      return 0;
+   }
+
+   for (i=0; i < client_list->qty; i++) {
+      message_list = bstrListCreate();
+      check(message_list != NULL, "bstrListCreate");
+      check(bstrListAlloc(message_list, 3) == BSTR_OK, "bstrListAlloc");
+      message_list->entry[0] = bformat("gateway_ack.%s", 
+                                       client_list->entry[i]->data);
+      check(message_list->entry[0] != NULL, "bformat");
+      message_list->qty = 1;
+      message_list->entry[1] = bformat("timestamp=%ld;%s=%d",
+                                       (long) time(NULL),
+                                       succeeded ? "notified" : "failed",
+                                       client_counts[i]);
+      check(message_list->entry[1] != NULL, "bformat");
+      message_list->qty = 2;
+      message_list->entry[2] = bfromcstr("");
+      check(message_list->entry[2] != NULL, "bfromcstr");
+      message_list->qty = 3;
+
+      check(publish_on_sockets(message_list, 
+                               state->pub_sockets,
+                               state->pub_socket_qty,
+                               ALL_PRIORITY_CLASSES,
+                               &dropped_sockets) != -1, 
+            "publish_on_sockets");
+      state->heartbeat_dropped += dropped_sockets;
+      bstrListDestroy(message_list);
+      message_list = NULL;
+   }
+
+   bstrListDestroy(client_list);
+   free(client_counts);
+   return 0;
+
+error:
+   if (message_list != NULL) bstrListDestroy(message_list);
+   if (client_list != NULL) bstrListDestroy(client_list);
+   free(client_counts);
+   return -1;
+}
+
+//----------------------------------------------------------------------------
+// the gateway's connection is no good: drop it, fail the rows in flight,
+// and try again after database_retry_interval
+// this doesn't touch the LISTEN connection
+// return 0 on success, -1 on failure
+static int
+reset_gateway_connection(struct State * state) {
+//----------------------------------------------------------------------------
+   struct Gateway * gateway = &state->gateway;
+
+   log_err("gateway database error %s", PQerrorMessage(gateway->connection));
+
+   // don't check the result here, our socket fd may be no good
+   reactor_remove(&state->reactor, &state->gateway_postgres_handler.handler);
+
+   PQfinish(gateway->connection);
+   gateway->connection = NULL;
+   gateway->connected = false;
+   gateway->failed_time = time(NULL);
+
+   return acknowledge_gateway_batch(state, false);
+}
+
+// forward references for the gateway callbacks
+static int
+next_gateway_batch(const struct Config * config, struct State * state);
+
+CALLBACK_RESULT_TYPE
+gateway_idle_cb(const struct Config * config, struct State * state);
+
+//----------------------------------------------------------------------------
+// read the result of the gateway's query in flight
+CALLBACK_RESULT_TYPE
+gateway_query_cb(const struct Config * config, struct State * state) {
+//----------------------------------------------------------------------------
+   struct Gateway * gateway = &state->gateway;
+   PGresult * result;
+   bool succeeded = true;
+   int ctl_result;
+
+   if (PQconsumeInput(gateway->connection) != 1) {
+      check(reset_gateway_connection(state) == 0, 
+            "reset_gateway_connection");
+      return CALLBACK_OK;
+   }
+
+   while (!PQisBusy(gateway->connection)) {
+      result = PQgetResult(gateway->connection);
+      if (result == NULL) {
+         // query complete
+         if (PQstatus(gateway->connection) != CONNECTION_OK) { 
+            check(reset_gateway_connection(state) == 0, 
+                  "reset_gateway_connection");
+            return CALLBACK_OK;
+         }
+         check(acknowledge_gateway_batch(state, succeeded) == 0,
+               "acknowledge_gateway_batch");
+         ctl_result = set_epoll_ctl_for_gateway(EPOLL_READ,
+                                                gateway_idle_cb,
+                                                state);
+         check(ctl_result == 0, "gateway query complete");
+         check(next_gateway_batch(config, state) == 0, "next_gateway_batch");
+         break;
+      }
+      if (PQresultStatus(result) != PGRES_TUPLES_OK) {
+         log_err("gateway query %s", PQresultErrorMessage(result));
+         succeeded = false;
+      }
+      PQclear(result);
+   }
+
+   return CALLBACK_OK;
+
+error:
+   return CALLBACK_ERROR;
+}
+
+//----------------------------------------------------------------------------
+// the gateway's connection is idle: nothing to read but errors
+CALLBACK_RESULT_TYPE
+gateway_idle_cb(const struct Config * config, struct State * state) {
+//----------------------------------------------------------------------------
+   (void) config; // unused
+   struct Gateway * gateway = &state->gateway;
+   PGnotify * notify;
+
+   if (PQconsumeInput(gateway->connection) != 1 ||
+       PQstatus(gateway->connection) != CONNECTION_OK) {
+      check(reset_gateway_connection(state) == 0, 
+            "reset_gateway_connection");
+      return CALLBACK_OK;
+   }
+   // we don't LISTEN on this connection, but be tidy
+   while ((notify = PQnotifies(gateway->connection)) != NULL) {
+      PQfreemem(notify);
+   }
+
+   return CALLBACK_OK;
+
+error:
+   return CALLBACK_ERROR;
+}
+
+//----------------------------------------------------------------------------
+// poll the gateway's connection forward
+CALLBACK_RESULT_TYPE
+gateway_connection_cb(const struct Config * config, struct State * state) {
+//----------------------------------------------------------------------------
+   struct Gateway * gateway = &state->gateway;
+   PostgresPollingStatusType polling_status;
+   int ctl_result;
+
+   polling_status = PQconnectPoll(gateway->connection);
+
+   switch (polling_status) {
+      case PGRES_POLLING_READING:
+      case PGRES_POLLING_WRITING:
+         ctl_result = set_epoll_ctl_for_gateway(
+            polling_status == PGRES_POLLING_READING ? EPOLL_READ : EPOLL_WRITE,
+            gateway_connection_cb,
+            state);
+         check(ctl_result == 0, "gateway_connection_cb");
+         break;
+
+      case PGRES_POLLING_OK:
+         log_info("gateway connected to database");
+         gateway->connected = true;
+         ctl_result = set_epoll_ctl_for_gateway(EPOLL_READ,
+                                                gateway_idle_cb,
+                                                state);
+         check(ctl_result == 0, "gateway_connection_cb");
+         check(next_gateway_batch(config, state) == 0, "next_gateway_batch");
+         break;
+         
+      default:
+         log_err("invalid Postgres Polling Status %s gateway_connection_cb",  
+                  POLLING_STATUS[polling_status]);
+         check(reset_gateway_connection(state) == 0, 
+               "reset_gateway_connection");
+         
+   } //switch 
+
+   return CALLBACK_OK;
+
+error:
+   return CALLBACK_ERROR;
+}
+
+//----------------------------------------------------------------------------
+// start the gateway's own connection, with the same parameters as the 
+// LISTEN connection
+// return 0 on success, -1 on failure
+static int
+start_gateway_connection(const struct Config * config, struct State * state) {
+//----------------------------------------------------------------------------
+   struct Gateway * gateway = &state->gateway;
+
+   gateway->connection = \
+      PQconnectStartParams(config->postgresql_keywords, 
+                           config->postgresql_values, 
+                           0);
+   check_mem(gateway->connection);
+   if (PQstatus(gateway->connection) == CONNECTION_BAD) {
+      return reset_gateway_connection(state);
+   }
+
+   // PQconnectPoll is documented to behave as if the socket was writable
+   // on the first call
+   if (gateway_connection_cb(config, state) != CALLBACK_OK) {
+      return -1;
+   }
+
+   return 0;
+
+error:
+   return -1;
+}
+
+//----------------------------------------------------------------------------
+// read what the writers have pushed and, if no query is in flight, send 
+// the next batch (connecting first, if we must)
+// return 0 on success, -1 on failure
+static int
+next_gateway_batch(const struct Config * config, struct State * state) {
+//----------------------------------------------------------------------------
+   struct Gateway * gateway = &state->gateway;
+   int ctl_result;
+
+   check(receive_gateway_rows(gateway, config->gateway_batch_size) == 0,
+         "receive_gateway_rows");
+   if (gateway->channels->qty == 0 || gateway->sent_clients != NULL) {
+      return 0;
+   }
+
+   if (gateway->connection == NULL) {
+      if (time(NULL) - gateway->failed_time >= 
+          config->database_retry_interval) {
+         check(start_gateway_connection(config, state) == 0,
+               "start_gateway_connection");
+      }
+      return 0;
+   }
+   if (!gateway->connected) {
+      return 0;
+   }
+
+   if (send_gateway_batch(gateway, config->gateway_batch_size) != 0) {
+      return reset_gateway_connection(state);
+   }
+   ctl_result = set_epoll_ctl_for_gateway(EPOLL_READ, 
+                                          gateway_query_cb, 
+                                          state);
+   check(ctl_result == 0, "next_gateway_batch");
+
+   return 0;
+
+error:
+   return -1;
+}
+
+//----------------------------------------------------------------------------
+// writers pushed something to the gateway
+CALLBACK_RESULT_TYPE
+gateway_pull_cb(const struct Config * config, struct State * state) {
+//----------------------------------------------------------------------------
+   check(next_gateway_batch(config, state) == 0, "next_gateway_batch");
+   return CALLBACK_OK;
+
+error:
+   return CALLBACK_ERROR;
+}
+
+//----------------------------------------------------------------------------
+// proxy clients connecting, talking or ready for more output
+CALLBACK_RESULT_TYPE
+pg_proxy_cb(const struct Config * config, struct State * state) {
+//----------------------------------------------------------------------------
+   check(pg_proxy_handle_events(&state->pg_proxy, config) == 0, 
+         "pg_proxy_handle_events");
+   return CALLBACK_OK;
+
+error:
+   return CALLBACK_ERROR;
+}
+
+//----------------------------------------------------------------------------
+// browsers connecting, sending requests or ready for more events
+CALLBACK_RESULT_TYPE
+sse_cb(const struct Config * config, struct State * state) {
+//----------------------------------------------------------------------------
+   check(sse_handle_events(&state->sse, config) == 0, "sse_handle_events");
+   return CALLBACK_OK;
+
+error:
+   return CALLBACK_ERROR;
+}
+
+//----------------------------------------------------------------------------
+// Redis clients connecting, sending commands or ready for more messages
+CALLBACK_RESULT_TYPE
+resp_cb(const struct Config * config, struct State * state) {
+//----------------------------------------------------------------------------
+   check(resp_handle_events(&state->resp, config) == 0, 
+         "resp_handle_events");
+   return CALLBACK_OK;
+
+error:
+   return CALLBACK_ERROR;
+}
+
+//----------------------------------------------------------------------------
+// append a metric with one sample and no labels
+// return 0 on success, -1 on failure
+static int
+format_metric(bstring output,
+              const char * name,
+              const char * type,
+              const char * help,
+              uint64_t value) {
+//----------------------------------------------------------------------------
+   check(format_metric_header(output, name, type, help) == 0, 
+         "format_metric_header");
+   check(bformata(output, "%s %" PRIu64 "\n", name, value) == BSTR_OK,
+         "bformata");
+
+   return 0;
+
+error:
+   return -1;
+}
+
+//----------------------------------------------------------------------------
+// append a metric with one sample per channel, from an array indexed like 
+// the channel list
+// return 0 on success, -1 on failure
+static int
+format_channel_metric(const struct Config * config,
+                      bstring output,
+                      const char * name,
+                      const char * type,
+                      const char * help,
+                      const uint64_t * values) {
+//----------------------------------------------------------------------------
+   int i;
+
+   check(format_metric_header(output, name, type, help) == 0, 
+         "format_metric_header");
+   for (i=0; i < config->channel_list->qty; i++) {
+      check(bformata(output, 
+                     "%s{channel=\"%s\"} %" PRIu64 "\n",
+                     name,
+                     (const char *) config->channel_list->entry[i]->data,
+                     values[i]) == BSTR_OK,
+            "bformata");
+   }
+
+   return 0;
+
+error:
+   return -1;
+}
+
+//----------------------------------------------------------------------------
+// the metrics in the Prometheus text format; the counters are the plain 
+// integers the event loop bumps, read here only when a scrape asks
+// return NULL on failure
+static bstring
+format_metrics(const struct Config * config, struct State * state) {
+//----------------------------------------------------------------------------
+   bstring output;
+   bstring labels = NULL;
+   bool database_header = false;
+   int i;
+
+   output = bfromcstr("");
+   check_mem(output);
+
+   check(format_metric(output,
+                       "skeeter_database_listening",
+                       "gauge",
+                       "1 while we are LISTENing on the database",
+                       state->postgres_listening ? 1 : 0) == 0,
+         "format_metric");
+   check(format_metric(output,
+                       "skeeter_database_retries_total",
+                       "counter",
+                       "Database connections lost or failed",
+                       state->database_retries) == 0,
+         "format_metric");
+   check(format_metric(output,
+                       "skeeter_leader",
+                       "gauge",
+                       "1 while we publish, 0 as a standby",
+                       state->leader ? 1 : 0) == 0,
+         "format_metric");
+   check(format_metric(output,
+                       "skeeter_heartbeats_total",
+                       "counter",
+                       "Heartbeats published",
+                       state->heartbeat_count) == 0,
+         "format_metric");
+
+   check(format_channel_metric(config,
+                               output,
+                               "skeeter_channel_sequence",
+                               "gauge",
+                               "Sequence number of the last message",
+                               state->channel_counts) == 0,
+         "format_channel_metric");
+   check(format_channel_metric(config,
+                               output,
+                               "skeeter_channel_messages_total",
+                               "counter",
+                               "Messages published",
+                               state->channel_published) == 0,
+         "format_channel_metric");
+   check(format_channel_metric(config,
+                               output,
+                               "skeeter_channel_bytes_total",
+                               "counter",
+                               "Bytes published, as sent",
+                               state->channel_bytes) == 0,
+         "format_channel_metric");
+   check(format_channel_metric(config,
+                               output,
+                               "skeeter_channel_dropped_total",
+                               "counter",
+                               "Messages dropped at a full socket or ring",
+                               state->channel_dropped) == 0,
+         "format_channel_metric");
+
+   check(format_metric_header(output,
+                              "skeeter_channel_latency_seconds",
+                              "histogram",
+                              "From reading a notification to sending it, "
+                              "after any batch or conflation window") == 0,
+         "format_metric_header");
+   for (i=0; i < config->channel_list->qty; i++) {
+      labels = bformat("channel=\"%s\"", 
+                       (const char *) config->channel_list->entry[i]->data);
+      check_mem(labels);
+      check(format_histogram(output,
+                             "skeeter_channel_latency_seconds",
+                             (const char *) labels->data,
+                             &state->channel_latency[i]) == 0,
+            "format_histogram");
+      bdestroy(labels);
+      labels = NULL;
+   }
+
+   for (i=0; i < config->channel_list->qty; i++) {
+      if (config->channel_config[i].producer_timestamp == NULL) {
+         continue;
+      }
+      if (!database_header) {
+         check(format_metric_header(output,
+                                    "skeeter_channel_database_latency_seconds",
+                                    "histogram",
+                                    "From the producer's timestamp to "
+                                    "reading the notification") == 0,
+               "format_metric_header");
+         database_header = true;
+      }
+      labels = bformat("channel=\"%s\"", 
+                       (const char *) config->channel_list->entry[i]->data);
+      check_mem(labels);
+      check(format_histogram(output,
+                             "skeeter_channel_database_latency_seconds",
+                             (const char *) labels->data,
+                             &state->channel_database_latency[i]) == 0,
+            "format_histogram");
+      bdestroy(labels);
+      labels = NULL;
+   }
+
+   check(format_metric(output,
+                       "skeeter_dispatch_total",
+                       "counter",
+                       "Wakeups of the event loop with events to handle",
+                       state->dispatch_count) == 0,
+         "format_metric");
+   check(format_metric(output,
+                       "skeeter_dispatch_batch_full_total",
+                       "counter",
+                       "Wakeups that filled epoll_batch_size",
+                       state->dispatch_full) == 0,
+         "format_metric");
+   check(format_metric_header(output,
+                              "skeeter_dispatch_seconds",
+                              "histogram",
+                              "Handling the events of one wakeup") == 0,
+         "format_metric_header");
+   check(format_histogram(output, 
+                          "skeeter_dispatch_seconds", 
+                          "", 
+                          &state->dispatch_time) == 0,
+         "format_histogram");
+
+   return output;
+
+error:
+   bdestroy(labels);
+   bdestroy(output);
+   return NULL;
+}
+
+//----------------------------------------------------------------------------
+// Prometheus connecting, or ready for the metrics
+CALLBACK_RESULT_TYPE
+metrics_cb(const struct Config * config, struct State * state) {
+//----------------------------------------------------------------------------
+   bstring body = NULL;
+
+   check(metrics_handle_events(&state->metrics) == 0, 
+         "metrics_handle_events");
+   if (state->metrics.waiting_qty > 0) {
+      body = format_metrics(config, state);
+      check(body != NULL, "format_metrics");
+      check(metrics_respond(&state->metrics, body) == 0, "metrics_respond");
+      bdestroy(body);
+   }
+
+   return CALLBACK_OK;
+
+error:
+   bdestroy(body);
+   return CALLBACK_ERROR;
+}
+
+//----------------------------------------------------------------------------
+// the heartbeat data frame: one line per channel, priority class, socket 
+// and endpoint
+//    channel=<name>;published=<n>;dropped=<n>;subscribed=<0|1>
+//       ;latency_p50_us=<n>;latency_p99_us=<n>;latency_max_us=<n>
+//       [;database_p50_us=<n>;database_p99_us=<n>;database_max_us=<n>]
+//    class=<name>;handled=<n>;latency_avg_us=<n>;latency_max_us=<n>
+//    socket=<name>;published=<n>;dropped=<n>
+//    endpoint=<uri>;connections=<n>;accepted=<n>;disconnected=<n>
+//    shm_ring=<name>;published=<n>;dropped=<n>;readers=<n>;max_lag=<bytes>
+//    relay=<upstream>;received=<n>;discarded=<n>
+//    gateway=<uri>;received=<n>;notified=<n>;failed=<n>;discarded=<n>
+//    pg_proxy=<port>;clients=<n>;accepted=<n>;notified=<n>;disconnected=<n>
+//    sse=<port>;clients=<n>;accepted=<n>;events=<n>;evicted=<n>
+//    resp=<port>;clients=<n>;accepted=<n>;messages=<n>;evicted=<n>
+// channel and class latency is for the notifications handled since the 
+// last heartbeat; database latency is for channels with producer_timestamp
+// return NULL on failure
+static bstring
+format_heartbeat_stats(const struct Config * config, struct State * state) {
+//----------------------------------------------------------------------------
+   bstring stats = bfromcstr("");
+   uint64_t max_lag;
+   int readers;
+   const struct Histogram * histogram;
+   const struct PriorityClass * priority_class;
+   const struct PubSocket * pub_socket;
+   const struct EndpointStats * endpoint;
+   int i;
+   int j;
+
+   check(stats != NULL, "bfromcstr");
+
+   for (i=0; i < config->channel_list->qty; i++) {
+      check(bformata(stats, 
+                     "channel=%s;published=%" PRIu64 ";dropped=%" PRIu64 
+                     ";subscribed=%d;latency_p50_us=%" PRIu64 
+                     ";latency_p99_us=%" PRIu64 ";latency_max_us=%" PRIu64,
+                     (const char *) config->channel_list->entry[i]->data,
+                     state->channel_published[i],
+                     state->channel_dropped[i],
+                     channel_is_subscribed(config, state, i),
+                     histogram_percentile(&state->interval_latency[i], 50),
+                     histogram_percentile(&state->interval_latency[i], 99),
+                     state->interval_latency[i].max) == BSTR_OK,
+            "bformata");
+      if (config->channel_config[i].producer_timestamp != NULL) {
+         histogram = &state->interval_database_latency[i];
+         check(bformata(stats, 
+                        ";database_p50_us=%" PRIu64 ";database_p99_us=%" 
+                        PRIu64 ";database_max_us=%" PRIu64,
+                        histogram_percentile(histogram, 50),
+                        histogram_percentile(histogram, 99),
+                        histogram->max) == BSTR_OK,
+               "bformata");
+      }
+      check(bconchar(stats, '\n') == BSTR_OK, "bconchar");
+   }
+
+   for (i=0; i < state->priority_class_qty; i++) {
+      priority_class = &state->priority_classes[i];
+      check(bformata(stats, 
+                     "class=%s;handled=%" PRIu64 ";latency_avg_us=%" PRIu64
+                     ";latency_max_us=%" PRIu64 "\n",
+                     (const char *) config->priority_class_list->entry[i]->data,
+                     priority_class->handled,
+                     (priority_class->interval_count == 0) ? 0 :
+                        priority_class->interval_latency_sum_us / 
+                           priority_class->interval_count,
+                     priority_class->interval_latency_max_us) == BSTR_OK,
+            "bformata");
+   }
+
+   for (i=0; i < state->pub_socket_qty; i++) {
+      pub_socket = &state->pub_sockets[i];
+      check(bformata(stats, 
+                     "socket=%s;published=%" PRIu64 ";dropped=%" PRIu64 "\n",
+                     pub_socket->name,
+                     pub_socket->published,
+                     pub_socket->dropped) == BSTR_OK,
+            "bformata");
+      for (j=0; j < pub_socket->monitor.endpoint_qty; j++) {
+         endpoint = &pub_socket->monitor.endpoints[j];
+         check(bformata(stats, 
+                        "endpoint=%s;connections=%d;accepted=%" PRIu64 
+                        ";disconnected=%" PRIu64 "\n",
+                        (const char *) endpoint->endpoint->data,
+                        endpoint->connections,
+                        endpoint->accepted,
+                        endpoint->disconnected) == BSTR_OK,
+               "bformata");
+      }
+   }
+
+   if (state->shm_ring.header != NULL) {
+      readers = shm_ring_readers(&state->shm_ring, &max_lag);
+      check(bformata(stats, 
+                     "shm_ring=%s;published=%" PRIu64 ";dropped=%" PRIu64
+                     ";readers=%d;max_lag=%" PRIu64 "\n",
+                     state->shm_ring.name,
+                     state->shm_ring.published,
+                     state->shm_ring.dropped,
+                     readers,
+                     max_lag) == BSTR_OK,
+            "bformata");
+   }
+
+   if (state->relay.zmq_socket != NULL) {
+      check(bformata(stats, 
+                     "relay=%s;received=%" PRIu64 ";discarded=%" PRIu64 "\n",
+                     config->relay_upstream,
+                     state->relay.received,
+                     state->relay.discarded) == BSTR_OK,
+            "bformata");
+   }
+
+   if (state->pg_proxy.listen_fd != -1) {
+      check(bformata(stats, 
+                     "pg_proxy=%d;clients=%d;accepted=%" PRIu64 
+                     ";notified=%" PRIu64 ";disconnected=%" PRIu64 "\n",
+                     config->pg_proxy_port,
+                     state->pg_proxy.client_qty,
+                     state->pg_proxy.accepted,
+                     state->pg_proxy.notified,
+                     state->pg_proxy.disconnected) == BSTR_OK,
+            "bformata");
+   }
+
+   if (state->sse.listen_fd != -1) {
+      check(bformata(stats, 
+                     "sse=%d;clients=%d;accepted=%" PRIu64 
+                     ";events=%" PRIu64 ";evicted=%" PRIu64 "\n",
+                     config->sse_port,
+                     state->sse.client_qty,
+                     state->sse.accepted,
+                     state->sse.events,
+                     state->sse.evicted) == BSTR_OK,
+            "bformata");
+   }
+
+   if (state->resp.listen_fd != -1) {
+      check(bformata(stats, 
+                     "resp=%d;clients=%d;accepted=%" PRIu64 
+                     ";messages=%" PRIu64 ";evicted=%" PRIu64 "\n",
+                     config->resp_port,
+                     state->resp.client_qty,
+                     state->resp.accepted,
+                     state->resp.messages,
+                     state->resp.evicted) == BSTR_OK,
+            "bformata");
+   }
+
+   if (state->gateway.zmq_socket != NULL) {
+      check(bformata(stats, 
+                     "gateway=%s;received=%" PRIu64 ";notified=%" PRIu64
+                     ";failed=%" PRIu64 ";discarded=%" PRIu64 "\n",
+                     config->gateway_uri,
+                     state->gateway.received,
+                     state->gateway.notified,
+                     state->gateway.failed,
+                     state->gateway.discarded) == BSTR_OK,
+            "bformata");
+   }
+
+   return stats;
+
+error:
+   bdestroy(stats);
+   return NULL;
+}
+
+//----------------------------------------------------------------------------
+// send the heartbeat message
+// the meta data has totals for drops and connected subscribers, 
+// the data frame has the per channel and per endpoint stats
+// return 0 on success, -1 on failure
+static int
+publish_heartbeat(const struct Config * config, struct State * state) {
+//----------------------------------------------------------------------------
+   int message_list_size = 3;
+   struct bstrList * message_list = NULL;
+   uint64_t dropped;
+   int dropped_sockets;
+   int connections = 0;
+   int result;
+   int i;
+
+   dropped = state->heartbeat_dropped;
+   for (i=0; i < config->channel_list->qty; i++) {
+      dropped += state->channel_dropped[i];
+   }
+   for (i=0; i < state->pub_socket_qty; i++) {
+      connections += monitor_connection_count(&state->pub_sockets[i].monitor);
+   }
+
+   // build the message list
+   message_list = bstrListCreate();
+   check(message_list != NULL, "bstrListCreate");
+
+   check(bstrListAlloc(message_list, message_list_size) == BSTR_OK,
+         "bstrListAlloc");
+
+   // first message is topic
+   message_list->entry[0] = bfromcstr("heartbeat");
+   check(message_list->entry[0] != NULL, "bfromcstr 0");
+
+   // second message is meta data
+   state->heartbeat_count++;
+   debug("heartbeat %" PRIu64, state->heartbeat_count);
+   message_list->entry[1] = \
+      bformat("timestamp=%ld;sequence=%" PRIu64 ";connected=%ld"
+              ";subscribers=%d;dropped=%" PRIu64,
+              (long) time(NULL),
+              state->heartbeat_count,
+              (long) state->postgres_connect_time,
+              connections,
+              dropped);
+   check(message_list->entry[1] != NULL, "bformat");
+
+   // third message is stats
+   message_list->entry[2] = format_heartbeat_stats(config, state);
+   check(message_list->entry[2] != NULL, "format_heartbeat_stats");
+   message_list->qty = message_list_size; 
+
+   // publish the message list
+   check(publish_on_sockets(message_list, 
+                            state->pub_sockets,
+                            state->pub_socket_qty,
+                            ALL_PRIORITY_CLASSES,
+                            &dropped_sockets) != -1, 
+         "publish_on_sockets");
+   state->heartbeat_dropped += dropped_sockets;
+   if (state->shm_ring.header != NULL) {
+      result = shm_ring_publish(&state->shm_ring, message_list);
+      check(result != -1, "shm_ring_publish");
+      if (result == 1) state->heartbeat_dropped++;
+   }
+
+   // clean up the message list
+   check(bstrListDestroy(message_list) == BSTR_OK, "bstrListDestroy");
+
+   return 0;
+
+error:
+   if (message_list != NULL) bstrListDestroy(message_list);
+   return -1;
+}
+
+//----------------------------------------------------------------------------
+// publish the heartbeat, and start the stats' next interval
+// return 0 on success, 1 on failure
+CALLBACK_RESULT_TYPE
+heartbeat_timer_cb(const struct Config * config, struct State * state) {
+//----------------------------------------------------------------------------
+   bool may_publish;
+   int i;
+
+   // the leader marks the notification stream for the standby
+   if (config->leader_lock_key != 0 && state->leader && 
+       state->postgres_listening) {
+      state->leader_mark_pending = true;
+      check(start_next_query(config, state) == 0, "start_next_query");
+   }
+
+   // the other process publishes the heartbeats, and their sequence
+   // numbers, until we take over; the standby mirrors the leader's. The
+   // rest of the housekeeping is ours either way.
+   may_publish = handoff_may_publish(&state->handoff) && state->leader;
+   if (may_publish) {
+      check(publish_heartbeat(config, state) == 0, "publish_heartbeat");
+   }
+
+   for (i=0; i < state->priority_class_qty; i++) {
+      reset_class_latency(&state->priority_classes[i]);
+   }
+   memset(state->interval_latency, 
+          0, 
+          config->channel_list->qty * sizeof(struct Histogram));
+   memset(state->interval_database_latency, 
+          0, 
+          config->channel_list->qty * sizeof(struct Histogram));
+
+   // the leader reports what went over the rate limit
+   if (may_publish) {
+      check(publish_rate_limit_summaries(config, state) == 0, 
+            "publish_rate_limit_summaries");
+   } else {
+      for (i=0; i < config->channel_list->qty; i++) {
+         state->token_buckets[i].dropped = 0;
+      }
+   }
+
+   if (state->sse.listen_fd != -1) {
+      check(sse_keepalive(&state->sse, config) == 0, "sse_keepalive");
+   }
+
+   // the gateway retries its connection when there are rows waiting, and
+   // the writers may have stopped pushing
+   if (state->gateway.zmq_socket != NULL) {
+      check(next_gateway_batch(config, state) == 0, "next_gateway_batch");
+   }
+
+   return CALLBACK_OK;
+
+error:
+
+   return CALLBACK_ERROR;
+}
+
+//----------------------------------------------------------------------------
+// subscribers connected or disconnected
+CALLBACK_RESULT_TYPE
+pub_monitor_cb(const struct Config * config, struct State * state) {
+//----------------------------------------------------------------------------
+   (void) config; // unused
+   int i;
+
+   for (i=0; i < state->pub_socket_qty; i++) {
+      check(process_monitor_events(&state->pub_sockets[i].monitor) == 0, 
+            "process_monitor_events");
+   }
+
+   return CALLBACK_OK;
+
+error:
+
+   return CALLBACK_ERROR;
+}
+
+//----------------------------------------------------------------------------
+// read subscription changes from every PUB socket
+// return 0 on success, -1 on failure
+static int
+process_all_subscriptions(struct State * state) {
+//----------------------------------------------------------------------------
+   int i;
+
+   for (i=0; i < state->pub_socket_qty; i++) {
+      check(process_subscriptions(state->pub_sockets[i].zmq_socket, 
+                                  state->pub_sockets[i].subscriptions) == 0, 
+            "process_subscriptions");
+   }
+
+   return 0;
+
+error:
+
+   return -1;
+}
+
+//----------------------------------------------------------------------------
+// subscriptions changed
+CALLBACK_RESULT_TYPE
+subscriptions_cb(const struct Config * config, struct State * state) {
+//----------------------------------------------------------------------------
+   (void) config; // unused
+   check(process_all_subscriptions(state) == 0, "process_all_subscriptions");
+
+   return CALLBACK_OK;
+
+error:
+
+   return CALLBACK_ERROR;
+}
+
+//----------------------------------------------------------------------------
+// publish one message from the upstream on the sockets of its channel's 
+// priority class, and the shared memory ring
+// return 0 on success, -1 on failure
+static int
+forward_relay_message(const struct Config * config, 
+                      struct State * state,
+                      zmq_msg_t * frames,
+                      int frame_qty) {
+//----------------------------------------------------------------------------
+   const void * ring_frames[MAX_RELAY_FRAMES];
+   size_t ring_sizes[MAX_RELAY_FRAMES];
+   struct tagbstring topic;
+   int channel_index;
+   int published;
+   int dropped;
+   int result;
+   int i;
+
+   // the topic frame is the channel name; subscriptions are prefixes, so 
+   // 'channel1' also gets us 'channel10'
+   btfromblk(topic, zmq_msg_data(&frames[0]), zmq_msg_size(&frames[0]));
+   channel_index = find_channel_index(config, &topic);
+   if (channel_index == -1) {
+      state->relay.discarded++;
+      return 0;
+   }
+
+   published = forward_on_sockets(
+      frames,
+      frame_qty,
+      state->pub_sockets,
+      state->pub_socket_qty,
+      config->channel_config[channel_index].priority_class_index,
+      &dropped);
+   check(published != -1, "forward_on_sockets");
+   state->channel_dropped[channel_index] += dropped;
+
+   if (state->shm_ring.header != NULL) {
+      for (i=0; i < frame_qty; i++) {
+         ring_frames[i] = zmq_msg_data(&frames[i]);
+         ring_sizes[i] = zmq_msg_size(&frames[i]);
+      }
+      result = shm_ring_publish_frames(&state->shm_ring, 
+                                       ring_frames, 
+                                       ring_sizes, 
+                                       frame_qty);
+      check(result != -1, "shm_ring_publish_frames");
+      if (result == 0) {
+         published++;
+      } else {
+         state->channel_dropped[channel_index]++;
+      }
+   }
+
+   if (published > 0) {
+      state->channel_published[channel_index]++;
+      for (i=0; i < frame_qty; i++) {
+         state->channel_bytes[channel_index] += zmq_msg_size(&frames[i]);
+      }
+   }
+
+   return 0;
+
+error:
+   return -1;
+}
+
+//----------------------------------------------------------------------------
+// forward everything the upstream has sent us
+// ZMQ_FD is edge triggered, so we read until there is nothing left
+// return 0 on success, -1 on failure
+static int
+forward_relay_messages(const struct Config * config, struct State * state) {
+//----------------------------------------------------------------------------
+   zmq_msg_t frames[MAX_RELAY_FRAMES];
+   int frame_qty;
+   int result;
+
+   while ((result = receive_relay_message(&state->relay, 
+                                          frames, 
+                                          &frame_qty)) == 1) {
+      result = forward_relay_message(config, state, frames, frame_qty);
+      close_frames(frames, frame_qty);
+      check(result == 0, "forward_relay_message");
+   }
+   check(result == 0, "receive_relay_message");
+
+   return 0;
+
+error:
+   return -1;
+}
+
+//----------------------------------------------------------------------------
+// the upstream has messages for us
+CALLBACK_RESULT_TYPE
+relay_cb(const struct Config * config, struct State * state) {
+//----------------------------------------------------------------------------
+   check(forward_relay_messages(config, state) == 0, 
+         "forward_relay_messages");
+
+   return CALLBACK_OK;
+
+error:
+
+   return CALLBACK_ERROR;
+}
+
+//----------------------------------------------------------------------------
+// poll the outbox tables, in case we missed a NOTIFY
+CALLBACK_RESULT_TYPE
+outbox_timer_cb(const struct Config * config, struct State * state) {
+//----------------------------------------------------------------------------
+   int i;
+
+   for (i=0; i < config->channel_list->qty; i++) {
+      if (config->channel_config[i].outbox_table != NULL) {
+         state->outbox_pending[i] = true;
+      }
+   }
+   check(start_next_query(config, state) == 0, "start_next_query");
+
+   return CALLBACK_OK;
+
+error:
+
+   return CALLBACK_ERROR;
+}
+
+//----------------------------------------------------------------------------
+// the standby tries for the advisory lock
+CALLBACK_RESULT_TYPE
+leader_timer_cb(const struct Config * config, struct State * state) {
+//----------------------------------------------------------------------------
+   if (state->leader || !state->postgres_listening) {
+      return CALLBACK_OK;
+   }
+
+   state->leader_lock_pending = true;
+   check(start_next_query(config, state) == 0, "start_next_query");
+
+   return CALLBACK_OK;
+
+error:
+
+   return CALLBACK_ERROR;
+}
+
+//----------------------------------------------------------------------------
+// the oldest notification in a batch has waited batch_max_latency:
+// publish every batch that has something in it
+CALLBACK_RESULT_TYPE
+batch_timer_cb(const struct Config * config, struct State * state) {
+//----------------------------------------------------------------------------
+   int i;
+
+   for (i=0; i < config->channel_list->qty; i++) {
+      check(flush_batch(config, state, i) == 0, "flush_batch");
+   }
+
+   return CALLBACK_OK;
+
+error:
+
+   return CALLBACK_ERROR;
+}
+
+//----------------------------------------------------------------------------
+// a channel's conflation window has closed: publish its pending entries
+// return 0 on success, -1 on failure
+static int
+conflate_timer_cb(struct Timer * timer) {
+//----------------------------------------------------------------------------
+   struct Skeeter * skeeter = (struct Skeeter *) timer->context;
+   int channel_index = timer - skeeter->state->conflate_timers;
+
+   return flush_conflated(skeeter->config, skeeter->state, channel_index);
+}
+
+//----------------------------------------------------------------------------
+// run the timers that are due
+CALLBACK_RESULT_TYPE
+timer_wheel_cb(const struct Config * config, struct State * state) {
+//----------------------------------------------------------------------------
+   (void) config; // unused
+   check(run_timer_wheel(&state->timer_wheel) == 0, "run_timer_wheel");
+
+   return CALLBACK_OK;
+
+error:
+
+   return CALLBACK_ERROR;
+}
+
+//----------------------------------------------------------------------------
+// a new skeeter is connecting to take over from us
+// if it can't, we carry on
+CALLBACK_RESULT_TYPE
+handoff_listen_cb(const struct Config * config, struct State * state) {
+//----------------------------------------------------------------------------
+   int result;
+
+   if (accept_handoff(&state->handoff, config) != 0) {
+      log_err("handoff failed, carrying on");
+      return CALLBACK_OK;
+   }
+   if (state->handoff.phase == HANDOFF_GIVING &&
+       state->handoff_handler.handler.fd == -1) {
+      result = add_state_handler(state,
+                                 &state->handoff_handler,
+                                 state->handoff.fd,
+                                 EPOLLIN);
+      check(result == 0, "epoll handoff");
+   }
+
+   return CALLBACK_OK;
+
+error:
+
+   return CALLBACK_ERROR;
+}
+
+//----------------------------------------------------------------------------
+// the other process's end of a handoff: the new process gets the old 
+// one's sequence numbers here, and either side may go away
+CALLBACK_RESULT_TYPE
+handoff_cb(const struct Config * config, struct State * state) {
+//----------------------------------------------------------------------------
+   bstring message = NULL;
+   int result;
+
+   result = read_handoff_message(&state->handoff, &message);
+   if (result == 0) {
+      return CALLBACK_OK;
+   }
+
+   if (result == -1) {
+      if (state->handoff.phase == HANDOFF_GIVING) {
+         log_warn("the new process went away before taking over");
+         reactor_remove(&state->reactor, &state->handoff_handler.handler);
+         check(end_handoff(&state->handoff) == 0, "end_handoff");
+      } else {
+         log_err("the old process went away without handing off, "
+                 "our sequence numbers start over");
+         check(finish_taking_over(config, state) == 0, "finish_taking_over");
+         check(publish_notifications(config, state) == 0, 
+               "publish_notifications");
+         check(start_next_query(config, state) == 0, "start_next_query");
+      }
+      return CALLBACK_OK;
+   }
+
+   if (state->handoff.phase == HANDOFF_TAKING ||
+       state->handoff.phase == HANDOFF_RESUMING) {
+      check(apply_handoff_state(config, state, message) == 0,
+            "apply_handoff_state");
+      if (state->handoff.phase == HANDOFF_RESUMING) {
+         check(finish_taking_over(config, state) == 0, "finish_taking_over");
+         check(publish_notifications(config, state) == 0, 
+               "publish_notifications");
+         check(start_next_query(config, state) == 0, "start_next_query");
+      } else {
+         // the old process hangs up next; we still drop the 
+         // notifications up to the marker
+         state->handoff.state_received = true;
+         reactor_remove(&state->reactor, &state->handoff_handler.handler);
+      }
+   }
+
+   bdestroy(message);
+   return CALLBACK_OK;
+
+error:
+
+   bdestroy(message);
+   return CALLBACK_ERROR;
+}
+
+//----------------------------------------------------------------------------
+// try to restart the postgres connection
+// return 0 on success, 1 on failure
+CALLBACK_RESULT_TYPE
+restart_timer_cb(const struct Config * config, struct State * state) {
+//----------------------------------------------------------------------------
+   debug("restart timer fired");
+
+   // the restart timer is one-shot, set_up_database_retry schedules it again
+   if (start_postgres_connection(config, state) != 0) {
+      return CALLBACK_DATABASE_ERROR;
+   }
+
+   return CALLBACK_OK;
+}
+
+//----------------------------------------------------------------------------
+CALLBACK_RESULT_TYPE
+postgres_connection_cb(const struct Config * config, struct State * state) {
+//----------------------------------------------------------------------------
+
+   PostgresPollingStatusType polling_status;
+   int ctl_result;
+
+   polling_status = PQconnectPoll(state->postgres_connection);
+
+   switch (polling_status) {
+      case PGRES_POLLING_READING:
+         ctl_result = set_epoll_ctl_for_postgres(EPOLL_READ, 
+                                                 postgres_connection_cb,
+                                                 state);
+         check(ctl_result == 0, "postgres_connection_cb");
+         break;
+
+      case PGRES_POLLING_WRITING:
+         ctl_result = set_epoll_ctl_for_postgres(EPOLL_WRITE, 
+                                                 postgres_connection_cb,
+                                                 state);
+         check(ctl_result == 0, "postgres_connection_cb");
+         break;
+
+      case PGRES_POLLING_OK:
+         state->postgres_connect_time = time(NULL);
+         if (state->pg_proxy.listen_fd != -1) {
+            set_pg_proxy_server_version(
+               &state->pg_proxy,
+               PQparameterStatus(state->postgres_connection, 
+                                 "server_version"));
+         }
+         check(send_listen_command(config, state) == 0, "send_listen_command");
+         ctl_result = set_epoll_ctl_for_postgres(EPOLL_READ, 
+                                                 check_listen_command_cb,
+                                                 state);
+         check(ctl_result == 0, "postgres_connection_cb");
+         break;
+         
+      default:
+         log_err("invalid Postgres Polling Status %s postgres_connection_cb",  
+                  POLLING_STATUS[polling_status]);
+         return CALLBACK_DATABASE_ERROR;
+         
+   } //switch 
+
+   return CALLBACK_OK;
+
+error:
+   return CALLBACK_ERROR;
+}
+
+
+//----------------------------------------------------------------------------
+// start the asynchronous connection process
+// returns 0 on success, 1 on failure
+int
+start_postgres_connection(const struct Config * config, struct State * state) {
+//----------------------------------------------------------------------------
+   PostgresPollingStatusType polling_status;
+   int ctl_result;
+
+   state->postgres_connection = \
+      PQconnectStartParams(config->postgresql_keywords, 
+                           config->postgresql_values, 
+                           0);
+   check(state->postgres_connection != NULL, "PQconnectStartParams");
+   check(PQstatus(state->postgres_connection) != CONNECTION_BAD, 
+         "CONNECTION_BAD");
+
+   polling_status = PQconnectPoll(state->postgres_connection);
+   switch (polling_status) {
+
+      case PGRES_POLLING_READING:
+         ctl_result = set_epoll_ctl_for_postgres(EPOLL_READ, 
+                                                 postgres_connection_cb,
+                                                 state);
+         check(ctl_result == 0, "start_postgres_connection");
+         break;
+
+      case PGRES_POLLING_WRITING:
+         ctl_result = set_epoll_ctl_for_postgres(EPOLL_WRITE, 
+                                                 postgres_connection_cb,
+                                                 state);
+         check(ctl_result == 0, "start_postgres_connection");
+         break;
+
+      default:
+         sentinel("invalid Postgres Polling Status %s",  
+                  POLLING_STATUS[polling_status]);
+   }
+
+   return 0;
+
+error:
+ 
+   return 1;
+}
+
+
+//----------------------------------------------------------------------------
+// an unregistered handler calling callback for the instance
+static void
+initialize_state_handler(struct Skeeter * skeeter, 
+                         struct StateHandler * handler,
+                         state_callback callback) {
+//----------------------------------------------------------------------------
+   initialize_reactor_handler(&handler->handler, state_handler_cb, skeeter);
+   handler->callback = callback;
+}
+
+//----------------------------------------------------------------------------
+// an unscheduled timer calling callback for the instance
+static void
+initialize_state_timer(struct Skeeter * skeeter, 
+                       struct StateTimer * timer,
+                       state_callback callback) {
+//----------------------------------------------------------------------------
+   initialize_timer(&timer->timer, state_timer_cb, skeeter);
+   timer->callback = callback;
+}
+
+//----------------------------------------------------------------------------
+int
+initialize_state(struct Skeeter * skeeter) {
+//----------------------------------------------------------------------------
+   const struct Config * config = skeeter->config;
+   struct State * state = skeeter->state;
+   int result;
+   int i;
+
+   result = start_reactor(&state->reactor, 
+                          config->reactor_backend,
+                          config->epoll_batch_size);
+   check(result == 0, "start_reactor");
+
+   // the wheel's grid is whole milliseconds of timer_slack
+   result = start_timer_wheel(&state->timer_wheel, 
+                              (config->timer_slack > 0) ? 
+                                 config->timer_slack / 1000 : 0);
+   check(result == 0, "start_timer_wheel");
+   initialize_state_handler(skeeter, 
+                            &state->timer_wheel_handler, 
+                            timer_wheel_cb);
+
+   initialize_state_timer(skeeter, 
+                          &state->heartbeat_timer, 
+                          heartbeat_timer_cb);
+   result = schedule_timer(&state->timer_wheel,
+                           &state->heartbeat_timer.timer,
+                           config->heartbeat_interval * 1000,
+                           config->heartbeat_interval * 1000);
+   check(result == 0, "schedule_timer");
+
+   initialize_state_timer(skeeter, 
+                          &state->restart_timer, 
+                          restart_timer_cb);
+
+   // the connection callbacks are set as the connection moves along
+   state->postgres_connection = NULL;
+   initialize_state_handler(skeeter, &state->postgres_handler, NULL);
+
+   initialize_state_timer(skeeter, &state->outbox_timer, outbox_timer_cb);
+   // scheduled when the first notification goes into an empty batch
+   initialize_state_timer(skeeter, &state->batch_timer, batch_timer_cb);
+   initialize_state_handler(skeeter, &state->relay_handler, relay_cb);
+   initialize_state_handler(skeeter, 
+                            &state->gateway_pull_handler, 
+                            gateway_pull_cb);
+   initialize_state_handler(skeeter, &state->gateway_postgres_handler, NULL);
+   initialize_state_handler(skeeter, &state->pg_proxy_handler, pg_proxy_cb);
+   initialize_state_handler(skeeter, &state->sse_handler, sse_cb);
+   initialize_state_handler(skeeter, &state->resp_handler, resp_cb);
+   initialize_state_handler(skeeter, &state->metrics_handler, metrics_cb);
+   initialize_state_handler(skeeter, 
+                            &state->handoff_listen_handler, 
+                            handoff_listen_cb);
+   initialize_state_handler(skeeter, &state->handoff_handler, handoff_cb);
+
+   for (i=0; i < config->channel_list->qty; i++) {
+      result = initialize_compressor(&state->compressors[i],
+                                     &config->channel_config[i]);
+      check(result == 0, "initialize_compressor");
+      initialize_token_bucket(&state->token_buckets[i],
+                              config->channel_config[i].rate_limit,
+                              config->channel_config[i].rate_burst,
+                              monotonic_us());
+      if (config->channel_config[i].batch_max_bytes > 0) {
+         check(initialize_batch(&state->batches[i]) == 0, "initialize_batch");
+      }
+      if (config->channel_config[i].conflate_window > 0) {
+         result = initialize_conflate_table(&state->conflate_tables[i],
+                                            CONFLATE_BUCKET_COUNT);
+         check(result == 0, "initialize_conflate_table");
+      }
+      // scheduled when the channel gets its first pending key
+      initialize_timer(&state->conflate_timers[i], 
+                       conflate_timer_cb, 
+                       skeeter);
+      if (config->channel_config[i].outbox_table != NULL) {
+         result = load_outbox_checkpoint(config, 
+                                         i, 
+                                         &state->outbox_last_ids[i]);
+         check(result == 0, "load_outbox_checkpoint");
+      }
+   }
+   if (outbox_channel_count(config) > 0) {
+      result = schedule_timer(&state->timer_wheel,
+                              &state->outbox_timer.timer,
+                              config->outbox_poll_interval * 1000,
+                              config->outbox_poll_interval * 1000);
+      check(result == 0, "schedule_timer");
+   }
+
+   initialize_state_timer(skeeter, &state->leader_timer, leader_timer_cb);
+   if (config->leader_lock_key != 0) {
+      result = schedule_timer(&state->timer_wheel,
+                              &state->leader_timer.timer,
+                              config->leader_retry_interval * 1000,
+                              config->leader_retry_interval * 1000);
+      check(result == 0, "schedule_timer");
+   }
+
+   // take the endpoints' listening sockets from a running skeeter
+   result = start_handoff(&state->handoff, config);
+   check(result == 0, "start_handoff");
+
+   result = create_pub_sockets(config, 
+                               skeeter->zmq_context, 
+                               state->handoff.endpoint_fds,
+                               &state->pub_sockets,
+                               &state->pub_socket_qty);
+   check(result == 0, "create_pub_sockets");
+   state->pub_socket_handlers = calloc(state->pub_socket_qty, 
+                                       sizeof(struct StateHandler));
+   check_mem(state->pub_socket_handlers);
+   state->pub_monitor_handlers = calloc(state->pub_socket_qty, 
+                                        sizeof(struct StateHandler));
+   check_mem(state->pub_monitor_handlers);
+   for (i=0; i < state->pub_socket_qty; i++) {
+      initialize_state_handler(skeeter, 
+                               &state->pub_socket_handlers[i], 
+                               subscriptions_cb);
+      initialize_state_handler(skeeter, 
+                               &state->pub_monitor_handlers[i], 
+                               pub_monitor_cb);
+   }
+
+   // a new object replaces the old process's ring under its name, and it
+   // would go on writing into the one its readers have until the marker:
+   // carry on with that one instead
+   if (config->shm_ring_name != NULL && state->handoff.shm_ring_fd != -1) {
+      result = take_shm_ring(&state->shm_ring, 
+                             config->shm_ring_name, 
+                             config->shm_ring_size,
+                             state->handoff.shm_ring_fd);
+      check(result == 0, "take_shm_ring");
+   } else if (config->shm_ring_name != NULL) {
+      result = create_shm_ring(&state->shm_ring, 
+                               config->shm_ring_name, 
+                               config->shm_ring_size);
+      check(result == 0, "create_shm_ring");
+   }
+   // to hand on to the next process
+   state->handoff.shm_ring_fd = state->shm_ring.fd;
+
+   return 0;
+
+error:
+
+   return 1;
+}
+
+//----------------------------------------------------------------------------
+// start the retry timer to re-try connecting to the database
+int
+set_up_database_retry(const struct Config * config, struct State * state) {
+//----------------------------------------------------------------------------
+   int result;
+
+   // don't check the state here, our socket fd may be no good
+   reactor_remove(&state->reactor, &state->postgres_handler.handler);
+   state->database_retries++;
+
+   PQfinish(state->postgres_connection); 
+   state->postgres_connection = NULL;
+   state->postgres_connect_time = 0;
+   state->postgres_listening = false;
+   state->query_result_cb = NULL;
+
+   // the lock went with the session, and the place of the last mark
+   if (config->leader_lock_key != 0) {
+      if (state->leader) {
+         log_info("leader: lost advisory lock %lld", 
+                  config->leader_lock_key);
+      }
+      state->leader = false;
+      state->leader_lock_pending = false;
+      state->leader_mark_pending = false;
+      bdestroy(state->leader_mark);
+      state->leader_mark = NULL;
+   }
+
+   result = schedule_timer(&state->timer_wheel,
+                           &state->restart_timer.timer,
+                           config->database_retry_interval * 1000,
+                           0);
+   check(result == 0, "schedule_timer");
+
+   return 0;
+error:
+   return -1;
+}
+
+//----------------------------------------------------------------------------
+// set the kernel's timer slack for this thread (and for the zeromq I/O 
+// threads, which inherit it when zmq_init starts them) from timer_slack: 
+// how late epoll_wait's timeout and the other sleeps may wake us
+// return 0 on success, -1 on failure
+static int
+set_timer_slack(const struct Config * config) {
+//----------------------------------------------------------------------------
+   // 0 would reset the slack to the default, 1ns is the least
+   unsigned long slack_ns = 1;
+
+   if (config->timer_slack < 0) {
+      return 0;
+   }
+   if (config->timer_slack > 0) {
+      slack_ns = (unsigned long) config->timer_slack * 1000;
+   }
+   check(prctl(PR_SET_TIMERSLACK, slack_ns, 0, 0, 0) == 0, 
+         "prctl(PR_SET_TIMERSLACK)");
+
+   return 0;
+
+error:
+   return -1;
+}
+
+//----------------------------------------------------------------------------
+// latency mode: lock our memory, so a notification never waits for a 
+// page fault
+// return 0 on success, -1 on failure
+static int
+set_lock_memory(const struct Config * config) {
+//----------------------------------------------------------------------------
+   if (!config->lock_memory) {
+      return 0;
+   }
+   check(mlockall(MCL_CURRENT | MCL_FUTURE) == 0, "mlockall");
+
+   return 0;
+
+error:
+   return -1;
+}
+
+//----------------------------------------------------------------------------
+// latency mode: the cpus for the zeromq io threads, set before they 
+// start. Without zmq_io_cpus, they inherit ours: every cpu but 
+// latency_cpu.
+// return 0 on success, -1 on failure
+static int
+set_zmq_io_cpus(const struct Config * config, void * zmq_context) {
+//----------------------------------------------------------------------------
+   int i;
+
+   if (config->zmq_io_cpu_qty == 0) {
+      return 0;
+   }
+#if defined(ZMQ_THREAD_AFFINITY_CPU_ADD)
+   for (i=0; i < config->zmq_io_cpu_qty; i++) {
+      check(zmq_ctx_set(zmq_context, 
+                        ZMQ_THREAD_AFFINITY_CPU_ADD, 
+                        config->zmq_io_cpus[i]) == 0,
+            "zmq_ctx_set ZMQ_THREAD_AFFINITY_CPU_ADD %d", 
+            config->zmq_io_cpus[i]);
+   }
+
+   return 0;
+
+error:
+   return -1;
+#else
+   (void) zmq_context; // unused
+   (void) i; // unused
+   log_warn("zmq_io_cpus needs zeromq 4.3, ignored");
+   return 0;
+#endif
+}
+
+//----------------------------------------------------------------------------
+// latency mode: move this thread to latency_cpu (take is true) or to 
+// every other cpu. We leave it before zeromq starts its io threads, so 
+// they don't inherit it. With one cpu there is nowhere else to go, and
+// the io threads share it.
+// return 0 on success, -1 on failure
+static int
+set_latency_cpu(const struct Config * config, bool take) {
+//----------------------------------------------------------------------------
+   long cpu_qty = sysconf(_SC_NPROCESSORS_CONF);
+   cpu_set_t cpu_set;
+   int i;
+
+   if (config->latency_cpu < 0) {
+      return 0;
+   }
+   check(config->latency_cpu < cpu_qty && config->latency_cpu < CPU_SETSIZE,
+         "latency_cpu %d, we have %ld cpus", config->latency_cpu, cpu_qty);
+
+   CPU_ZERO(&cpu_set);
+   if (take) {
+      CPU_SET(config->latency_cpu, &cpu_set);
+   } else {
+      for (i=0; i < cpu_qty && i < CPU_SETSIZE; i++) {
+         if (i != config->latency_cpu) CPU_SET(i, &cpu_set);
+      }
+   }
+   if (CPU_COUNT(&cpu_set) == 0) {
+      log_warn("latency_cpu %d is our only cpu, the zeromq io threads "
+               "share it", 
+               config->latency_cpu);
+      return 0;
+   }
+   check(sched_setaffinity(0, sizeof(cpu_set), &cpu_set) == 0,
+         "sched_setaffinity %d", config->latency_cpu);
+
+   return 0;
+
+error:
+   return -1;
+}
+
+//----------------------------------------------------------------------------
+// create an instance from config: open the PUB sockets (and the shared 
+// memory ring) and start connecting to the database
+// config must outlive the instance
+// return NULL on failure
+struct Skeeter *
+skeeter_create(const struct Config * config) {
+//----------------------------------------------------------------------------
+   struct Skeeter * skeeter = NULL;
+   struct State * state;
+   int result;
+   int i;
+
+   skeeter = calloc(1, sizeof(struct Skeeter));
+   check_mem(skeeter);
+   skeeter->config = config;
+
+   skeeter->state = create_state(config);
+   check(skeeter->state != NULL, "create_state");
+   state = skeeter->state;
+
+   check(set_timer_slack(config) == 0, "set_timer_slack");
+   check(set_lock_memory(config) == 0, "set_lock_memory");
+   check(set_latency_cpu(config, false) == 0, "set_latency_cpu");
+
+   skeeter->zmq_context = zmq_init(config->zmq_thread_pool_size);
+   check(skeeter->zmq_context != NULL, "initializing zeromq");
+   check(set_zmq_io_cpus(config, skeeter->zmq_context) == 0, 
+         "set_zmq_io_cpus");
+  
+   // the PUB sockets start the io threads
+   result = initialize_state(skeeter);
+   check(result == 0, "initialize_state");
+   check(set_latency_cpu(config, true) == 0, "set_latency_cpu");
+
+   // start polling the timer wheel, for the heartbeat and the rest
+   result = add_state_handler(state,
+                              &state->timer_wheel_handler,
+                              state->timer_wheel.fd,
+                              EPOLLIN | EPOLLERR);
+   check(result == 0, "epoll timer wheel");
+
+   // start polling the PUB sockets for subscriptions and their monitors 
+   // for connections
+   for (i=0; i < state->pub_socket_qty; i++) {
+      result = add_state_handler(state,
+                                 &state->pub_socket_handlers[i],
+                                 state->pub_sockets[i].fd,
+                                 EPOLLIN | EPOLLERR);
+      check(result == 0, "epoll pub socket");
+      result = add_state_handler(state,
+                                 &state->pub_monitor_handlers[i],
+                                 state->pub_sockets[i].monitor.fd,
+                                 EPOLLIN | EPOLLERR);
+      check(result == 0, "epoll pub monitor");
+   }
+
+   // the next skeeter, or the one we are taking over from
+   if (state->handoff.listen_fd != -1) {
+      result = add_state_handler(state,
+                                 &state->handoff_listen_handler,
+                                 state->handoff.listen_fd,
+                                 EPOLLIN);
+      check(result == 0, "epoll handoff listen");
+   }
+   if (state->handoff.fd != -1) {
+      result = add_state_handler(state,
+                                 &state->handoff_handler,
+                                 state->handoff.fd,
+                                 EPOLLIN);
+      check(result == 0, "epoll handoff");
+   }
+
+   // LISTEN clients speaking the postgres protocol
+   if (config->pg_proxy_port != 0) {
+      result = start_pg_proxy(&state->pg_proxy, config);
+      check(result == 0, "start_pg_proxy");
+      result = add_state_handler(state,
+                                 &state->pg_proxy_handler,
+                                 state->pg_proxy.epoll_fd,
+                                 EPOLLIN);
+      check(result == 0, "epoll pg_proxy");
+   }
+
+   // browsers
+   if (config->sse_port != 0) {
+      result = start_sse(&state->sse, config);
+      check(result == 0, "start_sse");
+      result = add_state_handler(state,
+                                 &state->sse_handler,
+                                 state->sse.epoll_fd,
+                                 EPOLLIN);
+      check(result == 0, "epoll sse");
+   }
+
+   // Redis pub/sub clients
+   if (config->resp_port != 0) {
+      result = start_resp(&state->resp, config);
+      check(result == 0, "start_resp");
+      result = add_state_handler(state,
+                                 &state->resp_handler,
+                                 state->resp.epoll_fd,
+                                 EPOLLIN);
+      check(result == 0, "epoll resp");
+   }
+
+   // Prometheus scrapes
+   if (config->metrics_port != 0) {
+      result = start_metrics(&state->metrics, config);
+      check(result == 0, "start_metrics");
+      result = add_state_handler(state,
+                                 &state->metrics_handler,
+                                 state->metrics.epoll_fd,
+                                 EPOLLIN);
+      check(result == 0, "epoll metrics");
+   }
+
+   // the gateway connects to the database when it has rows to send
+   if (config->gateway_uri != NULL) {
+      result = start_gateway(&state->gateway, config, skeeter->zmq_context);
+      check(result == 0, "start_gateway");
+      result = add_state_handler(state,
+                                 &state->gateway_pull_handler,
+                                 state->gateway.fd,
+                                 EPOLLIN | EPOLLERR);
+      check(result == 0, "epoll gateway");
+   }
+
+   // in relay mode, the upstream skeeter LISTENs for us
+   if (config->relay_upstream != NULL) {
+      result = start_relay(&state->relay, config, skeeter->zmq_context);
+      check(result == 0, "start_relay");
+      result = add_state_handler(state,
+                                 &state->relay_handler,
+                                 state->relay.fd,
+                                 EPOLLIN | EPOLLERR);
+      check(result == 0, "epoll relay");
+      return skeeter;
+   }
+
+   // start postgres connection process
+   if (start_postgres_connection(config, state) != 0) { 
+      log_err("unable to start posgres connection");
+      check(set_up_database_retry(config, state) == 0, "retry");
+   }
+
+   return skeeter;
+
+error:
+   skeeter_destroy(skeeter);
+   return NULL;
+}
+
+//----------------------------------------------------------------------------
+// call callback with every message published on the channel
+// return 0 for success, -1 for an unknown channel or failure
+int
+skeeter_subscribe(struct Skeeter * skeeter, 
+                  const char * channel,
+                  skeeter_callback callback,
+                  void * arg) {
+//----------------------------------------------------------------------------
+   struct ChannelCallbacks * callbacks;
+   struct ChannelCallback * entries;
+   bstring channel_name = NULL;
+   int channel_index;
+
+   channel_name = bfromcstr(channel);
+   check(channel_name != NULL, "bfromcstr");
+   channel_index = find_channel_index(skeeter->config, channel_name);
+   check(channel_index != -1, "unknown channel '%s'", channel);
+   bdestroy(channel_name);
+   channel_name = NULL;
+
+   callbacks = &skeeter->state->channel_callbacks[channel_index];
+   entries = realloc(callbacks->entries, 
+                     (callbacks->qty + 1) * sizeof(struct ChannelCallback));
+   check_mem(entries);
+   entries[callbacks->qty].callback = callback;
+   entries[callbacks->qty].arg = arg;
+   callbacks->entries = entries;
+   callbacks->qty++;
+
+   return 0;
+
+error:
+   bdestroy(channel_name);
+   return -1;
+}
+
+//----------------------------------------------------------------------------
+// the fd to poll for input in the host's event loop: when it is readable,
+// call skeeter_step(skeeter, 0)
+int
+skeeter_fd(const struct Skeeter * skeeter) {
+//----------------------------------------------------------------------------
+   return reactor_fd(&skeeter->state->reactor);
+}
+
+//---------------------------------------------------------------------------
+// the reactor callback for the host's fds
+// returns 0 on success, -1 on error
+static int
+host_handler_cb(struct ReactorHandler * reactor_handler, uint32_t events) {
+//---------------------------------------------------------------------------
+   (void) events; // unused, the host finds out for itself
+   struct HostHandler * handler = (struct HostHandler *) reactor_handler;
+
+   return handler->callback(reactor_handler->fd, handler->arg);
+}
+
+//----------------------------------------------------------------------------
+// call callback from skeeter_step whenever fd is readable
+// return 0 for success, -1 for failure
+int
+skeeter_watch_fd(struct Skeeter * skeeter, 
+                 int fd,
+                 skeeter_fd_callback callback,
+                 void * arg) {
+//----------------------------------------------------------------------------
+   struct State * state = skeeter->state;
+   struct HostHandler * handler = NULL;
+
+   handler = malloc(sizeof(struct HostHandler));
+   check_mem(handler);
+   initialize_reactor_handler(&handler->handler, host_handler_cb, skeeter);
+   handler->callback = callback;
+   handler->arg = arg;
+
+   check(reactor_add(&state->reactor, &handler->handler, fd, EPOLLIN) == 0,
+         "reactor_add");
+   handler->next = state->host_handlers;
+   state->host_handlers = handler;
+
+   return 0;
+
+error:
+   free(handler);
+   return -1;
+}
+
+//----------------------------------------------------------------------------
+// latency mode: before we sleep in epoll, spin for up to busy_poll
+// microseconds (and no longer than the timeout) waiting for the database
+// socket, and read it the moment something arrives. With SO_BUSY_POLL
+// each peek also polls the network device.
+// return 1 if we read the socket, 0 if nothing came (or we didn't spin),
+// -1 for failure
+static int
+spin_on_postgres(struct Skeeter * skeeter, int timeout_ms) {
+//----------------------------------------------------------------------------
+   const struct Config * config = skeeter->config;
+   struct State * state = skeeter->state;
+   struct StateHandler * handler = &state->postgres_handler;
+   uint64_t spin_us = config->busy_poll;
+   uint64_t start_us;
+   ssize_t peeked;
+   char byte;
+
+   // not while we are connecting, or writing a query
+   if (config->busy_poll <= 0 || timeout_ms == 0 ||
+       !state->postgres_listening || handler->handler.fd == -1 ||
+       (handler->handler.events & EPOLLIN) == 0) {
+      return 0;
+   }
+   if (timeout_ms > 0 && (uint64_t) timeout_ms * 1000 < spin_us) {
+      spin_us = (uint64_t) timeout_ms * 1000;
+   }
+
+   start_us = monotonic_us();
+   do {
+      peeked = recv(handler->handler.fd, &byte, 1, MSG_PEEK | MSG_DONTWAIT);
+      if (peeked != -1 || (errno != EAGAIN && errno != EWOULDBLOCK)) {
+         // data, EOF or an error: the callback finds out which
+         check(run_state_callback(skeeter, handler->callback) == 0,
+               "postgres callback");
+         return 1;
+      }
+   } while (monotonic_us() - start_us < spin_us);
+
+   return 0;
+
+error:
+   return -1;
+}
+
+//----------------------------------------------------------------------------
+// handle whatever is ready, waiting up to timeout_ms milliseconds for 
+// something to be ready (-1 waits forever); with busy_poll, spinning on 
+// the database socket first
+// database errors are handled here, by reconnecting after 
+// database_retry_interval
+// return 0 for success (including an interrupted wait), -1 for failure
+int
+skeeter_step(struct Skeeter * skeeter, int timeout_ms) {
+//----------------------------------------------------------------------------
+   const struct Config * config = skeeter->config;
+   struct State * state = skeeter->state;
+   int spun;
+   int result;
+
+   spun = spin_on_postgres(skeeter, timeout_ms);
+   check(spun != -1, "spin_on_postgres");
+
+   // after a spin, only what is ready: the database can't keep the rest 
+   // waiting
+   result = reactor_dispatch(&state->reactor, spun ? 0 : timeout_ms);
+   check(result != -1, "reactor_dispatch");
+   if (result == 0 && !spun) {
+      return 0;
+   }
+
+   // the lower priority notifications we read in this pass
+   check(drain_priority_classes(config, state) == 0, 
+         "drain_priority_classes");
+
+   // ZMQ_FD is edge triggered, and sending on the socket can consume 
+   // the edge for a subscription, so check for them after every pass
+   check(process_all_subscriptions(state) == 0, "process_all_subscriptions");
+
+   // and for messages, if the upstream's edge came in with something else
+   if (state->relay.zmq_socket != NULL) {
+      check(forward_relay_messages(config, state) == 0, 
+            "forward_relay_messages");
+   }
+
+   // a pass that only spun has no wakeup to time
+   if (result > 0) {
+      state->dispatch_count++;
+      if (result >= state->reactor.batch_size) {
+         state->dispatch_full++;
+      }
+      histogram_record(&state->dispatch_time, 
+                       monotonic_us() - state->reactor.woke_us);
+   }
+
+   return 0;
+
+error:
+   return -1;
+}
+
+//----------------------------------------------------------------------------
+// true once the instance has handed off to a new skeeter
+bool
+skeeter_handed_off(const struct Skeeter * skeeter) {
+//----------------------------------------------------------------------------
+   return skeeter->state->handoff.phase == HANDOFF_DONE;
+}
+
+//----------------------------------------------------------------------------
+// log the stats of the heartbeat, one line per channel, class and 
+// endpoint
+// return 0 for success, -1 for failure
+int
+skeeter_log_stats(struct Skeeter * skeeter) {
+//----------------------------------------------------------------------------
+   bstring stats = NULL;
+   struct bstrList * lines = NULL;
+   int i;
+
+   stats = format_heartbeat_stats(skeeter->config, skeeter->state);
+   check(stats != NULL, "format_heartbeat_stats");
+   lines = bsplit(stats, '\n');
+   check(lines != NULL, "bsplit");
+
+   log_info("heartbeats=%" PRIu64 ";connected=%ld",
+            skeeter->state->heartbeat_count,
+            (long) skeeter->state->postgres_connect_time);
+   for (i=0; i < lines->qty; i++) {
+      if (blength(lines->entry[i]) > 0) {
+         log_info("%s", (const char *) lines->entry[i]->data);
+      }
+   }
+
+   bstrListDestroy(lines);
+   bdestroy(stats);
+   return 0;
+
+error:
+   bdestroy(stats);
+   return -1;
+}
+
+//----------------------------------------------------------------------------
+// the same name in config, for a priority class or endpoint name that 
+// points into old_config
+static const char *
+moved_name(const struct Config * old_config, 
+           const struct Config * config,
+           const char * name) {
+//----------------------------------------------------------------------------
+   const struct bstrList * old_list = old_config->priority_class_list;
+   int i;
+
+   for (i=0; i < old_list->qty; i++) {
+      if (name == (const char *) old_list->entry[i]->data) {
+         return (const char *) config->priority_class_list->entry[i]->data;
+      }
+   }
+   old_list = old_config->endpoint_list;
+   for (i=0; i < old_list->qty; i++) {
+      if (name == (const char *) old_list->entry[i]->data) {
+         return (const char *) config->endpoint_list->entry[i]->data;
+      }
+   }
+
+   return name;
+}
+
+//----------------------------------------------------------------------------
+// switch the instance to a new version of its config, applying the 
+// options that can change while it runs; nothing is rebound or 
+// reconnected, and no notification or sequence number is lost
+// return 0 for success, -1 if config changes any other option, or for 
+// failure: the instance carries on with its old config
+int
+skeeter_reconfigure(struct Skeeter * skeeter, const struct Config * config) {
+//----------------------------------------------------------------------------
+   const struct Config * old_config = skeeter->config;
+   struct State * state = skeeter->state;
+   const struct ChannelConfig * channel_config;
+   struct TokenBucket * bucket;
+   const char * option;
+   uint64_t dropped;
+   int result;
+   int i;
+
+   option = fixed_option_changed(old_config, config);
+   if (option != NULL) {
+      log_err("%s has changed: that takes a restart (or a handoff)", option);
+      return -1;
+   }
+
+   if (config->heartbeat_interval != old_config->heartbeat_interval) {
+      result = schedule_timer(&state->timer_wheel,
+                              &state->heartbeat_timer.timer,
+                              config->heartbeat_interval * 1000,
+                              config->heartbeat_interval * 1000);
+      check(result == 0, "schedule_timer");
+   }
+
+   // batch_max_bytes, conflate_window and batch_max_latency are read as
+   // notifications come in; a window that is already open keeps its time
+   for (i=0; i < config->channel_list->qty; i++) {
+      channel_config = &config->channel_config[i];
+      if (channel_config->rate_limit == 
+             old_config->channel_config[i].rate_limit &&
+          channel_config->rate_burst == 
+             old_config->channel_config[i].rate_burst) {
+         continue;
+      }
+      // a full bucket at the new rate, still owing its summary
+      bucket = &state->token_buckets[i];
+      dropped = bucket->dropped;
+      initialize_token_bucket(bucket, 
+                              channel_config->rate_limit,
+                              channel_config->rate_burst,
+                              monotonic_us());
+      bucket->dropped = dropped;
+   }
+
+   // the names we hold point into the config
+   for (i=0; i < state->pub_socket_qty; i++) {
+      state->pub_sockets[i].name = moved_name(old_config, 
+                                              config, 
+                                              state->pub_sockets[i].name);
+   }
+   state->shm_ring.name = config->shm_ring_name;
+   state->handoff.path = config->handoff_path;
+
+   skeeter->config = config;
+   log_info("config reloaded");
+
+   return 0;
+
+error:
+   return -1;
+}
+
+//----------------------------------------------------------------------------
+// publish the notifications postgres has sent us but we haven't read, 
+// those waiting in a priority class, to be conflated or in a batch. Call
+// this before skeeter_destroy so we don't lose them.
+// return 0 for success, -1 for failure
+int
+skeeter_flush(struct Skeeter * skeeter) {
+//----------------------------------------------------------------------------
+   const struct Config * config = skeeter->config;
+   struct State * state = skeeter->state;
+   int i;
+
+   // whatever is in the socket buffer, without waiting for more
+   if (state->postgres_listening) {
+      if (PQconsumeInput(state->postgres_connection) == 1) {
+         check(publish_notifications(config, state) == 0, 
+               "publish_notifications");
+      } else {
+         log_err("PQconsumeInput %s", 
+                 PQerrorMessage(state->postgres_connection));
+      }
+   }
+
+   check(drain_priority_classes(config, state) == 0, "drain_priority_classes");
+   for (i=0; i < config->channel_list->qty; i++) {
+      check(flush_conflated(config, state, i) == 0, "flush_conflated");
+      check(flush_batch(config, state, i) == 0, "flush_batch");
+   }
+
+   return 0;
+
+error:
+   return -1;
+}
+
+//----------------------------------------------------------------------------
+// close the database connection and the sockets, and release resources
+// the config is left to the caller
+void
+skeeter_destroy(struct Skeeter * skeeter) {
+//----------------------------------------------------------------------------
+   if (skeeter == NULL) {
+      return;
+   }
+   if (skeeter->state != NULL) clear_state(skeeter->state);
+   if (skeeter->zmq_context != NULL) zmq_term(skeeter->zmq_context);
+   free(skeeter);
+}
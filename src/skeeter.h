@@ -0,0 +1,122 @@
+/*----------------------------------------------------------------------------
+ * skeeter.h
+ * 
+ * LISTEN to postgres and publish the notifications, as a library
+ *
+ * A program that wants notifications in-process can embed skeeter instead
+ * of subscribing over the network, and still get reconnect handling:
+ *
+ *    config = load_config(path);
+ *    skeeter = skeeter_create(config);
+ *    skeeter_subscribe(skeeter, "channel1", on_channel1, my_data);
+ *    // add skeeter_fd(skeeter) to the program's own event loop, and 
+ *    // when it is readable:
+ *    skeeter_step(skeeter, 0);
+ *    ...
+ *    skeeter_flush(skeeter);
+ *    skeeter_destroy(skeeter);
+ *    clear_config(config);
+ *
+ * With no pub_socket_uri or pub_endpoints in the config, there are no PUB 
+ * sockets: only the in-process callbacks (and the shared memory ring, if 
+ * configured).
+ *--------------------------------------------------------------------------*/
+#if !defined(__SKEETER_H__)
+#define __SKEETER_H__
+
+#include <stdbool.h>
+
+#include "config.h"
+
+struct Skeeter;
+
+// called with each message published on a channel, before batching and 
+// compression: the meta data is 'timestamp=<t>;sequence=<n>' (plus 
+// ';conflated=<n>' for conflating channels), data is the payload, or NULL.
+// Both are only good during the call.
+typedef void (* skeeter_callback)(const char * channel,
+                                  const char * meta,
+                                  const char * data,
+                                  void * arg);
+
+// called when an fd of the host's, from skeeter_watch_fd, is readable
+// return 0 for success, -1 for failure (skeeter_step fails)
+typedef int (* skeeter_fd_callback)(int fd, void * arg);
+
+// create an instance from config: open the PUB sockets (and the shared 
+// memory ring) and start connecting to the database
+// config must outlive the instance
+// return NULL on failure
+extern struct Skeeter *
+skeeter_create(const struct Config * config);
+
+// call callback with every message published on the channel
+// return 0 for success, -1 for an unknown channel or failure
+extern int
+skeeter_subscribe(struct Skeeter * skeeter, 
+                  const char * channel,
+                  skeeter_callback callback,
+                  void * arg);
+
+// the fd to poll for input in the host's event loop: when it is readable,
+// call skeeter_step(skeeter, 0)
+extern int
+skeeter_fd(const struct Skeeter * skeeter);
+
+// call callback from skeeter_step whenever fd is readable, so a program
+// that runs skeeter_step as its loop can wait for its own fds (a 
+// signalfd, say) in the same epoll_wait. The fd is left to the caller, 
+// and must outlive the instance.
+// return 0 for success, -1 for failure
+extern int
+skeeter_watch_fd(struct Skeeter * skeeter, 
+                 int fd,
+                 skeeter_fd_callback callback,
+                 void * arg);
+
+// handle whatever is ready, waiting up to timeout_ms milliseconds for 
+// something to be ready (-1 waits forever)
+// database errors are handled here, by reconnecting after 
+// database_retry_interval
+// return 0 for success (including an interrupted wait), -1 for failure
+extern int
+skeeter_step(struct Skeeter * skeeter, int timeout_ms);
+
+// true once the instance has handed off to a new skeeter (see 
+// handoff_path in skeeterrc): it publishes nothing more, and the program
+// should flush, destroy it and exit
+extern bool
+skeeter_handed_off(const struct Skeeter * skeeter);
+
+// log the stats of the heartbeat, one line per channel, class and 
+// endpoint
+// return 0 for success, -1 for failure
+extern int
+skeeter_log_stats(struct Skeeter * skeeter);
+
+// switch the instance to config, a new version of its config (reloaded
+// on SIGHUP, say). Only the channels' rate_limit, rate_burst, 
+// batch_max_bytes and conflate_window (so long as batching and 
+// conflation stay on or off), batch_max_latency, heartbeat_interval, 
+// database_retry_interval and epoll_timeout can change: nothing is 
+// rebound or reconnected, and no notification or sequence number is 
+// lost. config must outlive the instance; the old one can go once this 
+// succeeds.
+// return 0 for success, -1 if config changes any other option, or for 
+// failure: the instance carries on with its old config
+extern int
+skeeter_reconfigure(struct Skeeter * skeeter, const struct Config * config);
+
+// publish the notifications postgres has sent us but we haven't read, 
+// those waiting in a priority class, to be conflated or in a batch. Call
+// this before skeeter_destroy so we don't lose them.
+// return 0 for success, -1 for failure
+extern int
+skeeter_flush(struct Skeeter * skeeter);
+
+// close the database connection and the sockets, and release resources
+// the config is left to the caller
+extern void
+skeeter_destroy(struct Skeeter * skeeter);
+
+#endif // !defined(__SKEETER_H__)
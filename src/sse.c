@@ -0,0 +1,556 @@
+/*----------------------------------------------------------------------------
+ * sse.c
+ *
+ * server-sent events: a minimal HTTP/1.1 server for browsers, one
+ * text/event-stream per GET of /<channel>
+ *
+ * Each event is encoded once, and clients queue pointers to the shared
+ * buffer: we write a client's queue with one sendmsg. A client whose queue
+ * reaches OUTPUT_QUEUE_SIZE events or sse_max_output bytes is evicted,
+ * so a slow browser costs us memory, never time. The browser's
+ * EventSource reconnects by itself; the event id is the sequence number,
+ * so it can tell what it missed.
+ *--------------------------------------------------------------------------*/
+#define _GNU_SOURCE // accept4
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+#include "bstrlib.h"
+#include "config.h"
+#include "dbg_syslog.h"
+#include "output_queue.h"
+#include "sse.h"
+#include "tcp_listen.h"
+
+// the biggest request header we read
+static const int MAX_REQUEST = 8192;
+
+static const int SSE_EPOLL_EVENTS = 64;
+static const int READ_CHUNK = 4096;
+
+static struct tagbstring LINE_END = bsStatic("\r\n");
+static struct tagbstring HEADER_END = bsStatic("\r\n\r\n");
+static struct tagbstring HTTP_1 = bsStatic("HTTP/1.");
+
+// what to do with a client after reading or writing
+enum CLIENT_RESULT {
+   CLIENT_OK,
+   CLIENT_CLOSE,
+   CLIENT_ERROR
+};
+
+//----------------------------------------------------------------------------
+// write as much of the client's output as the socket takes, and poll for
+// writable while some is left
+// return CLIENT_OK, CLIENT_CLOSE if the client is gone (or done),
+// CLIENT_ERROR
+static enum CLIENT_RESULT
+flush_client(struct Sse * sse, struct SseClient * client) {
+//----------------------------------------------------------------------------
+   struct epoll_event event;
+   bool want_write;
+
+   if (output_queue_write(&client->output, client->fd) != 0) {
+      return CLIENT_CLOSE;
+   }
+   if (client->output.qty == 0 && client->close_when_flushed) {
+      return CLIENT_CLOSE;
+   }
+
+   want_write = client->output.qty > 0;
+   if (want_write != client->want_write) {
+      event.events = EPOLLIN | (want_write ? EPOLLOUT : 0);
+      event.data.ptr = client;
+      check(epoll_ctl(sse->epoll_fd, EPOLL_CTL_MOD, client->fd, &event) == 0,
+            "epoll_ctl");
+      client->want_write = want_write;
+   }
+
+   return CLIENT_OK;
+
+error:
+   return CLIENT_ERROR;
+}
+
+//----------------------------------------------------------------------------
+// queue a response we encoded for this client alone
+// return 0 for success, -1 for failure
+static int
+queue_response(struct SseClient * client,
+               const struct Config * config,
+               bstring data) {
+//----------------------------------------------------------------------------
+   struct SharedBuffer * response = create_shared_buffer(data);
+
+   check(response != NULL, "create_shared_buffer");
+   // a new client's queue is empty: this can't fail
+   output_queue_push(&client->output, response, config->sse_max_output);
+   release_shared_buffer(response);
+   return 0;
+
+error:
+   return -1;
+}
+
+//----------------------------------------------------------------------------
+// disconnect a client and free it
+static void
+close_client(struct Sse * sse, struct SseClient * client) {
+//----------------------------------------------------------------------------
+   // closing the fd takes it out of the epoll set
+   close(client->fd);
+   if (client->prev != NULL) {
+      client->prev->next = client->next;
+   } else {
+      sse->clients = client->next;
+   }
+   if (client->next != NULL) client->next->prev = client->prev;
+   sse->client_qty--;
+   if (client->channel_index != -1) {
+      sse->channel_clients[client->channel_index]--;
+   }
+
+   clear_output_queue(&client->output);
+   bdestroy(client->request);
+   free(client);
+}
+
+//----------------------------------------------------------------------------
+// queue an error response, and close once it is written
+// return 0 for success, -1 for failure
+static int
+respond_error(struct SseClient * client,
+              const struct Config * config,
+              const char * status,
+              const char * extra_header) {
+//----------------------------------------------------------------------------
+   bstring data;
+
+   data = bformat("HTTP/1.1 %s\r\n"
+                  "Content-Type: text/plain\r\n"
+                  "Content-Length: %d\r\n"
+                  "Connection: close\r\n"
+                  "%s"
+                  "\r\n"
+                  "%s\n",
+                  status,
+                  (int) strlen(status) + 1,
+                  extra_header,
+                  status);
+   check(queue_response(client, config, data) == 0, "queue_response");
+   client->close_when_flushed = true;
+
+   return 0;
+
+error:
+   return -1;
+}
+
+//----------------------------------------------------------------------------
+// we have the whole request header: answer GET /<channel> with the start
+// of the stream, anything else with an error
+// return 0 for success, -1 for failure
+static int
+handle_request(struct Sse * sse,
+               struct SseClient * client,
+               const struct Config * config) {
+//----------------------------------------------------------------------------
+   struct bstrList * request_line = NULL;
+   bstring channel = NULL;
+   bstring data = NULL;
+   int line_end;
+   int query;
+   int channel_index;
+
+   line_end = binstr(client->request, 0, &LINE_END);
+   check(line_end != BSTR_ERR, "no request line");
+   client->request->slen = line_end;
+   request_line = bsplit(client->request, ' ');
+   check(request_line != NULL, "bsplit");
+
+   if (request_line->qty != 3 ||
+       bstrncmp(request_line->entry[2],
+                &HTTP_1, blength(&HTTP_1)) != 0 ||
+       blength(request_line->entry[1]) < 2 ||
+       request_line->entry[1]->data[0] != '/') {
+      check(respond_error(client, config, "400 Bad Request", "") == 0,
+            "respond_error");
+   } else if (!biseqcstr(request_line->entry[0], "GET")) {
+      check(respond_error(client,
+                          config,
+                          "405 Method Not Allowed",
+                          "Allow: GET\r\n") == 0,
+            "respond_error");
+   } else {
+      // the query string (EventSource adds none, but cache busters do)
+      query = bstrchr(request_line->entry[1], '?');
+      channel = bmidstr(request_line->entry[1],
+                        1,
+                        (query == BSTR_ERR ?
+                         blength(request_line->entry[1]) : query) - 1);
+      check(channel != NULL, "bmidstr");
+      channel_index = find_channel_index(config, channel);
+      if (channel_index == -1) {
+         check(respond_error(client, config, "404 Not Found", "") == 0,
+               "respond_error");
+      } else {
+         data = bformat("HTTP/1.1 200 OK\r\n"
+                        "Content-Type: text/event-stream\r\n"
+                        "Cache-Control: no-cache\r\n"
+                        "Connection: close\r\n"
+                        "X-Accel-Buffering: no\r\n"
+                        "%s%s%s"
+                        "\r\n",
+                        config->sse_allow_origin != NULL ?
+                           "Access-Control-Allow-Origin: " : "",
+                        config->sse_allow_origin != NULL ?
+                           config->sse_allow_origin : "",
+                        config->sse_allow_origin != NULL ? "\r\n" : "");
+         check(queue_response(client, config, data) == 0, 
+               "queue_response");
+         client->channel_index = channel_index;
+         sse->channel_clients[channel_index]++;
+      }
+   }
+
+   bdestroy(channel);
+   bstrListDestroy(request_line);
+   bdestroy(client->request);
+   client->request = NULL;
+   return 0;
+
+error:
+   bdestroy(channel);
+   if (request_line != NULL) bstrListDestroy(request_line);
+   return -1;
+}
+
+//----------------------------------------------------------------------------
+// read the request; once we are streaming, input is ignored
+// return CLIENT_OK, CLIENT_CLOSE to disconnect the client, CLIENT_ERROR
+static enum CLIENT_RESULT
+read_client(struct Sse * sse,
+            struct SseClient * client,
+            const struct Config * config) {
+//----------------------------------------------------------------------------
+   unsigned char buffer[READ_CHUNK];
+   ssize_t received;
+
+   for (;;) {
+      received = recv(client->fd, buffer, sizeof buffer, MSG_DONTWAIT);
+      if (received == 0) {
+         return CLIENT_CLOSE;
+      }
+      if (received == -1) {
+         if (errno == EAGAIN || errno == EWOULDBLOCK) {
+            errno = 0;
+            break;
+         }
+         errno = 0;
+         return CLIENT_CLOSE;
+      }
+      if (client->request == NULL) {
+         continue;
+      }
+      check(bcatblk(client->request, buffer, received) == BSTR_OK,
+            "bcatblk");
+      if (binstr(client->request,
+                 0,
+                 &HEADER_END) != BSTR_ERR) {
+         check(handle_request(sse, client, config) == 0, "handle_request");
+      } else if (blength(client->request) > MAX_REQUEST) {
+         bdestroy(client->request);
+         client->request = NULL;
+         check(respond_error(client,
+                             config,
+                             "431 Request Header Fields Too Large",
+                             "") == 0,
+               "respond_error");
+      }
+   }
+
+   return flush_client(sse, client);
+
+error:
+   return CLIENT_ERROR;
+}
+
+//----------------------------------------------------------------------------
+// accept every client waiting on the listening socket
+// return 0 for success, -1 for failure
+static int
+accept_clients(struct Sse * sse, const struct Config * config) {
+//----------------------------------------------------------------------------
+   struct SseClient * client = NULL;
+   struct epoll_event event;
+   int fd;
+
+   for (;;) {
+      fd = accept4(sse->listen_fd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+      if (fd == -1) {
+         if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR ||
+             errno == ECONNABORTED) {
+            errno = 0;
+            return 0;
+         }
+         sentinel("accept4");
+      }
+      if (sse->client_qty >= config->sse_max_clients) {
+         log_info("sse at sse_max_clients (%d), refusing client",
+                  config->sse_max_clients);
+         close(fd);
+         continue;
+      }
+
+      client = calloc(1, sizeof(struct SseClient));
+      check_mem(client);
+      client->fd = fd;
+      client->channel_index = -1;
+      client->request = bfromcstr("");
+      check(client->request != NULL, "bfromcstr");
+
+      event.events = EPOLLIN;
+      event.data.ptr = client;
+      check(epoll_ctl(sse->epoll_fd, EPOLL_CTL_ADD, fd, &event) == 0,
+            "epoll_ctl");
+
+      client->next = sse->clients;
+      if (sse->clients != NULL) sse->clients->prev = client;
+      sse->clients = client;
+      sse->client_qty++;
+      sse->accepted++;
+      client = NULL;
+   }
+
+error:
+   if (client != NULL) {
+      bdestroy(client->request);
+      free(client);
+      close(fd);
+   }
+   return -1;
+}
+
+//----------------------------------------------------------------------------
+// listen on config.sse_address, config.sse_port
+// return 0 for success, -1 for failure
+int
+start_sse(struct Sse * sse, const struct Config * config) {
+//----------------------------------------------------------------------------
+   struct epoll_event listen_event;
+
+   sse->listen_fd = -1;
+   sse->epoll_fd = -1;
+   sse->clients = NULL;
+   sse->client_qty = 0;
+   sse->accepted = 0;
+   sse->events = 0;
+   sse->evicted = 0;
+
+   sse->channel_clients = calloc(config->channel_list->qty, sizeof(int));
+   check_mem(sse->channel_clients);
+
+   sse->listen_fd = tcp_listen("sse", 
+                               config->sse_address, 
+                               config->sse_port,
+                               config->handoff_path != NULL);
+   check(sse->listen_fd != -1, "tcp_listen");
+
+   sse->epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+   check(sse->epoll_fd != -1, "epoll_create1");
+
+   // a NULL ptr is the listening socket
+   listen_event.events = EPOLLIN;
+   listen_event.data.ptr = NULL;
+   check(epoll_ctl(sse->epoll_fd,
+                   EPOLL_CTL_ADD,
+                   sse->listen_fd,
+                   &listen_event) == 0,
+         "epoll_ctl");
+
+   return 0;
+
+error:
+   return -1;
+}
+
+//----------------------------------------------------------------------------
+// disconnect the clients and close the sockets
+void
+clear_sse(struct Sse * sse) {
+//----------------------------------------------------------------------------
+   while (sse->clients != NULL) {
+      close_client(sse, sse->clients);
+   }
+   if (sse->epoll_fd != -1) close(sse->epoll_fd);
+   if (sse->listen_fd != -1) close(sse->listen_fd);
+   free(sse->channel_clients);
+   sse->epoll_fd = -1;
+   sse->listen_fd = -1;
+   sse->channel_clients = NULL;
+}
+
+//----------------------------------------------------------------------------
+// accept new clients, and read from and write to the ones that are ready
+// return 0 for success, -1 for failure
+int
+sse_handle_events(struct Sse * sse, const struct Config * config) {
+//----------------------------------------------------------------------------
+   struct epoll_event event_list[SSE_EPOLL_EVENTS];
+   struct SseClient * client;
+   enum CLIENT_RESULT result;
+   int event_qty;
+   int i;
+
+   do {
+      event_qty = epoll_wait(sse->epoll_fd, event_list, SSE_EPOLL_EVENTS, 0);
+      if (event_qty == -1 && errno == EINTR) {
+         errno = 0;
+         return 0;
+      }
+      check(event_qty != -1, "epoll_wait");
+
+      for (i=0; i < event_qty; i++) {
+         client = event_list[i].data.ptr;
+         if (client == NULL) {
+            check(accept_clients(sse, config) == 0, "accept_clients");
+            continue;
+         }
+         if (event_list[i].events & (EPOLLIN | EPOLLERR | EPOLLHUP)) {
+            result = read_client(sse, client, config);
+         } else {
+            result = flush_client(sse, client);
+         }
+         check(result != CLIENT_ERROR, "sse client");
+         if (result == CLIENT_CLOSE) {
+            close_client(sse, client);
+         }
+      }
+   } while (event_qty == SSE_EPOLL_EVENTS);
+
+   return 0;
+
+error:
+   return -1;
+}
+
+//----------------------------------------------------------------------------
+// queue an event for every streaming client that wants it (channel_index
+// -1 for all of them) and write what we can
+// this takes the caller's reference to event
+// return 0 for success, -1 for failure
+static int
+broadcast_event(struct Sse * sse,
+                const struct Config * config,
+                int channel_index,
+                struct SharedBuffer * event) {
+//----------------------------------------------------------------------------
+   struct SseClient * client;
+   struct SseClient * next;
+   enum CLIENT_RESULT result;
+
+   for (client = sse->clients; client != NULL; client = next) {
+      next = client->next;
+      if (client->channel_index == -1 || client->close_when_flushed ||
+          (channel_index != -1 && client->channel_index != channel_index)) {
+         continue;
+      }
+      if (output_queue_push(&client->output, 
+                            event, 
+                            config->sse_max_output) != 0) {
+         log_info("sse client fd %d too slow, evicting", client->fd);
+         sse->evicted++;
+         close_client(sse, client);
+         continue;
+      }
+      result = flush_client(sse, client);
+      check(result != CLIENT_ERROR, "flush_client");
+      if (result == CLIENT_CLOSE) {
+         close_client(sse, client);
+      }
+   }
+
+   release_shared_buffer(event);
+   return 0;
+
+error:
+   release_shared_buffer(event);
+   return -1;
+}
+
+//----------------------------------------------------------------------------
+// send an event to every client streaming the channel
+//    id: <sequence>
+//    data: <a line of data>
+//    ...
+// data may be NULL
+// return 0 for success, -1 for failure
+int
+sse_publish(struct Sse * sse,
+            const struct Config * config,
+            int channel_index,
+            uint64_t sequence,
+            const char * data) {
+//----------------------------------------------------------------------------
+   struct SharedBuffer * event;
+   bstring encoded;
+   const char * line;
+   size_t length;
+
+   if (sse->channel_clients[channel_index] == 0) {
+      return 0;
+   }
+
+   encoded = bformat("id: %llu\n", (unsigned long long) sequence);
+   check(encoded != NULL, "bformat");
+
+   // a line break in the data starts another data line
+   line = data != NULL ? data : "";
+   for (;;) {
+      length = strcspn(line, "\r\n");
+      check(bcatcstr(encoded, "data: ") == BSTR_OK, "bcatcstr");
+      check(bcatblk(encoded, line, length) == BSTR_OK, "bcatblk");
+      check(bconchar(encoded, '\n') == BSTR_OK, "bconchar");
+      line += length;
+      if (line[0] == '\0') break;
+      if (line[0] == '\r' && line[1] == '\n') line++;
+      line++;
+   }
+   check(bconchar(encoded, '\n') == BSTR_OK, "bconchar");
+
+   event = create_shared_buffer(encoded);
+   encoded = NULL;
+   check(event != NULL, "create_shared_buffer");
+   sse->events++;
+
+   return broadcast_event(sse, config, channel_index, event);
+
+error:
+   bdestroy(encoded);
+   return -1;
+}
+
+//----------------------------------------------------------------------------
+// send a comment to every client, so proxies keep idle streams open
+// return 0 for success, -1 for failure
+int
+sse_keepalive(struct Sse * sse, const struct Config * config) {
+//----------------------------------------------------------------------------
+   struct SharedBuffer * event;
+
+   if (sse->client_qty == 0) {
+      return 0;
+   }
+   event = create_shared_buffer(bfromcstr(":\n\n"));
+   check(event != NULL, "create_shared_buffer");
+
+   return broadcast_event(sse, config, -1, event);
+
+error:
+   return -1;
+}
@@ -0,0 +1,83 @@
+/*----------------------------------------------------------------------------
+ * sse.h
+ *
+ * server-sent events: a minimal HTTP/1.1 server for browsers, one
+ * text/event-stream per GET of /<channel>
+ *--------------------------------------------------------------------------*/
+#if !defined(__SSE_H__)
+#define __SSE_H__
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "bstrlib.h"
+#include "config.h"
+#include "output_queue.h"
+
+struct SseClient {
+   int fd;
+   // the request so far, until we have the whole header
+   bstring request;
+   // the channel we are streaming, -1 until the request is answered
+   int channel_index;
+   // close once the queue is written (after an error response)
+   bool close_when_flushed;
+
+   // events (and the response header) to write
+   struct OutputQueue output;
+   // EPOLLOUT is set while output is not empty
+   bool want_write;
+
+   struct SseClient * prev;
+   struct SseClient * next;
+};
+
+struct Sse {
+   // listening TCP socket, -1 without SSE
+   int listen_fd;
+   // the listening socket and the clients are polled on their own epoll
+   // fd, so we can find the client from the event; this fd is polled in
+   // the main loop
+   int epoll_fd;
+
+   struct SseClient * clients;
+   int client_qty;
+   // streaming clients per channel, so we skip encoding for nobody
+   int * channel_clients;
+
+   uint64_t accepted;
+   uint64_t events;
+   // clients we disconnected because they could not keep up
+   uint64_t evicted;
+};
+
+// listen on config.sse_address, config.sse_port
+// return 0 for success, -1 for failure
+extern int
+start_sse(struct Sse * sse, const struct Config * config);
+
+// disconnect the clients and close the sockets
+extern void
+clear_sse(struct Sse * sse);
+
+// accept new clients, and read from and write to the ones that are ready
+// return 0 for success, -1 for failure
+extern int
+sse_handle_events(struct Sse * sse, const struct Config * config);
+
+// send an event to every client streaming the channel
+// data may be NULL
+// return 0 for success, -1 for failure
+extern int
+sse_publish(struct Sse * sse,
+            const struct Config * config,
+            int channel_index,
+            uint64_t sequence,
+            const char * data);
+
+// send a comment to every client, so proxies keep idle streams open
+// return 0 for success, -1 for failure
+extern int
+sse_keepalive(struct Sse * sse, const struct Config * config);
+
+#endif // !defined(__SSE_H__)
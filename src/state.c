@@ -20,22 +20,142 @@ create_state(const struct Config * config) {
    check_mem(state);
    bzero(state, sizeof(struct State));
 
-   state->heartbeat_timer_fd = -1;
-
-   state->restart_timer_fd = -1;
+   state->timer_wheel.fd = -1;
 
    state->postgres_connection = NULL;
    state->postgres_connect_time = 0;
-
-   state->epoll_fd = -1;
-
-   state->zmq_pub_socket = NULL;
+   state->postgres_listening = false;
+
+   state->query_result_cb = NULL;
+   state->query_channel_index = -1;
+
+   state->reactor.epoll_fd = -1;
+   state->reactor.uring = NULL;
+   state->reactor.event_list = NULL;
+
+   state->pub_sockets = NULL;
+   state->pub_socket_qty = 0;
+   state->pub_socket_handlers = NULL;
+   state->pub_monitor_handlers = NULL;
+
+   state->shm_ring.header = NULL;
+   state->shm_ring.fd = -1;
+
+   state->handoff.path = NULL;
+   state->handoff.listen_fd = -1;
+   state->handoff.fd = -1;
+   state->handoff.marker = NULL;
+   state->handoff.endpoint_fds = NULL;
+
+   state->leader = (config->leader_lock_key == 0);
+   state->leader_lock_pending = false;
+   state->leader_mark_pending = false;
+   state->leader_mark_count = 0;
+   state->leader_mark = NULL;
+
+   state->host_handlers = NULL;
+
+   state->relay.zmq_socket = NULL;
+   state->relay.fd = -1;
+
+   state->pg_proxy.listen_fd = -1;
+   state->pg_proxy.epoll_fd = -1;
+   state->pg_proxy.clients = NULL;
+
+   state->sse.listen_fd = -1;
+   state->sse.epoll_fd = -1;
+   state->sse.clients = NULL;
+   state->sse.channel_clients = NULL;
+
+   state->resp.listen_fd = -1;
+   state->resp.epoll_fd = -1;
+   state->resp.clients = NULL;
+   state->resp.channel_interest = NULL;
+
+   state->metrics.listen_fd = -1;
+   state->metrics.epoll_fd = -1;
+   state->metrics.clients = NULL;
+
+   state->gateway.zmq_socket = NULL;
+   state->gateway.fd = -1;
+   state->gateway.connection = NULL;
+   state->gateway.connected = false;
+   state->gateway.failed_time = 0;
+   state->gateway.channels = NULL;
+   state->gateway.payloads = NULL;
+   state->gateway.clients = NULL;
+   state->gateway.sent_clients = NULL;
+   state->gateway.received = 0;
+   state->gateway.notified = 0;
+   state->gateway.failed = 0;
+   state->gateway.discarded = 0;
 
    state->heartbeat_count = 0;
 
    state->channel_counts = calloc(config->channel_list->qty, sizeof(uint64_t));
    check_mem(state->channel_counts);
 
+   state->channel_published = calloc(config->channel_list->qty, 
+                                     sizeof(uint64_t));
+   check_mem(state->channel_published);
+   state->channel_dropped = calloc(config->channel_list->qty, 
+                                   sizeof(uint64_t));
+   check_mem(state->channel_dropped);
+   state->channel_bytes = calloc(config->channel_list->qty, 
+                                 sizeof(uint64_t));
+   check_mem(state->channel_bytes);
+   state->channel_latency = calloc(config->channel_list->qty, 
+                                   sizeof(struct Histogram));
+   check_mem(state->channel_latency);
+   state->channel_database_latency = calloc(config->channel_list->qty, 
+                                            sizeof(struct Histogram));
+   check_mem(state->channel_database_latency);
+   state->interval_latency = calloc(config->channel_list->qty, 
+                                    sizeof(struct Histogram));
+   check_mem(state->interval_latency);
+   state->interval_database_latency = calloc(config->channel_list->qty, 
+                                             sizeof(struct Histogram));
+   check_mem(state->interval_database_latency);
+
+   state->outbox_last_ids = calloc(config->channel_list->qty, 
+                                   sizeof(uint64_t));
+   check_mem(state->outbox_last_ids);
+
+   state->outbox_pending = calloc(config->channel_list->qty, sizeof(bool));
+   check_mem(state->outbox_pending);
+
+   state->leader_mark_counts = calloc(config->channel_list->qty, 
+                                      sizeof(uint64_t));
+   check_mem(state->leader_mark_counts);
+
+   state->compressors = calloc(config->channel_list->qty, 
+                               sizeof(struct Compressor));
+   check_mem(state->compressors);
+   state->channel_qty = config->channel_list->qty;
+
+   state->batches = calloc(config->channel_list->qty, sizeof(struct Batch));
+   check_mem(state->batches);
+
+   state->conflate_tables = calloc(config->channel_list->qty, 
+                                   sizeof(struct ConflateTable));
+   check_mem(state->conflate_tables);
+   state->conflate_timers = calloc(config->channel_list->qty, 
+                                   sizeof(struct Timer));
+   check_mem(state->conflate_timers);
+
+   state->token_buckets = calloc(config->channel_list->qty, 
+                                 sizeof(struct TokenBucket));
+   check_mem(state->token_buckets);
+
+   state->channel_callbacks = calloc(config->channel_list->qty, 
+                                     sizeof(struct ChannelCallbacks));
+   check_mem(state->channel_callbacks);
+
+   state->priority_classes = calloc(config->priority_class_list->qty, 
+                                    sizeof(struct PriorityClass));
+   check_mem(state->priority_classes);
+   state->priority_class_qty = config->priority_class_list->qty;
+
    return state;
 
 error:
@@ -49,14 +169,63 @@ error:
 void
 clear_state(struct State * state) {
 //----------------------------------------------------------------------------
-   if (state->heartbeat_timer_fd != -1) close(state->heartbeat_timer_fd);
-   if (state->restart_timer_fd != -1) close(state->restart_timer_fd);
+   struct HostHandler * host_handler;
+   int i;
+
+   clear_timer_wheel(&state->timer_wheel);
    if (state->postgres_connection != NULL) {
       PQfinish(state->postgres_connection); 
    }
-   if (state->epoll_fd != -1) close(state->epoll_fd);
-   if (state->zmq_pub_socket != NULL) zmq_close(state->zmq_pub_socket);
+   clear_reactor(&state->reactor);
+   clear_pub_sockets(state->pub_sockets, state->pub_socket_qty);
+   free(state->pub_socket_handlers);
+   free(state->pub_monitor_handlers);
+   // while the other process publishes for us, the ring is its too
+   if (!handoff_may_publish(&state->handoff)) {
+      release_shm_ring(&state->shm_ring);
+   } else {
+      clear_shm_ring(&state->shm_ring);
+   }
+   clear_handoff(&state->handoff);
+   clear_relay(&state->relay);
+   clear_gateway(&state->gateway);
+   clear_pg_proxy(&state->pg_proxy);
+   clear_sse(&state->sse);
+   clear_resp(&state->resp);
+   clear_metrics(&state->metrics);
    free(state->channel_counts);
+   free(state->channel_published);
+   free(state->channel_dropped);
+   free(state->channel_bytes);
+   free(state->channel_latency);
+   free(state->channel_database_latency);
+   free(state->interval_latency);
+   free(state->interval_database_latency);
+   free(state->outbox_last_ids);
+   free(state->outbox_pending);
+   bdestroy(state->leader_mark);
+   free(state->leader_mark_counts);
+   for (i=0; i < state->channel_qty; i++) {
+      clear_compressor(&state->compressors[i]);
+      clear_batch(&state->batches[i]);
+      clear_conflate_table(&state->conflate_tables[i]);
+      free(state->channel_callbacks[i].entries);
+   }
+   free(state->compressors);
+   free(state->batches);
+   free(state->conflate_tables);
+   free(state->conflate_timers);
+   free(state->token_buckets);
+   free(state->channel_callbacks);
+   while (state->host_handlers != NULL) {
+      host_handler = state->host_handlers;
+      state->host_handlers = host_handler->next;
+      free(host_handler);
+   }
+   for (i=0; i < state->priority_class_qty; i++) {
+      clear_priority_class(&state->priority_classes[i]);
+   }
+   free(state->priority_classes);
    free(state);
 }
 
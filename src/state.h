@@ -6,31 +6,227 @@
 #if !defined(__STATE_H__)
 #define __STATE_H__
 
-#include <sys/epoll.h>
-
+#include <stdbool.h>
+#include <stdint.h>
 #include <libpq-fe.h>
 
+#include "batch.h"
+#include "compress.h"
+#include "conflate.h"
+#include "gateway.h"
+#include "handoff.h"
+#include "histogram.h"
+#include "metrics.h"
+#include "pg_proxy.h"
+#include "priority.h"
+#include "pub_socket.h"
+#include "rate_limit.h"
+#include "reactor.h"
+#include "relay.h"
+#include "resp.h"
+#include "shm_ring.h"
+#include "sse.h"
+#include "skeeter.h"
+#include "timer_wheel.h"
 #include "config.h"
 
+struct State;
+
+typedef enum CALLBACK_RESULT {
+   CALLBACK_OK,
+   CALLBACK_DATABASE_ERROR,
+   CALLBACK_ERROR
+} CALLBACK_RESULT_TYPE;
+
+// called for events on one of our own fds
+typedef CALLBACK_RESULT_TYPE (* state_callback)(const struct Config * config,
+                                                struct State * state);
+
+// the reactor handler for one of our own fds: its context is the
+// struct Skeeter, and it calls callback, which the connection callbacks
+// switch as the connection moves along
+struct StateHandler {
+   // first, so the reactor's handler is the StateHandler
+   struct ReactorHandler handler;
+   state_callback callback;
+};
+
+// one of our own timers on the timer wheel, calling callback like a
+// StateHandler: its context is the struct Skeeter
+struct StateTimer {
+   // first, so the wheel's timer is the StateTimer
+   struct Timer timer;
+   state_callback callback;
+};
+
+// an fd of the host's, from skeeter_watch_fd
+struct HostHandler {
+   // first, so the reactor's handler is the HostHandler
+   struct ReactorHandler handler;
+   skeeter_fd_callback callback;
+   void * arg;
+   struct HostHandler * next;
+};
+
+// in-process subscribers to a channel, from skeeter_subscribe
+struct ChannelCallback {
+   skeeter_callback callback;
+   void * arg;
+};
+
+struct ChannelCallbacks {
+   struct ChannelCallback * entries;
+   int qty;
+};
+
+// called for each PGresult of the query in flight on postgres_connection
+// return 0 for success, -1 for failure
+typedef int (* query_result_handler)(const struct Config * config,
+                                     struct State * state,
+                                     const PGresult * result);
+
 struct State {
-   int heartbeat_timer_fd;
-   struct epoll_event heartbeat_timer_event;
+   // every timer below runs on the wheel, with one timerfd in the reactor
+   struct TimerWheel timer_wheel;
+   struct StateHandler timer_wheel_handler;
+
+   struct StateTimer heartbeat_timer;
 
-   int restart_timer_fd;
-   struct epoll_event restart_timer_event;
+   // scheduled while we wait to reconnect to the database
+   struct StateTimer restart_timer;
 
    PGconn * postgres_connection;
    time_t postgres_connect_time;
-   struct epoll_event postgres_event;
+   struct StateHandler postgres_handler;
+
+   // LISTEN has completed, we can send other queries
+   bool postgres_listening;
+
+   // the handler for the query in flight, NULL when the connection is idle
+   query_result_handler query_result_cb;
+   int query_channel_index;
+
+   // scheduled if there are outbox channels
+   struct StateTimer outbox_timer;
+
+   struct Reactor reactor;
+
+   // one per dedicated endpoint, and one per priority class shared by 
+   // the other endpoints of the class
+   struct PubSocket * pub_sockets;
+   int pub_socket_qty;
+   // parallel arrays to pub_sockets, the same callbacks serve every socket
+   struct StateHandler * pub_socket_handlers;
+   struct StateHandler * pub_monitor_handlers;
 
-   int epoll_fd;
+   // relay.zmq_socket is NULL unless config.relay_upstream is set
+   struct Relay relay;
+   struct StateHandler relay_handler;
 
-   void * zmq_pub_socket;
+   // gateway.zmq_socket is NULL unless config.gateway_uri is set
+   struct Gateway gateway;
+   struct StateHandler gateway_pull_handler;
+   struct StateHandler gateway_postgres_handler;
+
+   // pg_proxy.listen_fd is -1 unless config.pg_proxy_port is set
+   struct PgProxy pg_proxy;
+   struct StateHandler pg_proxy_handler;
+
+   // sse.listen_fd is -1 unless config.sse_port is set
+   struct Sse sse;
+   struct StateHandler sse_handler;
+
+   // resp.listen_fd is -1 unless config.resp_port is set
+   struct Resp resp;
+   struct StateHandler resp_handler;
+
+   // metrics.listen_fd is -1 unless config.metrics_port is set
+   struct Metrics metrics;
+   struct StateHandler metrics_handler;
+
+   // header is NULL unless config.shm_ring_name is set
+   struct ShmRing shm_ring;
+
+   // handoff.path is NULL unless config.handoff_path is set
+   struct Handoff handoff;
+   struct StateHandler handoff_listen_handler;
+   struct StateHandler handoff_handler;
+
+   // true unless config.leader_lock_key is set and another skeeter holds
+   // the lock. The standby does everything but publish, and mirrors the
+   // leader's sequence numbers from the marks it NOTIFYs on LEADER_CHANNEL
+   bool leader;
+   // queries for start_next_query: try for the lock, send a mark
+   bool leader_lock_pending;
+   bool leader_mark_pending;
+   uint64_t leader_mark_count;
+   // the last mark we saw, and our sequence numbers when we saw it
+   bstring leader_mark;
+   uint64_t * leader_mark_counts;
+   // the standby tries for the lock
+   struct StateTimer leader_timer;
 
    uint64_t heartbeat_count;
+   uint64_t heartbeat_dropped;
 
-   // parallel array to config.channel_list
+   // the number of entries in the parallel arrays
+   int channel_qty;
+
+   // parallel arrays to config.channel_list
    uint64_t * channel_counts;
+   // send outcomes: dropped is only counted with pub_socket_nodrop
+   uint64_t * channel_published;
+   uint64_t * channel_dropped;
+   // the frames we publish, as compressed
+   uint64_t * channel_bytes;
+   // microseconds from reading a notification to publishing it, and 
+   // from the producer's timestamp to reading it (channels with 
+   // producer_timestamp only)
+   struct Histogram * channel_latency;
+   struct Histogram * channel_database_latency;
+   // the same, since the last heartbeat
+   struct Histogram * interval_latency;
+   struct Histogram * interval_database_latency;
+
+   // for the metrics: database connections lost (or never made)
+   uint64_t database_retries;
+   // wakeups with something to do, the ones that filled 
+   // config.epoll_batch_size (so more waited), and how long we took over
+   // them in microseconds
+   uint64_t dispatch_count;
+   uint64_t dispatch_full;
+   struct Histogram dispatch_time;
+
+   // parallel arrays to config.channel_list, used by outbox channels
+   uint64_t * outbox_last_ids;
+   bool * outbox_pending;
+
+   // parallel array to config.channel_list
+   struct Compressor * compressors;
+
+   // parallel array to config.channel_list, used by batching channels
+   struct Batch * batches;
+   // scheduled while some channel has a batch waiting
+   struct StateTimer batch_timer;
+
+   // parallel arrays to config.channel_list, used by conflating channels
+   struct ConflateTable * conflate_tables;
+   // scheduled while the channel has pending entries, for the end of its
+   // conflate_window; the timer's index in the array is the channel's
+   struct Timer * conflate_timers;
+
+   // parallel array to config.channel_list
+   struct TokenBucket * token_buckets;
+
+   // parallel array to config.channel_list
+   struct ChannelCallbacks * channel_callbacks;
+
+   // from skeeter_watch_fd
+   struct HostHandler * host_handlers;
+
+   // parallel array to config.priority_class_list
+   struct PriorityClass * priority_classes;
+   int priority_class_qty;
 };
 
 extern struct State *
@@ -0,0 +1,69 @@
+/*----------------------------------------------------------------------------
+ * tcp_listen.c
+ * 
+ * listening TCP sockets for the front ends that don't speak zeromq
+ *--------------------------------------------------------------------------*/
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+#include "dbg_syslog.h"
+#include "tcp_listen.h"
+
+//----------------------------------------------------------------------------
+// a non blocking socket listening on host (NULL for 
+// DEFAULT_LISTEN_ADDRESS) and port; name is for the log
+// with reuse_port, the old and new process of a handoff can both listen
+// return the fd, -1 for failure
+int
+tcp_listen(const char * name, const char * host, int port, bool reuse_port) {
+//----------------------------------------------------------------------------
+   struct addrinfo hints;
+   struct addrinfo * address = NULL;
+   char port_string[16];
+   int reuse = 1;
+   int fd = -1;
+   int result;
+
+   if (host == NULL) host = DEFAULT_LISTEN_ADDRESS;
+
+   memset(&hints, 0, sizeof hints);
+   hints.ai_family = AF_UNSPEC;
+   hints.ai_socktype = SOCK_STREAM;
+   hints.ai_flags = AI_PASSIVE;
+   snprintf(port_string, sizeof port_string, "%d", port);
+   result = getaddrinfo(host, port_string, &hints, &address);
+   check(result == 0, "getaddrinfo %s %s", host, gai_strerror(result));
+
+   fd = socket(address->ai_family,
+               address->ai_socktype | SOCK_NONBLOCK | SOCK_CLOEXEC,
+               address->ai_protocol);
+   check(fd != -1, "socket");
+   check(setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof reuse) == 0,
+         "SO_REUSEADDR");
+   // accepted sockets inherit this: a message written while the client 
+   // has yet to acknowledge the last one goes now, not after its ACK
+   check(setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &reuse, sizeof reuse) == 0,
+         "TCP_NODELAY");
+   if (reuse_port) {
+      check(setsockopt(fd, SOL_SOCKET, SO_REUSEPORT, &reuse, sizeof reuse) 
+            == 0, "SO_REUSEPORT");
+   }
+   log_info("%s listening on %s port %d", name, host, port);
+   check(bind(fd, address->ai_addr, address->ai_addrlen) == 0,
+         "bind %s %d", host, port);
+   check(listen(fd, SOMAXCONN) == 0, "listen");
+   freeaddrinfo(address);
+
+   return fd;
+
+error:
+   if (fd != -1) close(fd);
+   if (address != NULL) freeaddrinfo(address);
+   return -1;
+}
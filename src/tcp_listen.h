@@ -0,0 +1,22 @@
+/*----------------------------------------------------------------------------
+ * tcp_listen.h
+ * 
+ * listening TCP sockets for the front ends that don't speak zeromq
+ *--------------------------------------------------------------------------*/
+#if !defined(__TCP_LISTEN_H__)
+#define __TCP_LISTEN_H__
+
+#include <stdbool.h>
+
+// the address front ends listen on by default: they don't authenticate
+// clients, so local only
+#define DEFAULT_LISTEN_ADDRESS "127.0.0.1"
+
+// a non blocking socket listening on host (NULL for 
+// DEFAULT_LISTEN_ADDRESS) and port; name is for the log
+// with reuse_port, the old and new process of a handoff can both listen
+// return the fd, -1 for failure
+extern int
+tcp_listen(const char * name, const char * host, int port, bool reuse_port);
+
+#endif // !defined(__TCP_LISTEN_H__)
@@ -0,0 +1,415 @@
+/*----------------------------------------------------------------------------
+ * timer_wheel.c
+ *
+ * every timer we need, on one CLOCK_MONOTONIC timerfd: a hierarchical
+ * timing wheel of millisecond ticks, with O(1) schedule and cancel
+ *
+ * A timer goes in the lowest level whose span covers its delay, in the
+ * slot for its expiry at that level's resolution. When the ticks reach a
+ * slot's turn in a higher level, its timers cascade down, and they expire
+ * from level 0. We don't visit idle ticks: the timerfd is armed for the
+ * next slot that has timers, and we jump straight to it.
+ *--------------------------------------------------------------------------*/
+#include <errno.h>
+#include <sys/timerfd.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "dbg_syslog.h"
+#include "timer_wheel.h"
+
+#define SLOT_MASK (TIMER_WHEEL_SLOTS - 1)
+
+// the furthest out we can place a timer, from the top level
+#define MAX_DELTA ((1ULL << (TIMER_WHEEL_LEVELS * TIMER_WHEEL_BITS)) - 1)
+
+//----------------------------------------------------------------------------
+// the current CLOCK_MONOTONIC time in milliseconds
+uint64_t
+timer_wheel_clock(void) {
+//----------------------------------------------------------------------------
+   struct timespec now;
+
+   clock_gettime(CLOCK_MONOTONIC, &now);
+   return (uint64_t) now.tv_sec * 1000 + now.tv_nsec / 1000000;
+}
+
+//----------------------------------------------------------------------------
+static bool
+slot_empty(const struct Timer * head) {
+//----------------------------------------------------------------------------
+   return head->next == head;
+}
+
+//----------------------------------------------------------------------------
+static void
+unlink_timer(struct Timer * timer) {
+//----------------------------------------------------------------------------
+   timer->prev->next = timer->next;
+   timer->next->prev = timer->prev;
+   timer->prev = timer;
+   timer->next = timer;
+}
+
+//----------------------------------------------------------------------------
+static void
+append_timer(struct Timer * head, struct Timer * timer) {
+//----------------------------------------------------------------------------
+   timer->prev = head->prev;
+   timer->next = head;
+   head->prev->next = timer;
+   head->prev = timer;
+}
+
+//----------------------------------------------------------------------------
+// move the timers of head to the empty list new_head
+static void
+take_slot(struct Timer * head, struct Timer * new_head) {
+//----------------------------------------------------------------------------
+   new_head->prev = new_head;
+   new_head->next = new_head;
+   if (!slot_empty(head)) {
+      new_head->next = head->next;
+      new_head->prev = head->prev;
+      new_head->next->prev = new_head;
+      new_head->prev->next = new_head;
+      head->prev = head;
+      head->next = head;
+   }
+}
+
+//----------------------------------------------------------------------------
+// put the timer in the slot for timer->expires, which is not before the
+// wheel's tick
+static void
+place_timer(struct TimerWheel * wheel, struct Timer * timer) {
+//----------------------------------------------------------------------------
+   uint64_t delta = timer->expires - wheel->now;
+   uint64_t expires = timer->expires;
+   int level = 0;
+   int slot;
+
+   if (delta > MAX_DELTA) {
+      // wait in the top level, and come round again
+      expires = wheel->now + MAX_DELTA;
+      delta = MAX_DELTA;
+   }
+   while (level < TIMER_WHEEL_LEVELS - 1 &&
+          delta >= (1ULL << ((level + 1) * TIMER_WHEEL_BITS))) {
+      level++;
+   }
+
+   slot = (expires >> (level * TIMER_WHEEL_BITS)) & SLOT_MASK;
+   append_timer(&wheel->slots[level][slot], timer);
+   wheel->timer_qty++;
+}
+
+//----------------------------------------------------------------------------
+// the next tick after the wheel's with something to do: timers to expire
+// or to cascade down
+// return the tick, 0 if there are no timers
+static uint64_t
+next_tick(const struct TimerWheel * wheel) {
+//----------------------------------------------------------------------------
+   uint64_t next = 0;
+   uint64_t tick;
+   uint64_t turn;
+   int level;
+   int i;
+
+   if (wheel->timer_qty == 0) {
+      return 0;
+   }
+
+   for (level=0; level < TIMER_WHEEL_LEVELS; level++) {
+      turn = wheel->now >> (level * TIMER_WHEEL_BITS);
+      // a timer in the top level may be a whole turn away
+      for (i=1; i <= TIMER_WHEEL_SLOTS; i++) {
+         if (!slot_empty(&wheel->slots[level][(turn + i) & SLOT_MASK])) {
+            tick = (turn + i) << (level * TIMER_WHEEL_BITS);
+            if (next == 0 || tick < next) {
+               next = tick;
+            }
+            break;
+         }
+      }
+      // the levels above have nothing before their next turn
+      turn = wheel->now >> ((level + 1) * TIMER_WHEEL_BITS);
+      if (next != 0 &&
+          next <= ((turn + 1) << ((level + 1) * TIMER_WHEEL_BITS))) {
+         break;
+      }
+   }
+
+   return next;
+}
+
+//----------------------------------------------------------------------------
+// arm the timerfd for the tick (late by up to the slack), or disarm it 
+// for 0
+// return 0 for success, -1 for failure
+static int
+arm_timer_wheel(struct TimerWheel * wheel, uint64_t tick) {
+//----------------------------------------------------------------------------
+   struct itimerspec timer_value;
+
+   if (tick != 0 && wheel->slack > 1) {
+      tick = ((tick + wheel->slack - 1) / wheel->slack) * wheel->slack;
+   }
+   if (tick == wheel->armed) {
+      return 0;
+   }
+
+   timer_value.it_interval.tv_sec = 0;
+   timer_value.it_interval.tv_nsec = 0;
+   timer_value.it_value.tv_sec = tick / 1000;
+   timer_value.it_value.tv_nsec = (tick % 1000) * 1000000L;
+   check(timerfd_settime(wheel->fd, TFD_TIMER_ABSTIME, &timer_value, NULL)
+         == 0, "timerfd_settime");
+   wheel->armed = tick;
+
+   return 0;
+
+error:
+   return -1;
+}
+
+//----------------------------------------------------------------------------
+// cascade the timers whose turn has come in the levels above, then run
+// the ones expiring at the wheel's tick, on the way to the tick until
+// return 0 for success, -1 for failure
+static int
+run_tick(struct TimerWheel * wheel, uint64_t until) {
+//----------------------------------------------------------------------------
+   struct Timer pending;
+   struct Timer * timer;
+   int shift;
+   int level;
+
+   for (level=TIMER_WHEEL_LEVELS - 1; level > 0; level--) {
+      shift = level * TIMER_WHEEL_BITS;
+      if ((wheel->now & ((1ULL << shift) - 1)) != 0) {
+         continue;
+      }
+      take_slot(&wheel->slots[level][(wheel->now >> shift) & SLOT_MASK],
+                &pending);
+      while (!slot_empty(&pending)) {
+         timer = pending.next;
+         unlink_timer(timer);
+         wheel->timer_qty--;
+         place_timer(wheel, timer);
+      }
+   }
+
+   // a callback may cancel the timers waiting behind it
+   take_slot(&wheel->slots[0][wheel->now & SLOT_MASK], &pending);
+   while (!slot_empty(&pending)) {
+      timer = pending.next;
+      unlink_timer(timer);
+      wheel->timer_qty--;
+      if (timer->period > 0) {
+         timer->expires += timer->period;
+         // we fell behind: skip what we missed, rather than run it again
+         // for every period on the way to until
+         if (timer->expires < until) {
+            timer->expires += (until - timer->expires + timer->period - 1) /
+                              timer->period * timer->period;
+         }
+         place_timer(wheel, timer);
+      } else {
+         timer->expires = 0;
+      }
+      if (timer->callback(timer) != 0) {
+         // don't leave the rest on our stack
+         while (!slot_empty(&pending)) {
+            timer = pending.next;
+            unlink_timer(timer);
+            wheel->timer_qty--;
+            timer->expires = wheel->now + 1;
+            place_timer(wheel, timer);
+         }
+         sentinel("timer callback");
+      }
+   }
+
+   return 0;
+
+error:
+   return -1;
+}
+
+//----------------------------------------------------------------------------
+// create the timerfd, with no timers, firing on a grid of slack 
+// milliseconds
+// return 0 for success, -1 for failure
+int
+start_timer_wheel(struct TimerWheel * wheel, uint64_t slack) {
+//----------------------------------------------------------------------------
+   int level;
+   int i;
+
+   for (level=0; level < TIMER_WHEEL_LEVELS; level++) {
+      for (i=0; i < TIMER_WHEEL_SLOTS; i++) {
+         wheel->slots[level][i].prev = &wheel->slots[level][i];
+         wheel->slots[level][i].next = &wheel->slots[level][i];
+      }
+   }
+   wheel->timer_qty = 0;
+   wheel->now = timer_wheel_clock();
+   wheel->armed = 0;
+   wheel->slack = slack;
+
+   wheel->fd = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC | TFD_NONBLOCK);
+   check(wheel->fd != -1, "timerfd_create");
+
+   return 0;
+
+error:
+   return -1;
+}
+
+//----------------------------------------------------------------------------
+void
+clear_timer_wheel(struct TimerWheel * wheel) {
+//----------------------------------------------------------------------------
+   if (wheel->fd != -1) close(wheel->fd);
+   wheel->fd = -1;
+}
+
+//----------------------------------------------------------------------------
+void
+initialize_timer(struct Timer * timer,
+                 timer_callback callback,
+                 void * context) {
+//----------------------------------------------------------------------------
+   timer->expires = 0;
+   timer->period = 0;
+   timer->callback = callback;
+   timer->context = context;
+   timer->prev = timer;
+   timer->next = timer;
+}
+
+//----------------------------------------------------------------------------
+// (re)schedule the timer to expire after delay milliseconds, then every
+// period milliseconds
+// return 0 for success, -1 for failure
+int
+schedule_timer(struct TimerWheel * wheel,
+               struct Timer * timer,
+               uint64_t delay,
+               uint64_t period) {
+//----------------------------------------------------------------------------
+   return schedule_timer_at(wheel, 
+                            timer, 
+                            timer_wheel_clock() + delay, 
+                            period);
+}
+
+//----------------------------------------------------------------------------
+// (re)schedule the timer to expire at the monotonic millisecond expires,
+// then every period milliseconds
+// return 0 for success, -1 for failure
+int
+schedule_timer_at(struct TimerWheel * wheel,
+                  struct Timer * timer,
+                  uint64_t expires,
+                  uint64_t period) {
+//----------------------------------------------------------------------------
+   cancel_timer(wheel, timer);
+
+   timer->expires = expires;
+   // the current tick has run
+   if (timer->expires <= wheel->now) {
+      timer->expires = wheel->now + 1;
+   }
+   timer->period = period;
+   place_timer(wheel, timer);
+
+   // an earlier tick than we are armed for (on the slack's grid, it may
+   // be where we are armed already); the timerfd fires late if we arm it
+   // for the expiry, not the cascade before, but that's fine: we run
+   // every tick up to the time it fires
+   if (wheel->armed == 0 || timer->expires < wheel->armed) {
+      check(arm_timer_wheel(wheel, timer->expires) == 0, "arm_timer_wheel");
+   }
+
+   return 0;
+
+error:
+   return -1;
+}
+
+//----------------------------------------------------------------------------
+// stop the timer, if it is scheduled
+// the timerfd may still fire for it, and find nothing to do
+void
+cancel_timer(struct TimerWheel * wheel, struct Timer * timer) {
+//----------------------------------------------------------------------------
+   if (timer->expires == 0) {
+      return;
+   }
+   unlink_timer(timer);
+   wheel->timer_qty--;
+   timer->expires = 0;
+}
+
+//----------------------------------------------------------------------------
+bool
+timer_scheduled(const struct Timer * timer) {
+//----------------------------------------------------------------------------
+   return timer->expires != 0;
+}
+
+//----------------------------------------------------------------------------
+// run the wheel up to the monotonic millisecond now, jumping over the
+// ticks with nothing to do; this doesn't touch the timerfd
+// return 0 for success, -1 for failure
+int
+advance_timer_wheel(struct TimerWheel * wheel, uint64_t now) {
+//----------------------------------------------------------------------------
+   uint64_t tick;
+
+   while (wheel->now < now) {
+      tick = next_tick(wheel);
+      if (tick == 0 || tick > now) {
+         wheel->now = now;
+         break;
+      }
+      wheel->now = tick;
+      check(run_tick(wheel, now) == 0, "run_tick");
+   }
+
+   return 0;
+
+error:
+   return -1;
+}
+
+//----------------------------------------------------------------------------
+// the timerfd fired: run the timers that are due, and re-arm it
+// return 0 for success, -1 for failure
+int
+run_timer_wheel(struct TimerWheel * wheel) {
+//----------------------------------------------------------------------------
+   uint64_t expiration_count;
+
+   // we may be here for a timer that was cancelled, or early
+   if (read(wheel->fd, &expiration_count, sizeof(expiration_count)) == -1) {
+      check(errno == EAGAIN, "read timerfd");
+   }
+   // the timerfd is disarmed once it has fired
+   wheel->armed = 0;
+
+   check(advance_timer_wheel(wheel, timer_wheel_clock()) == 0,
+         "advance_timer_wheel");
+
+   check(arm_timer_wheel(wheel, next_tick(wheel)) == 0, "arm_timer_wheel");
+
+   return 0;
+
+error:
+   // we will be back
+   arm_timer_wheel(wheel, next_tick(wheel));
+   return -1;
+}
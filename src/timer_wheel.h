@@ -0,0 +1,109 @@
+/*----------------------------------------------------------------------------
+ * timer_wheel.h
+ *
+ * every timer we need, on one CLOCK_MONOTONIC timerfd: a hierarchical
+ * timing wheel of millisecond ticks, with O(1) schedule and cancel
+ *--------------------------------------------------------------------------*/
+#if !defined(__TIMER_WHEEL_H__)
+#define __TIMER_WHEEL_H__
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// 4 levels of 256 slots: level 0 has a slot per millisecond, each level
+// above a slot per turn of the level below, so the wheel spans 2^32 ms
+// (49 days). Timers further out wait in the top level and come round.
+#define TIMER_WHEEL_LEVELS 4
+#define TIMER_WHEEL_BITS 8
+#define TIMER_WHEEL_SLOTS (1 << TIMER_WHEEL_BITS)
+
+struct Timer;
+
+// called when the timer expires; the timer may be scheduled again (or
+// cancelled, if it repeats) and other timers scheduled or cancelled
+// return 0 for success, -1 for failure
+typedef int (* timer_callback)(struct Timer * timer);
+
+struct Timer {
+   // monotonic milliseconds when due, 0 while not scheduled
+   uint64_t expires;
+   // milliseconds between expirations, 0 for a one-shot timer
+   uint64_t period;
+   timer_callback callback;
+   void * context;
+
+   // in a slot's list
+   struct Timer * prev;
+   struct Timer * next;
+};
+
+struct TimerWheel {
+   // CLOCK_MONOTONIC timerfd, armed for the next tick with work to do
+   int fd;
+   // the tick (monotonic millisecond) we have run the wheel up to
+   uint64_t now;
+   // what fd is armed for, 0 when it is disarmed
+   uint64_t armed;
+   // the fd fires on a grid of this many milliseconds, so timers close
+   // together expire in one wakeup; 0 or 1 for every millisecond
+   uint64_t slack;
+   // each slot is the head of a circular list
+   struct Timer slots[TIMER_WHEEL_LEVELS][TIMER_WHEEL_SLOTS];
+   int timer_qty;
+};
+
+// the current CLOCK_MONOTONIC time in milliseconds
+extern uint64_t
+timer_wheel_clock(void);
+
+// create the timerfd, with no timers, firing on a grid of slack 
+// milliseconds
+// return 0 for success, -1 for failure
+extern int
+start_timer_wheel(struct TimerWheel * wheel, uint64_t slack);
+
+// close the timerfd, the timers are left to their owners
+extern void
+clear_timer_wheel(struct TimerWheel * wheel);
+
+// a timer that is not scheduled
+extern void
+initialize_timer(struct Timer * timer, timer_callback callback, void * context);
+
+// (re)schedule the timer to expire after delay milliseconds, then every
+// period milliseconds (0 for once)
+// return 0 for success, -1 for failure
+extern int
+schedule_timer(struct TimerWheel * wheel,
+               struct Timer * timer,
+               uint64_t delay,
+               uint64_t period);
+
+// (re)schedule the timer to expire at the monotonic millisecond expires,
+// then every period milliseconds (0 for once)
+// return 0 for success, -1 for failure
+extern int
+schedule_timer_at(struct TimerWheel * wheel,
+                  struct Timer * timer,
+                  uint64_t expires,
+                  uint64_t period);
+
+// stop the timer, if it is scheduled
+extern void
+cancel_timer(struct TimerWheel * wheel, struct Timer * timer);
+
+extern bool
+timer_scheduled(const struct Timer * timer);
+
+// run the wheel up to the monotonic millisecond now, without touching
+// the timerfd
+// return 0 for success, -1 for failure
+extern int
+advance_timer_wheel(struct TimerWheel * wheel, uint64_t now);
+
+// the timerfd fired: run the timers that are due, and re-arm it
+// return 0 for success, -1 for failure
+extern int
+run_timer_wheel(struct TimerWheel * wheel);
+
+#endif // !defined(__TIMER_WHEEL_H__)
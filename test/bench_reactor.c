@@ -0,0 +1,177 @@
+/*----------------------------------------------------------------------------
+ * bench_reactor.c
+ * 
+ * the cost of dispatching an event: <fds> eventfds that are always 
+ * readable, each with a callback that only counts, dispatched <rounds> 
+ * times
+ *
+ * usage: test/bench_reactor raw|epoll|io_uring [fds [rounds]]
+ *    raw is a bare epoll_wait loop calling a function pointer stored in
+ *    data.ptr, the shape of the loop before the reactor; epoll and 
+ *    io_uring are the reactor's backends
+ *
+ * prints one line of key=value pairs; ns_per_event is the wall time over
+ * the events dispatched
+ *--------------------------------------------------------------------------*/
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "reactor.h"
+
+typedef void (* raw_callback)(void);
+
+static uint64_t dispatched = 0;
+
+//----------------------------------------------------------------------------
+static uint64_t
+now_ns(void) {
+//----------------------------------------------------------------------------
+   struct timespec now;
+
+   clock_gettime(CLOCK_MONOTONIC, &now);
+   return (uint64_t) now.tv_sec * 1000000000 + now.tv_nsec;
+}
+
+//----------------------------------------------------------------------------
+static void
+raw_count(void) {
+//----------------------------------------------------------------------------
+   dispatched++;
+}
+
+//----------------------------------------------------------------------------
+static int
+reactor_count(struct ReactorHandler * handler, uint32_t events) {
+//----------------------------------------------------------------------------
+   (void) handler;
+   (void) events;
+   dispatched++;
+   return 0;
+}
+
+//----------------------------------------------------------------------------
+// the loop before the reactor: epoll_wait, and a function pointer in
+// data.ptr
+static int
+run_raw(const int * fds, int fd_qty, int rounds) {
+//----------------------------------------------------------------------------
+   struct epoll_event * events = calloc(fd_qty, sizeof(struct epoll_event));
+   struct epoll_event event;
+   int epoll_fd = epoll_create1(0);
+   int event_qty;
+   int i;
+
+   if (events == NULL || epoll_fd == -1) return -1;
+   for (i=0; i < fd_qty; i++) {
+      event.events = EPOLLIN;
+      event.data.ptr = (void *) raw_count;
+      if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fds[i], &event) != 0) return -1;
+   }
+   while (rounds-- > 0) {
+      event_qty = epoll_wait(epoll_fd, events, fd_qty, -1);
+      if (event_qty == -1) return -1;
+      for (i=0; i < event_qty; i++) {
+         ((raw_callback) events[i].data.ptr)();
+      }
+   }
+   close(epoll_fd);
+   free(events);
+   return 0;
+}
+
+//----------------------------------------------------------------------------
+static int
+run_reactor(enum REACTOR_BACKEND backend, 
+            const int * fds, 
+            int fd_qty, 
+            int rounds) {
+//----------------------------------------------------------------------------
+   struct ReactorHandler * handlers;
+   struct Reactor reactor;
+   int i;
+
+   handlers = calloc(fd_qty, sizeof(struct ReactorHandler));
+   if (handlers == NULL) return -1;
+   if (start_reactor(&reactor, backend, fd_qty) != 0) return -1;
+   if (backend == REACTOR_IO_URING && reactor.uring == NULL) {
+      fprintf(stderr, "no io_uring: built without WITH_IO_URING, or the "
+              "kernel refused it\n");
+      return -1;
+   }
+   for (i=0; i < fd_qty; i++) {
+      initialize_reactor_handler(&handlers[i], reactor_count, NULL);
+      if (reactor_add(&reactor, &handlers[i], fds[i], EPOLLIN) != 0) {
+         return -1;
+      }
+   }
+   // the first round with io_uring only submits the polls
+   while (dispatched < (uint64_t) fd_qty * rounds) {
+      if (reactor_dispatch(&reactor, -1) == -1) return -1;
+   }
+   for (i=0; i < fd_qty; i++) {
+      reactor_remove(&reactor, &handlers[i]);
+   }
+   clear_reactor(&reactor);
+   free(handlers);
+   return 0;
+}
+
+//----------------------------------------------------------------------------
+int
+main(int argc, char ** argv) {
+//----------------------------------------------------------------------------
+   const char * mode = argc > 1 ? argv[1] : "epoll";
+   int fd_qty = argc > 2 ? atoi(argv[2]) : 64;
+   int rounds = argc > 3 ? atoi(argv[3]) : 100000;
+   uint64_t one = 1;
+   uint64_t start;
+   uint64_t elapsed;
+   int * fds;
+   int result;
+   int i;
+
+   fds = calloc(fd_qty, sizeof(int));
+   if (fds == NULL || fd_qty < 1 || rounds < 1) {
+      fprintf(stderr, "usage: %s raw|epoll|io_uring [fds [rounds]]\n", 
+              argv[0]);
+      return 1;
+   }
+   for (i=0; i < fd_qty; i++) {
+      fds[i] = eventfd(0, EFD_NONBLOCK);
+      if (fds[i] == -1 || write(fds[i], &one, sizeof one) != sizeof one) {
+         perror("eventfd");
+         return 1;
+      }
+   }
+
+   start = now_ns();
+   if (strcmp(mode, "raw") == 0) {
+      result = run_raw(fds, fd_qty, rounds);
+   } else if (strcmp(mode, "epoll") == 0) {
+      result = run_reactor(REACTOR_EPOLL, fds, fd_qty, rounds);
+   } else if (strcmp(mode, "io_uring") == 0) {
+      result = run_reactor(REACTOR_IO_URING, fds, fd_qty, rounds);
+   } else {
+      fprintf(stderr, "unknown mode '%s'\n", mode);
+      return 1;
+   }
+   elapsed = now_ns() - start;
+   if (result != 0) {
+      perror(mode);
+      return 1;
+   }
+
+   printf("mode=%s;fds=%d;rounds=%d;events=%llu;ns_per_event=%.1f\n",
+          mode, 
+          fd_qty, 
+          rounds, 
+          (unsigned long long) dispatched,
+          (double) elapsed / dispatched);
+   return 0;
+}
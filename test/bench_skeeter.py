@@ -0,0 +1,592 @@
+# -*- coding: utf-8 -*-
+"""
+bench_skeeter.py
+
+Load a running skeeter with notifications and report what a subscriber
+saw: throughput, latency percentiles, bytes on the wire and the CPU time
+skeeter spent.
+
+The producer NOTIFYs from its own database connection. Every payload is
+JSON that starts with the producer's clock
+
+    {"sent_us": <microseconds since the epoch>, ...
+
+padded to --size bytes with rows that look like a table's, so latency is
+measured from just before the commit to the subscriber, and compression
+sees a representative payload. (skeeter measures the database's share
+itself with channel-<name>-producer_timestamp=sent_us.)
+
+With --transport the subscribers are --clients connections to one of
+skeeter's other front ends instead of one zeromq SUB socket: pg_proxy
+(Postgres protocol, LISTEN), sse (HTTP server-sent events) or resp 
+(Redis SUBSCRIBE). Every client gets every notification, so
+received counts deliveries: --count times --clients.
+
+With --gateway the producers PUSH (channel, payload) to skeeter's
+gateway_uri instead, and skeeter NOTIFYs for them.
+
+With --scrape a Prometheus stand-in GETs /metrics from metrics_port that
+many times a second while the notifications flow.
+
+usage:
+    PYTHONPATH=. python3 test/bench_skeeter.py -c <skeeterrc> \\
+        --pid $(pidof skeeter) --count 20000 --rate 5000 --size 4000
+
+The report is one line of key=value pairs:
+    sent, received, lost: notifications, and sequence numbers we never saw
+    seconds, rate: from the first send to the last receive
+    p50_us, p99_us, p999_us, max_us: commit to subscriber latency
+    wire_bytes: the frames as received, data_bytes: the payloads
+    cpu_ms, cpu_us_per_message: skeeter's user + system time (with --pid)
+    backends: the most client backends Postgres had during the run, 
+        ours and skeeter's, less the one that counts them
+    scrapes, scrape_ms, scrape_bytes: with --scrape, the GETs of 
+        /metrics, the average time each took and the size of the last
+"""
+import argparse
+import json
+import logging
+import os
+import random
+import re
+import selectors
+import socket
+import struct
+import sys
+import threading
+import time
+import urllib.request
+
+import psycopg2
+import zmq
+
+from test.config import load_config
+
+_sent_us_re = re.compile(rb'"sent_us": (\d+)')
+_payload_variants = 64
+
+def _initialize_logging():
+    handler = logging.StreamHandler()
+    formatter = logging.Formatter(
+        '%(asctime)s %(levelname)-8s %(name)-20s: %(message)s')
+    handler.setFormatter(formatter)
+    logging.root.addHandler(handler)
+    logging.root.setLevel(logging.INFO)
+
+def _parse_args():
+    parser = argparse.ArgumentParser(description=__doc__.split("\n")[3])
+    parser.add_argument("-c", "--config", required=True,
+                        help="the skeeterrc skeeter is running with")
+    parser.add_argument("--pid", type=int,
+                        help="skeeter's pid, to report its cpu time")
+    parser.add_argument("--channel", default=None,
+                        help="channel to notify (default the first)")
+    parser.add_argument("--count", type=int, default=10000,
+                        help="notifications to send")
+    parser.add_argument("--rate", type=float, default=0.0,
+                        help="notifications per second, 0 for flat out")
+    parser.add_argument("--size", type=int, default=1000,
+                        help="payload size in bytes (NOTIFY allows 8000)")
+    parser.add_argument("--per-commit", type=int, default=1,
+                        help="notifications in each transaction")
+    parser.add_argument("--producers", type=int, default=1,
+                        help="producer threads, each with its own "
+                        "connection or PUSH socket")
+    parser.add_argument("--gateway", action="store_true",
+                        help="send through skeeter's gateway_uri")
+    parser.add_argument("--transport", default="zmq",
+                        choices=["zmq", "pg_proxy", "sse", "resp"],
+                        help="how the subscribers connect")
+    parser.add_argument("--clients", type=int, default=1,
+                        help="subscriber connections (not zmq)")
+    parser.add_argument("--scrape", type=float, default=0.0,
+                        help="GETs of /metrics per second, 0 for none")
+    parser.add_argument("--timeout", type=float, default=5.0,
+                        help="seconds to wait for stragglers")
+    return parser.parse_args()
+
+def _now_us():
+    return int(time.time() * 1000000)
+
+def _payload_body(size, rng):
+    """
+    the part of a payload after the timestamp: rows with the same keys and
+    varying values, like a trigger's row_to_json
+    """
+    rows = list()
+    body = ""
+    while len(body) < size:
+        rows.append({
+            "id": rng.randint(1, 10**9),
+            "account": "acct-{0:08d}".format(rng.randint(0, 10**6)),
+            "status": rng.choice(["new", "open", "filled", "cancelled"]),
+            "price": round(rng.uniform(1, 1000), 2),
+            "quantity": rng.randint(1, 5000),
+            "updated_at": "2024-05-{0:02d}T{1:02d}:{2:02d}:{3:02d}Z".format(
+                rng.randint(1, 28), rng.randint(0, 23),
+                rng.randint(0, 59), rng.randint(0, 59)),
+        })
+        body = json.dumps({"table": "orders", "op": "UPDATE", "rows": rows})
+    # leave room for the timestamp
+    return body[1:max(size - 32, 2)]
+
+def _make_payloads(size):
+    rng = random.Random(size)
+    return [_payload_body(size, rng) for _ in range(_payload_variants)]
+
+def _cpu_ms(pid):
+    """
+    user + system time of every thread of pid, in milliseconds
+    """
+    if pid is None:
+        return 0.0
+    with open("/proc/{0}/stat".format(pid)) as stat_file:
+        fields = stat_file.read().rsplit(")", 1)[1].split()
+    ticks = int(fields[11]) + int(fields[12])
+    return ticks * 1000.0 / os.sysconf("SC_CLK_TCK")
+
+def _produce(args, config, channel, index, ready_event, result):
+    """
+    NOTIFY this producer's share of args.count payloads on channel, at its
+    share of args.rate
+    """
+    log = logging.getLogger("produce-{0}".format(index))
+    payloads = _make_payloads(args.size)
+    count = args.count // args.producers
+    if index < args.count % args.producers:
+        count += 1
+    rate = args.rate / args.producers
+    if args.gateway:
+        push_socket = zmq.Context.instance().socket(zmq.PUSH)
+        push_socket.setsockopt(zmq.SNDHWM, 0)
+        push_socket.connect(config["gateway_uri"])
+        channel_frame = channel.encode("utf-8")
+    else:
+        connection = psycopg2.connect(**config["database-credentials"])
+        connection.autocommit = True
+        cursor = connection.cursor()
+    ready_event.wait()
+
+    start = time.time()
+    sent = 0
+    while sent < count:
+        batch = list()
+        for i in range(min(args.per_commit, count - sent)):
+            batch.append('{{"sent_us": {0}, {1}'.format(
+                _now_us(), payloads[(sent + i) % _payload_variants]))
+        if args.gateway:
+            for payload in batch:
+                push_socket.send_multipart(
+                    [channel_frame, payload.encode("utf-8")])
+        else:
+            cursor.execute("SELECT pg_notify(%s, p) FROM unnest(%s) p",
+                           [channel, batch])
+        sent += len(batch)
+        if rate > 0:
+            delay = start + sent / rate - time.time()
+            if delay > 0:
+                time.sleep(delay)
+
+    result[index] = sent
+    log.info("sent {0} in {1:.3f}s".format(sent, time.time() - start))
+    if args.gateway:
+        push_socket.close(linger=-1)
+    else:
+        connection.close()
+
+def _count_backends(config, done_event, result):
+    """
+    sample the number of client backends until done_event is set
+    """
+    connection = psycopg2.connect(**config["database-credentials"])
+    connection.autocommit = True
+    cursor = connection.cursor()
+    result["backends"] = 0
+    while not done_event.wait(0.1):
+        cursor.execute("SELECT count(*) FROM pg_stat_activity "
+                       "WHERE backend_type = 'client backend'")
+        (count, ) = cursor.fetchone()
+        result["backends"] = max(result["backends"], count - 1)
+    connection.close()
+
+def _scrape_metrics(args, config, done_event, result):
+    """
+    GET /metrics args.scrape times a second until done_event is set
+    """
+    url = "http://{0}:{1}/metrics".format(
+        config.get("metrics_address", "127.0.0.1"), config["metrics_port"])
+    interval = 1.0 / args.scrape
+    result["scrapes"] = 0
+    result["scrape_seconds"] = 0.0
+    result["scrape_bytes"] = 0
+    while not done_event.wait(interval):
+        start = time.time()
+        with urllib.request.urlopen(url) as response:
+            body = response.read()
+        result["scrape_seconds"] += time.time() - start
+        result["scrapes"] += 1
+        result["scrape_bytes"] = len(body)
+
+def _parse_meta(meta):
+    meta_dict = dict()
+    for entry in meta.decode("utf-8").split(";"):
+        key, value = entry.split("=", 1)
+        meta_dict[key] = value
+    return meta_dict
+
+def _decompress(config, channel, meta_dict, data):
+    compression = meta_dict.get("compression")
+    if compression is None:
+        return data
+    size = int(meta_dict["uncompressed_size"])
+    if compression == "lz4":
+        import lz4.block
+        return lz4.block.decompress(data, uncompressed_size=size)
+    if compression == "zstd":
+        import zstandard
+        if "zstd_decompressor" not in config:
+            dictionary_path = config.get(
+                "channel-{0}-zstd_dictionary".format(channel))
+            dictionary = None
+            if dictionary_path is not None:
+                with open(dictionary_path, "rb") as dictionary_file:
+                    dictionary = zstandard.ZstdCompressionDict(
+                        dictionary_file.read())
+            config["zstd_decompressor"] = \
+                zstandard.ZstdDecompressor(dict_data=dictionary)
+        return config["zstd_decompressor"].decompress(data, 
+                                                      max_output_size=size)
+    raise ValueError("unknown compression {0}".format(compression))
+
+def _unpack_batch(data):
+    """
+    split a batch data frame into payloads: (meta, data) pairs, each
+    field prefixed by its 4 byte length in network byte order
+    """
+    payloads = list()
+    offset = 0
+    while offset < len(data):
+        for field in range(2):
+            (length, ) = struct.unpack_from("!I", data, offset)
+            offset += 4
+            if field == 1:
+                payloads.append(data[offset:offset+length])
+            offset += length
+    return payloads
+
+class _Stats(object):
+    def __init__(self):
+        self.received = 0
+        self.lost = 0
+        self.expected_sequence = None
+        self.latencies = list()
+        self.wire_bytes = 0
+        self.data_bytes = 0
+        self.last_receive = None
+
+    def record_payload(self, received_us, payload):
+        match = _sent_us_re.search(payload, 0, 64)
+        if match is not None:
+            self.latencies.append(received_us - int(match.group(1)))
+        self.received += 1
+        self.data_bytes += len(payload)
+        self.last_receive = time.time()
+
+    def record_sequence(self, sequence, count):
+        if self.expected_sequence is not None and \
+           sequence > self.expected_sequence:
+            self.lost += sequence - self.expected_sequence
+        self.expected_sequence = sequence + count
+
+def _receive_zmq(args, config, channel, stats, done_event):
+    sub_socket = zmq.Context.instance().socket(zmq.SUB)
+    sub_socket.setsockopt(zmq.RCVHWM, 0)
+    sub_socket.setsockopt(zmq.SUBSCRIBE, channel.encode("utf-8"))
+    sub_socket.connect(config["pub_socket_uri"])
+    sub_socket.RCVTIMEO = int(args.timeout * 1000)
+    # let the subscription reach skeeter
+    time.sleep(0.5)
+    yield
+
+    while stats.received < args.count:
+        try:
+            frames = sub_socket.recv_multipart(copy=True)
+        except zmq.Again:
+            if done_event.is_set():
+                break
+            continue
+        received_us = _now_us()
+        stats.wire_bytes += sum(len(frame) for frame in frames)
+        meta_dict = _parse_meta(frames[1])
+        if len(frames) < 3 or "control" in meta_dict:
+            continue
+        data = _decompress(config, channel, meta_dict, frames[2])
+        if "batch" in meta_dict:
+            payloads = _unpack_batch(data)
+        else:
+            payloads = [data, ]
+        stats.record_sequence(int(meta_dict["sequence"]), len(payloads))
+        for payload in payloads:
+            stats.record_payload(received_us, payload)
+
+    sub_socket.close()
+
+def _connect_clients(args, port, handshake):
+    """
+    open args.clients connections to port and send each the handshake,
+    without waiting for answers
+    """
+    host = "127.0.0.1"
+    clients = list()
+    for _ in range(args.clients):
+        client = socket.create_connection((host, port))
+        client.sendall(handshake)
+        client.setblocking(False)
+        clients.append(client)
+    return clients
+
+def _receive_clients(args, clients, parse, stats, done_event):
+    """
+    read from every client until we have every delivery, or the producers 
+    are done and the clients have been quiet for args.timeout
+
+    parse(buffer, received_us, stats) handles the complete messages in the
+    buffer and returns what is left
+    """
+    selector = selectors.DefaultSelector()
+    for client in clients:
+        selector.register(client, selectors.EVENT_READ, bytearray())
+    expected = args.count * len(clients)
+    quiet_since = None
+    yield
+
+    while stats.received < expected:
+        events = selector.select(timeout=0.1)
+        if len(events) == 0:
+            if done_event.is_set():
+                quiet_since = quiet_since or time.time()
+                if time.time() - quiet_since > args.timeout:
+                    break
+            continue
+        quiet_since = None
+        received_us = _now_us()
+        for key, _ in events:
+            data = key.fileobj.recv(256 * 1024)
+            if len(data) == 0:
+                raise IOError("skeeter closed a client")
+            stats.wire_bytes += len(data)
+            buffer = key.data
+            buffer.extend(data)
+            remainder = parse(buffer, received_us, stats)
+            del buffer[:len(buffer) - len(remainder)]
+
+    for client in clients:
+        client.close()
+
+def _parse_pg_messages(buffer, received_us, stats):
+    """
+    handle the NotificationResponse messages in a Postgres protocol stream
+    """
+    offset = 0
+    while len(buffer) - offset >= 5:
+        (length, ) = struct.unpack_from("!I", buffer, offset + 1)
+        if len(buffer) - offset < length + 1:
+            break
+        if buffer[offset:offset+1] == b"A":
+            body = bytes(buffer[offset+5:offset+1+length])
+            # process id, channel, payload
+            payload = body[4:].split(b"\0")[1]
+            stats.record_payload(received_us, payload)
+        offset += length + 1
+    return buffer[offset:]
+
+def _receive_pg_proxy(args, config, channel, stats, done_event):
+    startup_body = struct.pack("!I", 196608) + b"user\0bench\0\0"
+    startup = struct.pack("!I", len(startup_body) + 4) + startup_body
+    query = "LISTEN {0}".format(channel).encode("utf-8") + b"\0"
+    handshake = startup + b"Q" + struct.pack("!I", len(query) + 4) + query
+    clients = _connect_clients(args, int(config["pg_proxy_port"]), handshake)
+    # let the LISTENs reach skeeter
+    time.sleep(0.5 + args.clients / 1000.0)
+    return _receive_clients(args, clients, _parse_pg_messages, stats, 
+                            done_event)
+
+def _parse_sse_events(buffer, received_us, stats):
+    """
+    handle the events in a text/event-stream, after the HTTP response
+    header
+    """
+    offset = 0
+    if buffer.startswith(b"HTTP/"):
+        offset = buffer.find(b"\r\n\r\n")
+        if offset == -1:
+            return buffer
+        offset += 4
+    while True:
+        end = buffer.find(b"\n\n", offset)
+        if end == -1:
+            break
+        lines = bytes(buffer[offset:end]).split(b"\n")
+        data = [line[6:] for line in lines if line.startswith(b"data: ")]
+        if len(data) > 0:
+            stats.record_payload(received_us, b"\n".join(data))
+        offset = end + 2
+    return buffer[offset:]
+
+def _receive_sse(args, config, channel, stats, done_event):
+    request = "GET /{0} HTTP/1.1\r\nHost: bench\r\n\r\n".format(channel)
+    clients = _connect_clients(args, int(config["sse_port"]), 
+                               request.encode("utf-8"))
+    time.sleep(0.5 + args.clients / 1000.0)
+    return _receive_clients(args, clients, _parse_sse_events, stats, 
+                            done_event)
+
+def _parse_resp_messages(buffer, received_us, stats):
+    """
+    handle the message replies in a RESP stream: arrays of bulk strings,
+    the data last
+    """
+    offset = 0
+    while True:
+        line_end = buffer.find(b"\r\n", offset)
+        if line_end == -1:
+            break
+        items = list()
+        pos = line_end + 2
+        for _ in range(int(buffer[offset+1:line_end])):
+            line_end = buffer.find(b"\r\n", pos)
+            if line_end == -1:
+                return buffer[offset:]
+            if buffer[pos:pos+1] == b":":
+                items.append(None)
+                pos = line_end + 2
+                continue
+            length = int(buffer[pos+1:line_end])
+            pos = line_end + 2
+            if len(buffer) < pos + length + 2:
+                return buffer[offset:]
+            items.append(bytes(buffer[pos:pos+length]))
+            pos += length + 2
+        if len(items) > 0 and items[0] in (b"message", b"pmessage"):
+            stats.record_payload(received_us, items[-1])
+        offset = pos
+    return buffer[offset:]
+
+def _receive_resp(args, config, channel, stats, done_event):
+    command = "SUBSCRIBE {0}\r\n".format(channel)
+    clients = _connect_clients(args, int(config["resp_port"]), 
+                               command.encode("utf-8"))
+    time.sleep(0.5 + args.clients / 1000.0)
+    return _receive_clients(args, clients, _parse_resp_messages, stats, 
+                            done_event)
+
+_receivers = {
+    "zmq": _receive_zmq,
+    "pg_proxy": _receive_pg_proxy,
+    "sse": _receive_sse,
+    "resp": _receive_resp,
+}
+
+def _percentile(ordered, percentile):
+    if len(ordered) == 0:
+        return 0
+    index = int(percentile / 100.0 * len(ordered) + 0.5) - 1
+    return ordered[min(max(index, 0), len(ordered) - 1)]
+
+def _report(args, stats, produce_result, start, cpu_ms):
+    ordered = sorted(stats.latencies)
+    end = stats.last_receive or time.time()
+    seconds = end - start
+    fields = [
+        ("sent", sum(produce_result.get("sent", {}).values())),
+        ("received", stats.received),
+        ("lost", stats.lost),
+        ("seconds", "{0:.3f}".format(seconds)),
+        ("rate", "{0:.0f}".format(stats.received / seconds)),
+        ("p50_us", _percentile(ordered, 50)),
+        ("p99_us", _percentile(ordered, 99)),
+        ("p999_us", _percentile(ordered, 99.9)),
+        ("max_us", ordered[-1] if ordered else 0),
+        ("wire_bytes", stats.wire_bytes),
+        ("data_bytes", stats.data_bytes),
+        ("backends", produce_result.get("backends", 0)),
+    ]
+    if args.scrape > 0:
+        scrapes = produce_result.get("scrapes", 0)
+        fields.append(("scrapes", scrapes))
+        fields.append(("scrape_ms", "{0:.2f}".format(
+            produce_result.get("scrape_seconds", 0.0) * 1000.0 / 
+            max(scrapes, 1))))
+        fields.append(("scrape_bytes", produce_result.get("scrape_bytes", 0)))
+    if args.pid is not None:
+        fields.append(("cpu_ms", "{0:.0f}".format(cpu_ms)))
+        fields.append(("cpu_us_per_message", "{0:.1f}".format(
+            cpu_ms * 1000.0 / max(stats.received, 1))))
+    print(";".join("{0}={1}".format(key, value) for key, value in fields))
+
+def main():
+    """
+    main entry point
+
+    returns 0 for success
+            1 for failure
+    """
+    _initialize_logging()
+    log = logging.getLogger("main")
+    args = _parse_args()
+    config = load_config(args.config)
+    channel = args.channel or config["channels"][0]
+
+    stats = _Stats()
+    ready_event = threading.Event()
+    done_event = threading.Event()
+    produce_result = {"sent": dict()}
+
+    receiver = _receivers[args.transport](args, config, channel, stats, 
+                                          done_event)
+    next(receiver)
+
+    producers = list()
+    for index in range(args.producers):
+        producer = threading.Thread(target=_produce, args=(
+            args, config, channel, index, ready_event, produce_result["sent"]))
+        producer.start()
+        producers.append(producer)
+    counter = threading.Thread(target=_count_backends, args=(
+        config, done_event, produce_result))
+    counter.start()
+    scraper = None
+    if args.scrape > 0:
+        scraper = threading.Thread(target=_scrape_metrics, args=(
+            args, config, done_event, produce_result))
+        scraper.start()
+
+    def wait_for_producers():
+        for producer in producers:
+            producer.join()
+        done_event.set()
+    waiter = threading.Thread(target=wait_for_producers)
+    waiter.start()
+
+    cpu_start = _cpu_ms(args.pid)
+    start = time.time()
+    ready_event.set()
+    for _ in receiver:
+        pass
+    cpu_ms = _cpu_ms(args.pid) - cpu_start
+    waiter.join()
+    counter.join()
+    if scraper is not None:
+        scraper.join()
+
+    _report(args, stats, produce_result, start, cpu_ms)
+    sent = sum(produce_result["sent"].values())
+    if args.transport != "zmq":
+        sent *= args.clients
+    if stats.received < sent:
+        log.error("received {0} of {1}".format(stats.received, sent))
+        return 1
+    return 0
+
+if __name__ == "__main__":
+    sys.exit(main())
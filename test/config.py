@@ -14,13 +14,15 @@ class ConfigError(Exception):
 _default_path = os.path.expanduser("~/.skeeterrc")
 _postgresql_tag = "postgresql-"
 
-def load_config():
+def load_config(config_path=None):
     """
-    load the config file, either from a path specified on the comandline
-    or from the default location
+    load the config file, either from config_path, a path specified on 
+    the comandline or from the default location
     """
     log = logging.getLogger("load_config")
-    if len(sys.argv) == 1:
+    if config_path is not None:
+        pass
+    elif len(sys.argv) == 1:
         config_path = _default_path
     elif len(sys.argv) == 2:
         config_path = sys.argv[1]
@@ -0,0 +1,142 @@
+/*----------------------------------------------------------------------------
+ * socket_client.h
+ * 
+ * for the C tests of the TCP front ends: a config from a string, and a
+ * client socket to talk to a front end polled in the same thread
+ *--------------------------------------------------------------------------*/
+#if !defined(__SOCKET_CLIENT_H__)
+#define __SOCKET_CLIENT_H__
+
+#include <arpa/inet.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include "bstrlib.h"
+#include "config.h"
+
+// what a client got back from the front end
+struct Reply {
+   unsigned char data[256 * 1024];
+   size_t length;
+   // the front end closed the connection
+   bool closed;
+};
+
+// poll the front end once: return 0 for success, -1 for failure
+typedef int (* pump_function)(void * front_end, const struct Config * config);
+
+//----------------------------------------------------------------------------
+// load a config from text, through a temporary file
+// return NULL for failure
+static inline const struct Config *
+config_from_text(const char * text) {
+//----------------------------------------------------------------------------
+   char path[] = "/tmp/skeeter_test_rc_XXXXXX";
+   const struct Config * config = NULL;
+   bstring path_bstring = NULL;
+   FILE * stream;
+   int fd;
+
+   fd = mkstemp(path);
+   if (fd == -1) return NULL;
+   stream = fdopen(fd, "w");
+   if (stream != NULL) {
+      fputs(text, stream);
+      fclose(stream);
+      path_bstring = bfromcstr(path);
+      config = load_config(path_bstring);
+      bdestroy(path_bstring);
+   } else {
+      close(fd);
+   }
+   unlink(path);
+   return config;
+}
+
+//----------------------------------------------------------------------------
+// connect a non blocking client socket to a listening socket on this host
+// return the fd, -1 for failure
+static inline int
+connect_client(int listen_fd) {
+//----------------------------------------------------------------------------
+   struct sockaddr_in address;
+   socklen_t address_size = sizeof address;
+   int one = 1;
+   int fd;
+
+   if (getsockname(listen_fd, 
+                   (struct sockaddr *) &address, 
+                   &address_size) == -1) {
+      return -1;
+   }
+   fd = socket(AF_INET, SOCK_STREAM, 0);
+   if (fd == -1) return -1;
+   if (setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof one) == -1 ||
+       connect(fd, (struct sockaddr *) &address, address_size) == -1 ||
+       fcntl(fd, F_SETFL, O_NONBLOCK) == -1) {
+      close(fd);
+      return -1;
+   }
+   return fd;
+}
+
+//----------------------------------------------------------------------------
+// send size bytes (if any), then poll the front end and collect what it 
+// sends back until it has been quiet for a few rounds
+// return 0 for success, -1 for failure
+static inline int
+exchange(int fd, 
+         const void * data, 
+         size_t size,
+         pump_function pump,
+         void * front_end,
+         const struct Config * config,
+         struct Reply * reply) {
+//----------------------------------------------------------------------------
+   ssize_t received;
+   int quiet = 0;
+
+   reply->length = 0;
+   reply->closed = false;
+   if (size > 0 && send(fd, data, size, MSG_NOSIGNAL) != (ssize_t) size) {
+      return -1;
+   }
+   while (quiet < 10) {
+      if (pump(front_end, config) != 0) return -1;
+      usleep(1000);
+      received = recv(fd, 
+                      reply->data + reply->length, 
+                      sizeof reply->data - reply->length,
+                      MSG_DONTWAIT);
+      if (received > 0) {
+         reply->length += received;
+         quiet = 0;
+      } else if (received == 0 || 
+                 (errno != EAGAIN && errno != EWOULDBLOCK)) {
+         reply->closed = true;
+         break;
+      } else {
+         quiet++;
+      }
+   }
+   errno = 0;
+   return 0;
+}
+
+//----------------------------------------------------------------------------
+// true if the reply contains the bytes of text
+static inline bool
+reply_contains(const struct Reply * reply, const char * text) {
+//----------------------------------------------------------------------------
+   return memmem(reply->data, reply->length, text, strlen(text)) != NULL;
+}
+
+#endif // !defined(__SOCKET_CLIENT_H__)
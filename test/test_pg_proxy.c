@@ -0,0 +1,522 @@
+/*----------------------------------------------------------------------------
+ * test_pg_proxy.c
+ * 
+ * the Postgres protocol front end: message framing, and what it makes of
+ * truncated, oversized and malformed messages
+ *--------------------------------------------------------------------------*/
+#define _GNU_SOURCE
+#include <stdint.h>
+#include <string.h>
+
+#include "pg_proxy.h"
+#include "socket_client.h"
+#include "unit_test.h"
+
+static const char * CONFIG_TEXT = 
+   "channels=channel1,channel2\n"
+   "pg_proxy_max_output=4096\n";
+
+static const struct Config * config;
+
+//----------------------------------------------------------------------------
+static int
+pump(void * front_end, const struct Config * config) {
+//----------------------------------------------------------------------------
+   return pg_proxy_handle_events(front_end, config);
+}
+
+//----------------------------------------------------------------------------
+static void
+put_uint32(unsigned char * data, uint32_t value) {
+//----------------------------------------------------------------------------
+   data[0] = value >> 24;
+   data[1] = value >> 16;
+   data[2] = value >> 8;
+   data[3] = value;
+}
+
+//----------------------------------------------------------------------------
+static uint32_t
+get_uint32(const unsigned char * data) {
+//----------------------------------------------------------------------------
+   return ((uint32_t) data[0] << 24) | ((uint32_t) data[1] << 16) |
+      ((uint32_t) data[2] << 8) | data[3];
+}
+
+//----------------------------------------------------------------------------
+// a startup message for protocol code, into data; return its size
+static size_t
+startup_message(unsigned char * data, uint32_t code) {
+//----------------------------------------------------------------------------
+   static const char parameters[] = "user\0test\0database\0test\0";
+   size_t size = 8 + sizeof parameters;
+
+   put_uint32(data, size);
+   put_uint32(data + 4, code);
+   memcpy(data + 8, parameters, sizeof parameters);
+   return size;
+}
+
+//----------------------------------------------------------------------------
+// a typed message with a NUL terminated string body; return its size
+static size_t
+string_message(unsigned char * data, char type, const char * text) {
+//----------------------------------------------------------------------------
+   size_t length = strlen(text) + 1;
+
+   data[0] = type;
+   put_uint32(data + 1, 4 + length);
+   memcpy(data + 5, text, length);
+   return 5 + length;
+}
+
+//----------------------------------------------------------------------------
+// the number of messages of type in the reply, skipping a leading SSL
+// answer; the body of the last one in *body
+static int
+count_messages(const struct Reply * reply, 
+               char type, 
+               const unsigned char ** body) {
+//----------------------------------------------------------------------------
+   size_t offset = 0;
+   uint32_t length;
+   int count = 0;
+
+   if (reply->length > 0 && reply->data[0] == 'N') offset = 1;
+   while (offset + 5 <= reply->length) {
+      length = get_uint32(reply->data + offset + 1);
+      if (length < 4 || offset + 1 + length > reply->length) break;
+      if (reply->data[offset] == type) {
+         count++;
+         if (body != NULL) *body = reply->data + offset + 5;
+      }
+      offset += 1 + length;
+   }
+   return count;
+}
+
+//----------------------------------------------------------------------------
+// true if the reply ends with ReadyForQuery in the given status
+static bool
+ends_ready(const struct Reply * reply, char status) {
+//----------------------------------------------------------------------------
+   return reply->length >= 6 && 
+      memcmp(reply->data + reply->length - 6, "Z\0\0\0\5", 5) == 0 &&
+      reply->data[reply->length - 1] == status;
+}
+
+//----------------------------------------------------------------------------
+// true if the reply has an ErrorResponse with this SQLSTATE
+static bool
+has_error(const struct Reply * reply, const char * sqlstate) {
+//----------------------------------------------------------------------------
+   char field[8];
+
+   snprintf(field, sizeof field, "C%s", sqlstate);
+   return count_messages(reply, 'E', NULL) > 0 && 
+      memmem(reply->data, reply->length, field, strlen(field) + 1) != NULL;
+}
+
+//----------------------------------------------------------------------------
+// connect and get through startup; return the client fd
+static int
+start_client(struct PgProxy * proxy) {
+//----------------------------------------------------------------------------
+   unsigned char message[64];
+   struct Reply reply;
+   size_t size = startup_message(message, 196608);
+   int fd = connect_client(proxy->listen_fd);
+
+   if (fd == -1) return -1;
+   if (exchange(fd, message, size, pump, proxy, config, &reply) != 0 ||
+       !ends_ready(&reply, 'I')) {
+      close(fd);
+      return -1;
+   }
+   return fd;
+}
+
+//----------------------------------------------------------------------------
+// send a simple query, collect the reply
+static int
+query(struct PgProxy * proxy, int fd, const char * text, struct Reply * reply) {
+//----------------------------------------------------------------------------
+   unsigned char message[1024];
+   size_t size = string_message(message, 'Q', text);
+
+   return exchange(fd, message, size, pump, proxy, config, reply);
+}
+
+//----------------------------------------------------------------------------
+static void
+test_startup(void) {
+//----------------------------------------------------------------------------
+   struct PgProxy proxy;
+   unsigned char message[64];
+   struct Reply reply;
+   size_t size;
+   int fd;
+
+   expect(start_pg_proxy(&proxy, config) == 0, "start_pg_proxy");
+   fd = connect_client(proxy.listen_fd);
+   expect(fd != -1, "connect_client");
+
+   // SSL request first, as libpq does: we say no
+   put_uint32(message, 8);
+   put_uint32(message + 4, 80877103);
+   expect(exchange(fd, message, 8, pump, &proxy, config, &reply) == 0, 
+          "exchange");
+   expect(reply.length == 1 && reply.data[0] == 'N', "SSL refused");
+
+   size = startup_message(message, 196608);
+   expect(exchange(fd, message, size, pump, &proxy, config, &reply) == 0,
+          "exchange");
+   expect(count_messages(&reply, 'R', NULL) == 1, "AuthenticationOk");
+   expect(count_messages(&reply, 'S', NULL) >= 2, "ParameterStatus");
+   expect(count_messages(&reply, 'K', NULL) == 1, "BackendKeyData");
+   expect(ends_ready(&reply, 'I'), "ReadyForQuery");
+   expect(!reply.closed, "still connected");
+
+   close(fd);
+   clear_pg_proxy(&proxy);
+}
+
+//----------------------------------------------------------------------------
+// a startup message, then a query, a byte at a time: nothing until the 
+// message is complete, then the answer
+static void
+test_truncated_messages(void) {
+//----------------------------------------------------------------------------
+   struct PgProxy proxy;
+   unsigned char message[64];
+   struct Reply reply;
+   size_t size;
+   size_t i;
+   int fd;
+
+   expect(start_pg_proxy(&proxy, config) == 0, "start_pg_proxy");
+   fd = connect_client(proxy.listen_fd);
+   expect(fd != -1, "connect_client");
+
+   size = startup_message(message, 196608);
+   for (i=0; i < size - 1; i++) {
+      expect(exchange(fd, message + i, 1, pump, &proxy, config, &reply) == 0,
+             "exchange");
+      expect(reply.length == 0 && !reply.closed, 
+             "answered at byte %zu of %zu", 
+             i, 
+             size);
+   }
+   expect(exchange(fd, message + i, 1, pump, &proxy, config, &reply) == 0,
+          "exchange");
+   expect(ends_ready(&reply, 'I'), "ReadyForQuery after the last byte");
+
+   size = string_message(message, 'Q', "LISTEN channel1");
+   for (i=0; i < size - 1; i++) {
+      expect(exchange(fd, message + i, 1, pump, &proxy, config, &reply) == 0,
+             "exchange");
+      expect(reply.length == 0 && !reply.closed, 
+             "answered at byte %zu of %zu", 
+             i, 
+             size);
+   }
+   expect(exchange(fd, message + i, 1, pump, &proxy, config, &reply) == 0,
+          "exchange");
+   expect(reply_contains(&reply, "LISTEN"), "CommandComplete");
+   expect(ends_ready(&reply, 'I'), "ReadyForQuery");
+
+   close(fd);
+   clear_pg_proxy(&proxy);
+}
+
+//----------------------------------------------------------------------------
+// two queries in one write are both answered, in order
+static void
+test_pipelined_messages(void) {
+//----------------------------------------------------------------------------
+   struct PgProxy proxy;
+   unsigned char message[128];
+   const unsigned char * body = NULL;
+   struct Reply reply;
+   size_t size;
+   int fd;
+
+   expect(start_pg_proxy(&proxy, config) == 0, "start_pg_proxy");
+   fd = start_client(&proxy);
+   expect(fd != -1, "start_client");
+
+   size = string_message(message, 'Q', "LISTEN channel1");
+   size += string_message(message + size, 'Q', "UNLISTEN *");
+   expect(exchange(fd, message, size, pump, &proxy, config, &reply) == 0,
+          "exchange");
+   expect(count_messages(&reply, 'C', &body) == 2, "two CommandComplete");
+   expect(body != NULL && strcmp((const char *) body, "UNLISTEN") == 0, 
+          "UNLISTEN last");
+   expect(count_messages(&reply, 'Z', NULL) == 2, "two ReadyForQuery");
+
+   close(fd);
+   clear_pg_proxy(&proxy);
+}
+
+//----------------------------------------------------------------------------
+// lengths we won't buffer, or that can't be a message, close the 
+// connection
+static void
+test_bad_lengths(void) {
+//----------------------------------------------------------------------------
+   static const uint32_t startup_lengths[] = {0, 3, 7, 64 * 1024 + 1, 
+                                              0xffffffff};
+   static const uint32_t message_lengths[] = {0, 3, 64 * 1024 + 1, 
+                                              0x80000000};
+   struct PgProxy proxy;
+   unsigned char message[16];
+   struct Reply reply;
+   size_t i;
+   int fd;
+
+   expect(start_pg_proxy(&proxy, config) == 0, "start_pg_proxy");
+
+   for (i=0; i < sizeof startup_lengths / sizeof startup_lengths[0]; i++) {
+      fd = connect_client(proxy.listen_fd);
+      expect(fd != -1, "connect_client");
+      memset(message, 0, sizeof message);
+      put_uint32(message, startup_lengths[i]);
+      put_uint32(message + 4, 196608);
+      expect(exchange(fd, message, 8, pump, &proxy, config, &reply) == 0,
+             "exchange");
+      expect(reply.closed, "startup length %u", startup_lengths[i]);
+      close(fd);
+   }
+
+   for (i=0; i < sizeof message_lengths / sizeof message_lengths[0]; i++) {
+      fd = start_client(&proxy);
+      expect(fd != -1, "start_client");
+      message[0] = 'Q';
+      put_uint32(message + 1, message_lengths[i]);
+      expect(exchange(fd, message, 5, pump, &proxy, config, &reply) == 0,
+             "exchange");
+      expect(reply.closed, "message length %u", message_lengths[i]);
+      close(fd);
+   }
+
+   // the largest message we buffer is fine
+   fd = start_client(&proxy);
+   expect(fd != -1, "start_client");
+   {
+      static unsigned char large[64 * 1024 + 1];
+
+      memset(large, ' ', sizeof large);
+      large[0] = 'Q';
+      put_uint32(large + 1, 64 * 1024);
+      memcpy(large + 5, "LISTEN channel2", 15);
+      large[sizeof large - 1] = '\0';
+      expect(exchange(fd, large, sizeof large, pump, &proxy, config, 
+                      &reply) == 0,
+             "exchange");
+      expect(!reply.closed, "64K query closed the connection");
+      expect(reply_contains(&reply, "LISTEN"), "CommandComplete");
+   }
+   close(fd);
+
+   expect(proxy.client_qty == 0 || proxy.client_qty == 1, 
+          "%d clients left", 
+          proxy.client_qty);
+   clear_pg_proxy(&proxy);
+}
+
+//----------------------------------------------------------------------------
+// protocols we don't speak get an error and are closed; a cancel request
+// is just closed
+static void
+test_unsupported_startup(void) {
+//----------------------------------------------------------------------------
+   struct PgProxy proxy;
+   unsigned char message[64];
+   struct Reply reply;
+   size_t size;
+   int fd;
+
+   expect(start_pg_proxy(&proxy, config) == 0, "start_pg_proxy");
+
+   fd = connect_client(proxy.listen_fd);
+   size = startup_message(message, 131072); // protocol 2.0
+   expect(exchange(fd, message, size, pump, &proxy, config, &reply) == 0,
+          "exchange");
+   expect(has_error(&reply, "0A000"), "unsupported protocol error");
+   expect(reply.closed, "protocol 2.0 closed");
+   close(fd);
+
+   fd = connect_client(proxy.listen_fd);
+   put_uint32(message, 16);
+   put_uint32(message + 4, 80877102);
+   put_uint32(message + 8, 1);
+   put_uint32(message + 12, 2);
+   expect(exchange(fd, message, 16, pump, &proxy, config, &reply) == 0,
+          "exchange");
+   expect(reply.length == 0 && reply.closed, "cancel request closed");
+   close(fd);
+
+   clear_pg_proxy(&proxy);
+}
+
+//----------------------------------------------------------------------------
+static void
+test_malformed_queries(void) {
+//----------------------------------------------------------------------------
+   static const struct {
+      const char * query;
+      const char * sqlstate;
+   } cases[] = {
+      {"LISTEN", "42601"},
+      {"LISTEN \"channel1", "42601"},
+      {"LISTEN channel1 channel2", "42601"},
+      {"LISTEN nosuchchannel", "42704"},
+      // the ; is in the identifier, not between statements
+      {"LISTEN \"channel1;\"", "42704"},
+      {"SELECT 1", "0A000"},
+      {"'", "42601"},
+   };
+   struct PgProxy proxy;
+   struct Reply reply;
+   size_t i;
+   int fd;
+
+   expect(start_pg_proxy(&proxy, config) == 0, "start_pg_proxy");
+   fd = start_client(&proxy);
+   expect(fd != -1, "start_client");
+
+   for (i=0; i < sizeof cases / sizeof cases[0]; i++) {
+      expect(query(&proxy, fd, cases[i].query, &reply) == 0, "query");
+      expect(has_error(&reply, cases[i].sqlstate), 
+             "'%s' should fail with %s", 
+             cases[i].query, 
+             cases[i].sqlstate);
+      expect(ends_ready(&reply, 'I'), "'%s' ReadyForQuery", cases[i].query);
+      expect(!reply.closed, "'%s' closed the connection", cases[i].query);
+   }
+
+   // an empty query
+   expect(query(&proxy, fd, " ; ", &reply) == 0, "query");
+   expect(count_messages(&reply, 'I', NULL) == 1, "EmptyQueryResponse");
+
+   // the first error ends the query, and fails the transaction
+   expect(query(&proxy, fd, "BEGIN; LISTEN x; LISTEN channel1", &reply) == 0,
+          "query");
+   expect(count_messages(&reply, 'C', NULL) == 1, "only BEGIN completes");
+   expect(ends_ready(&reply, 'E'), "failed transaction");
+   expect(query(&proxy, fd, "LISTEN channel1", &reply) == 0, "query");
+   expect(has_error(&reply, "25P02"), "commands ignored");
+   expect(query(&proxy, fd, "ROLLBACK", &reply) == 0, "query");
+   expect(ends_ready(&reply, 'I'), "rolled back");
+
+   close(fd);
+   clear_pg_proxy(&proxy);
+}
+
+//----------------------------------------------------------------------------
+// extended protocol messages get one error, then nothing until Sync
+static void
+test_extended_protocol(void) {
+//----------------------------------------------------------------------------
+   struct PgProxy proxy;
+   unsigned char message[128];
+   struct Reply reply;
+   size_t size;
+   int fd;
+
+   expect(start_pg_proxy(&proxy, config) == 0, "start_pg_proxy");
+   fd = start_client(&proxy);
+   expect(fd != -1, "start_client");
+
+   size = string_message(message, 'P', "");
+   size += string_message(message + size, 'B', "");
+   size += string_message(message + size, 'E', "");
+   expect(exchange(fd, message, size, pump, &proxy, config, &reply) == 0,
+          "exchange");
+   expect(count_messages(&reply, 'E', NULL) == 1, "one error");
+   expect(count_messages(&reply, 'Z', NULL) == 0, "not ready before Sync");
+
+   message[0] = 'S';
+   put_uint32(message + 1, 4);
+   expect(exchange(fd, message, 5, pump, &proxy, config, &reply) == 0,
+          "exchange");
+   expect(ends_ready(&reply, 'I'), "ready after Sync");
+
+   close(fd);
+   clear_pg_proxy(&proxy);
+}
+
+//----------------------------------------------------------------------------
+// listeners get NotificationResponse; a client that doesn't read is
+// disconnected when its output passes pg_proxy_max_output
+static void
+test_notify(void) {
+//----------------------------------------------------------------------------
+   struct PgProxy proxy;
+   struct Reply reply;
+   const unsigned char * body = NULL;
+   char payload[1024];
+   int listener;
+   int other;
+   int sink_size = 1024;
+   int i;
+
+   expect(start_pg_proxy(&proxy, config) == 0, "start_pg_proxy");
+   listener = start_client(&proxy);
+   other = start_client(&proxy);
+   expect(listener != -1 && other != -1, "start_client");
+   expect(query(&proxy, listener, "LISTEN channel1", &reply) == 0, "query");
+   expect(query(&proxy, other, "listen CHANNEL2", &reply) == 0, "query");
+
+   expect(pg_proxy_notify(&proxy, config, 0, 42, "channel1", "hello") == 0,
+          "pg_proxy_notify");
+   expect(exchange(listener, NULL, 0, pump, &proxy, config, &reply) == 0,
+          "exchange");
+   expect(count_messages(&reply, 'A', &body) == 1, "NotificationResponse");
+   expect(body != NULL && get_uint32(body) == 42 && 
+          strcmp((const char *) body + 4, "channel1") == 0 &&
+          strcmp((const char *) body + 13, "hello") == 0,
+          "notification body");
+   expect(exchange(other, NULL, 0, pump, &proxy, config, &reply) == 0,
+          "exchange");
+   expect(reply.length == 0, "not listening to channel1");
+
+   // fill the socket buffers and then pg_proxy_max_output
+   setsockopt(listener, SOL_SOCKET, SO_RCVBUF, &sink_size, sizeof sink_size);
+   memset(payload, 'x', sizeof payload - 1);
+   payload[sizeof payload - 1] = '\0';
+   for (i=0; i < 10000 && proxy.disconnected == 0; i++) {
+      expect(pg_proxy_notify(&proxy, config, 0, 42, "channel1", 
+                             payload) == 0,
+             "pg_proxy_notify");
+   }
+   expect(proxy.disconnected == 1, "slow client disconnected");
+   expect(proxy.client_qty == 1, "%d clients", proxy.client_qty);
+
+   close(listener);
+   close(other);
+   clear_pg_proxy(&proxy);
+}
+
+//----------------------------------------------------------------------------
+int
+main(void) {
+//----------------------------------------------------------------------------
+   config = config_from_text(CONFIG_TEXT);
+   if (config == NULL) {
+      fprintf(stderr, "config_from_text failed\n");
+      return 1;
+   }
+
+   run_test(test_startup);
+   run_test(test_truncated_messages);
+   run_test(test_pipelined_messages);
+   run_test(test_bad_lengths);
+   run_test(test_unsupported_startup);
+   run_test(test_malformed_queries);
+   run_test(test_extended_protocol);
+   run_test(test_notify);
+
+   clear_config(config);
+   return unit_test_result();
+}
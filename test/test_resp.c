@@ -0,0 +1,337 @@
+/*----------------------------------------------------------------------------
+ * test_resp.c
+ * 
+ * the Redis pub/sub front end: RESP parsing, and what it makes of
+ * truncated, oversized and malformed commands
+ *--------------------------------------------------------------------------*/
+#define _GNU_SOURCE
+#include <string.h>
+
+#include "resp.h"
+#include "socket_client.h"
+#include "unit_test.h"
+
+static const char * CONFIG_TEXT = 
+   "channels=channel1,channel2,other\n"
+   "resp_max_output=262144\n";
+
+static const struct Config * config;
+
+static const char * SUBSCRIBED_1 = 
+   "*3\r\n$9\r\nsubscribe\r\n$8\r\nchannel1\r\n:1\r\n";
+
+//----------------------------------------------------------------------------
+static int
+pump(void * front_end, const struct Config * config) {
+//----------------------------------------------------------------------------
+   return resp_handle_events(front_end, config);
+}
+
+//----------------------------------------------------------------------------
+// send text, collect the reply
+static int
+send_text(struct Resp * resp, int fd, const char * text, struct Reply * reply) {
+//----------------------------------------------------------------------------
+   return exchange(fd, text, strlen(text), pump, resp, config, reply);
+}
+
+//----------------------------------------------------------------------------
+// true if the reply is exactly text
+static bool
+reply_is(const struct Reply * reply, const char * text) {
+//----------------------------------------------------------------------------
+   return reply->length == strlen(text) && 
+      memcmp(reply->data, text, reply->length) == 0;
+}
+
+//----------------------------------------------------------------------------
+static void
+test_commands(void) {
+//----------------------------------------------------------------------------
+   struct Resp resp;
+   struct Reply reply;
+   int fd;
+
+   expect(start_resp(&resp, config) == 0, "start_resp");
+   fd = connect_client(resp.listen_fd);
+   expect(fd != -1, "connect_client");
+
+   expect(send_text(&resp, fd, "*1\r\n$4\r\nPING\r\n", &reply) == 0, "send");
+   expect(reply_is(&reply, "+PONG\r\n"), "PING");
+   expect(send_text(&resp, fd, "ping hello\r\n", &reply) == 0, "send");
+   expect(reply_is(&reply, "$5\r\nhello\r\n"), "inline PING");
+   expect(send_text(&resp, fd, "\r\n", &reply) == 0, "send");
+   expect(reply.length == 0 && !reply.closed, "empty inline command");
+
+   expect(send_text(&resp, fd, 
+                    "*2\r\n$9\r\nSUBSCRIBE\r\n$8\r\nchannel1\r\n", 
+                    &reply) == 0, 
+          "send");
+   expect(reply_is(&reply, SUBSCRIBED_1), "SUBSCRIBE");
+   expect(send_text(&resp, fd, "PING\r\n", &reply) == 0, "send");
+   expect(reply_is(&reply, "*2\r\n$4\r\npong\r\n$0\r\n\r\n"), 
+          "subscribed PING");
+
+   expect(send_text(&resp, fd, "FLUSHALL\r\n", &reply) == 0, "send");
+   expect(reply.length > 4 && memcmp(reply.data, "-ERR", 4) == 0, 
+          "unknown command");
+   expect(!reply.closed, "unknown command closed the connection");
+
+   expect(send_text(&resp, fd, "QUIT\r\n", &reply) == 0, "send");
+   expect(reply_is(&reply, "+OK\r\n") && reply.closed, "QUIT");
+
+   close(fd);
+   clear_resp(&resp);
+}
+
+//----------------------------------------------------------------------------
+// a command a byte at a time: nothing until it is complete
+static void
+test_truncated_command(void) {
+//----------------------------------------------------------------------------
+   static const char command[] = 
+      "*3\r\n$9\r\nsubscribe\r\n$8\r\nchannel1\r\n$5\r\nother\r\n";
+   struct Resp resp;
+   struct Reply reply;
+   size_t i;
+   int fd;
+
+   expect(start_resp(&resp, config) == 0, "start_resp");
+   fd = connect_client(resp.listen_fd);
+   expect(fd != -1, "connect_client");
+
+   for (i=0; i < sizeof command - 2; i++) {
+      expect(exchange(fd, command + i, 1, pump, &resp, config, &reply) == 0,
+             "exchange");
+      expect(reply.length == 0 && !reply.closed, 
+             "answered at byte %zu of %zu", 
+             i, 
+             sizeof command - 1);
+   }
+   expect(exchange(fd, command + i, 1, pump, &resp, config, &reply) == 0,
+          "exchange");
+   expect(reply_contains(&reply, SUBSCRIBED_1), "first subscription");
+   expect(reply_contains(&reply, "$5\r\nother\r\n:2\r\n"), 
+          "second subscription");
+
+   close(fd);
+   clear_resp(&resp);
+}
+
+//----------------------------------------------------------------------------
+// commands in one write are all answered, in order
+static void
+test_pipelined_commands(void) {
+//----------------------------------------------------------------------------
+   struct Resp resp;
+   struct Reply reply;
+   int fd;
+
+   expect(start_resp(&resp, config) == 0, "start_resp");
+   fd = connect_client(resp.listen_fd);
+   expect(fd != -1, "connect_client");
+
+   expect(send_text(&resp, fd, 
+                    "PING a\r\n*2\r\n$4\r\nPING\r\n$1\r\nb\r\nPING c\r\n",
+                    &reply) == 0,
+          "send");
+   expect(reply_is(&reply, "$1\r\na\r\n$1\r\nb\r\n$1\r\nc\r\n"), 
+          "three replies in order");
+
+   close(fd);
+   clear_resp(&resp);
+}
+
+//----------------------------------------------------------------------------
+// protocol errors get -ERR Protocol error and the connection closed
+static void
+test_malformed_commands(void) {
+//----------------------------------------------------------------------------
+   static const char * cases[] = {
+      "*x\r\n",
+      "*-1\r\n",
+      "*-2\r\n",
+      "*1025\r\n",
+      "*99999999999\r\n",
+      "*1\r\n+PING\r\n",
+      "*1\r\n$\r\nPING\r\n",
+      "*1\r\n$x\r\nPING\r\n",
+      "*1\r\n$-1\r\n",
+      "*1\r\n$65537\r\n",
+      // the bulk string is longer than its length says
+      "*1\r\n$3\r\nPING\r\n",
+      "*2\r\n$4\r\nPING\r\n$1\r\nab\r\n",
+   };
+   struct Resp resp;
+   struct Reply reply;
+   size_t i;
+   int fd;
+
+   expect(start_resp(&resp, config) == 0, "start_resp");
+
+   for (i=0; i < sizeof cases / sizeof cases[0]; i++) {
+      fd = connect_client(resp.listen_fd);
+      expect(fd != -1, "connect_client");
+      expect(send_text(&resp, fd, cases[i], &reply) == 0, "send");
+      expect(reply_is(&reply, "-ERR Protocol error\r\n") && reply.closed,
+             "case %zu: %zu bytes, closed %d", 
+             i, 
+             reply.length, 
+             reply.closed);
+      close(fd);
+   }
+
+   expect(resp.client_qty == 0, "%d clients left", resp.client_qty);
+   clear_resp(&resp);
+}
+
+//----------------------------------------------------------------------------
+// the limits: the longest bulk string is fine, a megabyte without a line 
+// end isn't, and neither is a megabyte of a command that isn't all here
+static void
+test_limits(void) {
+//----------------------------------------------------------------------------
+   static char command[1024 * 1024 + 64];
+   static char bulks[17 * (64 * 1024 + 10) + 16];
+   struct Resp resp;
+   struct Reply reply;
+   size_t size;
+   int fd;
+   int i;
+
+   expect(start_resp(&resp, config) == 0, "start_resp");
+
+   fd = connect_client(resp.listen_fd);
+   expect(fd != -1, "connect_client");
+   size = snprintf(command, sizeof command, 
+                   "*2\r\n$4\r\nPING\r\n$%d\r\n", 
+                   64 * 1024);
+   memset(command + size, 'x', 64 * 1024);
+   size += 64 * 1024;
+   memcpy(command + size, "\r\n", 2);
+   size += 2;
+   expect(exchange(fd, command, size, pump, &resp, config, &reply) == 0,
+          "exchange");
+   expect(!reply.closed, "64K bulk string closed the connection");
+   expect(reply.length == 64 * 1024 + 10, "%zu byte reply", reply.length);
+   close(fd);
+
+   fd = connect_client(resp.listen_fd);
+   expect(fd != -1, "connect_client");
+   memset(command, 'x', sizeof command);
+   expect(exchange(fd, command, sizeof command, pump, &resp, config, 
+                   &reply) == 0,
+          "exchange");
+   expect(reply_contains(&reply, "-ERR Protocol error\r\n") && reply.closed,
+          "a line without end: closed %d", 
+          reply.closed);
+   close(fd);
+
+   // 16 whole 64K bulk strings of 1024 promised, and the start of another
+   fd = connect_client(resp.listen_fd);
+   expect(fd != -1, "connect_client");
+   size = snprintf(bulks, sizeof bulks, "*1024\r\n");
+   for (i=0; i < 17; i++) {
+      size += snprintf(bulks + size, sizeof bulks - size, 
+                       "$%d\r\n", 
+                       64 * 1024);
+      if (i < 16) {
+         memset(bulks + size, 'x', 64 * 1024);
+         size += 64 * 1024;
+         memcpy(bulks + size, "\r\n", 2);
+         size += 2;
+      }
+   }
+   expect(exchange(fd, bulks, size, pump, &resp, config, &reply) == 0,
+          "exchange");
+   expect(reply_contains(&reply, "-ERR Protocol error\r\n") && reply.closed,
+          "a megabyte of unfinished bulks: closed %d", 
+          reply.closed);
+   close(fd);
+
+   clear_resp(&resp);
+}
+
+//----------------------------------------------------------------------------
+// message and pmessage framing; a client that doesn't read is evicted at 
+// resp_max_output
+static void
+test_publish(void) {
+//----------------------------------------------------------------------------
+   struct Resp resp;
+   struct Reply reply;
+   char data[1024];
+   int subscriber;
+   int pattern_subscriber;
+   int sink_size = 1024;
+   int i;
+
+   expect(start_resp(&resp, config) == 0, "start_resp");
+   subscriber = connect_client(resp.listen_fd);
+   pattern_subscriber = connect_client(resp.listen_fd);
+   expect(subscriber != -1 && pattern_subscriber != -1, "connect_client");
+   expect(send_text(&resp, subscriber, "SUBSCRIBE channel1\r\n", 
+                    &reply) == 0, 
+          "send");
+   expect(send_text(&resp, pattern_subscriber, "PSUBSCRIBE chan*\r\n", 
+                    &reply) == 0, 
+          "send");
+   expect(reply_is(&reply, "*3\r\n$10\r\npsubscribe\r\n$5\r\nchan*\r\n:1\r\n"),
+          "PSUBSCRIBE");
+
+   expect(resp_publish(&resp, config, 0, "hello") == 0, "resp_publish");
+   expect(exchange(subscriber, NULL, 0, pump, &resp, config, &reply) == 0,
+          "exchange");
+   expect(reply_is(&reply, 
+                   "*3\r\n$7\r\nmessage\r\n$8\r\nchannel1\r\n$5\r\nhello\r\n"),
+          "message");
+   expect(exchange(pattern_subscriber, NULL, 0, pump, &resp, config, 
+                   &reply) == 0,
+          "exchange");
+   expect(reply_is(&reply, 
+                   "*4\r\n$8\r\npmessage\r\n$5\r\nchan*\r\n"
+                   "$8\r\nchannel1\r\n$5\r\nhello\r\n"),
+          "pmessage");
+
+   // "other" matches neither
+   expect(resp_publish(&resp, config, 2, NULL) == 0, "resp_publish");
+   expect(exchange(subscriber, NULL, 0, pump, &resp, config, &reply) == 0,
+          "exchange");
+   expect(reply.length == 0, "not subscribed to other");
+
+   setsockopt(subscriber, SOL_SOCKET, SO_RCVBUF, &sink_size, 
+              sizeof sink_size);
+   memset(data, 'x', sizeof data - 1);
+   data[sizeof data - 1] = '\0';
+   for (i=0; i < 10000 && resp.evicted == 0; i++) {
+      expect(resp_publish(&resp, config, 1, data) == 0 &&
+             resp_publish(&resp, config, 0, data) == 0, 
+             "resp_publish");
+   }
+   expect(resp.evicted == 1, "%lu evicted", (unsigned long) resp.evicted);
+
+   close(subscriber);
+   close(pattern_subscriber);
+   clear_resp(&resp);
+}
+
+//----------------------------------------------------------------------------
+int
+main(void) {
+//----------------------------------------------------------------------------
+   config = config_from_text(CONFIG_TEXT);
+   if (config == NULL) {
+      fprintf(stderr, "config_from_text failed\n");
+      return 1;
+   }
+
+   run_test(test_commands);
+   run_test(test_truncated_command);
+   run_test(test_pipelined_commands);
+   run_test(test_malformed_commands);
+   run_test(test_limits);
+   run_test(test_publish);
+
+   clear_config(config);
+   return unit_test_result();
+}
@@ -0,0 +1,285 @@
+/*----------------------------------------------------------------------------
+ * test_shm_ring.c
+ * 
+ * the shared memory ring: shm_ring.c writing, reader/skeeter_ring.c reading
+ * in the same process
+ *--------------------------------------------------------------------------*/
+#include <errno.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "shm_ring.h"
+#include "skeeter_ring.h"
+#include "unit_test.h"
+
+#define CAPACITY 4096
+
+// a record is 8 bytes of header, 4 bytes of frame size and the frame;
+// these make 64 byte records, 64 to a ring
+#define FRAME_64 52
+// and 72 byte records, which don't divide the ring, so there is padding
+#define FRAME_72 60
+
+static char ring_name[64];
+
+//----------------------------------------------------------------------------
+// publish one frame of size bytes, filled with a byte of the sequence
+static int
+publish(struct ShmRing * ring, uint32_t sequence, size_t size) {
+//----------------------------------------------------------------------------
+   uint8_t frame[2048];
+   const void * frames[1] = {frame};
+   size_t sizes[1] = {size};
+
+   memset(frame, (int) (sequence & 0xff), size);
+   memcpy(frame, &sequence, sizeof sequence);
+   return shm_ring_publish_frames(ring, frames, sizes, 1);
+}
+
+//----------------------------------------------------------------------------
+// read without waiting; return the sequence of the message, or -1
+static int64_t
+read_sequence(struct SkeeterRingReader * reader, size_t expected_size) {
+//----------------------------------------------------------------------------
+   struct SkeeterRingMessage message;
+   uint32_t sequence;
+   size_t i;
+
+   if (skeeter_ring_read(reader, &message, 0) != 1) {
+      return -1;
+   }
+   if (message.frame_qty != 1 || message.sizes[0] != expected_size) {
+      return -1;
+   }
+   memcpy(&sequence, message.frames[0], sizeof sequence);
+   for (i=sizeof sequence; i < expected_size; i++) {
+      if (message.frames[0][i] != (sequence & 0xff)) {
+         return -1;
+      }
+   }
+   return sequence;
+}
+
+//----------------------------------------------------------------------------
+// open a fresh ring and a reader of it
+static int
+open_ring(struct ShmRing * ring, struct SkeeterRingReader * reader) {
+//----------------------------------------------------------------------------
+   if (create_shm_ring(ring, ring_name, CAPACITY) != 0) {
+      return -1;
+   }
+   if (skeeter_ring_open(reader, ring_name) != 0) {
+      clear_shm_ring(ring);
+      return -1;
+   }
+   return 0;
+}
+
+//----------------------------------------------------------------------------
+static void
+test_read_in_order(void) {
+//----------------------------------------------------------------------------
+   struct ShmRing ring;
+   struct SkeeterRingReader reader;
+   struct SkeeterRingMessage message;
+   uint32_t i;
+
+   expect(open_ring(&ring, &reader) == 0, "open_ring");
+   expect(skeeter_ring_read(&reader, &message, 0) == 0, "empty ring");
+   for (i=0; i < 10; i++) {
+      expect(publish(&ring, i, FRAME_64) == 0, "publish %u", i);
+   }
+   for (i=0; i < 10; i++) {
+      expect(read_sequence(&reader, FRAME_64) == i, "read %u", i);
+   }
+   expect(skeeter_ring_read(&reader, &message, 0) == 0, "drained");
+   expect(reader.overruns == 0, "%" PRIu64 " overruns", reader.overruns);
+
+   skeeter_ring_close(&reader);
+   clear_shm_ring(&ring);
+}
+
+//----------------------------------------------------------------------------
+// records that don't divide the ring: the writer pads to the end and the
+// reader skips the padding, many times round
+static void
+test_wrap_with_padding(void) {
+//----------------------------------------------------------------------------
+   struct ShmRing ring;
+   struct SkeeterRingReader reader;
+   int64_t next = 0;
+   int64_t sequence;
+   uint32_t i;
+
+   expect(open_ring(&ring, &reader) == 0, "open_ring");
+   for (i=0; i < 1000; i++) {
+      expect(publish(&ring, i, FRAME_72) == 0, "publish %u", i);
+      if (i % 7 == 6 || i == 999) {
+         while ((sequence = read_sequence(&reader, FRAME_72)) != -1) {
+            expect(sequence == next, "read %" PRId64 " not %" PRId64, 
+                   sequence, next);
+            next = sequence + 1;
+         }
+      }
+   }
+   expect(next == 1000, "read up to %" PRId64, next);
+   expect(ring.header->reserve_pos > 10 * CAPACITY, "went round");
+   expect(reader.overruns == 0, "%" PRIu64 " overruns", reader.overruns);
+
+   skeeter_ring_close(&reader);
+   clear_shm_ring(&ring);
+}
+
+//----------------------------------------------------------------------------
+// a reader exactly one ring behind has lost nothing; one byte more and
+// the writer has overrun it
+static void
+test_full_ring_then_overrun(void) {
+//----------------------------------------------------------------------------
+   struct ShmRing ring;
+   struct SkeeterRingReader reader;
+   struct SkeeterRingMessage message;
+   uint32_t i;
+
+   expect(open_ring(&ring, &reader) == 0, "open_ring");
+   for (i=0; i < CAPACITY / 64; i++) {
+      expect(publish(&ring, i, FRAME_64) == 0, "publish %u", i);
+   }
+   expect(ring.header->reserve_pos == reader.cursor + CAPACITY, 
+          "ring is full");
+   for (i=0; i < CAPACITY / 64; i++) {
+      expect(read_sequence(&reader, FRAME_64) == i, "read %u", i);
+   }
+   expect(reader.overruns == 0, "%" PRIu64 " overruns", reader.overruns);
+
+   // now lap the reader
+   for (i=0; i < CAPACITY / 64 + 1; i++) {
+      expect(publish(&ring, 1000 + i, FRAME_64) == 0, "publish %u", i);
+   }
+   expect(skeeter_ring_read(&reader, &message, 0) == 0, 
+          "skipped to the newest position");
+   expect(reader.overruns == 1, "%" PRIu64 " overruns", reader.overruns);
+   expect(reader.lost_bytes == CAPACITY + 64, 
+          "lost %" PRIu64 " bytes", 
+          reader.lost_bytes);
+
+   // and carry on from there
+   expect(publish(&ring, 2000, FRAME_64) == 0, "publish after overrun");
+   expect(read_sequence(&reader, FRAME_64) == 2000, "read after overrun");
+
+   skeeter_ring_close(&reader);
+   clear_shm_ring(&ring);
+}
+
+//----------------------------------------------------------------------------
+// a reader lapped many times over, by records that wrap with padding
+static void
+test_lapped_many_times(void) {
+//----------------------------------------------------------------------------
+   struct ShmRing ring;
+   struct SkeeterRingReader reader;
+   uint64_t start;
+   uint32_t i;
+
+   expect(open_ring(&ring, &reader) == 0, "open_ring");
+   start = reader.cursor;
+   for (i=0; i < 500; i++) {
+      expect(publish(&ring, i, FRAME_72) == 0, "publish %u", i);
+   }
+   expect(read_sequence(&reader, FRAME_72) == -1, "nothing left to read");
+   expect(reader.overruns == 1, "%" PRIu64 " overruns", reader.overruns);
+   expect(reader.lost_bytes == ring.header->commit_pos - start, 
+          "lost %" PRIu64 " bytes", 
+          reader.lost_bytes);
+   expect(publish(&ring, 500, FRAME_72) == 0, "publish");
+   expect(read_sequence(&reader, FRAME_72) == 500, "read after overrun");
+
+   skeeter_ring_close(&reader);
+   clear_shm_ring(&ring);
+}
+
+//----------------------------------------------------------------------------
+static void
+test_oversize_is_dropped(void) {
+//----------------------------------------------------------------------------
+   struct ShmRing ring;
+   struct SkeeterRingReader reader;
+   struct SkeeterRingMessage message;
+
+   expect(open_ring(&ring, &reader) == 0, "open_ring");
+   // max_record is a quarter of the ring, headers included
+   expect(publish(&ring, 1, CAPACITY / 4) == 1, "too big");
+   expect(ring.dropped == 1, "%" PRIu64 " dropped", ring.dropped);
+   expect(publish(&ring, 2, CAPACITY / 4 - 16) == 0, "just fits");
+   expect(read_sequence(&reader, CAPACITY / 4 - 16) == 2, "read");
+   expect(skeeter_ring_read(&reader, &message, 0) == 0, "drained");
+
+   skeeter_ring_close(&reader);
+   clear_shm_ring(&ring);
+}
+
+//----------------------------------------------------------------------------
+// after the writer closes the ring, the reader gets what is left, then 
+// EPIPE; a new reader finds no ring
+static void
+test_closed(void) {
+//----------------------------------------------------------------------------
+   struct ShmRing ring;
+   struct SkeeterRingReader reader;
+   struct SkeeterRingReader late_reader;
+   struct SkeeterRingMessage message;
+
+   expect(open_ring(&ring, &reader) == 0, "open_ring");
+   expect(publish(&ring, 7, FRAME_64) == 0, "publish");
+   clear_shm_ring(&ring);
+
+   expect(read_sequence(&reader, FRAME_64) == 7, "read after close");
+   errno = 0;
+   expect(skeeter_ring_read(&reader, &message, 0) == -1 && errno == EPIPE, 
+          "EPIPE after close, errno %d", 
+          errno);
+   skeeter_ring_close(&reader);
+
+   expect(skeeter_ring_open(&late_reader, ring_name) == -1, "no ring");
+}
+
+//----------------------------------------------------------------------------
+static void
+test_readers_and_lag(void) {
+//----------------------------------------------------------------------------
+   struct ShmRing ring;
+   struct SkeeterRingReader reader;
+   uint64_t max_lag;
+
+   expect(open_ring(&ring, &reader) == 0, "open_ring");
+   expect(publish(&ring, 1, FRAME_64) == 0, "publish");
+   expect(publish(&ring, 2, FRAME_64) == 0, "publish");
+   expect(shm_ring_readers(&ring, &max_lag) == 1, "one reader");
+   expect(max_lag == 128, "lag %" PRIu64, max_lag);
+   expect(read_sequence(&reader, FRAME_64) == 1, "read");
+   expect(shm_ring_readers(&ring, &max_lag) == 1, "one reader");
+   expect(max_lag == 64, "lag %" PRIu64, max_lag);
+
+   skeeter_ring_close(&reader);
+   expect(shm_ring_readers(&ring, &max_lag) == 0, "no readers");
+   clear_shm_ring(&ring);
+}
+
+//----------------------------------------------------------------------------
+int
+main(void) {
+//----------------------------------------------------------------------------
+   snprintf(ring_name, sizeof ring_name, "/skeeter_test_%d", (int) getpid());
+
+   run_test(test_read_in_order);
+   run_test(test_wrap_with_padding);
+   run_test(test_full_ring_then_overrun);
+   run_test(test_lapped_many_times);
+   run_test(test_oversize_is_dropped);
+   run_test(test_closed);
+   run_test(test_readers_and_lag);
+
+   return unit_test_result();
+}
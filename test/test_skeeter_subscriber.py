@@ -7,6 +7,7 @@ the PUB socket and reporting notifications.
 """
 import logging
 import signal
+import struct
 import sys
 from threading import Event
 import time
@@ -37,6 +38,23 @@ def _set_signal_handler(halt_event):
     """
     signal.signal(signal.SIGTERM, _create_signal_handler(halt_event))
 
+def _unpack_batch(data):
+    """
+    split a batch data frame into (meta, data) pairs
+    each field is prefixed by its 4 byte length in network byte order
+    """
+    entries = list()
+    offset = 0
+    while offset < len(data):
+        fields = list()
+        for _ in range(2):
+            (length, ) = struct.unpack_from("!I", data, offset)
+            offset += 4
+            fields.append(data[offset:offset+length])
+            offset += length
+        entries.append(tuple(fields))
+    return entries
+
 def _process_one_event(expected_sequence, topic, meta, data):
     log = logging.getLogger("event")
 
@@ -60,12 +78,19 @@ def _process_one_event(expected_sequence, topic, meta, data):
             topic, 
             meta_dict["sequence"], 
             connect_str)
+        if "subscribers" in meta_dict:
+            line = "{0} subscribers={1} dropped={2}".format(
+                line, meta_dict["subscribers"], meta_dict["dropped"])
     else:
         line = "{0:30} {1:20} {2:8} data_bytes={3}".format(
             meta_dict["timestamp"], 
             topic, 
             meta_dict["sequence"], 
             len(data))
+        if "compression" in meta_dict:
+            line = "{0} {1}={2}".format(line,
+                                         meta_dict["compression"],
+                                         meta_dict["uncompressed_size"])
 
     log.info(line)
 
@@ -127,10 +152,9 @@ def main():
             meta_bytes = sub_socket.recv()
             meta = meta_bytes.decode("utf-8")
             if sub_socket.rcvmore:
-                data_bytes = sub_socket.recv()
-                data = data_bytes.decode("utf-8")
+                data = sub_socket.recv()
             else:
-                data = ""
+                data = b""
         except KeyboardInterrupt:
             log.info("keyboard interrupt")
             halt_event.set()
@@ -139,7 +163,19 @@ def main():
             return_value = 1
             halt_event.set()
         else:
-            _process_one_event(expected_sequence, topic, meta, data)
+            if ";batch=" not in meta:
+                _process_one_event(expected_sequence, topic, meta, data)
+            elif ";compression=" in meta:
+                # we don't decompress here, so we can't check the 
+                # sequence of the entries in the batch
+                _process_one_event(expected_sequence, topic, meta, data)
+                expected_sequence[topic] = None
+            else:
+                for entry_meta, entry_data in _unpack_batch(data):
+                    _process_one_event(expected_sequence, 
+                                       topic, 
+                                       entry_meta.decode("utf-8"), 
+                                       entry_data)
 
     log.info("program terminates with return_value {0}".format(return_value))
     sub_socket.close()
@@ -0,0 +1,334 @@
+/*----------------------------------------------------------------------------
+ * test_timer_wheel.c
+ *
+ * the timer wheel on a clock of our own: schedule_timer_at() and
+ * advance_timer_wheel() in place of the monotonic clock and the timerfd
+ *--------------------------------------------------------------------------*/
+#include <inttypes.h>
+#include <stdio.h>
+
+#include "timer_wheel.h"
+#include "unit_test.h"
+
+#define MAX_PROBES 16
+#define LEVEL_1 (1ULL << TIMER_WHEEL_BITS)
+#define LEVEL_2 (1ULL << (2 * TIMER_WHEEL_BITS))
+#define LEVEL_3 (1ULL << (3 * TIMER_WHEEL_BITS))
+#define SPAN (1ULL << (TIMER_WHEEL_LEVELS * TIMER_WHEEL_BITS))
+
+struct Probe {
+   struct Timer timer;
+   struct TimerWheel * wheel;
+   // cancelled when this one fires
+   struct Timer * victim;
+   int fire_qty;
+   uint64_t fired_at;
+};
+
+// the probes in the order they fired
+static struct Probe * fired[MAX_PROBES * 4];
+static int fired_qty;
+
+//----------------------------------------------------------------------------
+static int
+probe_fired(struct Timer * timer) {
+//----------------------------------------------------------------------------
+   struct Probe * probe = (struct Probe *) timer->context;
+
+   probe->fire_qty++;
+   probe->fired_at = probe->wheel->now;
+   if (fired_qty < (int) (sizeof fired / sizeof fired[0])) {
+      fired[fired_qty++] = probe;
+   }
+   if (probe->victim != NULL) {
+      cancel_timer(probe->wheel, probe->victim);
+   }
+   return 0;
+}
+
+//----------------------------------------------------------------------------
+static void
+initialize_probes(struct TimerWheel * wheel, struct Probe * probes, int qty) {
+//----------------------------------------------------------------------------
+   int i;
+
+   for (i=0; i < qty; i++) {
+      initialize_timer(&probes[i].timer, probe_fired, &probes[i]);
+      probes[i].wheel = wheel;
+      probes[i].victim = NULL;
+      probes[i].fire_qty = 0;
+      probes[i].fired_at = 0;
+   }
+   fired_qty = 0;
+}
+
+//----------------------------------------------------------------------------
+// a wheel run up to the first tick at or after the clock that is offset
+// past a multiple of align
+static uint64_t
+start_at(struct TimerWheel * wheel, uint64_t slack,
+         uint64_t align, uint64_t offset) {
+//----------------------------------------------------------------------------
+   uint64_t base;
+
+   if (start_timer_wheel(wheel, slack) != 0) {
+      return 0;
+   }
+   base = (wheel->now / align + 1) * align + offset;
+   if (advance_timer_wheel(wheel, base) != 0 || wheel->now != base) {
+      return 0;
+   }
+   return base;
+}
+
+//----------------------------------------------------------------------------
+// timers either side of each level's span, from a tick on a level 2
+// boundary and from ticks off it, run a millisecond at a time and in
+// jumps: each expires on its tick, in order
+static void
+test_level_boundaries(void) {
+//----------------------------------------------------------------------------
+   static const uint64_t delays[] = {
+      1,
+      LEVEL_1 - 1, LEVEL_1, LEVEL_1 + 1,
+      LEVEL_2 - 1, LEVEL_2, LEVEL_2 + 1,
+      LEVEL_3 - 1, LEVEL_3, LEVEL_3 + 1,
+   };
+   static const uint64_t offsets[] = {0, 1, 200, LEVEL_2 - 1};
+   const int qty = sizeof delays / sizeof delays[0];
+   struct TimerWheel wheel;
+   struct Probe probes[MAX_PROBES];
+   uint64_t base;
+   uint64_t now;
+   size_t o;
+   int stepped;
+   int i;
+
+   for (o=0; o < sizeof offsets / sizeof offsets[0]; o++) {
+      for (stepped=0; stepped < 2; stepped++) {
+         base = start_at(&wheel, 0, LEVEL_2, offsets[o]);
+         expect(base != 0, "start_at");
+         initialize_probes(&wheel, probes, qty);
+         // schedule the furthest first
+         for (i=qty - 1; i >= 0; i--) {
+            expect(schedule_timer_at(&wheel,
+                                     &probes[i].timer,
+                                     base + delays[i],
+                                     0) == 0,
+                   "schedule_timer_at");
+         }
+         expect(wheel.timer_qty == qty, "%d timers", wheel.timer_qty);
+
+         if (stepped) {
+            for (now=base + 1; now <= base + LEVEL_2 + 2; now++) {
+               advance_timer_wheel(&wheel, now);
+            }
+            for (; now <= base + LEVEL_3 + 1; now += 997) {
+               advance_timer_wheel(&wheel, now);
+            }
+         }
+         expect(advance_timer_wheel(&wheel, base + 2 * LEVEL_3) == 0,
+                "advance_timer_wheel");
+
+         expect(fired_qty == qty,
+                "offset %" PRIu64 ": %d fired",
+                offsets[o],
+                fired_qty);
+         for (i=0; i < qty; i++) {
+            expect(probes[i].fire_qty == 1 &&
+                   probes[i].fired_at == base + delays[i],
+                   "offset %" PRIu64 " delay %" PRIu64 ": fired %d at +%"
+                   PRIu64,
+                   offsets[o],
+                   delays[i],
+                   probes[i].fire_qty,
+                   probes[i].fired_at - base);
+            expect(i >= fired_qty || fired[i] == &probes[i],
+                   "offset %" PRIu64 ": out of order at %d",
+                   offsets[o],
+                   i);
+            expect(!timer_scheduled(&probes[i].timer), "still scheduled");
+         }
+         expect(wheel.timer_qty == 0, "%d timers", wheel.timer_qty);
+         clear_timer_wheel(&wheel);
+      }
+   }
+}
+
+//----------------------------------------------------------------------------
+// cancelled timers don't fire, from any level, nor from behind the timer
+// that cancels them in the same slot
+static void
+test_cancel(void) {
+//----------------------------------------------------------------------------
+   struct TimerWheel wheel;
+   struct Probe probes[5];
+   uint64_t base;
+   int i;
+
+   base = start_at(&wheel, 0, LEVEL_2, 0);
+   expect(base != 0, "start_at");
+   initialize_probes(&wheel, probes, 5);
+
+   schedule_timer_at(&wheel, &probes[0].timer, base + 10, 0);
+   schedule_timer_at(&wheel, &probes[1].timer, base + 300, 0);
+   schedule_timer_at(&wheel, &probes[2].timer, base + 70000, 100);
+   // 3 and 4 share a slot, and 3 cancels 4
+   schedule_timer_at(&wheel, &probes[3].timer, base + 500, 0);
+   schedule_timer_at(&wheel, &probes[4].timer, base + 500, 0);
+   probes[3].victim = &probes[4].timer;
+   expect(wheel.timer_qty == 5, "%d timers", wheel.timer_qty);
+
+   cancel_timer(&wheel, &probes[1].timer);
+   cancel_timer(&wheel, &probes[2].timer);
+   expect(!timer_scheduled(&probes[1].timer), "1 scheduled");
+   expect(!timer_scheduled(&probes[2].timer), "2 scheduled");
+   // again, to no effect
+   cancel_timer(&wheel, &probes[2].timer);
+   expect(wheel.timer_qty == 3, "%d timers", wheel.timer_qty);
+
+   advance_timer_wheel(&wheel, base + 100000);
+   for (i=0; i < 5; i++) {
+      expect(probes[i].fire_qty == (i == 0 || i == 3),
+             "%d fired %d times",
+             i,
+             probes[i].fire_qty);
+   }
+   expect(wheel.timer_qty == 0, "%d timers", wheel.timer_qty);
+
+   // and a cancelled timer can be scheduled again
+   schedule_timer_at(&wheel, &probes[1].timer, base + 100001, 0);
+   advance_timer_wheel(&wheel, base + 100001);
+   expect(probes[1].fire_qty == 1, "1 fired %d times", probes[1].fire_qty);
+
+   clear_timer_wheel(&wheel);
+}
+
+//----------------------------------------------------------------------------
+// one advance over a long idle time runs the timers on the way on their
+// ticks, including one past the wheel's span; a repeating timer fires
+// once for the periods it missed, and keeps its phase
+static void
+test_idle_skips(void) {
+//----------------------------------------------------------------------------
+   struct TimerWheel wheel;
+   struct Probe probes[4];
+   uint64_t base;
+
+   base = start_at(&wheel, 0, LEVEL_2, 123);
+   expect(base != 0, "start_at");
+   initialize_probes(&wheel, probes, 4);
+
+   schedule_timer_at(&wheel, &probes[0].timer, base + 3 * 86400000ULL, 0);
+   schedule_timer_at(&wheel, &probes[1].timer, base + SPAN + 5000, 0);
+   schedule_timer_at(&wheel, &probes[2].timer, base + 1000, 1000);
+
+   expect(advance_timer_wheel(&wheel, base + 60500) == 0, "advance");
+   expect(wheel.now == base + 60500, "now +%" PRIu64, wheel.now - base);
+   expect(probes[2].fire_qty == 1,
+          "repeating timer fired %d times",
+          probes[2].fire_qty);
+   expect(probes[2].timer.expires == base + 61000,
+          "next at +%" PRIu64,
+          probes[2].timer.expires - base);
+   expect(advance_timer_wheel(&wheel, base + 62000) == 0, "advance");
+   expect(probes[2].fire_qty == 3,
+          "repeating timer fired %d times",
+          probes[2].fire_qty);
+   expect(probes[2].fired_at == base + 62000,
+          "last at +%" PRIu64,
+          probes[2].fired_at - base);
+   cancel_timer(&wheel, &probes[2].timer);
+
+   // nothing due before here
+   expect(advance_timer_wheel(&wheel, base + 2 * 86400000ULL) == 0,
+          "advance");
+   expect(probes[0].fire_qty == 0 && probes[1].fire_qty == 0,
+          "fired early");
+
+   expect(advance_timer_wheel(&wheel, base + 2 * SPAN) == 0, "advance");
+   expect(probes[0].fire_qty == 1 &&
+          probes[0].fired_at == base + 3 * 86400000ULL,
+          "3 days: fired %d at +%" PRIu64,
+          probes[0].fire_qty,
+          probes[0].fired_at - base);
+   expect(probes[1].fire_qty == 1 &&
+          probes[1].fired_at == base + SPAN + 5000,
+          "past the span: fired %d at +%" PRIu64,
+          probes[1].fire_qty,
+          probes[1].fired_at - base);
+   expect(wheel.now == base + 2 * SPAN, "now +%" PRIu64, wheel.now - base);
+   expect(wheel.timer_qty == 0, "%d timers", wheel.timer_qty);
+
+   // with nothing scheduled, the wheel goes straight there
+   expect(advance_timer_wheel(&wheel, base + 3 * SPAN) == 0, "advance");
+   expect(wheel.now == base + 3 * SPAN, "now +%" PRIu64, wheel.now - base);
+
+   clear_timer_wheel(&wheel);
+}
+
+//----------------------------------------------------------------------------
+// the timerfd is armed on the slack's grid, for the earliest timer, and
+// a timer due now or before goes on the next tick
+static void
+test_slack_grid(void) {
+//----------------------------------------------------------------------------
+   struct TimerWheel wheel;
+   struct Probe probes[5];
+   uint64_t base;
+
+   // base is a multiple of 10
+   base = start_at(&wheel, 10, 10 * LEVEL_2, 0);
+   expect(base != 0, "start_at");
+   initialize_probes(&wheel, probes, 5);
+   expect(wheel.armed == 0, "armed at +%" PRIu64, wheel.armed - base);
+
+   schedule_timer_at(&wheel, &probes[0].timer, base + 23, 0);
+   expect(wheel.armed == base + 30, "armed at +%" PRIu64, wheel.armed - base);
+   // earlier, on the same grid point
+   schedule_timer_at(&wheel, &probes[1].timer, base + 21, 0);
+   expect(wheel.armed == base + 30, "armed at +%" PRIu64, wheel.armed - base);
+   // later
+   schedule_timer_at(&wheel, &probes[2].timer, base + 45, 0);
+   expect(wheel.armed == base + 30, "armed at +%" PRIu64, wheel.armed - base);
+   // on a grid point
+   schedule_timer_at(&wheel, &probes[3].timer, base + 20, 0);
+   expect(wheel.armed == base + 20, "armed at +%" PRIu64, wheel.armed - base);
+   // in the past
+   schedule_timer_at(&wheel, &probes[4].timer, base - 5, 0);
+   expect(probes[4].timer.expires == base + 1,
+          "expires at +%" PRIu64,
+          probes[4].timer.expires - base);
+   expect(wheel.armed == base + 10, "armed at +%" PRIu64, wheel.armed - base);
+
+   // when the timerfd fires on the grid, everything up to it runs
+   advance_timer_wheel(&wheel, base + 30);
+   expect(fired_qty == 4, "%d fired", fired_qty);
+   expect(fired[0] == &probes[4] && fired[1] == &probes[3] &&
+          fired[2] == &probes[1] && fired[3] == &probes[0],
+          "out of order");
+   expect(probes[1].fired_at == base + 21,
+          "fired at +%" PRIu64,
+          probes[1].fired_at - base);
+   clear_timer_wheel(&wheel);
+
+   // with no slack, it is armed for the millisecond
+   base = start_at(&wheel, 0, 10, 0);
+   expect(base != 0, "start_at");
+   initialize_probes(&wheel, probes, 1);
+   schedule_timer_at(&wheel, &probes[0].timer, base + 23, 0);
+   expect(wheel.armed == base + 23, "armed at +%" PRIu64, wheel.armed - base);
+   clear_timer_wheel(&wheel);
+}
+
+//----------------------------------------------------------------------------
+int
+main(void) {
+//----------------------------------------------------------------------------
+   run_test(test_level_boundaries);
+   run_test(test_cancel);
+   run_test(test_idle_skips);
+   run_test(test_slack_grid);
+
+   return unit_test_result();
+}
@@ -0,0 +1,48 @@
+/*----------------------------------------------------------------------------
+ * unit_test.h
+ * 
+ * just enough of a unit test harness for the C tests in this directory
+ * (after minunit, from Learn C the Hard Way)
+ *
+ * Each test is a function returning void that calls expect(); main() 
+ * runs them with run_test() and returns unit_test_result().
+ *--------------------------------------------------------------------------*/
+#if !defined(__UNIT_TEST_H__)
+#define __UNIT_TEST_H__
+
+#include <stdio.h>
+
+static int unit_test_run = 0;
+static int unit_test_failures = 0;
+
+// count a failure, with a message, if A is false
+#define expect(A, M, ...) do { \
+   if (!(A)) { \
+      fprintf(stderr, "[FAIL] %s:%d: " M "\n", \
+              __FILE__, __LINE__, ##__VA_ARGS__); \
+      unit_test_failures++; \
+   } \
+} while (0)
+
+#define run_test(T) do { \
+   int failures_before = unit_test_failures; \
+   T(); \
+   unit_test_run++; \
+   fprintf(stderr, "%s %s\n", \
+           unit_test_failures == failures_before ? "[ok]  " : "[FAIL]", \
+           #T); \
+} while (0)
+
+//----------------------------------------------------------------------------
+// print a summary, and return the exit status for main()
+static inline int
+unit_test_result(void) {
+//----------------------------------------------------------------------------
+   fprintf(stderr, 
+           "%d tests, %d failures\n", 
+           unit_test_run, 
+           unit_test_failures);
+   return unit_test_failures == 0 ? 0 : 1;
+}
+
+#endif // !defined(__UNIT_TEST_H__)